@@ -0,0 +1,439 @@
+/******************************************************************************
+ * KIK-BENCH: Keystroke-replay benchmark for KIK-EDITOR.
+ *
+ * Spawns the editor on a pseudo-terminal, replays keystroke traces and
+ * measures what the user would feel: how long each key takes until the
+ * editor has finished drawing, how many bytes it sends to the terminal
+ * and how much memory it needs.
+ *
+ * Scenarios:
+ * - open:   startup on a large generated file (editorOpen + first frame)
+ * - typing: a burst of single keystrokes in INSERT mode
+ * - scroll: stepping and jumping through the large file
+ * - paste:  a large block of text arriving in one write
+ * - save:   writing the large file back with :w
+ * - trace:  any recorded key file given with -t (same format as -s scripts)
+ *
+ * Each scenario runs in a fresh editor process on a fresh copy of the
+ * file, with HOME and XDG_RUNTIME_DIR pointing at the benchmark's
+ * temporary directory so that nothing of the user's setup is used. A
+ * step (one key, or a count prefix with its command) is done when the
+ * terminal has been quiet for the quiet window; its latency is the time
+ * from sending the step to the last byte of output it caused.
+ *
+ * Results are printed to stdout as JSON so runs can be compared.
+ *
+ * Compilation:
+ * g++ -std=c++11 -O2 -o kik-bench kik_bench.cpp -lutil
+ *
+ * Usage:
+ * ./kik-bench [-e ./kik-editor] [-n lines] [-q quiet_ms] [-t trace.keys]...
+ *
+ ******************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+// POSIX API headers
+#include <unistd.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// --- Data Structures ---
+
+// Benchmark settings taken from the command line
+struct BenchConfig {
+    std::string editor;          // Path to the kik-editor binary
+    long lines;                  // Size of the generated file
+    int quiet_ms;                // Silence that marks the end of a step
+    std::vector<std::string> traces; // Extra recorded traces (-t)
+    std::string workdir;         // Temporary directory for test files
+};
+
+// One scenario: the keys to send, split into steps
+struct Scenario {
+    std::string name;
+    std::vector<std::string> steps;
+};
+
+// Measurements for one scenario run
+struct ScenarioResult {
+    std::string name;
+    double startup_us;
+    std::vector<double> latencies_us; // One entry per step
+    long long bytes_written;          // Bytes the editor wrote to the pty
+    long peak_rss_kb;
+    int exit_status;
+};
+
+BenchConfig C;
+
+// --- Helpers ---
+
+/**
+ * @brief Prints an error message and exits the program.
+ * @param s The error message to display.
+ */
+void die(const std::string& s) {
+    perror(s.c_str());
+    exit(1);
+}
+
+/**
+ * @brief Returns a monotonic timestamp in microseconds.
+ */
+double nowUs() {
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Writes the generated test file.
+ * @param path Where to write it.
+ * @param lines Number of lines.
+ */
+void writeTestFile(const std::string& path, long lines) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) die("cannot create " + path);
+    for (long i = 1; i <= lines; i++) {
+        fprintf(f, "line %ld: int value_%ld = value_%ld * 10 + 7; // filler text\n", i, i, i - 1);
+    }
+    fclose(f);
+}
+
+/**
+ * @brief Splits a recorded key stream into steps.
+ * Each key is a step, except that count digits are kept together with
+ * the command they apply to. A newline is sent as Enter, matching the
+ * editor's -s script format.
+ * @param keys The raw key bytes.
+ */
+std::vector<std::string> splitSteps(const std::string& keys) {
+    std::vector<std::string> steps;
+    std::string pending;
+    for (char c : keys) {
+        // pending only ever holds count digits between steps
+        bool digit = (c >= '1' && c <= '9') || (c == '0' && !pending.empty());
+        pending += (c == '\n') ? '\r' : c;
+        if (!digit) {
+            steps.push_back(pending);
+            pending.clear();
+        }
+    }
+    if (!pending.empty()) steps.push_back(pending);
+    return steps;
+}
+
+/**
+ * @brief Appends one step per byte of the string.
+ */
+void addKeys(Scenario& sc, const std::string& keys) {
+    for (char c : keys) sc.steps.push_back(std::string(1, c));
+}
+
+// --- Editor Session ---
+
+/**
+ * @brief Reads from the pty until the editor has been quiet for a while.
+ * The quiet window only starts once output has begun, so slow steps
+ * (opening or saving a big file) are not cut short; a step that draws
+ * nothing at all gives up after a few seconds.
+ * @param fd The pty master.
+ * @param bytes Incremented by the number of bytes read.
+ * @param last_byte_us Receives the time the last byte arrived.
+ * @param started True if output has already begun.
+ * @return false if the editor closed the terminal.
+ */
+bool drainUntilQuiet(int fd, long long& bytes, double& last_byte_us, bool started = false) {
+    char buf[65536];
+    while (true) {
+        struct pollfd p = { fd, POLLIN, 0 };
+        int r = poll(&p, 1, started ? C.quiet_ms : 5000);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            die("poll failed");
+        }
+        if (r == 0) return true;
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) return false; // EIO once the child has exited
+        bytes += n;
+        last_byte_us = nowUs();
+        started = true;
+    }
+}
+
+/**
+ * @brief Sends one step to the editor.
+ * Large steps (a paste) do not fit the terminal's input queue, so output
+ * is drained while writing; otherwise both sides would block on full
+ * buffers.
+ * @param fd The pty master.
+ * @param step The bytes to send.
+ * @param bytes Incremented by the number of bytes read.
+ * @param last_byte_us Receives the time the last byte arrived.
+ * @return false if the editor closed the terminal.
+ */
+bool sendStep(int fd, const std::string& step, long long& bytes, double& last_byte_us) {
+    char buf[65536];
+    size_t sent = 0;
+    while (sent < step.size()) {
+        struct pollfd p = { fd, POLLIN | POLLOUT, 0 };
+        if (poll(&p, 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll failed");
+        }
+        if (p.revents & POLLIN) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) return false;
+            bytes += n;
+            last_byte_us = nowUs();
+        }
+        if (p.revents & POLLOUT) {
+            ssize_t n = write(fd, step.data() + sent, std::min<size_t>(step.size() - sent, 1024));
+            if (n == -1 && errno != EAGAIN && errno != EINTR) return false;
+            if (n > 0) sent += n;
+        }
+        if (p.revents & (POLLHUP | POLLERR)) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Runs one scenario in a fresh editor process.
+ * @param sc The scenario to replay.
+ * @param file The file to open.
+ * @return The measurements.
+ */
+ScenarioResult runScenario(const Scenario& sc, const std::string& file) {
+    ScenarioResult res;
+    res.name = sc.name;
+    res.bytes_written = 0;
+    res.peak_rss_kb = 0;
+    res.exit_status = -1;
+
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_row = 24;
+    ws.ws_col = 80;
+
+    int fd;
+    double start = nowUs();
+    pid_t pid = forkpty(&fd, NULL, NULL, &ws);
+    if (pid == -1) die("forkpty failed");
+    if (pid == 0) {
+        // Keep the user's config, sessions and server socket out of the run
+        setenv("HOME", C.workdir.c_str(), 1);
+        setenv("XDG_RUNTIME_DIR", C.workdir.c_str(), 1);
+        unsetenv("XDG_CACHE_HOME");
+        unsetenv("KIK_SOCKET");
+        unsetenv("KIK_TRACE");
+        execl(C.editor.c_str(), C.editor.c_str(), file.c_str(), (char*)NULL);
+        _exit(127);
+    }
+
+    double last = start;
+    bool alive = drainUntilQuiet(fd, res.bytes_written, last);
+    res.startup_us = last - start;
+
+    for (size_t i = 0; alive && i < sc.steps.size(); i++) {
+        const std::string& step = sc.steps[i];
+        double sent = nowUs();
+        last = sent;
+        long long before = res.bytes_written;
+        // A paste may already have started drawing while it was being sent
+        alive = sendStep(fd, step, res.bytes_written, last) &&
+                drainUntilQuiet(fd, res.bytes_written, last, res.bytes_written != before);
+        res.latencies_us.push_back(last - sent);
+    }
+
+    if (alive) {
+        const char* quit = "\x1b:q!\r";
+        write(fd, quit, strlen(quit));
+        drainUntilQuiet(fd, res.bytes_written, last);
+    }
+
+    // Give the editor a moment to exit on its own before forcing it
+    int status = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    for (int tries = 0; tries < 100; tries++) {
+        if (wait4(pid, &status, WNOHANG, &ru) == pid) break;
+        if (tries == 99) {
+            kill(pid, SIGKILL);
+            wait4(pid, &status, 0, &ru);
+        }
+        usleep(20000);
+    }
+    close(fd);
+    res.peak_rss_kb = ru.ru_maxrss;
+    res.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+    return res;
+}
+
+// --- Reporting ---
+
+/**
+ * @brief Returns the p-th percentile of a sorted sample set.
+ */
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/**
+ * @brief Escapes a string for inclusion in JSON output.
+ */
+std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+/**
+ * @brief Prints all results as one JSON document.
+ */
+void printResults(const std::vector<ScenarioResult>& results) {
+    printf("{\n  \"editor\": %s,\n  \"lines\": %ld,\n  \"quiet_ms\": %d,\n  \"scenarios\": [\n",
+           jsonString(C.editor).c_str(), C.lines, C.quiet_ms);
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScenarioResult& r = results[i];
+        std::vector<double> sorted = r.latencies_us;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (double v : sorted) sum += v;
+        printf("    {\n");
+        printf("      \"name\": %s,\n", jsonString(r.name).c_str());
+        printf("      \"steps\": %zu,\n", sorted.size());
+        printf("      \"startup_us\": %.0f,\n", r.startup_us);
+        printf("      \"latency_us\": { \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f, \"mean\": %.0f },\n",
+               percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+               sorted.empty() ? 0.0 : sorted.back(), sorted.empty() ? 0.0 : sum / sorted.size());
+        printf("      \"bytes_written\": %lld,\n", r.bytes_written);
+        printf("      \"bytes_per_step\": %.0f,\n", sorted.empty() ? 0.0 : (double)r.bytes_written / sorted.size());
+        printf("      \"peak_rss_kb\": %ld,\n", r.peak_rss_kb);
+        printf("      \"exit_status\": %d\n", r.exit_status);
+        printf("    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+// --- Scenarios ---
+
+/**
+ * @brief Builds the built-in scenarios plus any recorded traces.
+ */
+std::vector<Scenario> buildScenarios() {
+    std::vector<Scenario> all;
+
+    Scenario open;
+    open.name = "open";
+    all.push_back(open);
+
+    Scenario typing;
+    typing.name = "typing";
+    addKeys(typing, "i");
+    for (int i = 0; i < 200; i++) typing.steps.push_back(std::string(1, "kik typing burst "[i % 17]));
+    addKeys(typing, "\x1b");
+    all.push_back(typing);
+
+    Scenario scroll;
+    scroll.name = "scroll";
+    for (int i = 0; i < 300; i++) addKeys(scroll, "j");
+    scroll.steps.push_back(std::to_string(C.lines / 2) + "j");
+    for (int i = 0; i < 100; i++) addKeys(scroll, "k");
+    addKeys(scroll, "G");
+    scroll.steps.push_back("1G");
+    all.push_back(scroll);
+
+    Scenario paste;
+    paste.name = "paste";
+    addKeys(paste, "o");
+    std::string block;
+    for (int i = 0; i < 1024; i++) block += "int pasted = 42;";
+    paste.steps.push_back(block);
+    addKeys(paste, "\x1b");
+    all.push_back(paste);
+
+    Scenario save;
+    save.name = "save";
+    addKeys(save, "ix\x1b:w\r");
+    all.push_back(save);
+
+    for (const std::string& path : C.traces) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) die("cannot open trace " + path);
+        std::string keys((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        Scenario trace;
+        trace.name = "trace:" + path;
+        trace.steps = splitSteps(keys);
+        all.push_back(trace);
+    }
+    return all;
+}
+
+// --- Main ---
+
+int main(int argc, char* argv[]) {
+    C.editor = "./kik-editor";
+    C.lines = 1000000;
+    C.quiet_ms = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:q:t:")) != -1) {
+        switch (opt) {
+            case 'e': C.editor = optarg; break;
+            case 'n': C.lines = atol(optarg); break;
+            case 'q': C.quiet_ms = atoi(optarg); break;
+            case 't': C.traces.push_back(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-e editor] [-n lines] [-q quiet_ms] [-t trace.keys]...\n", argv[0]);
+                return 2;
+        }
+    }
+    if (access(C.editor.c_str(), X_OK) == -1) die("cannot run " + C.editor);
+
+    char tmpl[] = "/tmp/kik-bench.XXXXXX";
+    if (!mkdtemp(tmpl)) die("mkdtemp failed");
+    C.workdir = tmpl;
+    std::string master = C.workdir + "/master.txt";
+    writeTestFile(master, C.lines);
+
+    std::vector<ScenarioResult> results;
+    for (const Scenario& sc : buildScenarios()) {
+        // Every scenario edits its own copy, so saves do not leak into the next run
+        std::string file = C.workdir + "/bench.txt";
+        std::string cmd = "cp '" + master + "' '" + file + "'";
+        if (system(cmd.c_str()) != 0) die("cannot copy test file");
+        fprintf(stderr, "kik-bench: running %s...\n", sc.name.c_str());
+        results.push_back(runScenario(sc, file));
+        unlink(file.c_str());
+    }
+    // The editor may have left session snapshots under the fake HOME
+    std::string cleanup = "rm -rf '" + C.workdir + "'";
+    if (system(cleanup.c_str()) != 0) fprintf(stderr, "kik-bench: cannot remove %s\n", C.workdir.c_str());
+
+    printResults(results);
+    return 0;
+}
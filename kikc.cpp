@@ -0,0 +1,4631 @@
+/******************************************************************************
+ * KIKC: Compiler from KIK to MIPS assembly.
+ *
+ * Compiles a KIK program, together with every file it imports, into one
+ * MIPS32 assembly file for SPIM or MARS. System calls use their common
+ * numbering: print_int 1, print_string 4, read_int 5, read_string 8,
+ * sbrk 9, print_char 11, read_char 12 and exit2 17.
+ *
+ * Pipeline:
+ * - Lexer: a table-driven DFA run over the memory-mapped source
+ * - Imports: each file is a module, read once however often it is
+ *   imported; the import graph must be acyclic
+ * - Parser: recursive descent into a per-thread node arena, with
+ *   identifiers and string literals interned in a symbol table
+ * - Code generation: one walk over each function that checks types and
+ *   emits MIPS instructions
+ * - Loops: before each loop, invariant expressions (s.length() in a
+ *   loop test included) are computed once into hidden locals, and
+ *   array elements indexed by a variable that moves in constant steps
+ *   are reached through a pointer that moves with it
+ * - Register allocation: linear scan over the live intervals of each
+ *   function's variables, into $t0-$t9 and $s0-$s7
+ * - Peephole: redundant moves and reloads are removed, and multiplication
+ *   and division by constants become shifts
+ * - Link: the modules' code is joined and cross-module calls checked
+ *
+ * Modules are compiled on separate threads as soon as everything they
+ * import is done. Each module sees only the interfaces (functions,
+ * globals, enums and type names) of its transitive imports. Compiled
+ * modules are cached in ~/.cache/kikc (or $XDG_CACHE_HOME/kikc), keyed by
+ * a hash of their source and of the interfaces they import, so editing a
+ * file recompiles only the modules whose inputs changed.
+ *
+ * Supported: int, char, bool and str values, fixed-size arrays, pass by
+ * reference (int& x), constants and enums, if/else, while, do-while,
+ * for, switch, break/continue, cout/cin, string concatenation, and the
+ * io.kik bindings output() and input(). Floats, classes and exceptions
+ * are parsed but rejected by the MIPS back end. Division by zero traps
+ * (teq).
+ *
+ * Imports are found the way the editor finds them: next to the
+ * importing file, in a KIK-Library directory there or in any parent
+ * directory, then in each directory listed in KIK_PATH.
+ *
+ * SPIM and MARS run without delayed branches by default. With
+ * --delay-slots the output is for a machine that has them: every branch
+ * and jump is followed by a useful instruction or a nop.
+ *
+ * Comments in the output form a line table: `# function name in file`
+ * before each function and `# line n` before the code of each source
+ * line. kiksim --profile reads it to attribute cycles to KIK code.
+ *
+ * A file without `int kik()` compiles as a library: its functions are
+ * emitted but there is no `main` entry point.
+ *
+ * Compilation:
+ * g++ -std=c++11 -O2 -pthread -o kikc kikc.cpp
+ *
+ * Usage:
+ * ./kikc [-o out.s] [-j threads] [--cache dir | --no-cache] [--stats] [--delay-slots] file.kik
+ *
+ ******************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+// POSIX API headers
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// --- Data Structures ---
+
+// Token kinds. Single-character punctuation uses the character itself.
+enum TokenKind {
+    T_EOF = 256,
+    T_IDENT,
+    T_INT,
+    T_FLOAT,
+    T_STRING,
+    T_CHAR,
+    // Two-character operators
+    T_INC, T_DEC, T_ADD_ASSIGN, T_SUB_ASSIGN, T_MUL_ASSIGN, T_DIV_ASSIGN,
+    T_MOD_ASSIGN, T_ARROW, T_LE, T_GE, T_SHL, T_SHR, T_EQ, T_NE, T_AND, T_OR,
+    // Keywords
+    T_IMPORT, T_CONSTANT, T_IF, T_ELSE, T_WHILE, T_DO, T_FOR, T_SWITCH,
+    T_CASE, T_DEFAULT, T_BREAK, T_CONTINUE, T_RETURN, T_CLASS, T_STRUCT,
+    T_ENUM, T_TRUE, T_FALSE, T_COUT, T_CIN, T_KW_INT, T_KW_FLOAT,
+    T_KW_DOUBLE, T_KW_CHAR, T_KW_BOOL, T_KW_STR, T_KW_VOID, T_PUBLIC,
+    T_PRIVATE, T_PROTECTED, T_VIRTUAL, T_OVERRIDE, T_TRY, T_CATCH, T_THROW,
+    T_NEW,
+    // Lexical errors, reported by the parser where they occur
+    T_BAD_CHAR, T_BAD_STRING, T_BAD_COMMENT
+};
+
+// One token; its text is a slice of the mapped source
+struct Token {
+    uint16_t kind;
+    uint32_t offset, length;
+    uint32_t line;          // 1-based
+};
+
+// Value types known to the back end
+enum BaseType : uint8_t {
+    TY_VOID,
+    TY_INT,
+    TY_CHAR,
+    TY_BOOL,
+    TY_STR,
+    TY_FLOAT,               // Parsed, not supported by the MIPS back end
+    TY_CLASS                // Classes, structs and opaque types; likewise
+};
+
+// The type of a variable, parameter or expression
+struct Type {
+    BaseType base;
+    int array;              // Element count of an array variable; -1 if not an array
+    bool pointer;           // Holds an address: `T*`, `T[]` parameters, decayed arrays
+    bool ref;               // Pass-by-reference parameter (`T&`)
+};
+
+// Syntax tree node kinds
+enum NodeKind {
+    // Expressions
+    N_INT, N_CHAR, N_BOOL, N_STRING, N_FLOAT, N_NAME, N_UNARY, N_BINARY,
+    N_ASSIGN, N_INCDEC, N_CALL, N_METHOD, N_INDEX, N_CAST, N_INIT_LIST,
+    // Statements
+    N_BLOCK, N_DECL, N_VAR, N_EXPR, N_IF, N_WHILE, N_DO, N_FOR, N_SWITCH,
+    N_CASE, N_RETURN, N_BREAK, N_CONTINUE, N_COUT, N_CIN, N_ENDL,
+    N_UNSUPPORTED
+};
+
+// Handle of a node in the syntax tree arena; 0 is no node
+typedef uint32_t NodeId;
+// Handle of an interned identifier or string literal; 0 is ""
+typedef uint32_t Symbol;
+
+// A node of the syntax tree. Children form a list threaded through `next`.
+struct Node {
+    uint8_t kind;           // NodeKind
+    bool postfix;           // N_INCDEC: x++ rather than ++x
+    bool constant;          // N_DECL: declared with `constant`
+    uint16_t op;            // Operator token kind; for N_INCDEC, '+' or '-'
+    uint32_t tok;           // Token the node starts at, for messages
+    Symbol text;            // Identifier, or the decoded string literal
+    int32_t value;          // Integer, char and bool literals
+    Type type;              // N_DECL, N_VAR, N_CAST
+    NodeId first, last;     // Children
+    NodeId next;            // Next sibling
+    uint32_t count;         // Number of children
+};
+
+// Nodes live in fixed-size chunks that never move, so a handle splits
+// into a chunk number and an index within it
+#define AST_CHUNK_BITS 12
+#define AST_CHUNK_NODES (1u << AST_CHUNK_BITS)
+#define SYMBOL_BLOCK_SIZE 65536
+
+// Bump allocator for the syntax trees of all files
+struct NodeArena {
+    std::vector<Node*> chunks;
+    uint32_t count;         // Nodes handed out, including the null node
+};
+
+// Interned identifiers and string literals. The text of each symbol is
+// bump-allocated in large blocks; `slots` is an open-addressed hash table
+// of symbol numbers plus one.
+struct SymbolTable {
+    std::vector<char*> blocks;
+    size_t block_used;
+    std::vector<const char*> text;
+    std::vector<uint32_t> length;
+    std::vector<uint32_t> slots;
+};
+
+// A function parameter
+struct Param {
+    Symbol name;
+    Type type;
+    Symbol user_type;       // Name of an enum or handle type, until collectSymbols resolves it
+    uint32_t tok;
+};
+
+struct SourceFile;
+
+// A function definition or prototype
+struct Function {
+    Symbol name;
+    Type ret;
+    Symbol ret_user_type;   // As for Param::user_type
+    std::vector<Param> params;
+    NodeId body;            // 0 for prototypes such as `void output(str s);`
+    bool defined;           // Has a body here or in the module that declared it
+    SourceFile* file;       // nullptr if it came from an imported interface
+    uint32_t tok;
+    std::string where;      // Location, for functions from an interface
+};
+
+// A parsed source file
+struct SourceFile {
+    std::string path;       // Canonical
+    const char* data;       // Mapped file, followed by at least one NUL byte
+    size_t size;
+    size_t map_size;
+    std::vector<uint32_t> line_starts;
+    std::vector<Token> tokens;
+    std::vector<std::unique_ptr<Function>> functions;
+    std::vector<NodeId> globals;                // N_DECL nodes
+    std::vector<std::pair<Symbol, long>> enum_values;
+    std::vector<Symbol> enum_types;
+    std::vector<Symbol> opaque_types;           // Classes and structs
+    std::vector<Symbol> handle_types;           // `type` names, which are word-sized handles
+    ~SourceFile() {
+        if (data) munmap((void*)data, map_size);
+    }
+};
+
+// Thrown at the first error; reported by main
+struct CompileError {
+    std::string where;      // "file:line:col"
+    std::string message;
+};
+
+// MIPS operations the code generator emits
+enum Op {
+    OP_LABEL, OP_ADDU, OP_SUBU, OP_MUL, OP_DIV, OP_MFLO, OP_MFHI, OP_AND,
+    OP_OR, OP_XOR, OP_SLT, OP_SLTU, OP_ADDIU, OP_ANDI, OP_SLTI, OP_SLTIU, OP_XORI,
+    OP_SLL, OP_SRA, OP_SRL, OP_LI, OP_LA, OP_MOVE, OP_LW, OP_SW, OP_LBU, OP_SB, OP_BEQ, OP_BNE,
+    OP_J, OP_JAL, OP_JR, OP_SYSCALL, OP_TEQ, OP_NOP, OP_COUNT
+};
+
+// One emitted instruction. Registers are MIPS numbers; -1 if unused.
+struct Instr {
+    Op op;
+    int rd, rs, rt;
+    int32_t imm;
+    std::string label;      // Branch or jump target, OP_LA symbol, or the label itself
+    uint32_t line;          // Source line, for the listing
+};
+
+// A variable in scope during code generation
+struct Variable {
+    Type type;
+    bool global;
+    bool constant;
+    int offset;             // From $fp, for locals
+    std::string label;      // For globals
+    bool known;             // A scalar constant whose value is known at compile time
+    int32_t value;
+};
+
+// Names visible to every function of the program
+struct ProgramSymbols {
+    std::unordered_map<Symbol, Function*> functions;
+    std::unordered_map<Symbol, Variable> globals;
+    std::unordered_map<Symbol, long> enum_values;
+    std::unordered_map<Symbol, bool> enum_types;
+    std::unordered_map<Symbol, bool> opaque_types;
+    std::unordered_map<Symbol, bool> handle_types;
+};
+
+// Code generation state for the function being compiled
+// An array element inside a loop, reached through a pointer that the
+// loop keeps in step with its index
+struct ReducedAccess {
+    int pointer;            // Frame offset of the pointer
+    int32_t offset;         // Bytes from the pointer to the element
+    Type type;              // Element type
+};
+
+struct FunctionGen {
+    Function* fn;
+    std::vector<Instr> code;
+    std::vector<std::unordered_map<Symbol, Variable>> scopes;
+    int frame;              // Bytes of locals below $fp
+    std::vector<int> words; // Frame offsets of word-sized locals and parameters, which may live in registers
+    unsigned temps;         // Bitmask of busy temporaries (index into TEMP_REGS)
+    std::vector<std::string> break_labels, continue_labels;
+    std::string return_label;
+    uint32_t line;          // Source line of the statement being compiled
+    const SourceFile* file;
+    // Loop optimization, for the loops being compiled
+    std::unordered_map<const Node*, Variable> hoisted;      // Invariant expressions, computed into hidden locals before the loop
+    std::unordered_map<const Node*, ReducedAccess> reduced; // Array accesses made through a pointer
+    std::unordered_map<int, std::vector<std::pair<int, int>>> steps; // Frame offset of an index: the pointers that follow it, with their element sizes
+};
+
+// A value computed into a register
+struct Value {
+    int reg;
+    Type type;
+};
+
+// Compiler settings from the command line
+struct Options {
+    std::string input;
+    std::string output;
+    std::string cache_dir;  // Empty if the module cache is off
+    int jobs;               // Worker threads
+    bool stats;
+    bool delay_slots;       // Fill branch delay slots, for delayed-branch machines
+};
+
+// The module being compiled by one thread: its symbols, with those of
+// its imports, and its share of the output
+struct Unit {
+    ProgramSymbols symbols;
+    std::vector<std::unique_ptr<Function>> imported; // Declared by imported interfaces
+    std::vector<std::string> data;    // Lines of the .data section
+    std::vector<Instr> text;          // The module's functions
+    std::unordered_map<std::string, bool> runtime; // Runtime helpers used
+    std::unordered_map<std::string, std::string> needs; // Functions called but defined by another module
+    std::string prefix;               // Keeps local labels apart from other modules'
+    int next_label;
+    int next_string;
+};
+
+// Kinds of module interface declarations
+enum DeclKind { D_FUNCTION, D_GLOBAL, D_ENUM, D_ENUM_TYPE, D_TYPE, D_HANDLE };
+
+// One declaration of a module interface, as importers see it
+struct Declaration {
+    DeclKind kind;
+    std::string name;
+    Type type;                        // Return type of functions
+    std::vector<Type> params;
+    bool flag;                        // Functions: defined; globals: constant
+    bool known;                       // Globals: constant with a known value
+    long value;                       // Enum constants and known constants
+    std::string where;
+};
+
+// One source file of the import graph, compiled on its own once the
+// modules it imports are done
+struct Module {
+    std::unique_ptr<SourceFile> file;
+    std::vector<Module*> imports;     // Direct imports, in order
+    std::vector<Module*> closure;     // Transitive imports, each after its own imports
+    std::vector<Module*> dependents;  // Modules that import this one
+    uint64_t key;                     // Hash of the source and the imported interfaces
+    std::string interface;            // Declarations visible to importers
+    uint64_t interface_hash;
+    std::vector<std::string> runtime; // Runtime helpers used
+    std::vector<std::pair<std::string, std::string>> needs; // Called elsewhere-defined functions and where
+    std::vector<std::string> data;    // Lines of the .data section
+    std::vector<std::string> text;    // Lines of the .text section
+    int pending;                      // Imports not compiled yet
+    bool cached;                      // Loaded from the module cache
+    size_t nodes, symbols;            // Arena use, for --stats
+};
+
+// The import graph and the linked result
+struct Program {
+    std::vector<std::unique_ptr<Module>> modules; // Root first, then imports
+    std::unordered_map<std::string, Module*> by_path;
+    double lex_us;                    // Time spent lexing, for --stats
+};
+
+Options O;
+Program P;
+// Each worker thread compiles one module at a time into its own arena
+thread_local NodeArena A;
+thread_local SymbolTable I;
+thread_local Unit U;
+
+// --- Helpers ---
+
+/**
+ * @brief Prints an error message and exits the program.
+ * @param s The error message to display.
+ */
+void die(const std::string& s) {
+    perror(s.c_str());
+    exit(1);
+}
+
+/**
+ * @brief Returns a monotonic timestamp in microseconds.
+ */
+double nowUs() {
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Returns the canonical form of a path, or the path itself.
+ */
+std::string canonicalPath(const std::string& path) {
+    char buf[PATH_MAX];
+    return realpath(path.c_str(), buf) ? std::string(buf) : path;
+}
+
+/**
+ * @brief Returns the "file:line:col" of a token, for messages.
+ */
+std::string tokenWhere(const SourceFile& F, uint32_t tok) {
+    const Token& t = F.tokens[std::min<size_t>(tok, F.tokens.size() - 1)];
+    uint32_t col = t.offset - F.line_starts[t.line - 1] + 1;
+    return F.path + ":" + std::to_string(t.line) + ":" + std::to_string(col);
+}
+
+/**
+ * @brief Throws a CompileError located at a token.
+ */
+[[noreturn]] void errorAt(const SourceFile& F, uint32_t tok, const std::string& message) {
+    throw CompileError{tokenWhere(F, tok), message};
+}
+
+// --- Syntax Tree Arena ---
+
+/**
+ * @brief Allocates a zeroed node; handle 0 is never returned.
+ */
+NodeId nodeAlloc() {
+    if ((A.count & (AST_CHUNK_NODES - 1)) == 0) {
+        Node* chunk = (Node*)calloc(AST_CHUNK_NODES, sizeof(Node));
+        if (!chunk) die("calloc");
+        A.chunks.push_back(chunk);
+        if (A.count == 0) A.count = 1;
+    }
+    return A.count++;
+}
+
+/**
+ * @brief Returns the node behind a handle.
+ */
+inline Node* at(NodeId id) {
+    return &A.chunks[id >> AST_CHUNK_BITS][id & (AST_CHUNK_NODES - 1)];
+}
+
+/**
+ * @brief Appends a child to a node.
+ */
+void addKid(NodeId parent, NodeId kid) {
+    Node* n = at(parent);
+    if (n->last) at(n->last)->next = kid;
+    else n->first = kid;
+    n->last = kid;
+    n->count++;
+}
+
+/**
+ * @brief Returns the i-th child of a node.
+ */
+const Node* kid(const Node* n, uint32_t i) {
+    NodeId k = n->first;
+    while (i--) k = at(k)->next;
+    return at(k);
+}
+
+/**
+ * @brief Copies symbol text into the current block, starting a new one
+ * when it is full.
+ */
+const char* symbolStore(const char* s, size_t len) {
+    if (I.blocks.empty() || I.block_used + len + 1 > SYMBOL_BLOCK_SIZE) {
+        I.blocks.push_back((char*)malloc(std::max<size_t>(SYMBOL_BLOCK_SIZE, len + 1)));
+        if (!I.blocks.back()) die("malloc");
+        I.block_used = 0;
+    }
+    char* copy = I.blocks.back() + I.block_used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    I.block_used += len + 1;
+    return copy;
+}
+
+/**
+ * @brief Hashes symbol text (FNV-1a).
+ */
+inline uint32_t symbolHash(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+/**
+ * @brief Returns the symbol for a piece of text, adding it if it is new.
+ */
+Symbol intern(const char* s, size_t len) {
+    if (I.slots.empty()) {
+        I.slots.assign(1024, 0);
+        I.text.push_back(symbolStore("", 0)); // Symbol 0
+        I.length.push_back(0);
+        I.slots[symbolHash("", 0) & 1023] = 1;
+    }
+    size_t mask = I.slots.size() - 1;
+    size_t h = symbolHash(s, len) & mask;
+    for (; I.slots[h]; h = (h + 1) & mask) {
+        Symbol id = I.slots[h] - 1;
+        if (I.length[id] == len && memcmp(I.text[id], s, len) == 0) return id;
+    }
+    Symbol id = I.text.size();
+    I.text.push_back(symbolStore(s, len));
+    I.length.push_back(len);
+    I.slots[h] = id + 1;
+    if (I.text.size() * 2 > I.slots.size()) {
+        // Keep the table at most half full
+        std::vector<uint32_t> slots(I.slots.size() * 2, 0);
+        mask = slots.size() - 1;
+        for (Symbol i = 0; i < I.text.size(); i++) {
+            size_t k = symbolHash(I.text[i], I.length[i]) & mask;
+            while (slots[k]) k = (k + 1) & mask;
+            slots[k] = i + 1;
+        }
+        I.slots.swap(slots);
+    }
+    return id;
+}
+
+/**
+ * @brief Returns the symbol for a string, adding it if it is new.
+ */
+Symbol intern(const std::string& s) {
+    return intern(s.data(), s.size());
+}
+
+/**
+ * @brief Returns the text of a symbol.
+ */
+std::string symbolString(Symbol id) {
+    return std::string(I.text[id], I.length[id]);
+}
+
+/**
+ * @brief Frees every node and symbol at once, after code generation.
+ */
+void arenaFree() {
+    for (Node* chunk : A.chunks) free(chunk);
+    for (char* block : I.blocks) free(block);
+    A = NodeArena();
+    I = SymbolTable();
+}
+
+// --- Lexer ---
+
+// Character classes of the lexer DFA
+enum CharClass {
+    CC_OTHER, CC_SPACE, CC_NEWLINE, CC_ALPHA, CC_DIGIT, CC_DOT, CC_DQUOTE,
+    CC_SQUOTE, CC_BACKSLASH, CC_SLASH, CC_STAR, CC_HASH, CC_PLUS, CC_MINUS,
+    CC_LT, CC_GT, CC_EQ, CC_BANG, CC_AMP, CC_PIPE, CC_PERCENT, CC_SINGLE,
+    CC_EOF, CC_COUNT
+};
+
+// States of the lexer DFA. S_STOP ends the current token.
+enum LexState {
+    S_STOP, S_START, S_SPACE, S_IDENT, S_INT, S_INT_DOT, S_FLOAT, S_DOT,
+    S_STR, S_STR_ESC, S_STR_END, S_CHR, S_CHR_ESC, S_CHR_END, S_SLASH,
+    S_LINE_COMMENT, S_BLOCK, S_BLOCK_STAR, S_BLOCK_END, S_HASH, S_PLUS,
+    S_MINUS, S_STAR, S_PERCENT, S_LT, S_GT, S_EQ, S_BANG, S_AMP, S_PIPE,
+    S_OP1, S_OP2, S_BAD, S_COUNT
+};
+
+// What a token ending in each state is
+enum LexAccept {
+    A_NONE, A_SKIP, A_IDENT, A_INT, A_FLOAT, A_STRING, A_CHAR, A_OP1, A_OP2,
+    A_BAD_CHAR, A_BAD_STRING, A_BAD_COMMENT
+};
+
+static uint8_t CHAR_CLASS[256];
+static uint8_t NEXT_STATE[S_COUNT][CC_COUNT];
+static uint8_t ACCEPT[S_COUNT];
+
+static const struct { const char* text; int kind; } KEYWORDS[] = {
+    {"import", T_IMPORT}, {"constant", T_CONSTANT}, {"if", T_IF}, {"else", T_ELSE},
+    {"while", T_WHILE}, {"do", T_DO}, {"for", T_FOR}, {"switch", T_SWITCH},
+    {"case", T_CASE}, {"default", T_DEFAULT}, {"break", T_BREAK},
+    {"continue", T_CONTINUE}, {"return", T_RETURN}, {"class", T_CLASS},
+    {"struct", T_STRUCT}, {"enum", T_ENUM}, {"true", T_TRUE}, {"false", T_FALSE},
+    {"cout", T_COUT}, {"cin", T_CIN}, {"int", T_KW_INT}, {"float", T_KW_FLOAT},
+    {"double", T_KW_DOUBLE}, {"char", T_KW_CHAR}, {"bool", T_KW_BOOL},
+    {"str", T_KW_STR}, {"void", T_KW_VOID}, {"public", T_PUBLIC},
+    {"private", T_PRIVATE}, {"protected", T_PROTECTED}, {"virtual", T_VIRTUAL},
+    {"override", T_OVERRIDE}, {"try", T_TRY}, {"catch", T_CATCH},
+    {"throw", T_THROW}, {"new", T_NEW}, {nullptr, 0}
+};
+
+// Open-addressed keyword table, indexed by lexKeywordHash
+static int16_t KEYWORD_SLOTS[256];
+
+/**
+ * @brief Hashes an identifier for the keyword table.
+ */
+inline unsigned lexKeywordHash(const char* s, size_t len) {
+    return (len * 31 + (unsigned char)s[0] * 7 + (unsigned char)s[len - 1]) & 255;
+}
+
+/**
+ * @brief Fills the character class, transition and keyword tables.
+ */
+void lexInitTables() {
+    for (int c = 0; c < 256; c++) {
+        uint8_t cls = CC_OTHER;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') cls = CC_SPACE;
+        else if (c == '\n') cls = CC_NEWLINE;
+        else if (isalpha(c) || c == '_') cls = CC_ALPHA;
+        else if (isdigit(c)) cls = CC_DIGIT;
+        else if (strchr("(){}[];,:~^?", c) && c) cls = CC_SINGLE;
+        CHAR_CLASS[c] = cls;
+    }
+    CHAR_CLASS['.'] = CC_DOT; CHAR_CLASS['"'] = CC_DQUOTE; CHAR_CLASS['\''] = CC_SQUOTE;
+    CHAR_CLASS['\\'] = CC_BACKSLASH; CHAR_CLASS['/'] = CC_SLASH; CHAR_CLASS['*'] = CC_STAR;
+    CHAR_CLASS['#'] = CC_HASH; CHAR_CLASS['+'] = CC_PLUS; CHAR_CLASS['-'] = CC_MINUS;
+    CHAR_CLASS['<'] = CC_LT; CHAR_CLASS['>'] = CC_GT; CHAR_CLASS['='] = CC_EQ;
+    CHAR_CLASS['!'] = CC_BANG; CHAR_CLASS['&'] = CC_AMP; CHAR_CLASS['|'] = CC_PIPE;
+    CHAR_CLASS['%'] = CC_PERCENT;
+    CHAR_CLASS[0] = CC_EOF; // The sentinel after the mapped source
+
+    auto set = [](int state, int cls, int next) { NEXT_STATE[state][cls] = next; };
+    auto set_all = [](int state, int next) {
+        for (int c = 0; c < CC_COUNT; c++) {
+            if (c != CC_EOF) NEXT_STATE[state][c] = next;
+        }
+    };
+    memset(NEXT_STATE, S_STOP, sizeof(NEXT_STATE));
+
+    set_all(S_START, S_BAD);
+    set(S_START, CC_SPACE, S_SPACE); set(S_START, CC_NEWLINE, S_SPACE);
+    set(S_START, CC_ALPHA, S_IDENT); set(S_START, CC_DIGIT, S_INT);
+    set(S_START, CC_DOT, S_DOT); set(S_START, CC_DQUOTE, S_STR);
+    set(S_START, CC_SQUOTE, S_CHR); set(S_START, CC_SLASH, S_SLASH);
+    set(S_START, CC_HASH, S_HASH); set(S_START, CC_SINGLE, S_OP1);
+    set(S_START, CC_PLUS, S_PLUS); set(S_START, CC_MINUS, S_MINUS);
+    set(S_START, CC_STAR, S_STAR); set(S_START, CC_PERCENT, S_PERCENT);
+    set(S_START, CC_LT, S_LT); set(S_START, CC_GT, S_GT); set(S_START, CC_EQ, S_EQ);
+    set(S_START, CC_BANG, S_BANG); set(S_START, CC_AMP, S_AMP); set(S_START, CC_PIPE, S_PIPE);
+
+    set(S_SPACE, CC_SPACE, S_SPACE); set(S_SPACE, CC_NEWLINE, S_SPACE);
+    set(S_IDENT, CC_ALPHA, S_IDENT); set(S_IDENT, CC_DIGIT, S_IDENT);
+    set(S_INT, CC_DIGIT, S_INT); set(S_INT, CC_DOT, S_INT_DOT);
+    set(S_INT_DOT, CC_DIGIT, S_FLOAT); set(S_FLOAT, CC_DIGIT, S_FLOAT);
+    set(S_DOT, CC_DIGIT, S_FLOAT);
+
+    set_all(S_STR, S_STR);
+    set(S_STR, CC_NEWLINE, S_STOP); set(S_STR, CC_BACKSLASH, S_STR_ESC); set(S_STR, CC_DQUOTE, S_STR_END);
+    set_all(S_STR_ESC, S_STR); set(S_STR_ESC, CC_NEWLINE, S_STOP);
+    set_all(S_CHR, S_CHR);
+    set(S_CHR, CC_NEWLINE, S_STOP); set(S_CHR, CC_BACKSLASH, S_CHR_ESC); set(S_CHR, CC_SQUOTE, S_CHR_END);
+    set_all(S_CHR_ESC, S_CHR); set(S_CHR_ESC, CC_NEWLINE, S_STOP);
+
+    set(S_SLASH, CC_SLASH, S_LINE_COMMENT); set(S_SLASH, CC_STAR, S_BLOCK); set(S_SLASH, CC_EQ, S_OP2);
+    set(S_HASH, CC_HASH, S_LINE_COMMENT);
+    set_all(S_LINE_COMMENT, S_LINE_COMMENT); set(S_LINE_COMMENT, CC_NEWLINE, S_STOP);
+    set_all(S_BLOCK, S_BLOCK); set(S_BLOCK, CC_STAR, S_BLOCK_STAR);
+    set_all(S_BLOCK_STAR, S_BLOCK); set(S_BLOCK_STAR, CC_STAR, S_BLOCK_STAR); set(S_BLOCK_STAR, CC_SLASH, S_BLOCK_END);
+
+    // Two-character operators: ++ += -- -= -> *= %= << <= >> >= == != && ||
+    set(S_PLUS, CC_PLUS, S_OP2); set(S_PLUS, CC_EQ, S_OP2);
+    set(S_MINUS, CC_MINUS, S_OP2); set(S_MINUS, CC_EQ, S_OP2); set(S_MINUS, CC_GT, S_OP2);
+    set(S_STAR, CC_EQ, S_OP2); set(S_PERCENT, CC_EQ, S_OP2);
+    set(S_LT, CC_LT, S_OP2); set(S_LT, CC_EQ, S_OP2);
+    set(S_GT, CC_GT, S_OP2); set(S_GT, CC_EQ, S_OP2);
+    set(S_EQ, CC_EQ, S_OP2); set(S_BANG, CC_EQ, S_OP2);
+    set(S_AMP, CC_AMP, S_OP2); set(S_PIPE, CC_PIPE, S_OP2);
+
+    ACCEPT[S_SPACE] = A_SKIP; ACCEPT[S_LINE_COMMENT] = A_SKIP; ACCEPT[S_BLOCK_END] = A_SKIP;
+    ACCEPT[S_IDENT] = A_IDENT; ACCEPT[S_INT] = A_INT;
+    ACCEPT[S_INT_DOT] = A_FLOAT; ACCEPT[S_FLOAT] = A_FLOAT;
+    ACCEPT[S_DOT] = A_OP1; ACCEPT[S_SLASH] = A_OP1; ACCEPT[S_OP1] = A_OP1;
+    for (int st = S_PLUS; st <= S_PIPE; st++) ACCEPT[st] = A_OP1;
+    ACCEPT[S_OP2] = A_OP2;
+    ACCEPT[S_STR] = A_BAD_STRING; ACCEPT[S_STR_ESC] = A_BAD_STRING; ACCEPT[S_STR_END] = A_STRING;
+    ACCEPT[S_CHR] = A_BAD_STRING; ACCEPT[S_CHR_ESC] = A_BAD_STRING; ACCEPT[S_CHR_END] = A_CHAR;
+    ACCEPT[S_BLOCK] = A_BAD_COMMENT; ACCEPT[S_BLOCK_STAR] = A_BAD_COMMENT;
+    ACCEPT[S_HASH] = A_BAD_CHAR; ACCEPT[S_BAD] = A_BAD_CHAR;
+
+
+    memset(KEYWORD_SLOTS, -1, sizeof(KEYWORD_SLOTS));
+    for (int i = 0; KEYWORDS[i].text; i++) {
+        unsigned h = lexKeywordHash(KEYWORDS[i].text, strlen(KEYWORDS[i].text));
+        while (KEYWORD_SLOTS[h] != -1) h = (h + 1) & 255;
+        KEYWORD_SLOTS[h] = i;
+    }
+}
+
+/**
+ * @brief Returns the keyword kind of an identifier, or T_IDENT.
+ */
+int lexKeyword(const char* s, size_t len) {
+    for (unsigned h = lexKeywordHash(s, len); KEYWORD_SLOTS[h] != -1; h = (h + 1) & 255) {
+        const char* kw = KEYWORDS[KEYWORD_SLOTS[h]].text;
+        if (strncmp(kw, s, len) == 0 && kw[len] == '\0') return KEYWORDS[KEYWORD_SLOTS[h]].kind;
+    }
+    return T_IDENT;
+}
+
+/**
+ * @brief Returns the token kind of a two-character operator.
+ */
+int lexOperator2(char a, char b) {
+    switch ((a << 8) | b) {
+        case ('+' << 8) | '+': return T_INC;
+        case ('-' << 8) | '-': return T_DEC;
+        case ('+' << 8) | '=': return T_ADD_ASSIGN;
+        case ('-' << 8) | '=': return T_SUB_ASSIGN;
+        case ('*' << 8) | '=': return T_MUL_ASSIGN;
+        case ('/' << 8) | '=': return T_DIV_ASSIGN;
+        case ('%' << 8) | '=': return T_MOD_ASSIGN;
+        case ('-' << 8) | '>': return T_ARROW;
+        case ('<' << 8) | '=': return T_LE;
+        case ('>' << 8) | '=': return T_GE;
+        case ('<' << 8) | '<': return T_SHL;
+        case ('>' << 8) | '>': return T_SHR;
+        case ('=' << 8) | '=': return T_EQ;
+        case ('!' << 8) | '=': return T_NE;
+        case ('&' << 8) | '&': return T_AND;
+        default: return T_OR;
+    }
+}
+
+/**
+ * @brief Splits a mapped source file into tokens.
+ * Each token is found by running the DFA from S_START until the next
+ * character has no transition; the state it stopped in says what the
+ * token is. Line numbers come from a table of line starts built with
+ * memchr beforehand.
+ */
+void lexFile(SourceFile& F) {
+    const char* base = F.data;
+    const char* end = base + F.size;
+    F.line_starts.assign(1, 0);
+    for (const char* p = base; p < end && (p = (const char*)memchr(p, '\n', end - p)); p++) {
+        F.line_starts.push_back(p + 1 - base);
+    }
+    F.tokens.clear();
+    F.tokens.reserve(F.size / 4 + 1);
+    size_t line = 0;
+    const char* p = base;
+    while (true) {
+        const char* start = p;
+        uint8_t state = S_START;
+        uint8_t next;
+        while ((next = NEXT_STATE[state][CHAR_CLASS[(uint8_t)*p]]) != S_STOP) {
+            state = next;
+            p++;
+        }
+        if (state == S_START) {
+            // Only NUL stops the DFA at once: the sentinel, or a stray NUL
+            if (p >= end) break;
+            state = S_BAD;
+            p++;
+        }
+        uint8_t accept = ACCEPT[state];
+        if (accept == A_SKIP) continue;
+        Token t;
+        t.offset = start - base;
+        t.length = p - start;
+        while (line + 1 < F.line_starts.size() && F.line_starts[line + 1] <= t.offset) line++;
+        t.line = line + 1;
+        switch (accept) {
+            case A_IDENT: t.kind = lexKeyword(start, t.length); break;
+            case A_INT: t.kind = T_INT; break;
+            case A_FLOAT: t.kind = T_FLOAT; break;
+            case A_STRING: t.kind = T_STRING; break;
+            case A_CHAR: t.kind = T_CHAR; break;
+            case A_OP1: t.kind = (uint8_t)*start; break;
+            case A_OP2: t.kind = lexOperator2(start[0], start[1]); break;
+            case A_BAD_STRING: t.kind = T_BAD_STRING; break;
+            case A_BAD_COMMENT: t.kind = T_BAD_COMMENT; break;
+            default: t.kind = T_BAD_CHAR; break;
+        }
+        F.tokens.push_back(t);
+    }
+    Token eof = {T_EOF, (uint32_t)F.size, 0, (uint32_t)F.line_starts.size()};
+    F.tokens.push_back(eof);
+}
+
+/**
+ * @brief Maps a source file and splits it into tokens.
+ * @return False if the file cannot be read.
+ */
+bool loadFile(SourceFile& F) {
+    int fd = open(F.path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+    // Reserve whole pages past the end, so the lexer can stop at a NUL
+    // sentinel instead of checking bounds: the tail of the file's last page
+    // is zero-filled, and the extra anonymous page covers page-sized files.
+    size_t page = sysconf(_SC_PAGESIZE);
+    F.size = st.st_size;
+    F.map_size = (F.size / page + 1) * page;
+    void* map = mmap(nullptr, F.map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    F.data = (const char*)map;
+    if (F.size > 0 && mmap(map, F.size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+    double start = nowUs();
+    lexFile(F);
+    P.lex_us += nowUs() - start;
+    return true;
+}
+
+// --- Parser ---
+
+// Parser position within one file
+struct Parser {
+    SourceFile* F;
+    uint32_t pos;
+};
+
+/**
+ * @brief Returns the text of a token.
+ */
+std::string tokenText(const SourceFile& F, const Token& t) {
+    return std::string(F.data + t.offset, t.length);
+}
+
+/**
+ * @brief Returns the token `ahead` positions past the current one.
+ */
+const Token& peek(Parser& p, uint32_t ahead = 0) {
+    return p.F->tokens[std::min<size_t>(p.pos + ahead, p.F->tokens.size() - 1)];
+}
+
+/**
+ * @brief Returns true if the token `ahead` positions on has the given kind.
+ */
+bool is(Parser& p, int kind, uint32_t ahead = 0) {
+    return peek(p, ahead).kind == kind;
+}
+
+/**
+ * @brief Consumes the current token if it has the given kind.
+ */
+bool accept(Parser& p, int kind) {
+    if (!is(p, kind)) return false;
+    p.pos++;
+    return true;
+}
+
+/**
+ * @brief Describes a token for error messages.
+ */
+std::string describe(Parser& p, const Token& t) {
+    if (t.kind == T_EOF) return "end of file";
+    return "'" + tokenText(*p.F, t) + "'";
+}
+
+/**
+ * @brief Reports a syntax error at the current token.
+ * Lexical error tokens are reported as what they are instead.
+ */
+[[noreturn]] void fail(Parser& p, const std::string& message) {
+    const Token& t = peek(p);
+    if (t.kind == T_BAD_STRING) errorAt(*p.F, p.pos, "unterminated literal");
+    if (t.kind == T_BAD_COMMENT) errorAt(*p.F, p.pos, "unterminated block comment");
+    if (t.kind == T_BAD_CHAR) errorAt(*p.F, p.pos, "stray " + describe(p, t) + " in program");
+    errorAt(*p.F, p.pos, message + ", found " + describe(p, t));
+}
+
+/**
+ * @brief Consumes a token of the given kind or reports what was expected.
+ */
+void expect(Parser& p, int kind, const char* what) {
+    if (!accept(p, kind)) fail(p, std::string("expected ") + what);
+}
+
+/**
+ * @brief Interns the text of a token.
+ */
+Symbol tokenSymbol(const SourceFile& F, const Token& t) {
+    return intern(F.data + t.offset, t.length);
+}
+
+/**
+ * @brief Consumes an identifier and returns its symbol.
+ */
+Symbol expectIdent(Parser& p, const char* what) {
+    if (!is(p, T_IDENT)) fail(p, std::string("expected ") + what);
+    return tokenSymbol(*p.F, p.F->tokens[p.pos++]);
+}
+
+/**
+ * @brief Creates a node starting at the current token.
+ */
+NodeId newNode(Parser& p, NodeKind kind) {
+    NodeId id = nodeAlloc();
+    Node* n = at(id);
+    n->kind = kind;
+    n->tok = p.pos;
+    n->type = Type{TY_VOID, -1, false, false};
+    return id;
+}
+
+/**
+ * @brief Returns true if a built-in type keyword starts here.
+ */
+bool isBuiltinType(Parser& p, uint32_t ahead = 0) {
+    int k = peek(p, ahead).kind;
+    return k == T_KW_INT || k == T_KW_FLOAT || k == T_KW_DOUBLE || k == T_KW_CHAR ||
+           k == T_KW_BOOL || k == T_KW_STR || k == T_KW_VOID;
+}
+
+/**
+ * @brief Returns true if a declaration starts here: a built-in type, or a
+ * type name followed by a variable name (`Color c;`, `filePointer* f;`).
+ */
+bool isDeclaration(Parser& p) {
+    if (isBuiltinType(p)) return true;
+    if (!is(p, T_IDENT)) return false;
+    uint32_t k = 1;
+    while (is(p, '*', k)) k++;
+    return is(p, T_IDENT, k);
+}
+
+/**
+ * @brief Returns true if a function definition or prototype starts here:
+ * type { "*" } name "(".
+ */
+bool isFunctionStart(Parser& p) {
+    if (!isBuiltinType(p) && !is(p, T_IDENT)) return false;
+    uint32_t k = 1;
+    while (is(p, '*', k)) k++;
+    return is(p, T_IDENT, k) && is(p, '(', k + 1);
+}
+
+/**
+ * @brief type ::= ( built-in | identifier ) { "*" }
+ * User type names are resolved by the code generator.
+ */
+Type parseType(Parser& p, Symbol* user_name) {
+    Type t = {TY_INT, -1, false, false};
+    switch (peek(p).kind) {
+        case T_KW_INT: t.base = TY_INT; break;
+        case T_KW_CHAR: t.base = TY_CHAR; break;
+        case T_KW_BOOL: t.base = TY_BOOL; break;
+        case T_KW_STR: t.base = TY_STR; break;
+        case T_KW_VOID: t.base = TY_VOID; break;
+        case T_KW_FLOAT: case T_KW_DOUBLE: t.base = TY_FLOAT; break;
+        case T_IDENT:
+            t.base = TY_CLASS;
+            if (user_name) *user_name = tokenSymbol(*p.F, peek(p));
+            break;
+        default: fail(p, "expected a type");
+    }
+    p.pos++;
+    if (accept(p, '*')) t.pointer = true;
+    while (accept(p, '*')) {}
+    return t;
+}
+
+NodeId parseExpression(Parser& p);
+NodeId parseStatement(Parser& p);
+
+/**
+ * @brief Decodes the escapes of a string or char literal's body.
+ */
+std::string decodeLiteral(Parser& p, const Token& t) {
+    std::string out;
+    const char* s = p.F->data + t.offset + 1;
+    const char* end = p.F->data + t.offset + t.length - 1;
+    for (; s < end; s++) {
+        if (*s != '\\' || s + 1 >= end) {
+            out += *s;
+            continue;
+        }
+        switch (*++s) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case '0': out += '\0'; break;
+            default: out += *s; break;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Parses a primary expression and its postfix operators.
+ */
+NodeId parsePostfix(Parser& p) {
+    NodeId n;
+    const Token& t = peek(p);
+    switch (t.kind) {
+        case T_INT: {
+            n = newNode(p, N_INT);
+            errno = 0;
+            unsigned long v = strtoul(tokenText(*p.F, t).c_str(), nullptr, 10);
+            if (errno || v > 0x80000000UL) fail(p, "integer literal out of range");
+            at(n)->value = (int32_t)v;
+            p.pos++;
+            break;
+        }
+        case T_FLOAT:
+            n = newNode(p, N_FLOAT);
+            at(n)->text = tokenSymbol(*p.F, t);
+            p.pos++;
+            break;
+        case T_STRING:
+            n = newNode(p, N_STRING);
+            at(n)->text = intern(decodeLiteral(p, t));
+            p.pos++;
+            break;
+        case T_CHAR: {
+            n = newNode(p, N_CHAR);
+            std::string c = decodeLiteral(p, t);
+            if (c.size() != 1) fail(p, "a char literal holds exactly one character");
+            at(n)->value = (unsigned char)c[0];
+            p.pos++;
+            break;
+        }
+        case T_TRUE: case T_FALSE:
+            n = newNode(p, N_BOOL);
+            at(n)->value = t.kind == T_TRUE;
+            p.pos++;
+            break;
+        case T_IDENT:
+            n = newNode(p, N_NAME);
+            at(n)->text = tokenSymbol(*p.F, t);
+            p.pos++;
+            break;
+        case '(':
+            if (isBuiltinType(p, 1) && is(p, ')', 2)) {
+                // Explicit cast: (int) value
+                n = newNode(p, N_CAST);
+                p.pos++;
+                at(n)->type = parseType(p, nullptr);
+                p.pos++;
+                addKid(n, parsePostfix(p));
+                return n;
+            }
+            p.pos++;
+            n = parseExpression(p);
+            expect(p, ')', "')'");
+            break;
+        case '{':
+            n = newNode(p, N_INIT_LIST);
+            p.pos++;
+            if (!is(p, '}')) {
+                do {
+                    addKid(n, parseExpression(p));
+                } while (accept(p, ',') && !is(p, '}'));
+            }
+            expect(p, '}', "'}' to close the initializer list");
+            break;
+        default:
+            fail(p, "expected an expression");
+    }
+    while (true) {
+        if (is(p, '(')) {
+            if (at(n)->kind != N_NAME) fail(p, "only named functions can be called");
+            at(n)->kind = N_CALL;
+            p.pos++;
+            if (!is(p, ')')) {
+                do {
+                    addKid(n, parseExpression(p));
+                } while (accept(p, ','));
+            }
+            expect(p, ')', "')' after the arguments");
+        } else if (is(p, '[')) {
+            NodeId index = newNode(p, N_INDEX);
+            p.pos++;
+            addKid(index, n);
+            addKid(index, parseExpression(p));
+            expect(p, ']', "']'");
+            n = index;
+        } else if (is(p, '.') || is(p, T_ARROW)) {
+            NodeId method = newNode(p, N_METHOD);
+            p.pos++;
+            at(method)->text = expectIdent(p, "a member name");
+            addKid(method, n);
+            if (!accept(p, '(')) errorAt(*p.F, at(method)->tok, "member variables are not supported by the MIPS back end");
+            if (!is(p, ')')) {
+                do {
+                    addKid(method, parseExpression(p));
+                } while (accept(p, ','));
+            }
+            expect(p, ')', "')' after the arguments");
+            n = method;
+        } else if (is(p, T_INC) || is(p, T_DEC)) {
+            NodeId step = newNode(p, N_INCDEC);
+            at(step)->op = is(p, T_INC) ? '+' : '-';
+            at(step)->postfix = true;
+            p.pos++;
+            addKid(step, n);
+            n = step;
+        } else {
+            return n;
+        }
+    }
+}
+
+/**
+ * @brief Parses prefix operators and their operand.
+ */
+NodeId parseUnary(Parser& p) {
+    int k = peek(p).kind;
+    if (k == T_INC || k == T_DEC) {
+        NodeId n = newNode(p, N_INCDEC);
+        at(n)->op = k == T_INC ? '+' : '-';
+        p.pos++;
+        addKid(n, parseUnary(p));
+        return n;
+    }
+    if (k == '!' || k == '-' || k == '+' || k == '&' || k == '*' || k == '~') {
+        NodeId n = newNode(p, N_UNARY);
+        at(n)->op = k;
+        p.pos++;
+        addKid(n, parseUnary(p));
+        return n;
+    }
+    return parsePostfix(p);
+}
+
+/**
+ * @brief Returns the precedence of a binary operator, or 0 if it is none.
+ */
+int binaryPrecedence(int kind) {
+    switch (kind) {
+        case T_OR: return 1;
+        case T_AND: return 2;
+        case T_EQ: case T_NE: return 3;
+        case '<': case '>': case T_LE: case T_GE: return 4;
+        case '+': case '-': return 5;
+        case '*': case '/': case '%': return 6;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Parses binary operators of at least the given precedence.
+ */
+NodeId parseBinary(Parser& p, int min_prec) {
+    NodeId left = parseUnary(p);
+    int prec;
+    while ((prec = binaryPrecedence(peek(p).kind)) >= min_prec && prec > 0) {
+        NodeId n = newNode(p, N_BINARY);
+        at(n)->op = peek(p).kind;
+        at(n)->tok = at(left)->tok;
+        p.pos++;
+        addKid(n, left);
+        addKid(n, parseBinary(p, prec + 1));
+        left = n;
+    }
+    return left;
+}
+
+/**
+ * @brief expression ::= binary [ assign-op expression ]
+ */
+NodeId parseExpression(Parser& p) {
+    NodeId left = parseBinary(p, 1);
+    int k = peek(p).kind;
+    if (k == '=' || k == T_ADD_ASSIGN || k == T_SUB_ASSIGN || k == T_MUL_ASSIGN ||
+        k == T_DIV_ASSIGN || k == T_MOD_ASSIGN) {
+        NodeId n = newNode(p, N_ASSIGN);
+        at(n)->op = k;
+        at(n)->tok = at(left)->tok;
+        p.pos++;
+        addKid(n, left);
+        addKid(n, parseExpression(p));
+        return n;
+    }
+    return left;
+}
+
+/**
+ * @brief block ::= "{" { statement } "}"
+ */
+NodeId parseBlock(Parser& p) {
+    NodeId n = newNode(p, N_BLOCK);
+    expect(p, '{', "'{' to open a block");
+    while (!is(p, '}') && !is(p, T_EOF)) addKid(n, parseStatement(p));
+    expect(p, '}', "'}' to close the block");
+    return n;
+}
+
+/**
+ * @brief Parses the variables of a declaration after its type:
+ * name [ "[" size "]" ] [ "=" expression ] { "," ... } ";"
+ * @param decl The N_DECL node; receives one N_VAR per variable.
+ * @param user_type Name of a user type, for the code generator.
+ */
+void parseVariables(Parser& p, NodeId decl, Symbol user_type) {
+    do {
+        NodeId var = newNode(p, N_VAR);
+        at(var)->text = expectIdent(p, "a variable name");
+        at(var)->type = at(decl)->type;
+        if (accept(p, '[')) {
+            if (!is(p, T_INT)) fail(p, "expected an array size");
+            at(var)->type.array = atoi(tokenText(*p.F, peek(p)).c_str());
+            p.pos++;
+            expect(p, ']', "']'");
+        }
+        if (accept(p, '=')) addKid(var, parseExpression(p));
+        addKid(decl, var);
+    } while (accept(p, ','));
+    at(decl)->text = user_type;
+    expect(p, ';', "';' after the declaration");
+}
+
+/**
+ * @brief Parses a declaration: [ "constant" ] [ type ] variables.
+ * A constant without a type takes the type of its value.
+ */
+NodeId parseDeclaration(Parser& p) {
+    NodeId decl = newNode(p, N_DECL);
+    at(decl)->constant = accept(p, T_CONSTANT);
+    Symbol user_type = 0;
+    if (at(decl)->constant && is(p, T_IDENT) && is(p, '=', 1)) {
+        at(decl)->type.base = TY_VOID; // Inferred from the initializer
+    } else {
+        at(decl)->type = parseType(p, &user_type);
+    }
+    parseVariables(p, decl, user_type);
+    return decl;
+}
+
+/**
+ * @brief Parses `condition ":" block`, the shape of KIK control blocks.
+ */
+void parseConditionBlock(Parser& p, NodeId n) {
+    addKid(n, parseExpression(p));
+    expect(p, ':', "':' after the condition");
+    addKid(n, parseBlock(p));
+}
+
+/**
+ * @brief Skips a balanced `{ ... }` group, for constructs the back end
+ * rejects anyway.
+ */
+void skipBraces(Parser& p) {
+    expect(p, '{', "'{'");
+    for (int depth = 1; depth > 0;) {
+        if (is(p, T_EOF)) fail(p, "expected '}'");
+        if (is(p, '{')) depth++;
+        if (is(p, '}')) depth--;
+        p.pos++;
+    }
+}
+
+/**
+ * @brief Parses one statement inside a function body.
+ */
+NodeId parseStatement(Parser& p) {
+    NodeId n;
+    switch (peek(p).kind) {
+        case '{':
+            return parseBlock(p);
+        case ';':
+            n = newNode(p, N_BLOCK);
+            p.pos++;
+            return n;
+        case T_IF:
+            n = newNode(p, N_IF);
+            p.pos++;
+            parseConditionBlock(p, n);
+            if (accept(p, T_ELSE)) {
+                if (is(p, T_IF)) {
+                    addKid(n, parseStatement(p));
+                } else {
+                    expect(p, ':', "':' after 'else'");
+                    addKid(n, parseBlock(p));
+                }
+            }
+            return n;
+        case T_WHILE:
+            n = newNode(p, N_WHILE);
+            p.pos++;
+            parseConditionBlock(p, n);
+            return n;
+        case T_DO:
+            n = newNode(p, N_DO);
+            p.pos++;
+            addKid(n, parseBlock(p));
+            expect(p, T_WHILE, "'while' after the do block");
+            addKid(n, parseExpression(p));
+            if (!accept(p, ';')) {
+                expect(p, ':', "':' after the condition");
+                uint32_t block = p.pos;
+                if (at(parseBlock(p))->count) errorAt(*p.F, block, "the block after a do-while condition must be empty");
+            }
+            return n;
+        case T_FOR: {
+            // for [type] init; condition; [:] increment: { ... }
+            n = newNode(p, N_FOR);
+            p.pos++;
+            if (isDeclaration(p)) {
+                NodeId decl = newNode(p, N_DECL);
+                Symbol user_type = 0;
+                at(decl)->type = parseType(p, &user_type);
+                NodeId var = newNode(p, N_VAR);
+                at(var)->text = expectIdent(p, "a loop variable");
+                at(var)->type = at(decl)->type;
+                expect(p, '=', "'=' to initialize the loop variable");
+                addKid(var, parseExpression(p));
+                addKid(decl, var);
+                at(decl)->text = user_type;
+                addKid(n, decl);
+            } else {
+                NodeId init = newNode(p, N_EXPR);
+                addKid(init, parseExpression(p));
+                addKid(n, init);
+            }
+            expect(p, ';', "';' after the loop initialization");
+            addKid(n, parseExpression(p));
+            expect(p, ';', "';' after the loop condition");
+            accept(p, ':');
+            addKid(n, parseExpression(p));
+            expect(p, ':', "':' after the loop increment");
+            addKid(n, parseBlock(p));
+            return n;
+        }
+        case T_SWITCH:
+            n = newNode(p, N_SWITCH);
+            p.pos++;
+            addKid(n, parseExpression(p));
+            expect(p, ':', "':' after the switch value");
+            expect(p, '{', "'{' to open the switch");
+            while (!is(p, '}') && !is(p, T_EOF)) {
+                NodeId c = newNode(p, N_CASE);
+                if (accept(p, T_CASE)) {
+                    addKid(c, parseExpression(p));
+                } else if (!accept(p, T_DEFAULT)) {
+                    fail(p, "expected 'case' or 'default'");
+                }
+                expect(p, ':', "':' after the case label");
+                NodeId body = newNode(p, N_BLOCK);
+                while (!is(p, T_CASE) && !is(p, T_DEFAULT) && !is(p, '}') && !is(p, T_EOF)) {
+                    addKid(body, parseStatement(p));
+                }
+                addKid(c, body); // Last kid: the body
+                addKid(n, c);
+            }
+            expect(p, '}', "'}' to close the switch");
+            return n;
+        case T_RETURN:
+            n = newNode(p, N_RETURN);
+            p.pos++;
+            if (!is(p, ';')) addKid(n, parseExpression(p));
+            expect(p, ';', "';' after the return value");
+            return n;
+        case T_BREAK: case T_CONTINUE:
+            n = newNode(p, is(p, T_BREAK) ? N_BREAK : N_CONTINUE);
+            p.pos++;
+            expect(p, ';', "';'");
+            return n;
+        case T_COUT: case T_CIN: {
+            bool out = is(p, T_COUT);
+            n = newNode(p, out ? N_COUT : N_CIN);
+            p.pos++;
+            int op = out ? T_SHL : T_SHR;
+            if (!is(p, op)) fail(p, out ? "expected '<<'" : "expected '>>'");
+            while (accept(p, op)) {
+                if (out && is(p, T_IDENT) && tokenText(*p.F, peek(p)) == "endl") {
+                    addKid(n, newNode(p, N_ENDL));
+                    p.pos++;
+                } else {
+                    addKid(n, parseBinary(p, 1));
+                }
+            }
+            expect(p, ';', "';' after the I/O statement");
+            return n;
+        }
+        case T_TRY: case T_THROW:
+            n = newNode(p, N_UNSUPPORTED);
+            at(n)->text = intern("exceptions");
+            while (!is(p, ';') && !is(p, '{') && !is(p, T_EOF)) p.pos++;
+            return n;
+        case T_CONSTANT:
+            return parseDeclaration(p);
+        default:
+            if (isDeclaration(p)) return parseDeclaration(p);
+            n = newNode(p, N_EXPR);
+            addKid(n, parseExpression(p));
+            expect(p, ';', "';' after the statement");
+            return n;
+    }
+}
+
+/**
+ * @brief parameters ::= "(" [ type [ "&" ] name [ "[" "]" ] { "," ... } ] ")"
+ */
+void parseParameters(Parser& p, Function& fn) {
+    expect(p, '(', "'('");
+    if (is(p, T_KW_VOID) && is(p, ')', 1)) p.pos++;
+    if (!is(p, ')')) {
+        do {
+            Param param;
+            param.user_type = 0;
+            param.type = parseType(p, &param.user_type);
+            param.tok = p.pos - 1;
+            param.type.ref = accept(p, '&');
+            param.name = expectIdent(p, "a parameter name");
+            if (accept(p, '[')) {
+                expect(p, ']', "']'");
+                param.type.pointer = true;
+            }
+            fn.params.push_back(param);
+        } while (accept(p, ','));
+    }
+    expect(p, ')', "')' after the parameters");
+}
+
+/**
+ * @brief Finds the imports of a lexed file without parsing the rest.
+ * @param names Receives the file names as written.
+ * @param toks Receives the token of each name, for messages.
+ */
+void scanImports(SourceFile& F, std::vector<std::string>& names, std::vector<uint32_t>& toks) {
+    Parser p = {&F, 0};
+    for (; !is(p, T_EOF); p.pos++) {
+        if (!is(p, T_IMPORT)) continue;
+        p.pos++;
+        if (!is(p, T_STRING)) fail(p, "expected a file name string");
+        toks.push_back(p.pos);
+        names.push_back(decodeLiteral(p, peek(p)));
+    }
+}
+
+/**
+ * @brief Parses a whole file: imports, then functions, globals, enums
+ * and type declarations. Imports were already followed by scanImports.
+ */
+void parseFile(SourceFile& F) {
+    Parser p = {&F, 0};
+    while (!is(p, T_EOF)) {
+        if (accept(p, ';')) continue;
+        if (accept(p, T_IMPORT)) {
+            expect(p, T_STRING, "a file name string");
+            expect(p, ';', "';' after the import");
+        } else if (is(p, T_CLASS) || is(p, T_STRUCT)) {
+            p.pos++;
+            F.opaque_types.push_back(expectIdent(p, "a class name"));
+            while (!is(p, '{') && !is(p, T_EOF)) p.pos++;
+            skipBraces(p);
+            accept(p, ';');
+        } else if (accept(p, T_ENUM)) {
+            Symbol name = expectIdent(p, "an enum name");
+            accept(p, ':');
+            expect(p, '{', "'{' to open the enum");
+            long value = 0;
+            while (!is(p, '}')) {
+                Symbol member = expectIdent(p, "an enum constant");
+                if (accept(p, '=')) {
+                    bool negative = accept(p, '-');
+                    if (!is(p, T_INT)) fail(p, "expected an integer value");
+                    value = atol(tokenText(F, peek(p)).c_str()) * (negative ? -1 : 1);
+                    p.pos++;
+                }
+                F.enum_values.push_back(std::make_pair(member, value++));
+                if (!accept(p, ',')) break;
+            }
+            expect(p, '}', "'}' to close the enum");
+            accept(p, ';');
+            F.enum_types.push_back(name);
+        } else if (is(p, T_IDENT) && tokenText(F, peek(p)) == "type" && is(p, T_IDENT, 1) && is(p, ';', 2)) {
+            F.handle_types.push_back(tokenSymbol(F, peek(p, 1)));
+            p.pos += 3;
+        } else if (!isFunctionStart(p)) {
+            F.globals.push_back(parseDeclaration(p));
+        } else {
+            std::unique_ptr<Function> fn(new Function());
+            fn->file = &F;
+            fn->ret = parseType(p, &fn->ret_user_type);
+            fn->tok = p.pos;
+            fn->name = expectIdent(p, "a function name");
+            parseParameters(p, *fn);
+            if (!accept(p, ';')) {
+                accept(p, ':');
+                fn->body = parseBlock(p);
+                fn->defined = true;
+            }
+            F.functions.push_back(std::move(fn));
+        }
+    }
+}
+
+/**
+ * @brief Finds an imported file like the editor does.
+ * @param name The name as written in the import.
+ * @param dir Directory of the importing file.
+ * @return The canonical path, or "" if it was not found.
+ */
+std::string resolveImport(const std::string& name, const std::string& dir) {
+    std::vector<std::string> candidates;
+    candidates.push_back(dir + "/" + name);
+    for (std::string d = dir; !d.empty();) {
+        candidates.push_back(d + "/KIK-Library/" + name);
+        size_t slash = d.rfind('/');
+        d = slash == std::string::npos || slash == 0 ? "" : d.substr(0, slash);
+    }
+    if (const char* env = getenv("KIK_PATH")) {
+        std::string paths = env;
+        for (size_t start = 0; start <= paths.size();) {
+            size_t end = paths.find(':', start);
+            if (end == std::string::npos) end = paths.size();
+            if (end > start) candidates.push_back(paths.substr(start, end - start) + "/" + name);
+            start = end + 1;
+        }
+    }
+    for (const auto& c : candidates) {
+        if (access(c.c_str(), R_OK) == 0) return canonicalPath(c);
+    }
+    return "";
+}
+
+// --- Code Generation ---
+
+// Temporaries for expression values: $t0-$t9
+static const int TEMP_REGS[] = {8, 9, 10, 11, 12, 13, 14, 15, 24, 25};
+static const int TEMP_COUNT = 10;
+
+enum Register {
+    R_ZERO = 0, R_V0 = 2, R_A0 = 4, R_SP = 29, R_FP = 30, R_RA = 31
+};
+
+static const char* const REG_NAMES[32] = {
+    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+
+// Operand layouts for printing
+enum OpFormat { F_LABEL, F_RRR, F_RR, F_R, F_RRI, F_RI, F_RL, F_MEM, F_BRANCH, F_JUMP, F_NONE };
+
+static const struct { const char* name; OpFormat format; } OPS[OP_COUNT] = {
+    {"", F_LABEL}, {"addu", F_RRR}, {"subu", F_RRR}, {"mul", F_RRR}, {"div", F_RR},
+    {"mflo", F_R}, {"mfhi", F_R}, {"and", F_RRR}, {"or", F_RRR}, {"xor", F_RRR},
+    {"slt", F_RRR}, {"sltu", F_RRR}, {"addiu", F_RRI}, {"andi", F_RRI},
+    {"slti", F_RRI}, {"sltiu", F_RRI}, {"xori", F_RRI}, {"sll", F_RRI}, {"sra", F_RRI}, {"srl", F_RRI}, {"li", F_RI}, {"la", F_RL}, {"move", F_RR},
+    {"lw", F_MEM}, {"sw", F_MEM}, {"lbu", F_MEM}, {"sb", F_MEM}, {"beq", F_BRANCH},
+    {"bne", F_BRANCH}, {"j", F_JUMP}, {"jal", F_JUMP}, {"jr", F_R}, {"syscall", F_NONE},
+    {"teq", F_RR}, {"nop", F_NONE}
+};
+
+thread_local FunctionGen G;
+
+/**
+ * @brief Appends an instruction to the function being compiled.
+ * For two-register forms the registers are (rd, rs); memory forms are
+ * (rt, imm(rs)); branches compare rs with rt.
+ */
+void emit(Op op, int rd, int rs, int rt, int32_t imm = 0, const std::string& label = "") {
+    Instr in = {op, rd, rs, rt, imm, label, G.line};
+    G.code.push_back(in);
+}
+void emitLabel(const std::string& label) { emit(OP_LABEL, -1, -1, -1, 0, label); }
+void emitLi(int rd, int32_t value) { emit(OP_LI, rd, -1, -1, value); }
+void emitMove(int rd, int rs) { emit(OP_MOVE, rd, rs, -1); }
+
+/**
+ * @brief Returns a fresh local label.
+ */
+std::string newLabel() {
+    return "L" + U.prefix + "_" + std::to_string(U.next_label++);
+}
+
+/**
+ * @brief Throws a CompileError at a node of the current function.
+ */
+[[noreturn]] void errorAtNode(const Node* n, const std::string& message) {
+    errorAt(*G.file, n->tok, message);
+}
+
+/**
+ * @brief Reserves a temporary register.
+ */
+int tempAlloc(const Node* n) {
+    for (int i = 0; i < TEMP_COUNT; i++) {
+        if (!(G.temps & (1u << i))) {
+            G.temps |= 1u << i;
+            return TEMP_REGS[i];
+        }
+    }
+    errorAtNode(n, "expression too complex: out of temporary registers");
+}
+
+/**
+ * @brief Releases a temporary register.
+ */
+void tempFree(int reg) {
+    for (int i = 0; i < TEMP_COUNT; i++) {
+        if (TEMP_REGS[i] == reg) G.temps &= ~(1u << i);
+    }
+}
+
+/**
+ * @brief Returns the name of a type, for messages.
+ */
+std::string typeName(const Type& t) {
+    static const char* const NAMES[] = {"void", "int", "char", "bool", "str", "float", "class"};
+    std::string s = NAMES[t.base];
+    if (t.pointer) s += "*";
+    if (t.array >= 0) s += "[" + std::to_string(t.array) + "]";
+    return s;
+}
+
+/**
+ * @brief Returns true for types held as a plain number.
+ */
+bool isScalar(const Type& t) {
+    return !t.pointer && t.array < 0 && (t.base == TY_INT || t.base == TY_CHAR || t.base == TY_BOOL);
+}
+
+/**
+ * @brief Returns true for str values.
+ */
+bool isString(const Type& t) {
+    return !t.pointer && t.array < 0 && t.base == TY_STR;
+}
+
+/**
+ * @brief Rejects types the MIPS back end cannot represent.
+ */
+void checkSupported(const Node* n, const Type& t) {
+    if (t.base == TY_FLOAT) errorAtNode(n, "floating point is not supported by the MIPS back end");
+    if (t.base == TY_CLASS) errorAtNode(n, "class and opaque types are not supported by the MIPS back end");
+}
+
+/**
+ * @brief Tells whether a user type is represented as an int: enums, and
+ * handles declared with `type` such as file.kik's filePointer.
+ */
+bool isWordType(Symbol user_name) {
+    return U.symbols.enum_types.count(user_name) || U.symbols.handle_types.count(user_name);
+}
+
+/**
+ * @brief Resolves the type named by a declaration.
+ * Enum and handle names become int; other user types are rejected.
+ */
+Type resolveType(const Node* n, Type t, Symbol user_name) {
+    if (t.base == TY_CLASS && isWordType(user_name)) t.base = TY_INT;
+    if (t.base == TY_CLASS) {
+        errorAtNode(n, "type '" + symbolString(user_name) + "' is not supported by the MIPS back end");
+    }
+    checkSupported(n, t);
+    return t;
+}
+
+/**
+ * @brief Looks up a variable in the enclosing scopes, then the globals.
+ */
+const Variable* lookupVariable(Symbol name) {
+    for (size_t i = G.scopes.size(); i-- > 0;) {
+        auto it = G.scopes[i].find(name);
+        if (it != G.scopes[i].end()) return &it->second;
+    }
+    auto it = U.symbols.globals.find(name);
+    return it == U.symbols.globals.end() ? nullptr : &it->second;
+}
+
+/**
+ * @brief Reserves frame space for a local variable.
+ * @return Its offset from $fp.
+ */
+int frameAlloc(const Type& t) {
+    int bytes = 4;
+    if (t.array >= 0) bytes = t.base == TY_CHAR ? (t.array + 3) & ~3 : t.array * 4;
+    G.frame += std::max(bytes, 4);
+    if (t.array < 0) G.words.push_back(-G.frame);
+    return -G.frame;
+}
+
+/**
+ * @brief Adds the string to the data section.
+ * @return Its label.
+ */
+std::string stringLabel(const std::string& text) {
+    std::string label = "S" + U.prefix + "_" + std::to_string(U.next_string++);
+    std::string escaped;
+    for (char c : text) {
+        switch (c) {
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\0': escaped += "\\0"; break;
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            default: escaped += c; break;
+        }
+    }
+    U.data.push_back(label + ":\t.asciiz \"" + escaped + "\"");
+    return label;
+}
+
+Value genExpr(const Node* n);
+
+/**
+ * @brief Calls a function, keeping busy temporaries across the call.
+ * @param target Label to jump to.
+ * @param args Registers holding the arguments, in order; they are freed.
+ * @param n Node for messages.
+ * @return A temporary holding $v0.
+ */
+int genCallSequence(const std::string& target, const std::vector<int>& args, const Node* n) {
+    for (int r : args) tempFree(r);
+    // The argument registers are free now, but still hold their values
+    std::vector<int> saved;
+    for (int i = 0; i < TEMP_COUNT; i++) {
+        if (G.temps & (1u << i)) saved.push_back(TEMP_REGS[i]);
+    }
+    int extra = std::max<int>(args.size() - 4, 0);
+    int pushed = saved.size() + extra;
+    if (pushed) emit(OP_ADDIU, R_SP, R_SP, -1, -4 * pushed);
+    for (size_t i = 0; i < saved.size(); i++) emit(OP_SW, saved[i], R_SP, -1, 4 * (extra + i));
+    for (size_t i = 0; i < args.size(); i++) {
+        if (i < 4) emitMove(R_A0 + i, args[i]);
+        else emit(OP_SW, args[i], R_SP, -1, 4 * (i - 4));
+    }
+    emit(OP_JAL, -1, -1, -1, 0, target);
+    for (size_t i = 0; i < saved.size(); i++) emit(OP_LW, saved[i], R_SP, -1, 4 * (extra + i));
+    if (pushed) emit(OP_ADDIU, R_SP, R_SP, -1, 4 * pushed);
+    int result = tempAlloc(n);
+    emitMove(result, R_V0);
+    return result;
+}
+
+/**
+ * @brief Calls a runtime helper, marking it for inclusion.
+ */
+int genRuntimeCall(const char* name, const std::vector<int>& args, const Node* n) {
+    U.runtime[name] = true;
+    return genCallSequence(name, args, n);
+}
+
+/**
+ * @brief Converts a value to a string for concatenation and output.
+ */
+int genToString(const Value& v, const Node* n) {
+    if (isString(v.type)) return v.reg;
+    if (v.type.base == TY_CHAR && isScalar(v.type)) return genRuntimeCall("__kik_chrstr", {v.reg}, n);
+    if (isScalar(v.type)) return genRuntimeCall("__kik_itoa", {v.reg}, n);
+    errorAtNode(n, "cannot convert " + typeName(v.type) + " to str");
+}
+
+// Where an lvalue lives: offset(base)
+struct Address {
+    int base;               // $fp, or a temporary holding an address
+    int32_t offset;
+    Type type;              // Type of the value stored there
+    bool byte;              // Access with lbu/sb rather than lw/sw
+};
+
+/**
+ * @brief Releases the temporary an address uses, if any.
+ */
+void addressFree(const Address& a) {
+    if (a.base != R_FP) tempFree(a.base);
+}
+
+/**
+ * @brief Computes an address into a temporary, e.g. to pass it by reference.
+ */
+int addressReg(const Address& a, const Node* n) {
+    if (a.base == R_FP) {
+        int reg = tempAlloc(n);
+        emit(OP_ADDIU, reg, R_FP, -1, a.offset);
+        return reg;
+    }
+    if (a.offset) emit(OP_ADDIU, a.base, a.base, -1, a.offset);
+    return a.base;
+}
+
+Address genAddress(const Node* n);
+
+/**
+ * @brief Computes the address of an array element or a character of a
+ * string.
+ * @param n The indexing node, for messages.
+ * @param base The array, pointer or str indexed.
+ * @param index The index.
+ */
+Address genIndexAddress(const Node* n, const Node* base, const Node* index) {
+    Address a = {R_FP, 0, Type{TY_INT, -1, false, false}, false};
+    const Variable* var = base->kind == N_NAME ? lookupVariable(base->text) : nullptr;
+    if (var && var->type.array >= 0) {
+        a = genAddress(base);
+    } else {
+        Value b = genExpr(base);
+        if (!b.type.pointer && !isString(b.type)) errorAtNode(n, "cannot index a value of type " + typeName(b.type));
+        a.base = b.reg;
+        a.type = b.type;
+        if (isString(b.type)) a.type.base = TY_CHAR;
+    }
+    a.type.array = -1;
+    a.type.pointer = false;
+    a.byte = a.type.base == TY_CHAR;
+    if (index->kind == N_INT || index->kind == N_CHAR) {
+        a.offset += index->value * (a.byte ? 1 : 4);
+        return a;
+    }
+    Value i = genExpr(index);
+    if (!isScalar(i.type)) errorAtNode(index, "array index must be an int");
+    if (!a.byte) emit(OP_SLL, i.reg, i.reg, -1, 2);
+    if (a.base == R_FP) {
+        emit(OP_ADDU, i.reg, i.reg, R_FP);
+        a.base = i.reg;
+    } else {
+        emit(OP_ADDU, a.base, a.base, i.reg);
+        tempFree(i.reg);
+    }
+    return a;
+}
+
+/**
+ * @brief Computes the address of a variable or array element.
+ */
+Address genAddress(const Node* n) {
+    Address a = {R_FP, 0, Type{TY_INT, -1, false, false}, false};
+    if (n->kind == N_NAME) {
+        const Variable* v = lookupVariable(n->text);
+        if (!v) {
+            if (U.symbols.enum_values.count(n->text)) errorAtNode(n, "cannot assign to enum constant '" + symbolString(n->text) + "'");
+            errorAtNode(n, "'" + symbolString(n->text) + "' is not declared");
+        }
+        if (v->global) {
+            a.base = tempAlloc(n);
+            emit(OP_LA, a.base, -1, -1, 0, v->label);
+        } else if (v->type.ref) {
+            a.base = tempAlloc(n);
+            emit(OP_LW, a.base, R_FP, -1, v->offset);
+        } else {
+            a.offset = v->offset;
+        }
+        a.type = v->type;
+        a.type.ref = false;
+        return a;
+    }
+    if (n->kind == N_INDEX) {
+        auto reduced = G.reduced.find(n);
+        if (reduced == G.reduced.end()) return genIndexAddress(n, kid(n, 0), kid(n, 1));
+        // The enclosing loop keeps a pointer near this element
+        a.base = tempAlloc(n);
+        emit(OP_LW, a.base, R_FP, -1, reduced->second.pointer);
+        a.offset = reduced->second.offset;
+        a.type = reduced->second.type;
+        a.byte = a.type.base == TY_CHAR;
+        return a;
+    }
+    errorAtNode(n, "expression is not assignable");
+}
+
+/**
+ * @brief Loads the value stored at an address.
+ * @return A temporary holding it; the address is released.
+ */
+int genLoad(const Address& a, const Node* n) {
+    int reg = a.base == R_FP ? tempAlloc(n) : a.base;
+    emit(a.byte ? OP_LBU : OP_LW, reg, a.base, -1, a.offset);
+    return reg;
+}
+
+/**
+ * @brief Stores a register at an address.
+ */
+void genStore(const Address& a, int reg) {
+    emit(a.byte ? OP_SB : OP_SW, reg, a.base, -1, a.offset);
+}
+
+/**
+ * @brief Evaluates an expression at compile time if it only involves
+ * literals, enum constants and constants with known values. Division by
+ * a constant zero is left to trap at run time.
+ * @param value Receives the value.
+ * @param type Receives its type.
+ * @return False if the expression needs code to evaluate.
+ */
+bool foldConstant(const Node* n, int32_t& value, Type& type) {
+    type = Type{TY_INT, -1, false, false};
+    switch (n->kind) {
+        case N_INT: case N_CHAR: case N_BOOL:
+            value = n->value;
+            if (n->kind != N_INT) type.base = n->kind == N_CHAR ? TY_CHAR : TY_BOOL;
+            return true;
+        case N_NAME: {
+            const Variable* var = lookupVariable(n->text);
+            if (var) {
+                if (!var->known) return false;
+                value = var->value;
+                type = var->type;
+                return true;
+            }
+            auto e = U.symbols.enum_values.find(n->text);
+            if (e == U.symbols.enum_values.end()) return false;
+            value = (int32_t)e->second;
+            return true;
+        }
+        case N_UNARY: {
+            if (!foldConstant(at(n->first), value, type)) return false;
+            if (n->op == '-') value = (int32_t)(0u - (uint32_t)value), type.base = TY_INT;
+            else if (n->op == '!') value = !value, type.base = TY_BOOL;
+            else if (n->op != '+') return false;
+            return true;
+        }
+        case N_CAST: {
+            if (!isScalar(n->type) || !foldConstant(at(n->first), value, type)) return false;
+            if (n->type.base == TY_CHAR) value &= 0xff;
+            if (n->type.base == TY_BOOL) value = value != 0;
+            type = n->type;
+            return true;
+        }
+        case N_BINARY: {
+            int32_t a, b;
+            Type ta, tb;
+            const Node* left = at(n->first);
+            if (!foldConstant(left, a, ta) || !foldConstant(at(left->next), b, tb)) return false;
+            uint32_t ua = a, ub = b;
+            type.base = binaryPrecedence(n->op) <= 4 ? TY_BOOL : TY_INT;
+            switch (n->op) {
+                case '+': value = (int32_t)(ua + ub); return true;
+                case '-': value = (int32_t)(ua - ub); return true;
+                case '*': value = (int32_t)(ua * ub); return true;
+                case '/': case '%':
+                    if (b == 0 || (a == INT32_MIN && b == -1)) return false;
+                    value = n->op == '/' ? a / b : a % b;
+                    return true;
+                case '<': value = a < b; return true;
+                case '>': value = a > b; return true;
+                case T_LE: value = a <= b; return true;
+                case T_GE: value = a >= b; return true;
+                case T_EQ: value = a == b; return true;
+                case T_NE: value = a != b; return true;
+                case T_AND: value = a && b; return true;
+                case T_OR: value = a || b; return true;
+                default: return false;
+            }
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Returns the operator that gives the same result with the
+ * operands swapped, or 0 if there is none.
+ */
+int mirrorOperator(int op) {
+    switch (op) {
+        case '+': case '*': case T_EQ: case T_NE: return op;
+        case '<': return '>';
+        case '>': return '<';
+        case T_LE: return T_GE;
+        case T_GE: return T_LE;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Returns whether a value fits a signed 16-bit immediate.
+ */
+inline bool fitsImmediate(int64_t v) {
+    return v >= -32768 && v <= 32767;
+}
+
+/**
+ * @brief Emits a binary operator whose right operand is a constant using
+ * immediate-operand instructions. The result replaces `left`.
+ * @return False if the constant does not fit; nothing is emitted then.
+ */
+bool genArithmeticImmediate(int op, int left, int32_t c) {
+    switch (op) {
+        case '+':
+            if (!fitsImmediate(c)) return false;
+            emit(OP_ADDIU, left, left, -1, c);
+            return true;
+        case '-':
+            if (!fitsImmediate(-(int64_t)c)) return false;
+            emit(OP_ADDIU, left, left, -1, -c);
+            return true;
+        case '<': case T_GE:
+            // x >= c is !(x < c)
+            if (!fitsImmediate(c)) return false;
+            emit(OP_SLTI, left, left, -1, c);
+            if (op == T_GE) emit(OP_XORI, left, left, -1, 1);
+            return true;
+        case T_LE: case '>':
+            // x <= c is x < c + 1, and x > c is its negation
+            if (!fitsImmediate((int64_t)c + 1)) return false;
+            emit(OP_SLTI, left, left, -1, c + 1);
+            if (op == '>') emit(OP_XORI, left, left, -1, 1);
+            return true;
+        case T_EQ: case T_NE:
+            // Make the register zero exactly when x == c
+            if (c > 0 && c <= 0xffff) emit(OP_XORI, left, left, -1, c);
+            else if (c < 0 && c >= -32767) emit(OP_ADDIU, left, left, -1, -c);
+            else if (c != 0) return false;
+            if (op == T_EQ) emit(OP_SLTIU, left, left, -1, 1);
+            else emit(OP_SLTU, left, R_ZERO, left);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Emits the arithmetic for a binary operator on two registers.
+ * The result replaces `left`.
+ */
+void genArithmetic(int op, int left, int right) {
+    switch (op) {
+        case '+': emit(OP_ADDU, left, left, right); break;
+        case '-': emit(OP_SUBU, left, left, right); break;
+        case '*': emit(OP_MUL, left, left, right); break;
+        case '/': case '%':
+            emit(OP_TEQ, right, R_ZERO, -1); // Division by zero is a runtime error
+            emit(OP_DIV, left, right, -1);
+            emit(op == '/' ? OP_MFLO : OP_MFHI, left, -1, -1);
+            break;
+        case '<': emit(OP_SLT, left, left, right); break;
+        case '>': emit(OP_SLT, left, right, left); break;
+        case T_LE: emit(OP_SLT, left, right, left); emit(OP_XORI, left, left, -1, 1); break;
+        case T_GE: emit(OP_SLT, left, left, right); emit(OP_XORI, left, left, -1, 1); break;
+        case T_EQ: emit(OP_XOR, left, left, right); emit(OP_SLTIU, left, left, -1, 1); break;
+        case T_NE: emit(OP_XOR, left, left, right); emit(OP_SLTU, left, R_ZERO, left); break;
+    }
+}
+
+/**
+ * @brief Maps a compound assignment to its arithmetic operator.
+ */
+int assignOperator(int op) {
+    switch (op) {
+        case T_ADD_ASSIGN: return '+';
+        case T_SUB_ASSIGN: return '-';
+        case T_MUL_ASSIGN: return '*';
+        case T_DIV_ASSIGN: return '/';
+        case T_MOD_ASSIGN: return '%';
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Checks that a value can be stored into a variable of a type.
+ */
+void checkAssignable(const Node* n, const Type& to, const Type& from) {
+    if (isScalar(to) && isScalar(from)) return;
+    if (isString(to) && isString(from)) return;
+    if (to.pointer && from.pointer && to.base == from.base) return;
+    errorAtNode(n, "cannot assign " + typeName(from) + " to " + typeName(to));
+}
+
+// Bindings declared in file.kik, each a runtime helper around one of
+// the MARS file system calls 13-16
+static const struct { const char* name; const char* helper; } FILE_BINDINGS[] = {
+    {"fopen", "__kik_fopen"},
+    {"fread", "__kik_fread"},
+    {"fwrite", "__kik_fwrite"},
+    {"fclose", "__kik_fclose"},
+    {nullptr, nullptr}
+};
+
+/**
+ * @brief Compiles a call to a user function or an io.kik or file.kik
+ * binding.
+ */
+Value genCall(const Node* n) {
+    auto it = U.symbols.functions.find(n->text);
+    if (it == U.symbols.functions.end()) {
+        if (lookupVariable(n->text)) errorAtNode(n, "'" + symbolString(n->text) + "' is not a function");
+        errorAtNode(n, "call to undeclared function '" + symbolString(n->text) + "'");
+    }
+    const Function& fn = *it->second;
+    if (n->count != fn.params.size()) {
+        errorAtNode(n, "'" + symbolString(fn.name) + "' takes " + std::to_string(fn.params.size()) + " argument(s), " +
+                       std::to_string(n->count) + " given");
+    }
+    Value result = {0, fn.ret};
+    const char* helper = nullptr;
+    if (!fn.defined) {
+        // System call bindings declared in io.kik
+        if (fn.name == intern("output")) {
+            Value v = genExpr(kid(n, 0));
+            if (isString(v.type)) emitLi(R_V0, 4);
+            else if (v.type.base == TY_CHAR && isScalar(v.type)) emitLi(R_V0, 11);
+            else if (isScalar(v.type)) emitLi(R_V0, 1);
+            else errorAtNode(kid(n, 0), "cannot output a value of type " + typeName(v.type));
+            emitMove(R_A0, v.reg);
+            emit(OP_SYSCALL, -1, -1, -1);
+            tempFree(v.reg);
+            result.reg = -1;
+            return result;
+        }
+        if (fn.name == intern("input")) {
+            result.reg = genRuntimeCall("__kik_input", {}, n);
+            result.type = Type{TY_STR, -1, false, false};
+            return result;
+        }
+        for (int i = 0; FILE_BINDINGS[i].name && !helper; i++) {
+            if (fn.name == intern(FILE_BINDINGS[i].name)) helper = FILE_BINDINGS[i].helper;
+        }
+        // Defined by a module this one does not import, if anywhere; checked at link time
+        if (!helper) U.needs.insert(std::make_pair(symbolString(fn.name), tokenWhere(*G.file, n->tok)));
+    }
+    std::vector<int> args;
+    size_t i = 0;
+    for (NodeId k = n->first; k; k = at(k)->next, i++) {
+        const Node* arg = at(k);
+        const Type& want = fn.params[i].type;
+        if (want.ref) {
+            Address a = genAddress(arg);
+            Type plain = want;
+            plain.ref = false;
+            if (a.byte) errorAtNode(arg, "cannot pass a character of a string by reference");
+            checkAssignable(arg, plain, a.type);
+            args.push_back(addressReg(a, arg));
+            continue;
+        }
+        Value v = genExpr(arg);
+        checkAssignable(arg, want, v.type);
+        args.push_back(v.reg);
+    }
+    if (helper) result.reg = genRuntimeCall(helper, args, n);
+    else result.reg = genCallSequence("f_" + symbolString(fn.name), args, n);
+    if (fn.ret.base == TY_VOID) {
+        tempFree(result.reg);
+        result.reg = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief Recognizes an assignment that moves a variable by a constant:
+ * x++, x--, x += c, x -= c, x = x + c, x = x - c or x = c + x.
+ * @param name Receives the variable's name.
+ * @param step Receives the amount added; small enough that four times
+ * it fits an immediate.
+ * @return False for any other assignment.
+ */
+bool stepAmount(const Node* n, Symbol& name, int32_t& step) {
+    const Node* target = kid(n, 0);
+    if (target->kind != N_NAME) return false;
+    name = target->text;
+    if (n->kind == N_INCDEC) {
+        step = n->op == '+' ? 1 : -1;
+        return true;
+    }
+    if (n->kind != N_ASSIGN) return false;
+    const Node* value = kid(n, 1);
+    int op = assignOperator(n->op);
+    int32_t c;
+    Type type;
+    if (op == '+' || op == '-') {
+        if (!foldConstant(value, c, type)) return false;
+        step = op == '+' ? c : -c;
+    } else if (!op && value->kind == N_BINARY && (value->op == '+' || value->op == '-')) {
+        const Node* left = kid(value, 0);
+        const Node* right = kid(value, 1);
+        if (left->kind == N_NAME && left->text == name && foldConstant(right, c, type)) {
+            step = value->op == '+' ? c : -c;
+        } else if (value->op == '+' && right->kind == N_NAME && right->text == name && foldConstant(left, c, type)) {
+            step = c;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    return isScalar(type) && fitsImmediate(4 * (int64_t)step);
+}
+
+/**
+ * @brief Moves the pointers that follow a loop index, after a store to
+ * the index.
+ * @param n The assignment or increment that stored it.
+ */
+void genStepUpdates(const Node* n) {
+    const Node* target = kid(n, 0);
+    if (target->kind != N_NAME || G.steps.empty()) return;
+    const Variable* var = lookupVariable(target->text);
+    if (!var || var->global || var->type.ref) return;
+    auto it = G.steps.find(var->offset);
+    if (it == G.steps.end()) return;
+    Symbol name;
+    int32_t step;
+    if (!stepAmount(n, name, step)) errorAtNode(n, "internal error: loop index changed by an unknown amount");
+    for (const auto& pointer : it->second) {
+        int reg = tempAlloc(n);
+        emit(OP_LW, reg, R_FP, -1, pointer.first);
+        emit(OP_ADDIU, reg, reg, -1, step * pointer.second);
+        emit(OP_SW, reg, R_FP, -1, pointer.first);
+        tempFree(reg);
+    }
+}
+
+/**
+ * @brief Compiles an expression into a temporary register.
+ * @return The register and the value's type; reg is -1 for void calls.
+ */
+Value genExpr(const Node* n) {
+    Value v = {0, Type{TY_INT, -1, false, false}};
+    auto hoisted = G.hoisted.find(n);
+    if (hoisted != G.hoisted.end()) {
+        v.reg = tempAlloc(n);
+        emit(OP_LW, v.reg, R_FP, -1, hoisted->second.offset);
+        v.type = hoisted->second.type;
+        return v;
+    }
+    int32_t folded;
+    if ((n->kind == N_NAME || n->kind == N_UNARY || n->kind == N_BINARY || n->kind == N_CAST) &&
+        foldConstant(n, folded, v.type)) {
+        v.reg = tempAlloc(n);
+        emitLi(v.reg, folded);
+        return v;
+    }
+    switch (n->kind) {
+        case N_INT:
+            v.reg = tempAlloc(n);
+            emitLi(v.reg, (int32_t)n->value);
+            return v;
+        case N_CHAR: case N_BOOL:
+            v.reg = tempAlloc(n);
+            emitLi(v.reg, (int32_t)n->value);
+            v.type.base = n->kind == N_CHAR ? TY_CHAR : TY_BOOL;
+            return v;
+        case N_STRING:
+            v.reg = tempAlloc(n);
+            emit(OP_LA, v.reg, -1, -1, 0, stringLabel(symbolString(n->text)));
+            v.type.base = TY_STR;
+            return v;
+        case N_FLOAT:
+            errorAtNode(n, "floating point is not supported by the MIPS back end");
+        case N_NAME: {
+            const Variable* var = lookupVariable(n->text);
+            if (!var) {
+                auto e = U.symbols.enum_values.find(n->text);
+                if (e == U.symbols.enum_values.end()) errorAtNode(n, "'" + symbolString(n->text) + "' is not declared");
+                v.reg = tempAlloc(n);
+                emitLi(v.reg, (int32_t)e->second);
+                return v;
+            }
+            Address a = genAddress(n);
+            v.type = a.type;
+            if (v.type.array >= 0) {
+                // An array used as a value is the address of its first element
+                v.reg = addressReg(a, n);
+                v.type.array = -1;
+                v.type.pointer = true;
+            } else {
+                v.reg = genLoad(a, n);
+            }
+            return v;
+        }
+        case N_INDEX: {
+            Address a = genAddress(n);
+            v.reg = genLoad(a, n);
+            v.type = a.type;
+            return v;
+        }
+        case N_UNARY: {
+            v = genExpr(kid(n, 0));
+            if (!isScalar(v.type)) errorAtNode(n, "operator needs a number, not " + typeName(v.type));
+            if (n->op == '-') emit(OP_SUBU, v.reg, R_ZERO, v.reg);
+            else if (n->op == '!') emit(OP_SLTIU, v.reg, v.reg, -1, 1), v.type.base = TY_BOOL;
+            else if (n->op != '+') errorAtNode(n, "pointer and bitwise operators are not supported");
+            if (n->op == '-') v.type.base = TY_INT;
+            return v;
+        }
+        case N_CAST: {
+            v = genExpr(kid(n, 0));
+            checkSupported(n, n->type);
+            if (!isScalar(v.type) || !isScalar(n->type)) {
+                errorAtNode(n, "cannot cast " + typeName(v.type) + " to " + typeName(n->type));
+            }
+            if (n->type.base == TY_CHAR) emit(OP_ANDI, v.reg, v.reg, -1, 0xff);
+            if (n->type.base == TY_BOOL) emit(OP_SLTU, v.reg, R_ZERO, v.reg);
+            v.type = n->type;
+            return v;
+        }
+        case N_BINARY: {
+            if (n->op == T_AND || n->op == T_OR) {
+                // Short-circuit: the right side runs only if it decides the result
+                std::string done = newLabel();
+                v = genExpr(kid(n, 0));
+                if (!isScalar(v.type)) errorAtNode(n, "'&&' and '||' need bool operands");
+                emit(OP_SLTU, v.reg, R_ZERO, v.reg);
+                emit(n->op == T_AND ? OP_BEQ : OP_BNE, -1, v.reg, R_ZERO, 0, done);
+                Value right = genExpr(kid(n, 1));
+                if (!isScalar(right.type)) errorAtNode(n, "'&&' and '||' need bool operands");
+                emit(OP_SLTU, v.reg, R_ZERO, right.reg);
+                tempFree(right.reg);
+                emitLabel(done);
+                v.type.base = TY_BOOL;
+                return v;
+            }
+            // With one constant operand, compile the other and use an immediate form
+            const Node* first = at(n->first);
+            const Node* second = at(first->next);
+            int32_t imm;
+            Type imm_type;
+            bool right_imm = foldConstant(second, imm, imm_type);
+            bool left_imm = !right_imm && mirrorOperator(n->op) && foldConstant(first, imm, imm_type);
+            Value left = genExpr(left_imm ? second : first);
+            if ((left_imm || right_imm) && isScalar(left.type) && isScalar(imm_type) &&
+                genArithmeticImmediate(left_imm ? mirrorOperator(n->op) : n->op, left.reg, imm)) {
+                v.reg = left.reg;
+                v.type.base = binaryPrecedence(n->op) <= 4 ? TY_BOOL : TY_INT;
+                return v;
+            }
+            Value right = genExpr(left_imm ? first : second);
+            if (left_imm) std::swap(left, right);
+            if (n->op == '+' && (isString(left.type) || isString(right.type))) {
+                int a = genToString(left, kid(n, 0));
+                int b = genToString(right, kid(n, 1));
+                v.reg = genRuntimeCall("__kik_concat", {a, b}, n);
+                v.type.base = TY_STR;
+                return v;
+            }
+            if ((n->op == T_EQ || n->op == T_NE) && isString(left.type) && isString(right.type)) {
+                v.reg = genRuntimeCall("__kik_streq", {left.reg, right.reg}, n);
+                if (n->op == T_NE) emit(OP_XORI, v.reg, v.reg, -1, 1);
+                v.type.base = TY_BOOL;
+                return v;
+            }
+            if (!isScalar(left.type) || !isScalar(right.type)) {
+                errorAtNode(n, "invalid operands " + typeName(left.type) + " and " + typeName(right.type));
+            }
+            genArithmetic(n->op, left.reg, right.reg);
+            tempFree(right.reg);
+            v.reg = left.reg;
+            v.type.base = binaryPrecedence(n->op) <= 4 ? TY_BOOL : TY_INT;
+            return v;
+        }
+        case N_ASSIGN: {
+            const Node* target = kid(n, 0);
+            if (target->kind == N_NAME) {
+                const Variable* var = lookupVariable(target->text);
+                if (var && var->constant) errorAtNode(n, "cannot assign to constant '" + symbolString(target->text) + "'");
+                if (var && var->type.array >= 0) errorAtNode(n, "cannot assign to array '" + symbolString(target->text) + "'");
+            }
+            Value value = genExpr(kid(n, 1));
+            Address a = genAddress(target);
+            int op = assignOperator(n->op);
+            if (op) {
+                int old = tempAlloc(n);
+                emit(a.byte ? OP_LBU : OP_LW, old, a.base, -1, a.offset);
+                if (op == '+' && isString(a.type)) {
+                    Value left = {old, a.type};
+                    int right = genToString(value, kid(n, 1));
+                    value.reg = genRuntimeCall("__kik_concat", {left.reg, right}, n);
+                    value.type = a.type;
+                } else {
+                    if (!isScalar(a.type) || !isScalar(value.type)) errorAtNode(n, "compound assignment needs numbers");
+                    genArithmetic(op, old, value.reg);
+                    tempFree(value.reg);
+                    value.reg = old;
+                }
+            }
+            checkAssignable(n, a.type, value.type);
+            genStore(a, value.reg);
+            addressFree(a);
+            genStepUpdates(n);
+            value.type = a.type;
+            return value;
+        }
+        case N_INCDEC: {
+            const Node* target = kid(n, 0);
+            if (target->kind == N_NAME) {
+                const Variable* var = lookupVariable(target->text);
+                if (var && var->constant) errorAtNode(n, "cannot modify constant '" + symbolString(target->text) + "'");
+            }
+            Address a = genAddress(target);
+            if (!isScalar(a.type)) errorAtNode(n, "'++' and '--' need a number");
+            v.reg = tempAlloc(n);
+            int updated = tempAlloc(n);
+            emit(a.byte ? OP_LBU : OP_LW, v.reg, a.base, -1, a.offset);
+            emit(OP_ADDIU, updated, v.reg, -1, n->op == '+' ? 1 : -1);
+            genStore(a, updated);
+            if (!n->postfix) emitMove(v.reg, updated);
+            tempFree(updated);
+            addressFree(a);
+            genStepUpdates(n);
+            v.type = a.type;
+            return v;
+        }
+        case N_CALL:
+            return genCall(n);
+        case N_METHOD: {
+            if (n->text != intern("length") || n->count != 1) {
+                errorAtNode(n, "unknown method '" + symbolString(n->text) + "'");
+            }
+            Value s = genExpr(kid(n, 0));
+            if (!isString(s.type)) errorAtNode(n, "length() needs a str, not " + typeName(s.type));
+            v.reg = genRuntimeCall("__kik_strlen", {s.reg}, n);
+            return v;
+        }
+        case N_INIT_LIST:
+            errorAtNode(n, "an initializer list can only initialize an array");
+        default:
+            errorAtNode(n, "expected an expression");
+    }
+}
+
+/**
+ * @brief Compiles an expression used as a condition.
+ */
+int genCondition(const Node* n) {
+    Value v = genExpr(n);
+    if (v.reg < 0 || !isScalar(v.type)) errorAtNode(n, "condition must be a number or bool");
+    return v.reg;
+}
+
+/**
+ * @brief Jumps to a label when a condition has the given truth value.
+ * A constant condition needs no test: it always jumps or never does.
+ */
+void genJumpIf(const Node* n, bool when, const std::string& label) {
+    int32_t value;
+    Type type;
+    if (foldConstant(n, value, type) && isScalar(type)) {
+        if ((value != 0) == when) emit(OP_J, -1, -1, -1, 0, label);
+        return;
+    }
+    int c = genCondition(n);
+    emit(when ? OP_BNE : OP_BEQ, -1, c, R_ZERO, 0, label);
+    tempFree(c);
+}
+
+void genStatement(const Node* n);
+
+/**
+ * @brief Compiles a block in its own scope.
+ */
+void genBlock(const Node* n) {
+    G.scopes.push_back(std::unordered_map<Symbol, Variable>());
+    for (NodeId k = n->first; k; k = at(k)->next) genStatement(at(k));
+    G.scopes.pop_back();
+}
+
+/**
+ * @brief Resolves the type of a declared variable.
+ * A constant declared without a type takes the type of its value.
+ */
+Type declaredType(const Node* decl, const Node* var) {
+    Type t = var->type;
+    if (decl->type.base == TY_VOID && decl->constant) {
+        const Node* init = !var->count ? nullptr : kid(var, 0);
+        if (!init) errorAtNode(var, "constant '" + symbolString(var->text) + "' needs a value");
+        switch (init->kind) {
+            case N_STRING: t.base = TY_STR; break;
+            case N_CHAR: t.base = TY_CHAR; break;
+            case N_BOOL: t.base = TY_BOOL; break;
+            case N_FLOAT: t.base = TY_FLOAT; break;
+            default: t.base = TY_INT; break;
+        }
+    } else if (t.base == TY_VOID) {
+        errorAtNode(var, "variable '" + symbolString(var->text) + "' cannot be void");
+    }
+    return resolveType(var, t, decl->text);
+}
+
+/**
+ * @brief Compiles a local declaration: reserves frame space and stores
+ * the initial values.
+ */
+void genLocalDecl(const Node* decl) {
+    for (NodeId k = decl->first; k; k = at(k)->next) {
+        const Node* var = at(k);
+        Variable local = {declaredType(decl, var), false, decl->constant, 0, "", false, 0};
+        if (G.scopes.back().count(var->text)) errorAtNode(var, "'" + symbolString(var->text) + "' is already declared in this scope");
+        local.offset = frameAlloc(local.type);
+        if (decl->constant && !var->count) errorAtNode(var, "constant '" + symbolString(var->text) + "' needs a value");
+        if (!!var->count) {
+            const Node* init = kid(var, 0);
+            if (local.type.array >= 0) {
+                // Arrays take an initializer list, or a string for char arrays
+                bool bytes = local.type.base == TY_CHAR;
+                std::vector<const Node*> items;
+                std::string text;
+                if (init->kind == N_STRING && bytes) text = symbolString(init->text) + '\0';
+                else if (init->kind == N_INIT_LIST) for (NodeId k = init->first; k; k = at(k)->next) items.push_back(at(k));
+                else errorAtNode(init, "arrays are initialized with a list");
+                size_t count = std::max(items.size(), text.size());
+                if ((int)count > local.type.array) errorAtNode(init, "too many initializers for '" + symbolString(var->text) + "'");
+                for (size_t i = 0; i < count; i++) {
+                    Value v;
+                    if (!text.empty()) {
+                        v.reg = tempAlloc(init);
+                        emitLi(v.reg, (unsigned char)text[i]);
+                        v.type = Type{TY_CHAR, -1, false, false};
+                    } else {
+                        v = genExpr(items[i]);
+                    }
+                    Type elem = local.type;
+                    elem.array = -1;
+                    checkAssignable(init, elem, v.type);
+                    emit(bytes ? OP_SB : OP_SW, v.reg, R_FP, -1, local.offset + (int)(bytes ? i : 4 * i));
+                    tempFree(v.reg);
+                }
+            } else {
+                Value v = genExpr(init);
+                if (v.reg < 0) errorAtNode(init, "void value used in an initializer");
+                checkAssignable(init, local.type, v.type);
+                emit(OP_SW, v.reg, R_FP, -1, local.offset);
+                tempFree(v.reg);
+                // Uses of a constant with a known value compile to immediates
+                Type t;
+                local.known = decl->constant && isScalar(local.type) && foldConstant(init, local.value, t);
+            }
+        }
+        G.scopes.back()[var->text] = local;
+    }
+}
+
+/**
+ * @brief Compiles cout << ... and cin >> ... statements.
+ */
+void genStreamStatement(const Node* n) {
+    for (NodeId k = n->first; k; k = at(k)->next) {
+        const Node* item = at(k);
+        if (n->kind == N_COUT) {
+            if (item->kind == N_ENDL) {
+                emitLi(R_A0, '\n');
+                emitLi(R_V0, 11);
+                emit(OP_SYSCALL, -1, -1, -1);
+                continue;
+            }
+            Value v = genExpr(item);
+            if (v.reg < 0) errorAtNode(item, "cannot print a void value");
+            if (isString(v.type)) emitLi(R_V0, 4);
+            else if (v.type.base == TY_CHAR && isScalar(v.type)) emitLi(R_V0, 11);
+            else if (isScalar(v.type)) emitLi(R_V0, 1);
+            else errorAtNode(item, "cannot print a value of type " + typeName(v.type));
+            emitMove(R_A0, v.reg);
+            emit(OP_SYSCALL, -1, -1, -1);
+            tempFree(v.reg);
+            continue;
+        }
+        Address a = genAddress(item);
+        int value;
+        if (isString(a.type)) {
+            value = genRuntimeCall("__kik_input", {}, item);
+        } else if (isScalar(a.type)) {
+            emitLi(R_V0, a.type.base == TY_CHAR ? 12 : 5);
+            emit(OP_SYSCALL, -1, -1, -1);
+            value = tempAlloc(item);
+            emitMove(value, R_V0);
+        } else {
+            errorAtNode(item, "cannot read a value of type " + typeName(a.type));
+        }
+        genStore(a, value);
+        tempFree(value);
+        addressFree(a);
+    }
+}
+
+// What the repeated part of a loop may change
+struct LoopEffects {
+    std::unordered_map<Symbol, bool> written; // Names assigned or declared; true if only ever moved by constant steps
+    bool calls;             // Calls a KIK function, which may change globals
+    bool stores;            // Stores through an index, or reads with cin
+};
+
+// What enterLoop set up, to be dropped again when the loop is done
+struct LoopInfo {
+    std::vector<const Node*> hoisted, reduced;
+    std::vector<int> stepped; // Index offsets, once per pointer added to G.steps
+};
+
+/**
+ * @brief Collects what a statement or expression inside a loop may change.
+ */
+void scanLoop(const Node* n, LoopEffects& e) {
+    switch (n->kind) {
+        case N_ASSIGN: case N_INCDEC: {
+            const Node* target = kid(n, 0);
+            if (target->kind != N_NAME) {
+                e.stores = true;
+                break;
+            }
+            Symbol name;
+            int32_t step;
+            bool steps = stepAmount(n, name, step);
+            auto it = e.written.insert(std::make_pair(target->text, true)).first;
+            it->second = it->second && steps;
+            break;
+        }
+        case N_DECL:
+            for (NodeId k = n->first; k; k = at(k)->next) e.written[at(k)->text] = false;
+            break;
+        case N_CIN:
+            e.stores = true;
+            for (NodeId k = n->first; k; k = at(k)->next) {
+                if (at(k)->kind == N_NAME) e.written[at(k)->text] = false;
+            }
+            break;
+        case N_CALL: {
+            auto it = U.symbols.functions.find(n->text);
+            if (it == U.symbols.functions.end()) {
+                e.calls = true;
+                break;
+            }
+            const Function& fn = *it->second;
+            if (fn.defined || (fn.name != intern("output") && fn.name != intern("input"))) e.calls = true;
+            // Arguments passed by reference may be changed
+            size_t i = 0;
+            for (NodeId k = n->first; k && i < fn.params.size(); k = at(k)->next, i++) {
+                if (!fn.params[i].type.ref) continue;
+                if (at(k)->kind == N_NAME) e.written[at(k)->text] = false;
+                else e.stores = true;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    for (NodeId k = n->first; k; k = at(k)->next) scanLoop(at(k), e);
+}
+
+/**
+ * @brief Finds the variable a loop-invariant name refers to.
+ * @return Null if the loop may change it, or it is not a plain local or
+ * global variable.
+ */
+const Variable* invariantVariable(const Node* n, const LoopEffects& e) {
+    if (n->kind != N_NAME || e.written.count(n->text)) return nullptr;
+    const Variable* var = lookupVariable(n->text);
+    if (!var || var->type.ref || (var->global && e.calls)) return nullptr;
+    return var;
+}
+
+/**
+ * @brief Checks that a scalar expression has the same value on every
+ * iteration of a loop and can be evaluated early without side effects.
+ * @param test The expression is, or is part of, a test evaluated before
+ * every iteration including the first; only such expressions may call
+ * length(), which reads memory.
+ */
+bool isInvariant(const Node* n, const LoopEffects& e, bool test) {
+    int32_t value;
+    Type type;
+    switch (n->kind) {
+        case N_INT: case N_CHAR: case N_BOOL:
+            return true;
+        case N_NAME: {
+            if (!lookupVariable(n->text)) return U.symbols.enum_values.count(n->text) > 0;
+            const Variable* var = invariantVariable(n, e);
+            return var && isScalar(var->type);
+        }
+        case N_UNARY:
+            return (n->op == '-' || n->op == '!' || n->op == '+') && isInvariant(kid(n, 0), e, test);
+        case N_CAST:
+            return isScalar(n->type) && isInvariant(kid(n, 0), e, test);
+        case N_BINARY:
+            // Division by a variable could trap on an iteration that never runs
+            if ((n->op == '/' || n->op == '%') && !(foldConstant(kid(n, 1), value, type) && value)) return false;
+            return isInvariant(kid(n, 0), e, test) && isInvariant(kid(n, 1), e, test && n->op != T_AND && n->op != T_OR);
+        case N_METHOD: {
+            if (!test || e.calls || e.stores || n->text != intern("length") || n->count != 1) return false;
+            const Variable* var = invariantVariable(kid(n, 0), e);
+            return var && isString(var->type);
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Collects the largest invariant subexpressions worth computing
+ * once before a loop: neither names nor constants, and not already
+ * handled by an enclosing loop.
+ * @param test As for isInvariant.
+ */
+void findInvariants(const Node* n, const LoopEffects& e, bool test, std::vector<const Node*>& found) {
+    if (G.hoisted.count(n) || G.reduced.count(n)) return;
+    int32_t value;
+    Type type;
+    bool simple = n->kind == N_NAME || n->kind == N_INT || n->kind == N_CHAR || n->kind == N_BOOL;
+    if (!simple && isInvariant(n, e, test) && !foldConstant(n, value, type)) {
+        found.push_back(n);
+        return;
+    }
+    bool short_circuit = n->kind == N_BINARY && (n->op == T_AND || n->op == T_OR);
+    for (NodeId k = n->first; k; k = at(k)->next) {
+        findInvariants(at(k), e, test && (!short_circuit || k == n->first), found);
+    }
+}
+
+/**
+ * @brief Recognizes an index of the form i, i + c, c + i or i - c, where
+ * the loop moves i only by constant steps, if at all.
+ * @param index Receives the i node.
+ * @param offset Receives c.
+ */
+bool inductionIndex(const Node* n, const LoopEffects& e, const Node*& index, int32_t& offset) {
+    int32_t value;
+    Type type;
+    index = n;
+    offset = 0;
+    if (n->kind == N_BINARY && (n->op == '+' || n->op == '-')) {
+        if (foldConstant(kid(n, 1), value, type)) {
+            index = kid(n, 0);
+            offset = n->op == '+' ? value : -value;
+        } else if (n->op == '+' && foldConstant(kid(n, 0), value, type)) {
+            index = kid(n, 1);
+            offset = value;
+        } else {
+            return false;
+        }
+        if (!isScalar(type)) return false;
+    }
+    if (index->kind != N_NAME) return false;
+    const Variable* var = lookupVariable(index->text);
+    if (!var || var->global || var->type.ref || !isScalar(var->type) || var->known) return false;
+    auto it = e.written.find(index->text);
+    return it == e.written.end() || it->second;
+}
+
+/**
+ * @brief Collects the array accesses in a loop whose address can follow
+ * the index: an array, pointer or str the loop does not change, indexed
+ * as inductionIndex describes.
+ */
+void findReductions(const Node* n, const LoopEffects& e, std::vector<const Node*>& found) {
+    if (G.reduced.count(n)) return;
+    if (n->kind == N_INDEX) {
+        const Node* base = kid(n, 0);
+        const Node* index;
+        int32_t offset;
+        // An array's address is fixed; a pointer or str must be a local
+        // the loop does not assign
+        const Variable* var = base->kind == N_NAME && !e.written.count(base->text) ? lookupVariable(base->text) : nullptr;
+        bool array = var && var->type.array >= 0;
+        bool pointer = var && !var->global && !var->type.ref && (var->type.pointer || isString(var->type));
+        if ((array || pointer) && inductionIndex(kid(n, 1), e, index, offset) && fitsImmediate(4 * (int64_t)offset)) {
+            found.push_back(n);
+            return;
+        }
+    }
+    for (NodeId k = n->first; k; k = at(k)->next) findReductions(at(k), e, found);
+}
+
+/**
+ * @brief Compiles the code that runs once before a loop: invariant
+ * expressions into hidden locals, and for each array and index used
+ * together, a pointer to the indexed element.
+ * @param test The test evaluated before every iteration, or null for a
+ * do-while, whose test follows the body.
+ * @param parts Everything the loop repeats: test, body and step.
+ * @return What to drop with leaveLoop once the loop is compiled.
+ */
+LoopInfo enterLoop(const Node* test, const std::vector<const Node*>& parts) {
+    LoopInfo loop;
+    LoopEffects e = {std::unordered_map<Symbol, bool>(), false, false};
+    for (const Node* part : parts) scanLoop(part, e);
+
+    std::vector<const Node*> found;
+    for (const Node* part : parts) findReductions(part, e, found);
+    std::map<std::pair<Symbol, Symbol>, ReducedAccess> pointers;
+    for (const Node* n : found) {
+        const Node* base = kid(n, 0);
+        const Node* index;
+        int32_t offset;
+        inductionIndex(kid(n, 1), e, index, offset);
+        auto key = std::make_pair(base->text, index->text);
+        auto it = pointers.find(key);
+        if (it == pointers.end()) {
+            // One pointer per array and index, at the element the index selects
+            Address a = genIndexAddress(n, base, index);
+            ReducedAccess first = {frameAlloc(Type{TY_INT, -1, false, false}), 0, a.type};
+            int reg = addressReg(a, n);
+            emit(OP_SW, reg, R_FP, -1, first.pointer);
+            tempFree(reg);
+            int follows = lookupVariable(index->text)->offset;
+            G.steps[follows].push_back(std::make_pair(first.pointer, a.byte ? 1 : 4));
+            loop.stepped.push_back(follows);
+            it = pointers.insert(std::make_pair(key, first)).first;
+        }
+        ReducedAccess access = it->second;
+        access.offset = offset * (access.type.base == TY_CHAR ? 1 : 4);
+        G.reduced[n] = access;
+        loop.reduced.push_back(n);
+    }
+
+    found.clear();
+    for (const Node* part : parts) findInvariants(part, e, part == test, found);
+    for (const Node* n : found) {
+        Value v = genExpr(n);
+        Variable hidden = {v.type, false, false, frameAlloc(Type{TY_INT, -1, false, false}), "", false, 0};
+        emit(OP_SW, v.reg, R_FP, -1, hidden.offset);
+        tempFree(v.reg);
+        G.hoisted[n] = hidden;
+        loop.hoisted.push_back(n);
+    }
+    return loop;
+}
+
+/**
+ * @brief Drops what enterLoop set up, once the loop is compiled.
+ */
+void leaveLoop(const LoopInfo& loop) {
+    for (const Node* n : loop.hoisted) G.hoisted.erase(n);
+    for (const Node* n : loop.reduced) G.reduced.erase(n);
+    for (int offset : loop.stepped) {
+        auto it = G.steps.find(offset);
+        it->second.pop_back();
+        if (it->second.empty()) G.steps.erase(it);
+    }
+}
+
+/**
+ * @brief Compiles one statement.
+ */
+void genStatement(const Node* n) {
+    G.line = G.file->tokens[n->tok].line;
+    switch (n->kind) {
+        case N_BLOCK:
+            genBlock(n);
+            break;
+        case N_DECL:
+            genLocalDecl(n);
+            break;
+        case N_EXPR: {
+            Value v = genExpr(kid(n, 0));
+            if (v.reg >= 0) tempFree(v.reg);
+            break;
+        }
+        case N_IF: {
+            int32_t value;
+            Type type;
+            if (foldConstant(at(n->first), value, type) && isScalar(type)) {
+                // Both branches are checked, but only the taken one is kept
+                uint32_t branch = 1;
+                for (NodeId k = at(n->first)->next; k; k = at(k)->next, branch++) {
+                    size_t code = G.code.size(), data = U.data.size();
+                    genStatement(at(k));
+                    if (branch != (value ? 1u : 2u)) {
+                        G.code.resize(code);
+                        U.data.resize(data);
+                    }
+                }
+                break;
+            }
+            std::string other = newLabel(), done = newLabel();
+            genJumpIf(kid(n, 0), false, other);
+            genStatement(kid(n, 1));
+            if (n->count > 2) emit(OP_J, -1, -1, -1, 0, done);
+            emitLabel(other);
+            if (n->count > 2) {
+                genStatement(kid(n, 2));
+                emitLabel(done);
+            }
+            break;
+        }
+        case N_WHILE: {
+            std::string top = newLabel(), done = newLabel();
+            LoopInfo loop = enterLoop(kid(n, 0), {kid(n, 0), kid(n, 1)});
+            emitLabel(top);
+            genJumpIf(kid(n, 0), false, done);
+            G.break_labels.push_back(done);
+            G.continue_labels.push_back(top);
+            genStatement(kid(n, 1));
+            G.break_labels.pop_back();
+            G.continue_labels.pop_back();
+            emit(OP_J, -1, -1, -1, 0, top);
+            emitLabel(done);
+            leaveLoop(loop);
+            break;
+        }
+        case N_DO: {
+            std::string top = newLabel(), next = newLabel(), done = newLabel();
+            LoopInfo loop = enterLoop(nullptr, {kid(n, 0), kid(n, 1)});
+            emitLabel(top);
+            G.break_labels.push_back(done);
+            G.continue_labels.push_back(next);
+            genStatement(kid(n, 0));
+            G.break_labels.pop_back();
+            G.continue_labels.pop_back();
+            emitLabel(next);
+            genJumpIf(kid(n, 1), true, top);
+            emitLabel(done);
+            leaveLoop(loop);
+            break;
+        }
+        case N_FOR: {
+            std::string top = newLabel(), next = newLabel(), done = newLabel();
+            G.scopes.push_back(std::unordered_map<Symbol, Variable>());
+            genStatement(kid(n, 0));
+            LoopInfo loop = enterLoop(kid(n, 1), {kid(n, 1), kid(n, 2), kid(n, 3)});
+            emitLabel(top);
+            genJumpIf(kid(n, 1), false, done);
+            G.break_labels.push_back(done);
+            G.continue_labels.push_back(next);
+            genStatement(kid(n, 3));
+            G.break_labels.pop_back();
+            G.continue_labels.pop_back();
+            emitLabel(next);
+            G.line = G.file->tokens[kid(n, 2)->tok].line;
+            Value step = genExpr(kid(n, 2));
+            if (step.reg >= 0) tempFree(step.reg);
+            emit(OP_J, -1, -1, -1, 0, top);
+            emitLabel(done);
+            leaveLoop(loop);
+            G.scopes.pop_back();
+            break;
+        }
+        case N_SWITCH: {
+            std::string done = newLabel();
+            Value v = genExpr(kid(n, 0));
+            if (!isScalar(v.type)) errorAtNode(n, "switch needs a number, not " + typeName(v.type));
+            std::vector<std::string> labels;
+            std::string fallback = done;
+            NodeId cases = at(n->first)->next;
+            for (NodeId k = cases; k; k = at(k)->next) {
+                const Node* c = at(k);
+                labels.push_back(newLabel());
+                if (c->count == 1) {
+                    fallback = labels.back();
+                    continue;
+                }
+                Value value = genExpr(kid(c, 0));
+                emit(OP_BEQ, -1, v.reg, value.reg, 0, labels.back());
+                tempFree(value.reg);
+            }
+            tempFree(v.reg);
+            emit(OP_J, -1, -1, -1, 0, fallback);
+            G.break_labels.push_back(done);
+            size_t i = 0;
+            for (NodeId k = cases; k; k = at(k)->next) {
+                emitLabel(labels[i++]);
+                genStatement(at(at(k)->last));
+            }
+            G.break_labels.pop_back();
+            emitLabel(done);
+            break;
+        }
+        case N_RETURN: {
+            const Type& ret = G.fn->ret;
+            if (!n->count) {
+                if (ret.base != TY_VOID) errorAtNode(n, "'" + symbolString(G.fn->name) + "' must return a value");
+            } else {
+                if (ret.base == TY_VOID) errorAtNode(n, "void function '" + symbolString(G.fn->name) + "' cannot return a value");
+                Value v = genExpr(kid(n, 0));
+                checkAssignable(n, ret, v.type);
+                emitMove(R_V0, v.reg);
+                tempFree(v.reg);
+            }
+            emit(OP_J, -1, -1, -1, 0, G.return_label);
+            break;
+        }
+        case N_BREAK:
+            if (G.break_labels.empty()) errorAtNode(n, "'break' outside a loop or switch");
+            emit(OP_J, -1, -1, -1, 0, G.break_labels.back());
+            break;
+        case N_CONTINUE:
+            if (G.continue_labels.empty()) errorAtNode(n, "'continue' outside a loop");
+            emit(OP_J, -1, -1, -1, 0, G.continue_labels.back());
+            break;
+        case N_COUT: case N_CIN:
+            genStreamStatement(n);
+            break;
+        case N_UNSUPPORTED:
+            errorAtNode(n, symbolString(n->text) + " are not supported by the MIPS back end");
+        default:
+            errorAtNode(n, "expected a statement");
+    }
+}
+
+void allocateRegisters(size_t frame_at);
+void peephole(std::vector<Instr>& code);
+void fillDelaySlots(std::vector<Instr>& code);
+
+/**
+ * @brief Compiles one function into U.text.
+ * Frame layout: $fp points at the saved $fp, with $ra above it and the
+ * caller's 5th and later arguments above that; locals and the homes of
+ * the first four parameters sit below $fp, followed by the saved $s
+ * registers. Variables are then moved into registers where possible.
+ */
+void genFunction(Function& fn) {
+    G = FunctionGen();
+    G.fn = &fn;
+    G.file = fn.file;
+    G.line = fn.file->tokens[fn.tok].line;
+    G.return_label = "f_" + symbolString(fn.name) + "_ret";
+    G.scopes.push_back(std::unordered_map<Symbol, Variable>());
+
+    emitLabel("f_" + symbolString(fn.name));
+    emit(OP_ADDIU, R_SP, R_SP, -1, -8);
+    emit(OP_SW, R_RA, R_SP, -1, 4);
+    emit(OP_SW, R_FP, R_SP, -1, 0);
+    emitMove(R_FP, R_SP);
+    size_t frame_at = G.code.size();
+    emit(OP_ADDIU, R_SP, R_SP, -1, 0); // Patched once the frame size is known
+    for (size_t i = 0; i < fn.params.size(); i++) {
+        Variable param = {fn.params[i].type, false, false, 0, "", false, 0};
+        checkSupported(at(G.fn->body), param.type);
+        if (G.scopes[0].count(fn.params[i].name)) {
+            errorAt(*fn.file, fn.tok, "duplicate parameter '" + symbolString(fn.params[i].name) + "'");
+        }
+        if (i < 4) {
+            param.offset = frameAlloc(Type{TY_INT, -1, false, false});
+            emit(OP_SW, R_A0 + i, R_FP, -1, param.offset);
+        } else {
+            param.offset = 8 + 4 * (i - 4);
+            G.words.push_back(param.offset);
+        }
+        G.scopes[0][fn.params[i].name] = param;
+    }
+    genBlock(at(fn.body));
+    emitLabel(G.return_label);
+    emitMove(R_SP, R_FP);
+    emit(OP_LW, R_FP, R_SP, -1, 0);
+    emit(OP_LW, R_RA, R_SP, -1, 4);
+    emit(OP_ADDIU, R_SP, R_SP, -1, 8);
+    emit(OP_JR, R_RA, -1, -1);
+    allocateRegisters(frame_at);
+    G.code[frame_at].imm = -G.frame;
+    peephole(G.code);
+    if (O.delay_slots) fillDelaySlots(G.code);
+    U.text.insert(U.text.end(), G.code.begin(), G.code.end());
+}
+
+/**
+ * @brief Evaluates a global initializer, which must be a string literal
+ * or a constant expression.
+ * @return The .data directive operand.
+ */
+std::string globalInitializer(const Node* init, const Type& t, const SourceFile& F) {
+    int32_t value;
+    Type folded;
+    if (isScalar(t) && foldConstant(init, value, folded) && isScalar(folded)) return std::to_string(value);
+    if (isString(t) && init->kind == N_STRING) return stringLabel(symbolString(init->text));
+    errorAt(F, init->tok, "global initializers must be constant expressions of the variable's type");
+}
+
+/**
+ * @brief Emits the .data entry of one global declaration.
+ */
+void genGlobal(const Node* decl, const SourceFile& F) {
+    G.file = &F;
+    for (NodeId k = decl->first; k; k = at(k)->next) {
+        const Node* var = at(k);
+        Variable global = {declaredType(decl, var), true, decl->constant, 0, "g_" + symbolString(var->text), false, 0};
+        if (U.symbols.globals.count(var->text) || U.symbols.functions.count(var->text)) {
+            errorAt(F, var->tok, "'" + symbolString(var->text) + "' is already declared");
+        }
+        if (decl->constant && !var->count) errorAt(F, var->tok, "constant '" + symbolString(var->text) + "' needs a value");
+        std::string line = global.label + ":\t";
+        const Node* init = !var->count ? nullptr : kid(var, 0);
+        if (global.type.array >= 0) {
+            Type elem = global.type;
+            elem.array = -1;
+            bool bytes = global.type.base == TY_CHAR;
+            std::vector<std::string> values;
+            if (init && init->kind == N_INIT_LIST) {
+                for (NodeId k = init->first; k; k = at(k)->next) values.push_back(globalInitializer(at(k), elem, F));
+            } else if (init) {
+                errorAt(F, init->tok, "arrays are initialized with a list");
+            }
+            if ((int)values.size() > global.type.array) errorAt(F, init->tok, "too many initializers for '" + symbolString(var->text) + "'");
+            int rest = global.type.array - values.size();
+            if (!values.empty()) {
+                line += bytes ? ".byte " : ".word ";
+                for (size_t i = 0; i < values.size(); i++) line += (i ? ", " : "") + values[i];
+                if (rest) line += "\n\t.space " + std::to_string(rest * (bytes ? 1 : 4));
+            } else {
+                line += ".space " + std::to_string(std::max(global.type.array * (bytes ? 1 : 4), 1));
+            }
+        } else {
+            std::string value = init ? globalInitializer(init, global.type, F) : std::string("0");
+            line += ".word " + value;
+            if (decl->constant && isScalar(global.type)) {
+                // Folded to a number by globalInitializer
+                global.known = true;
+                global.value = atoi(value.c_str());
+            }
+        }
+        U.data.push_back("\t.align 2");
+        U.data.push_back(line);
+        U.symbols.globals[var->text] = global;
+    }
+}
+
+/**
+ * @brief Returns where a function was declared, for messages.
+ */
+std::string functionWhere(const Function* fn) {
+    return fn->file ? tokenWhere(*fn->file, fn->tok) : fn->where;
+}
+
+/**
+ * @brief Adds a function to the module's symbols. A definition replaces
+ * a prototype; two definitions are an error.
+ */
+void declareFunction(Function* fn) {
+    Function*& slot = U.symbols.functions[fn->name];
+    if (slot && slot->defined && fn->defined) {
+        throw CompileError{functionWhere(fn), "redefinition of '" + symbolString(fn->name) + "' (first defined at " +
+                                                  functionWhere(slot) + ")"};
+    }
+    if (slot && slot->params.size() != fn->params.size()) {
+        throw CompileError{functionWhere(fn), "'" + symbolString(fn->name) + "' does not match its declaration at " +
+                                                  functionWhere(slot)};
+    }
+    if (!slot || fn->defined) slot = fn;
+}
+
+/**
+ * @brief Resolves the user types in a function's signature, which the
+ * parser could not do before the file's enums and handle types were known.
+ */
+void resolveSignature(SourceFile& F, Function& fn) {
+    if (fn.ret.base == TY_CLASS) {
+        if (!isWordType(fn.ret_user_type)) {
+            errorAt(F, fn.tok, "functions returning '" + symbolString(fn.ret_user_type) + "' are not supported by the MIPS back end");
+        }
+        fn.ret.base = TY_INT;
+    }
+    for (Param& param : fn.params) {
+        if (param.type.base != TY_CLASS) continue;
+        if (!isWordType(param.user_type)) {
+            errorAt(F, param.tok, "parameters of type '" + symbolString(param.user_type) + "' are not supported by the MIPS back end");
+        }
+        param.type.base = TY_INT;
+    }
+}
+
+/**
+ * @brief Collects the functions, enums and types of a file, so functions
+ * can call each other regardless of order.
+ */
+void collectSymbols(SourceFile& F) {
+    for (const auto& e : F.enum_values) U.symbols.enum_values[e.first] = e.second;
+    for (Symbol t : F.enum_types) U.symbols.enum_types[t] = true;
+    for (Symbol t : F.opaque_types) U.symbols.opaque_types[t] = true;
+    for (Symbol t : F.handle_types) U.symbols.handle_types[t] = true;
+    for (const auto& fn : F.functions) {
+        resolveSignature(F, *fn);
+        declareFunction(fn.get());
+        if (fn->name == intern("kik") && fn->defined && (fn->ret.base != TY_INT || !fn->params.empty())) {
+            errorAt(F, fn->tok, "the main function must be 'int kik()'");
+        }
+    }
+}
+
+// --- Register Allocation ---
+
+// Callee-saved registers $s0-$s7; a function saves the ones it uses
+static const int SAVED_REGS[] = {16, 17, 18, 19, 20, 21, 22, 23};
+static const int SAVED_COUNT = 8;
+
+// A basic block of the function being allocated
+struct Block {
+    size_t start, end;                  // Instructions [start, end)
+    std::vector<size_t> succ;
+    std::vector<uint64_t> use, def, in, out; // Variables, as bitsets
+    unsigned temp_use, temp_def, temp_in, temp_out; // Temporaries, as masks over TEMP_REGS
+};
+
+// The live range of a variable, from the first to the last point where
+// it is live
+struct Interval {
+    int var;                            // Index into the candidate variables
+    size_t start, end;
+    double weight;                      // Accesses, each counting 10^(loop depth)
+    int reg;                            // -1 if it stays in its frame slot
+};
+
+/**
+ * @brief Returns the TEMP_REGS mask bit of a register, or 0.
+ */
+inline unsigned tempBit(int reg) {
+    for (int i = 0; i < TEMP_COUNT; i++) {
+        if (TEMP_REGS[i] == reg) return 1u << i;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the registers an instruction names as operands: up to two
+ * it reads and one it writes, -1 where there is none. The implicit
+ * operands of calls and system calls are not included.
+ */
+void regEffects(const Instr& in, int reads[2], int& write) {
+    reads[0] = reads[1] = write = -1;
+    switch (in.op) {
+        case OP_LABEL: case OP_J: case OP_JAL: case OP_SYSCALL: case OP_NOP:
+            break;
+        case OP_DIV: case OP_TEQ: case OP_SW: case OP_SB: case OP_JR:
+            reads[0] = in.rd;
+            reads[1] = in.rs;
+            break;
+        case OP_BEQ: case OP_BNE:
+            reads[0] = in.rs;
+            reads[1] = in.rt;
+            break;
+        default:
+            // Everything else writes rd from rs and rt
+            reads[0] = in.rs;
+            reads[1] = in.rt;
+            write = in.rd;
+            break;
+    }
+}
+
+/**
+ * @brief Finds the temporaries an instruction reads and writes. Calls
+ * write all of them, since the callee may.
+ */
+void tempEffects(const Instr& in, unsigned& use, unsigned& def) {
+    int reads[2], write;
+    regEffects(in, reads, write);
+    use = tempBit(reads[0]) | tempBit(reads[1]);
+    def = in.op == OP_JAL ? (1u << TEMP_COUNT) - 1 : tempBit(write);
+}
+
+/**
+ * @brief Splits a function into basic blocks and links each to its
+ * successors.
+ * @param block_of Receives the block of each instruction.
+ */
+void splitBlocks(const std::vector<Instr>& code, std::vector<Block>& blocks, std::vector<size_t>& block_of) {
+    size_t n = code.size();
+    std::unordered_map<std::string, size_t> label_at;
+    block_of.assign(n, 0);
+    blocks.clear();
+    for (size_t i = 0; i < n; i++) {
+        Op prev = i ? code[i - 1].op : OP_J;
+        if (code[i].op == OP_LABEL || prev == OP_BEQ || prev == OP_BNE || prev == OP_J || prev == OP_JR) {
+            if (!blocks.empty()) blocks.back().end = i;
+            blocks.push_back(Block());
+            blocks.back().start = i;
+        }
+        if (code[i].op == OP_LABEL) label_at[code[i].label] = blocks.size() - 1;
+        block_of[i] = blocks.size() - 1;
+    }
+    if (blocks.empty()) return;
+    blocks.back().end = n;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        const Instr& last = code[blocks[b].end - 1];
+        if (last.op != OP_J && last.op != OP_JR && b + 1 < blocks.size()) blocks[b].succ.push_back(b + 1);
+        auto label = label_at.find(last.label);
+        if ((last.op == OP_J || last.op == OP_BEQ || last.op == OP_BNE) && label != label_at.end()) {
+            blocks[b].succ.push_back(label->second);
+        }
+    }
+}
+
+/**
+ * @brief Computes which temporaries are live after each instruction.
+ * @return A mask over TEMP_REGS per instruction.
+ */
+std::vector<unsigned> tempLiveness(const std::vector<Instr>& code) {
+    std::vector<Block> blocks;
+    std::vector<size_t> block_of;
+    splitBlocks(code, blocks, block_of);
+    for (auto& B : blocks) {
+        B.temp_use = B.temp_def = B.temp_in = B.temp_out = 0;
+        for (size_t i = B.start; i < B.end; i++) {
+            unsigned use, def;
+            tempEffects(code[i], use, def);
+            B.temp_use |= use & ~B.temp_def;
+            B.temp_def |= def;
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            Block& B = blocks[b];
+            for (size_t s : B.succ) B.temp_out |= blocks[s].temp_in;
+            unsigned temp_in = B.temp_use | (B.temp_out & ~B.temp_def);
+            if (temp_in != B.temp_in) B.temp_in = temp_in, changed = true;
+        }
+    }
+    std::vector<unsigned> live_after(code.size());
+    for (const auto& B : blocks) {
+        unsigned live = B.temp_out;
+        for (size_t i = B.end; i-- > B.start;) {
+            live_after[i] = live;
+            unsigned use, def;
+            tempEffects(code[i], use, def);
+            live = (live & ~def) | use;
+        }
+    }
+    return live_after;
+}
+
+/**
+ * @brief Moves the function's word-sized variables into registers.
+ *
+ * A variable qualifies if its frame slot is only loaded and stored, never
+ * addressed (arrays, `&` arguments). Liveness over the basic blocks gives
+ * each variable an interval, and a linear scan over the intervals hands
+ * out registers: a temporary if none of its uses by expressions, and no
+ * call, fall within the interval; else one of $s0-$s7. When none is free
+ * the variable whose accesses weigh least, counting loop nesting, stays
+ * in memory, so loop counters keep their registers.
+ * @param frame_at Index of the instruction that allocates the frame;
+ * saves of $s registers and loads of stack arguments go after it.
+ */
+void allocateRegisters(size_t frame_at) {
+    std::vector<Instr>& code = G.code;
+    size_t n = code.size();
+    std::unordered_map<int, int> word_at;
+    for (size_t i = 0; i < G.words.size(); i++) word_at[G.words[i]] = i;
+    std::vector<int> access(n, -1);     // Word loaded or stored by each instruction
+    std::vector<bool> addressed(G.words.size(), false), accessed(G.words.size(), false);
+    for (size_t i = 0; i < n; i++) {
+        if (code[i].rs != R_FP || code[i].op == OP_MOVE) continue;
+        auto it = word_at.find(code[i].imm);
+        if (it == word_at.end()) continue;
+        if (code[i].op == OP_LW || code[i].op == OP_SW) access[i] = it->second, accessed[it->second] = true;
+        else addressed[it->second] = true;
+    }
+    std::vector<int> var_of(G.words.size(), -1), words;
+    for (size_t w = 0; w < G.words.size(); w++) {
+        if (accessed[w] && !addressed[w]) var_of[w] = words.size(), words.push_back(w);
+    }
+    if (words.empty()) return;
+    size_t vars = words.size(), width = (vars + 63) / 64;
+    for (size_t i = 0; i < n; i++) {
+        if (access[i] >= 0) access[i] = var_of[access[i]];
+    }
+
+    // Basic blocks, and the loop depth of each instruction
+    std::vector<Block> blocks;
+    std::vector<size_t> block_of;
+    splitBlocks(code, blocks, block_of);
+    std::vector<int> depth(n + 1, 0);
+    for (const auto& B : blocks) {
+        for (size_t s : B.succ) {
+            if (blocks[s].start > B.start) continue;
+            // A back edge: everything from the target to here is a loop
+            depth[blocks[s].start]++;
+            depth[B.end]--;
+        }
+    }
+    for (size_t i = 1; i < n; i++) depth[i] += depth[i - 1];
+
+    // Liveness of variables and temporaries
+    for (auto& b : blocks) {
+        b.use.assign(width, 0);
+        b.def.assign(width, 0);
+        b.in.assign(width, 0);
+        b.out.assign(width, 0);
+        b.temp_use = b.temp_def = b.temp_in = b.temp_out = 0;
+        for (size_t i = b.start; i < b.end; i++) {
+            unsigned use, def;
+            tempEffects(code[i], use, def);
+            b.temp_use |= use & ~b.temp_def;
+            b.temp_def |= def;
+            int v = access[i];
+            if (v < 0) continue;
+            uint64_t bit = 1ull << (v % 64);
+            if (code[i].op == OP_LW && !(b.def[v / 64] & bit)) b.use[v / 64] |= bit;
+            if (code[i].op == OP_SW) b.def[v / 64] |= bit;
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            Block& B = blocks[b];
+            for (size_t s : B.succ) {
+                for (size_t k = 0; k < width; k++) B.out[k] |= blocks[s].in[k];
+                B.temp_out |= blocks[s].temp_in;
+            }
+            for (size_t k = 0; k < width; k++) {
+                uint64_t in = B.use[k] | (B.out[k] & ~B.def[k]);
+                if (in != B.in[k]) B.in[k] = in, changed = true;
+            }
+            unsigned temp_in = B.temp_use | (B.temp_out & ~B.temp_def);
+            if (temp_in != B.temp_in) B.temp_in = temp_in, changed = true;
+        }
+    }
+
+    // Intervals, and where each temporary is busy: live or touched
+    std::vector<Interval> intervals(vars);
+    for (size_t v = 0; v < vars; v++) intervals[v] = Interval{(int)v, n, 0, 0, -1};
+    std::vector<std::vector<uint32_t>> busy(TEMP_COUNT, std::vector<uint32_t>(n + 1, 0)); // Prefix counts
+    for (const auto& B : blocks) {
+        for (size_t k = 0; k < width; k++) {
+            for (uint64_t bits = B.in[k] | B.out[k]; bits; bits &= bits - 1) {
+                uint64_t bit = bits & -bits;
+                Interval& iv = intervals[k * 64 + __builtin_ctzll(bits)];
+                iv.start = std::min(iv.start, (B.in[k] & bit) ? B.start : B.end - 1);
+                iv.end = std::max(iv.end, (B.out[k] & bit) ? B.end - 1 : B.start);
+            }
+        }
+        unsigned live = B.temp_out;
+        for (size_t i = B.end; i-- > B.start;) {
+            unsigned use, def;
+            tempEffects(code[i], use, def);
+            unsigned touched = live | use | def;
+            for (int t = 0; t < TEMP_COUNT; t++) busy[t][i + 1] = (touched >> t) & 1;
+            live = (live & ~def) | use;
+            int v = access[i];
+            if (v < 0) continue;
+            Interval& iv = intervals[v];
+            iv.start = std::min(iv.start, i);
+            iv.end = std::max(iv.end, i);
+            iv.weight += pow(10.0, std::min(depth[i], 9));
+        }
+    }
+    for (int t = 0; t < TEMP_COUNT; t++) {
+        for (size_t i = 1; i <= n; i++) busy[t][i] += busy[t][i - 1];
+    }
+
+    // Linear scan in order of interval start
+    std::sort(intervals.begin(), intervals.end(),
+              [](const Interval& a, const Interval& b) { return a.start < b.start; });
+    long until[32];                     // Last instruction of the interval holding each register
+    Interval* holder[32] = {nullptr};
+    for (int r = 0; r < 32; r++) until[r] = -1;
+    for (auto& iv : intervals) {
+        int reg = -1;
+        for (int t = 0; t < TEMP_COUNT && reg < 0; t++) {
+            int r = TEMP_REGS[t];
+            if (until[r] < (long)iv.start && busy[t][iv.end + 1] == busy[t][iv.start]) reg = r;
+        }
+        for (int s = 0; s < SAVED_COUNT && reg < 0; s++) {
+            if (until[SAVED_REGS[s]] < (long)iv.start) reg = SAVED_REGS[s];
+        }
+        if (reg < 0) {
+            // All taken: the lightest of the live variables stays in memory
+            int victim = SAVED_REGS[0];
+            for (int s = 1; s < SAVED_COUNT; s++) {
+                if (holder[SAVED_REGS[s]]->weight < holder[victim]->weight) victim = SAVED_REGS[s];
+            }
+            if (holder[victim]->weight >= iv.weight) continue;
+            holder[victim]->reg = -1;
+            reg = victim;
+        }
+        iv.reg = reg;
+        until[reg] = iv.end;
+        holder[reg] = &iv;
+    }
+
+    // Rewrite loads and stores of allocated variables as moves
+    std::vector<int> reg_of(vars, -1);
+    bool saved[32] = {false};
+    for (const auto& iv : intervals) {
+        reg_of[iv.var] = iv.reg;
+        if (iv.reg >= 16 && iv.reg <= 23) saved[iv.reg] = true;
+    }
+    std::vector<std::pair<int, int>> saves;    // Register, frame offset
+    for (int s = 0; s < SAVED_COUNT; s++) {
+        if (!saved[SAVED_REGS[s]]) continue;
+        G.frame += 4;
+        saves.push_back(std::make_pair(SAVED_REGS[s], -G.frame));
+    }
+    std::vector<Instr> out;
+    out.reserve(n + 2 * saves.size() + vars);
+    for (size_t i = 0; i < n; i++) {
+        Instr in = code[i];
+        int reg = access[i] >= 0 ? reg_of[access[i]] : -1;
+        if (reg >= 0) in = Instr{OP_MOVE, in.op == OP_LW ? in.rd : reg, in.op == OP_LW ? reg : in.rd, -1, 0, "", in.line};
+        out.push_back(in);
+        if (i == frame_at) {
+            for (const auto& s : saves) out.push_back(Instr{OP_SW, s.first, R_FP, -1, s.second, "", in.line});
+            for (size_t v = 0; v < vars; v++) {
+                int offset = G.words[words[v]];
+                if (reg_of[v] >= 0 && offset > 0) out.push_back(Instr{OP_LW, reg_of[v], R_FP, -1, offset, "", in.line});
+            }
+        }
+        if (in.op == OP_LABEL && in.label == G.return_label) {
+            for (const auto& s : saves) out.push_back(Instr{OP_LW, s.first, R_FP, -1, s.second, "", in.line});
+        }
+    }
+    code.swap(out);
+}
+
+// --- Peephole ---
+
+/**
+ * @brief Returns whether an instruction names a register as an operand it
+ * reads.
+ */
+bool readsReg(const Instr& in, int reg) {
+    int reads[2], write;
+    regEffects(in, reads, write);
+    return reads[0] == reg || reads[1] == reg;
+}
+
+/**
+ * @brief Returns whether an instruction writes a register.
+ */
+bool writesReg(const Instr& in, int reg) {
+    int reads[2], write;
+    regEffects(in, reads, write);
+    return write == reg;
+}
+
+/**
+ * @brief Returns whether an instruction reads or writes a register.
+ */
+bool touchesReg(const Instr& in, int reg) {
+    return readsReg(in, reg) || writesReg(in, reg);
+}
+
+/**
+ * @brief Makes an instruction read one register in place of another.
+ */
+void replaceReads(Instr& in, int from, int to) {
+    switch (in.op) {
+        case OP_DIV: case OP_TEQ: case OP_SW: case OP_SB: case OP_JR:
+            if (in.rd == from) in.rd = to;
+            if (in.rs == from) in.rs = to;
+            break;
+        default:
+            if (in.rs == from) in.rs = to;
+            if (in.rt == from) in.rt = to;
+            break;
+    }
+}
+
+/**
+ * @brief Returns whether an instruction ends the stretch a rewrite may
+ * look across: labels, branches, jumps, calls and system calls.
+ */
+bool isBarrier(const Instr& in) {
+    switch (in.op) {
+        case OP_LABEL: case OP_BEQ: case OP_BNE: case OP_J: case OP_JAL: case OP_JR: case OP_SYSCALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Returns the first instruction after `from` that touches a
+ * register or is a barrier, or the end of the code.
+ */
+size_t nextUse(const std::vector<Instr>& code, size_t from, int reg) {
+    size_t j = from + 1;
+    while (j < code.size() && !touchesReg(code[j], reg) && !isBarrier(code[j])) j++;
+    return j;
+}
+
+/**
+ * @brief Rewrites `li b, C` + `mul a, x, b` (either operand order) as
+ * shifts when C has one or two bits set, so x * 10 becomes
+ * (x << 3) + (x << 1). The two-bit form needs a scratch register: b, or
+ * x if the product replaces b and x is dead.
+ * @param live Temporaries live after the mul.
+ * @return False, emitting nothing, if the pattern does not apply.
+ */
+bool reduceMultiply(const Instr& li, const Instr& mul, unsigned live, std::vector<Instr>& out) {
+    int b = li.rd, a = mul.rd;
+    int x = mul.rs == b ? mul.rt : mul.rs;
+    uint32_t c = li.imm;
+    if ((mul.rs != b && mul.rt != b) || x == b || !c || (b != a && (live & tempBit(b)))) return false;
+    int high = 31 - __builtin_clz(c), low = __builtin_ctz(c);
+    if (high == low) {
+        out.push_back(Instr{OP_SLL, a, x, -1, high, "", mul.line});
+        return true;
+    }
+    if (c != ((1u << high) | (1u << low))) return false;
+    int scratch = b;
+    if (b == a) {
+        if (x == a || !tempBit(x) || (live & tempBit(x))) return false;
+        scratch = x;
+    }
+    // When the scratch register is x, it is shifted last
+    out.push_back(Instr{OP_SLL, scratch == x ? a : scratch, x, -1, high, "", mul.line});
+    out.push_back(Instr{OP_SLL, scratch == x ? x : a, x, -1, low, "", mul.line});
+    out.push_back(Instr{OP_ADDU, a, a, scratch, 0, "", mul.line});
+    return true;
+}
+
+/**
+ * @brief Rewrites `li b, 2^k` + `teq b, $zero` + `div x, b` +
+ * `mflo y` (or `mfhi y`) as shifts. Negative dividends are biased by
+ * 2^k - 1 first, so the quotient rounds toward zero like div's.
+ * @param in The four instructions.
+ * @param live Temporaries live after the mflo or mfhi.
+ * @return False, emitting nothing, if the pattern does not apply.
+ */
+bool reduceDivide(const Instr* in, unsigned live, std::vector<Instr>& out) {
+    int b = in[0].rd, x = in[2].rd, y = in[3].rd;
+    int32_t c = in[0].imm;
+    if (in[1].op != OP_TEQ || in[1].rd != b || in[1].rs != R_ZERO || in[2].op != OP_DIV || in[2].rs != b ||
+        (in[3].op != OP_MFLO && in[3].op != OP_MFHI) || x == b || y == b || !tempBit(b) ||
+        (live & tempBit(b)) || c < 2 || c > (1 << 30) || (c & (c - 1))) {
+        return false;
+    }
+    int k = __builtin_ctz(c);
+    uint32_t line = in[2].line;
+    out.push_back(Instr{OP_SRA, b, x, -1, 31, "", line});
+    out.push_back(Instr{OP_SRL, b, b, -1, 32 - k, "", line});
+    out.push_back(Instr{OP_ADDU, b, x, b, 0, "", line});
+    if (in[3].op == OP_MFLO) {
+        out.push_back(Instr{OP_SRA, y, b, -1, k, "", line});
+    } else {
+        out.push_back(Instr{OP_SRA, b, b, -1, k, "", line});
+        out.push_back(Instr{OP_SLL, b, b, -1, k, "", line});
+        out.push_back(Instr{OP_SUBU, y, x, b, 0, "", line});
+    }
+    return true;
+}
+
+/**
+ * @brief One pass of local rewrites over a function:
+ * - drops `move r, r` and writes to temporaries that are never read
+ * - reads x directly where the copy made by `move t, x` is next used
+ * - writes straight to y in `op t, ...` + `move y, t`
+ * - turns a load of the word just stored into a move
+ * - strength-reduces multiplication and division by constants
+ * Temporaries are only dropped where liveness shows them dead. A rewrite
+ * ending at instruction j freezes everything up to j for the rest of the
+ * pass, so the liveness computed at the start stays valid.
+ * @return True if anything changed.
+ */
+bool peepholePass(std::vector<Instr>& code) {
+    std::vector<unsigned> live = tempLiveness(code);
+    std::vector<Instr> out;
+    out.reserve(code.size());
+    std::vector<bool> gone(code.size(), false);
+    size_t n = code.size(), frozen = 0;
+    bool changed = false;
+    for (size_t i = 0; i < n; i++) {
+        if (gone[i]) continue;
+        Instr& in = code[i];
+        if (i < frozen) {
+            out.push_back(in);
+            continue;
+        }
+        int reads[2], write;
+        regEffects(in, reads, write);
+        unsigned bit = write >= 0 ? tempBit(write) : 0;
+        if ((in.op == OP_MOVE && in.rd == in.rs) || (bit && !(live[i] & bit))) {
+            changed = true;
+            continue;
+        }
+        if (in.op == OP_MOVE && bit) {
+            size_t j = i + 1;
+            while (j < n && !touchesReg(code[j], in.rd) && !writesReg(code[j], in.rs) && !isBarrier(code[j])) j++;
+            if (j < n && readsReg(code[j], in.rd) && !writesReg(code[j], in.rs) &&
+                (writesReg(code[j], in.rd) || !(live[j] & bit))) {
+                replaceReads(code[j], in.rd, in.rs);
+                frozen = j + 1;
+                changed = true;
+                continue;
+            }
+        }
+        if (bit && in.op != OP_MOVE) {
+            size_t j = nextUse(code, i, write);
+            if (j < n && code[j].op == OP_MOVE && code[j].rs == write && !(live[j] & bit)) {
+                int target = code[j].rd;
+                bool clear = true;
+                for (size_t k = i + 1; k < j && clear; k++) clear = !touchesReg(code[k], target);
+                if (clear) {
+                    in.rd = target;
+                    gone[j] = true;
+                    frozen = j + 1;
+                    changed = true;
+                    out.push_back(in);
+                    continue;
+                }
+            }
+        }
+        if (in.op == OP_SW) {
+            for (size_t j = i + 1; j < n && !isBarrier(code[j]); j++) {
+                Instr& next = code[j];
+                if (next.op == OP_LW && next.rs == in.rs && next.imm == in.imm) {
+                    if (next.rd == in.rd) gone[j] = true;
+                    else next = Instr{OP_MOVE, next.rd, in.rd, -1, 0, "", next.line};
+                    frozen = j + 1;
+                    changed = true;
+                    break;
+                }
+                if (next.op == OP_SW || next.op == OP_SB || writesReg(next, in.rs) || writesReg(next, in.rd)) break;
+            }
+        }
+        if (in.op == OP_LI && i + 1 < n && code[i + 1].op == OP_MUL && reduceMultiply(in, code[i + 1], live[i + 1], out)) {
+            frozen = ++i + 1;
+            changed = true;
+            continue;
+        }
+        if (in.op == OP_LI && i + 3 < n && reduceDivide(&code[i], live[i + 3], out)) {
+            i += 3;
+            frozen = i + 1;
+            changed = true;
+            continue;
+        }
+        out.push_back(in);
+    }
+    code.swap(out);
+    return changed;
+}
+
+/**
+ * @brief Runs the peephole rewrites over a function until none applies.
+ */
+void peephole(std::vector<Instr>& code) {
+    for (int pass = 0; pass < 8 && peepholePass(code); pass++) {
+    }
+}
+
+/**
+ * @brief Returns whether an instruction may sit in a delay slot at all.
+ * `la`, and `li` of a constant that needs lui + ori, assemble to two
+ * machine instructions, and only the first would run in the slot.
+ */
+bool isSlotCandidate(const Instr& in) {
+    if (isBarrier(in) || in.op == OP_NOP || in.op == OP_LA) return false;
+    return in.op != OP_LI || (in.imm >= -32768 && in.imm <= 65535);
+}
+
+/**
+ * @brief Returns whether an instruction can execute in the delay slot of
+ * the branch or jump that follows it: the branch must not read what it
+ * writes, and it must leave $ra alone for `jal` and `jr $ra`.
+ */
+bool fitsDelaySlot(const Instr& in, const Instr& branch) {
+    if (!isSlotCandidate(in) || touchesReg(in, R_RA)) return false;
+    int reads[2], write;
+    regEffects(in, reads, write);
+    return write < 0 || !readsReg(branch, write);
+}
+
+/**
+ * @brief Returns whether the instruction after a conditional branch can
+ * run in its delay slot, on both paths: it only writes a temporary that
+ * is dead wherever the branch goes, and it cannot fault.
+ * @param live Temporaries live after the branch.
+ */
+bool fitsBothPaths(const Instr& in, unsigned live) {
+    if (!isSlotCandidate(in) || in.op == OP_LW || in.op == OP_LBU) return false;
+    int reads[2], write;
+    regEffects(in, reads, write);
+    return write >= 0 && tempBit(write) && !(live & tempBit(write));
+}
+
+/**
+ * @brief Fills the delay slot after every branch and jump, for machines
+ * that run with delayed branches. The instruction before the branch
+ * moves into the slot if it can. Otherwise a conditional branch takes
+ * the next instruction if running it on the taken path is harmless, and
+ * a `j` gets a copy of the first instruction at its target and jumps
+ * past it. Any other slot gets a nop.
+ */
+void fillDelaySlots(std::vector<Instr>& code) {
+    size_t n = code.size();
+    std::vector<unsigned> live = tempLiveness(code);
+    std::unordered_map<std::string, size_t> label_at;
+    std::vector<bool> moved(n, false);  // Instructions that move into the slot after them
+    std::vector<bool> hoisted(n, false); // Instructions that move into the slot before them
+    for (size_t i = 0; i < n; i++) {
+        Op op = code[i].op;
+        if (op == OP_LABEL) label_at[code[i].label] = i;
+        bool branch = op == OP_BEQ || op == OP_BNE || op == OP_J || op == OP_JAL || op == OP_JR;
+        if (branch && i && fitsDelaySlot(code[i - 1], code[i])) moved[i - 1] = true;
+    }
+    for (size_t i = 0; i + 1 < n; i++) {
+        bool branch = code[i].op == OP_BEQ || code[i].op == OP_BNE;
+        if (branch && !(i && moved[i - 1]) && !moved[i + 1] && fitsBothPaths(code[i + 1], live[i])) {
+            hoisted[i + 1] = true;
+        }
+    }
+    // Jumps whose slot gets a copy of their target's first instruction,
+    // and the labels placed after those instructions
+    std::unordered_map<size_t, size_t> copy_of;
+    std::unordered_map<size_t, std::string> label_after;
+    for (size_t i = 0; i < n; i++) {
+        if (code[i].op != OP_J || (i && moved[i - 1])) continue;
+        auto target = label_at.find(code[i].label);
+        if (target == label_at.end()) continue;
+        size_t t = target->second;
+        while (t < n && code[t].op == OP_LABEL) t++;
+        if (t == n || !isSlotCandidate(code[t]) || moved[t]) continue;
+        if (!label_after.count(t)) label_after[t] = newLabel();
+        copy_of[i] = t;
+    }
+    std::vector<Instr> out;
+    out.reserve(n + n / 4);
+    for (size_t i = 0; i < n; i++) {
+        const Instr& in = code[i];
+        Op op = in.op;
+        if (moved[i] || hoisted[i]) continue;
+        if (op == OP_BEQ || op == OP_BNE || op == OP_J || op == OP_JAL || op == OP_JR) {
+            auto copy = copy_of.find(i);
+            if (i && moved[i - 1]) {
+                out.push_back(in);
+                out.push_back(code[i - 1]);
+            } else if (i + 1 < n && hoisted[i + 1]) {
+                out.push_back(in);
+                out.push_back(code[i + 1]);
+            } else if (copy != copy_of.end()) {
+                out.push_back(Instr{OP_J, -1, -1, -1, 0, label_after[copy->second], in.line});
+                out.push_back(code[copy->second]);
+            } else {
+                out.push_back(in);
+                out.push_back(Instr{OP_NOP, -1, -1, -1, 0, "", in.line});
+            }
+        } else {
+            out.push_back(in);
+        }
+        auto label = label_after.find(i);
+        if (label != label_after.end()) out.push_back(Instr{OP_LABEL, -1, -1, -1, 0, label->second, in.line});
+    }
+    code.swap(out);
+}
+
+// --- Runtime ---
+
+// Helpers called by generated code, emitted only when used. They follow
+// the calling convention: arguments in $a0-$a3, result in $v0, and they
+// may clobber $t registers (callers save the ones in use).
+static const struct { const char* name; const char* needs; const char* code; } RUNTIME[] = {
+    {"__kik_strlen", nullptr,
+     "__kik_strlen:\n"
+     "\tmove $v0, $zero\n"
+     "__kik_strlen_loop:\n"
+     "\taddu $t0, $a0, $v0\n"
+     "\tlbu $t0, 0($t0)\n"
+     "\tbeq $t0, $zero, __kik_strlen_done\n"
+     "\taddiu $v0, $v0, 1\n"
+     "\tj __kik_strlen_loop\n"
+     "__kik_strlen_done:\n"
+     "\tjr $ra\n"},
+    {"__kik_concat", "__kik_strlen",
+     "__kik_concat:\n"
+     "\taddiu $sp, $sp, -16\n"
+     "\tsw $ra, 12($sp)\n"
+     "\tsw $a0, 8($sp)\n"
+     "\tsw $a1, 4($sp)\n"
+     "\tjal __kik_strlen\n"
+     "\tsw $v0, 0($sp)\n"
+     "\tlw $a0, 4($sp)\n"
+     "\tjal __kik_strlen\n"
+     "\tlw $t0, 0($sp)\n"
+     "\taddu $a0, $t0, $v0\n"
+     "\taddiu $a0, $a0, 4\n"
+     "\tli $t0, -4\n"
+     "\tand $a0, $a0, $t0\n"
+     "\tli $v0, 9\n"
+     "\tsyscall\n"
+     "\tmove $t2, $v0\n"
+     "\tlw $t1, 8($sp)\n"
+     "__kik_concat_a:\n"
+     "\tlbu $t0, 0($t1)\n"
+     "\tbeq $t0, $zero, __kik_concat_b\n"
+     "\tsb $t0, 0($t2)\n"
+     "\taddiu $t1, $t1, 1\n"
+     "\taddiu $t2, $t2, 1\n"
+     "\tj __kik_concat_a\n"
+     "__kik_concat_b:\n"
+     "\tlw $t1, 4($sp)\n"
+     "__kik_concat_b_loop:\n"
+     "\tlbu $t0, 0($t1)\n"
+     "\tsb $t0, 0($t2)\n"
+     "\taddiu $t1, $t1, 1\n"
+     "\taddiu $t2, $t2, 1\n"
+     "\tbne $t0, $zero, __kik_concat_b_loop\n"
+     "\tlw $ra, 12($sp)\n"
+     "\taddiu $sp, $sp, 16\n"
+     "\tjr $ra\n"},
+    {"__kik_itoa", nullptr,
+     "__kik_itoa:\n"
+     "\tmove $t0, $a0\n"
+     "\tli $a0, 16\n"
+     "\tli $v0, 9\n"
+     "\tsyscall\n"
+     "\taddiu $t1, $v0, 15\n"
+     "\tsb $zero, 0($t1)\n"
+     "\tmove $t3, $t0\n"
+     "\tslt $t2, $t0, $zero\n"
+     "\tbeq $t2, $zero, __kik_itoa_loop\n"
+     "\tsubu $t0, $zero, $t0\n"
+     "__kik_itoa_loop:\n"
+     "\tli $t2, 10\n"
+     "\tdivu $t0, $t2\n"
+     "\tmfhi $t2\n"
+     "\tmflo $t0\n"
+     "\taddiu $t2, $t2, 48\n"
+     "\taddiu $t1, $t1, -1\n"
+     "\tsb $t2, 0($t1)\n"
+     "\tbne $t0, $zero, __kik_itoa_loop\n"
+     "\tslt $t2, $t3, $zero\n"
+     "\tbeq $t2, $zero, __kik_itoa_done\n"
+     "\tli $t2, 45\n"
+     "\taddiu $t1, $t1, -1\n"
+     "\tsb $t2, 0($t1)\n"
+     "__kik_itoa_done:\n"
+     "\tmove $v0, $t1\n"
+     "\tjr $ra\n"},
+    {"__kik_chrstr", nullptr,
+     "__kik_chrstr:\n"
+     "\tmove $t0, $a0\n"
+     "\tli $a0, 4\n"
+     "\tli $v0, 9\n"
+     "\tsyscall\n"
+     "\tsb $t0, 0($v0)\n"
+     "\tsb $zero, 1($v0)\n"
+     "\tjr $ra\n"},
+    {"__kik_streq", nullptr,
+     "__kik_streq:\n"
+     "\tlbu $t0, 0($a0)\n"
+     "\tlbu $t1, 0($a1)\n"
+     "\tbne $t0, $t1, __kik_streq_no\n"
+     "\tbeq $t0, $zero, __kik_streq_yes\n"
+     "\taddiu $a0, $a0, 1\n"
+     "\taddiu $a1, $a1, 1\n"
+     "\tj __kik_streq\n"
+     "__kik_streq_yes:\n"
+     "\tli $v0, 1\n"
+     "\tjr $ra\n"
+     "__kik_streq_no:\n"
+     "\tmove $v0, $zero\n"
+     "\tjr $ra\n"},
+    {"__kik_input", nullptr,
+     "__kik_input:\n"
+     "\tli $a0, 256\n"
+     "\tli $v0, 9\n"
+     "\tsyscall\n"
+     "\tmove $t0, $v0\n"
+     "\tmove $a0, $v0\n"
+     "\tli $a1, 256\n"
+     "\tli $v0, 8\n"
+     "\tsyscall\n"
+     "\tmove $v0, $t0\n"
+     "__kik_input_strip:\n"
+     "\tlbu $t1, 0($t0)\n"
+     "\tbeq $t1, $zero, __kik_input_done\n"
+     "\taddiu $t2, $t1, -10\n"
+     "\tbeq $t2, $zero, __kik_input_cut\n"
+     "\taddiu $t0, $t0, 1\n"
+     "\tj __kik_input_strip\n"
+     "__kik_input_cut:\n"
+     "\tsb $zero, 0($t0)\n"
+     "__kik_input_done:\n"
+     "\tjr $ra\n"},
+    {"__kik_fopen", nullptr,
+     "__kik_fopen:\n"
+     "\tlbu $t0, 0($a1)\n"
+     "\tli $a1, 1\n"
+     "\taddiu $t1, $t0, -119\n"
+     "\tbeq $t1, $zero, __kik_fopen_open\n"
+     "\tli $a1, 9\n"
+     "\taddiu $t1, $t0, -97\n"
+     "\tbeq $t1, $zero, __kik_fopen_open\n"
+     "\tmove $a1, $zero\n"
+     "__kik_fopen_open:\n"
+     "\tmove $a2, $zero\n"
+     "\tli $v0, 13\n"
+     "\tsyscall\n"
+     "\tjr $ra\n"},
+    {"__kik_fread", nullptr,
+     "__kik_fread:\n"
+     "\tmul $a2, $a2, $a3\n"
+     "\tli $v0, 14\n"
+     "\tsyscall\n"
+     "\tjr $ra\n"},
+    {"__kik_fwrite", nullptr,
+     "__kik_fwrite:\n"
+     "\tmul $a2, $a2, $a3\n"
+     "\tli $v0, 15\n"
+     "\tsyscall\n"
+     "\tjr $ra\n"},
+    {"__kik_fclose", nullptr,
+     "__kik_fclose:\n"
+     "\tli $v0, 16\n"
+     "\tsyscall\n"
+     "\tjr $ra\n"},
+    {nullptr, nullptr, nullptr}
+};
+
+// --- Output ---
+
+/**
+ * @brief Formats one instruction as assembly text.
+ */
+std::string formatInstr(const Instr& in) {
+    if (in.op == OP_LABEL) return in.label + ":";
+    std::string s = "\t" + std::string(OPS[in.op].name);
+    switch (OPS[in.op].format) {
+        case F_RRR: s += " " + std::string(REG_NAMES[in.rd]) + ", " + REG_NAMES[in.rs] + ", " + REG_NAMES[in.rt]; break;
+        case F_RR: s += " " + std::string(REG_NAMES[in.rd]) + ", " + REG_NAMES[in.rs]; break;
+        case F_R: s += " " + std::string(REG_NAMES[in.rd]); break;
+        case F_RRI: s += " " + std::string(REG_NAMES[in.rd]) + ", " + REG_NAMES[in.rs] + ", " + std::to_string(in.imm); break;
+        case F_RI: s += " " + std::string(REG_NAMES[in.rd]) + ", " + std::to_string(in.imm); break;
+        case F_RL: s += " " + std::string(REG_NAMES[in.rd]) + ", " + in.label; break;
+        case F_MEM: s += " " + std::string(REG_NAMES[in.rd]) + ", " + std::to_string(in.imm) + "(" + REG_NAMES[in.rs] + ")"; break;
+        case F_BRANCH: s += " " + std::string(REG_NAMES[in.rs]) + ", " + REG_NAMES[in.rt] + ", " + in.label; break;
+        case F_JUMP: s += " " + in.label; break;
+        default: break;
+    }
+    return s;
+}
+
+/**
+ * @brief Formats the module's functions as lines of assembly. Each
+ * function starts with a blank line and a `# function name in file`
+ * comment, and each source line with a `# line n` comment; together they
+ * are the line table a simulator can profile by.
+ * @param file The module's file name, without its directory.
+ */
+std::vector<std::string> formatText(const std::vector<Instr>& text, const std::string& file) {
+    std::vector<std::string> lines;
+    uint32_t line = 0;
+    for (const auto& in : text) {
+        if (in.op == OP_LABEL && in.label.compare(0, 2, "f_") == 0 && in.label.find("_ret") == std::string::npos) {
+            lines.push_back("");
+            lines.push_back("# function " + in.label.substr(2) + " in " + file);
+            line = 0;
+        }
+        if (in.op != OP_LABEL && in.line != line) {
+            line = in.line;
+            lines.push_back("\t# line " + std::to_string(line));
+        }
+        lines.push_back(formatInstr(in));
+    }
+    return lines;
+}
+
+/**
+ * @brief Returns a runtime helper's code, with a nop in the delay slot of
+ * each branch and jump when delay slots are on.
+ */
+std::string runtimeCode(const char* code) {
+    if (!O.delay_slots) return code;
+    std::string out;
+    for (const char* line = code; *line;) {
+        const char* end = strchr(line, '\n');
+        out.append(line, end + 1);
+        if (line[0] == '\t' && (line[1] == 'b' || line[1] == 'j')) out += "\tnop\n";
+        line = end + 1;
+    }
+    return out;
+}
+
+/**
+ * @brief Writes the assembly file: the data and text of every module,
+ * root first, then the runtime helpers any of them use.
+ * @param entry True if the program has `int kik()` to start from.
+ */
+void writeAssembly(const std::string& path, bool entry) {
+    FILE* out = path == "-" ? stdout : fopen(path.c_str(), "w");
+    if (!out) die("cannot create " + path);
+    const std::string& root = P.modules[0]->file->path;
+    std::string name = root.substr(root.rfind('/') + 1);
+    fprintf(out, "# Generated by kikc from %s\n", name.c_str());
+    fprintf(out, "\t.data\n");
+    for (const auto& m : P.modules) {
+        for (const auto& line : m->data) fprintf(out, "%s\n", line.c_str());
+    }
+    fprintf(out, "\n\t.text\n");
+    if (entry) {
+        // Start at kik() and exit with its return value
+        fprintf(out, "\t.globl main\nmain:\n\tjal f_kik\n%s\tmove $a0, $v0\n\tli $v0, 17\n\tsyscall\n",
+                O.delay_slots ? "\tnop\n" : "");
+    }
+    std::unordered_map<std::string, bool> runtime;
+    for (const auto& m : P.modules) {
+        for (const auto& line : m->text) fprintf(out, "%s\n", line.c_str());
+        for (const auto& helper : m->runtime) runtime[helper] = true;
+    }
+    for (int i = 0; RUNTIME[i].name; i++) {
+        if (runtime.count(RUNTIME[i].name) && RUNTIME[i].needs) runtime[RUNTIME[i].needs] = true;
+    }
+    for (int i = 0; RUNTIME[i].name; i++) {
+        if (runtime.count(RUNTIME[i].name)) {
+            fprintf(out, "\n# function %s\n%s", RUNTIME[i].name, runtimeCode(RUNTIME[i].code).c_str());
+        }
+    }
+    if (out != stdout) fclose(out);
+}
+
+// --- Modules ---
+
+// Changes whenever the compiler is rebuilt, so stale cache entries are ignored
+static const char CACHE_VERSION[] = "kikc-module 4 " __DATE__ " " __TIME__;
+
+static const char* const DECL_NAMES[] = {"function", "global", "enum", "enumtype", "type", "handle"};
+
+/**
+ * @brief Hashes bytes (FNV-1a, 64 bits), continuing from a previous hash.
+ */
+uint64_t hash64(const void* data, size_t len, uint64_t h = 14695981039346656037ull) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+/**
+ * @brief Formats a 64-bit value as 16 hex digits.
+ */
+std::string hex64(uint64_t v) {
+    char buf[17];
+    snprintf(buf, sizeof buf, "%016llx", (unsigned long long)v);
+    return buf;
+}
+
+/**
+ * @brief Returns the next space-separated field of a line.
+ * @param pos Where to start; moved past the field.
+ */
+std::string nextField(const std::string& line, size_t& pos) {
+    size_t end = line.find(' ', pos);
+    if (end == std::string::npos) end = line.size();
+    std::string field = line.substr(pos, end - pos);
+    pos = std::min(end + 1, line.size());
+    return field;
+}
+
+/**
+ * @brief Splits text into lines, without the newlines.
+ */
+std::vector<std::string> splitLines(const std::string& text) {
+    std::vector<std::string> lines;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        lines.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+/**
+ * @brief Encodes a type for an interface, as "base,array,pointer,ref".
+ */
+std::string typeCode(const Type& t) {
+    return std::to_string(t.base) + "," + std::to_string(t.array) + "," + std::to_string(t.pointer) + "," +
+           std::to_string(t.ref);
+}
+
+/**
+ * @brief Decodes a type written by typeCode.
+ * @return False if the text is not a type.
+ */
+bool parseTypeCode(const std::string& code, Type& t) {
+    int base, array, pointer, ref;
+    if (sscanf(code.c_str(), "%d,%d,%d,%d", &base, &array, &pointer, &ref) != 4 || base < 0 || base > TY_CLASS) {
+        return false;
+    }
+    t = Type{(BaseType)base, array, pointer != 0, ref != 0};
+    return true;
+}
+
+/**
+ * @brief Formats an interface declaration as one line.
+ */
+std::string formatDeclaration(const Declaration& d) {
+    std::string line = std::string(DECL_NAMES[d.kind]) + " " + d.name;
+    switch (d.kind) {
+        case D_FUNCTION:
+            line += " " + typeCode(d.type) + " " + std::to_string(d.flag) + " " + std::to_string(d.params.size());
+            for (const Type& t : d.params) line += " " + typeCode(t);
+            return line + " " + d.where;
+        case D_GLOBAL:
+            return line + " " + typeCode(d.type) + " " + std::to_string(d.flag) + " " + std::to_string(d.known) + " " +
+                   std::to_string(d.value) + " " + d.where;
+        case D_ENUM:
+            return line + " " + std::to_string(d.value);
+        default:
+            return line;
+    }
+}
+
+/**
+ * @brief Parses an interface written by moduleInterface.
+ * @return False if it is malformed, as in a damaged cache entry.
+ */
+bool parseInterface(const std::string& text, std::vector<Declaration>& decls) {
+    for (const auto& line : splitLines(text)) {
+        size_t pos = 0;
+        std::string kind = nextField(line, pos);
+        Declaration d = {D_FUNCTION, "", Type{TY_VOID, -1, false, false}, {}, false, false, 0, ""};
+        while (d.kind <= D_HANDLE && kind != DECL_NAMES[d.kind]) d.kind = (DeclKind)(d.kind + 1);
+        if (d.kind > D_HANDLE) return false;
+        d.name = nextField(line, pos);
+        if (d.name.empty()) return false;
+        if (d.kind == D_FUNCTION || d.kind == D_GLOBAL) {
+            if (!parseTypeCode(nextField(line, pos), d.type)) return false;
+            d.flag = nextField(line, pos) == "1";
+        }
+        if (d.kind == D_FUNCTION) {
+            long count = atol(nextField(line, pos).c_str());
+            for (long i = 0; i < count; i++) {
+                Type t;
+                if (!parseTypeCode(nextField(line, pos), t)) return false;
+                d.params.push_back(t);
+            }
+        }
+        if (d.kind == D_GLOBAL) d.known = nextField(line, pos) == "1";
+        if (d.kind == D_ENUM || d.kind == D_GLOBAL) d.value = atol(nextField(line, pos).c_str());
+        d.where = line.substr(pos);
+        decls.push_back(d);
+    }
+    return true;
+}
+
+/**
+ * @brief Describes what a compiled module declares for its importers:
+ * functions (a definition in preference to a prototype), globals, enums
+ * and type names.
+ */
+std::string moduleInterface(const SourceFile& F) {
+    std::string text;
+    std::unordered_map<Symbol, const Function*> shown;
+    std::vector<Symbol> order;
+    for (const auto& fn : F.functions) {
+        const Function*& slot = shown[fn->name];
+        if (!slot) order.push_back(fn->name);
+        if (!slot || fn->defined) slot = fn.get();
+    }
+    for (Symbol name : order) {
+        const Function* fn = shown[name];
+        Declaration d = {D_FUNCTION, symbolString(name), fn->ret, {}, fn->defined, false, 0, tokenWhere(F, fn->tok)};
+        for (const Param& p : fn->params) d.params.push_back(p.type);
+        text += formatDeclaration(d) + "\n";
+    }
+    for (NodeId decl : F.globals) {
+        for (NodeId k = at(decl)->first; k; k = at(k)->next) {
+            const Node* var = at(k);
+            const Variable& v = U.symbols.globals[var->text];
+            Declaration d = {D_GLOBAL, symbolString(var->text), v.type, {}, v.constant, v.known, v.value, tokenWhere(F, var->tok)};
+            text += formatDeclaration(d) + "\n";
+        }
+    }
+    for (const auto& e : F.enum_values) text += "enum " + symbolString(e.first) + " " + std::to_string(e.second) + "\n";
+    for (Symbol t : F.enum_types) text += "enumtype " + symbolString(t) + "\n";
+    for (Symbol t : F.opaque_types) text += "type " + symbolString(t) + "\n";
+    for (Symbol t : F.handle_types) text += "handle " + symbolString(t) + "\n";
+    return text;
+}
+
+/**
+ * @brief Makes the declarations of an imported module visible to the
+ * module being compiled.
+ */
+void importInterface(const Module& m) {
+    std::vector<Declaration> decls;
+    parseInterface(m.interface, decls);
+    for (const auto& d : decls) {
+        Symbol name = intern(d.name);
+        switch (d.kind) {
+            case D_FUNCTION: {
+                std::unique_ptr<Function> fn(new Function());
+                fn->name = name;
+                fn->ret = d.type;
+                for (const Type& t : d.params) fn->params.push_back(Param{0, t, 0, 0});
+                fn->defined = d.flag;
+                fn->where = d.where;
+                declareFunction(fn.get());
+                U.imported.push_back(std::move(fn));
+                break;
+            }
+            case D_GLOBAL:
+                if (U.symbols.globals.count(name)) throw CompileError{d.where, "'" + d.name + "' is already declared"};
+                U.symbols.globals[name] = Variable{d.type, true, d.flag, 0, "g_" + d.name, d.known, (int32_t)d.value};
+                break;
+            case D_ENUM: U.symbols.enum_values[name] = d.value; break;
+            case D_ENUM_TYPE: U.symbols.enum_types[name] = true; break;
+            case D_TYPE: U.symbols.opaque_types[name] = true; break;
+            case D_HANDLE: U.symbols.handle_types[name] = true; break;
+        }
+    }
+}
+
+/**
+ * @brief Returns the cache entry file of a module.
+ */
+std::string cachePath(const Module& m) {
+    return O.cache_dir + "/" + hex64(m.key) + ".kim";
+}
+
+/**
+ * @brief Creates a directory and its missing parents.
+ * @return False if it does not exist afterwards.
+ */
+bool makeDirectories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+    mkdir(path.c_str(), 0755);
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Loads a compiled module from the cache.
+ * @return False if there is no complete entry for its key.
+ */
+bool cacheLoad(Module& m) {
+    FILE* in = fopen(cachePath(m).c_str(), "rb");
+    if (!in) return false;
+    std::string text;
+    char buf[65536];
+    for (size_t n; (n = fread(buf, 1, sizeof buf, in)) > 0;) text.append(buf, n);
+    fclose(in);
+    std::vector<std::string> lines = splitLines(text);
+    if (lines.size() < 2 || lines[0] != CACHE_VERSION || lines.back() != "%end") return false;
+    std::string section, interface;
+    for (size_t i = 1; i + 1 < lines.size(); i++) {
+        const std::string& line = lines[i];
+        if (!line.empty() && line[0] == '%') section = line;
+        else if (section == "%interface") interface += line + "\n";
+        else if (section == "%runtime") m.runtime.push_back(line);
+        else if (section == "%needs") m.needs.push_back(std::make_pair(line.substr(0, line.find(' ')), line.substr(line.find(' ') + 1)));
+        else if (section == "%data") m.data.push_back(line);
+        else if (section == "%text") m.text.push_back(line);
+        else return false;
+    }
+    std::vector<Declaration> decls;
+    if (!parseInterface(interface, decls)) {
+        m.runtime.clear();
+        m.needs.clear();
+        m.data.clear();
+        m.text.clear();
+        return false;
+    }
+    m.interface = interface;
+    return true;
+}
+
+/**
+ * @brief Writes a compiled module to the cache. The entry is renamed into
+ * place, so other compilers never see a partial one; failures only cost
+ * a recompile next time.
+ */
+void cacheStore(const Module& m) {
+    std::string path = cachePath(m);
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) return;
+    fprintf(out, "%s\n%%interface\n%s%%runtime\n", CACHE_VERSION, m.interface.c_str());
+    for (const auto& helper : m.runtime) fprintf(out, "%s\n", helper.c_str());
+    fprintf(out, "%%needs\n");
+    for (const auto& need : m.needs) fprintf(out, "%s %s\n", need.first.c_str(), need.second.c_str());
+    fprintf(out, "%%data\n");
+    for (const auto& line : m.data) fprintf(out, "%s\n", line.c_str());
+    fprintf(out, "%%text\n");
+    for (const auto& line : m.text) fprintf(out, "%s\n", line.c_str());
+    fprintf(out, "%%end\n");
+    if (fclose(out) != 0 || rename(tmp.c_str(), path.c_str()) != 0) unlink(tmp.c_str());
+}
+
+/**
+ * @brief Loads and lexes a file and, recursively, everything it imports,
+ * building the import graph. Each file is read once even if several
+ * files import it.
+ * @param stack Modules being discovered, to report import cycles.
+ */
+Module* discoverModule(const std::string& path, std::vector<Module*>& stack) {
+    auto found = P.by_path.find(path);
+    if (found != P.by_path.end()) return found->second;
+    std::unique_ptr<Module> owned(new Module());
+    Module* m = owned.get();
+    m->file.reset(new SourceFile());
+    m->file->path = path;
+    m->file->data = nullptr;
+    m->file->size = 0;
+    if (!loadFile(*m->file)) die("cannot read " + path);
+    P.by_path[path] = m;
+    P.modules.push_back(std::move(owned));
+
+    std::vector<std::string> names;
+    std::vector<uint32_t> toks;
+    scanImports(*m->file, names, toks);
+    std::string dir = path.substr(0, path.rfind('/'));
+    stack.push_back(m);
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string resolved = resolveImport(names[i], dir.empty() ? "/" : dir);
+        if (resolved.empty()) errorAt(*m->file, toks[i], "cannot find imported file \"" + names[i] + "\"");
+        auto cycle = P.by_path.find(resolved);
+        if (cycle != P.by_path.end() && std::find(stack.begin(), stack.end(), cycle->second) != stack.end()) {
+            std::string chain;
+            for (auto it = std::find(stack.begin(), stack.end(), cycle->second); it != stack.end(); ++it) {
+                chain += (*it)->file->path.substr((*it)->file->path.rfind('/') + 1) + " -> ";
+            }
+            errorAt(*m->file, toks[i], "import cycle: " + chain + names[i]);
+        }
+        Module* import = discoverModule(resolved, stack);
+        if (std::find(m->imports.begin(), m->imports.end(), import) != m->imports.end()) continue;
+        m->imports.push_back(import);
+        import->dependents.push_back(m);
+    }
+    stack.pop_back();
+    return m;
+}
+
+/**
+ * @brief Appends the transitive imports of a module to `closure`, each
+ * after its own imports.
+ */
+void collectClosure(Module* m, std::vector<Module*>& closure, std::unordered_map<Module*, bool>& seen) {
+    for (Module* import : m->imports) {
+        if (seen[import]) continue;
+        seen[import] = true;
+        collectClosure(import, closure, seen);
+        closure.push_back(import);
+    }
+}
+
+/**
+ * @brief Parses, checks and generates code for one module against the
+ * interfaces of everything it imports.
+ */
+void compileModule(Module& m) {
+    U = Unit();
+    G = FunctionGen();
+    U.prefix = hex64(m.key).substr(0, 8);
+    for (Module* import : m.closure) importInterface(*import);
+    SourceFile& F = *m.file;
+    parseFile(F);
+    collectSymbols(F);
+    for (NodeId decl : F.globals) genGlobal(at(decl), F);
+    for (const auto& fn : F.functions) {
+        if (fn->defined && U.symbols.functions[fn->name] == fn.get()) genFunction(*fn);
+    }
+
+    m.interface = moduleInterface(F);
+    for (int i = 0; RUNTIME[i].name; i++) {
+        if (U.runtime.count(RUNTIME[i].name)) m.runtime.push_back(RUNTIME[i].name);
+    }
+    for (const auto& need : U.needs) m.needs.push_back(need);
+    std::sort(m.needs.begin(), m.needs.end());
+    for (const auto& entry : U.data) {
+        for (const auto& line : splitLines(entry)) m.data.push_back(line);
+    }
+    m.text = formatText(U.text, F.path.substr(F.path.rfind('/') + 1));
+    m.nodes = A.count;
+    m.symbols = I.text.size();
+    arenaFree();
+    U = Unit();
+}
+
+/**
+ * @brief Compiles a module, or loads it from the cache when neither its
+ * source nor the interfaces it imports have changed.
+ */
+void buildModule(Module& m) {
+    std::string header = std::string(CACHE_VERSION) + (O.delay_slots ? " delay-slots\n" : "\n") + m.file->path + "\n";
+    m.key = hash64(header.data(), header.size());
+    m.key = hash64(m.file->data, m.file->size, m.key);
+    for (Module* import : m.closure) m.key = hash64(&import->interface_hash, sizeof(uint64_t), m.key);
+    m.cached = !O.cache_dir.empty() && cacheLoad(m);
+    if (!m.cached) {
+        compileModule(m);
+        if (!O.cache_dir.empty()) cacheStore(m);
+    }
+    m.interface_hash = hash64(m.interface.data(), m.interface.size());
+}
+
+// Work shared by the compiler threads
+struct Scheduler {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<Module*> ready;       // Modules whose imports are all compiled
+    size_t done;
+    bool failed;
+    CompileError error;               // The first error
+};
+
+/**
+ * @brief Compiles ready modules until all are done or one fails.
+ */
+void compileWorker(Scheduler& S) {
+    std::unique_lock<std::mutex> hold(S.lock);
+    for (;;) {
+        S.wake.wait(hold, [&] { return !S.ready.empty() || S.failed || S.done == P.modules.size(); });
+        if (S.failed || S.ready.empty()) return;
+        Module* m = S.ready.back();
+        S.ready.pop_back();
+        hold.unlock();
+        try {
+            buildModule(*m);
+        } catch (const CompileError& e) {
+            hold.lock();
+            if (!S.failed) S.error = e;
+            S.failed = true;
+            S.wake.notify_all();
+            return;
+        }
+        hold.lock();
+        S.done++;
+        for (Module* d : m->dependents) {
+            if (--d->pending == 0) S.ready.push_back(d);
+        }
+        S.wake.notify_all();
+    }
+}
+
+/**
+ * @brief Compiles every module, independent ones in parallel.
+ * @return The number of threads used.
+ */
+int compileModules() {
+    Scheduler S;
+    S.done = 0;
+    S.failed = false;
+    for (auto it = P.modules.rbegin(); it != P.modules.rend(); ++it) {
+        Module* m = it->get();
+        std::unordered_map<Module*, bool> seen;
+        collectClosure(m, m->closure, seen);
+        m->pending = m->imports.size();
+        if (!m->pending) S.ready.push_back(m);
+    }
+    int threads = std::max(1, std::min<int>(O.jobs, P.modules.size()));
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) workers.push_back(std::thread(compileWorker, std::ref(S)));
+    compileWorker(S);
+    for (auto& w : workers) w.join();
+    if (S.failed) throw S.error;
+    return threads;
+}
+
+/**
+ * @brief Checks the modules against each other: every function and
+ * global is defined once, and every function called across modules is
+ * defined somewhere.
+ * @return True if the program has `int kik()` to start from.
+ */
+bool linkModules() {
+    std::unordered_map<std::string, std::string> defined; // Label -> where
+    for (const auto& m : P.modules) {
+        std::vector<Declaration> decls;
+        parseInterface(m->interface, decls);
+        for (const auto& d : decls) {
+            if ((d.kind != D_FUNCTION || !d.flag) && d.kind != D_GLOBAL) continue;
+            auto slot = defined.insert(std::make_pair((d.kind == D_FUNCTION ? "f_" : "g_") + d.name, d.where));
+            if (!slot.second) {
+                throw CompileError{d.where, "redefinition of '" + d.name + "' (first defined at " + slot.first->second + ")"};
+            }
+        }
+    }
+    for (const auto& m : P.modules) {
+        for (const auto& need : m->needs) {
+            if (!defined.count("f_" + need.first)) {
+                throw CompileError{need.second, "'" + need.first + "' is declared but has no body or MIPS system call"};
+            }
+        }
+    }
+    return defined.count("f_kik") != 0;
+}
+
+// --- Main ---
+
+/**
+ * @brief Returns the default module cache directory, or "" if there is
+ * no home directory to put it in.
+ */
+std::string defaultCacheDir() {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) return std::string(xdg) + "/kikc";
+    const char* home = getenv("HOME");
+    if (home && *home) return std::string(home) + "/.cache/kikc";
+    return "";
+}
+
+int main(int argc, char* argv[]) {
+    O.stats = false;
+    O.delay_slots = false;
+    O.cache_dir = defaultCacheDir();
+    O.jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            O.output = argv[++i];
+        } else if (arg == "-j" && i + 1 < argc) {
+            O.jobs = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--cache" && i + 1 < argc) {
+            O.cache_dir = argv[++i];
+        } else if (arg == "--no-cache") {
+            O.cache_dir.clear();
+        } else if (arg == "--stats") {
+            O.stats = true;
+        } else if (arg == "--delay-slots") {
+            O.delay_slots = true;
+        } else if (arg[0] == '-' && arg != "-") {
+            O.input.clear();
+            break;
+        } else {
+            O.input = arg;
+        }
+    }
+    if (O.input.empty()) {
+        fprintf(stderr, "Usage: %s [-o out.s] [-j threads] [--cache dir | --no-cache] [--stats] [--delay-slots] file.kik\n", argv[0]);
+        return 2;
+    }
+    if (O.output.empty()) {
+        std::string base = O.input.substr(O.input.rfind('/') + 1);
+        if (base.size() > 4 && base.compare(base.size() - 4, 4, ".kik") == 0) base.resize(base.size() - 4);
+        O.output = base + ".s";
+    }
+    if (access(O.input.c_str(), R_OK) == -1) die("cannot read " + O.input);
+    if (!O.cache_dir.empty() && !makeDirectories(O.cache_dir)) O.cache_dir.clear();
+
+    lexInitTables();
+    try {
+        double start = nowUs();
+        std::vector<Module*> stack;
+        discoverModule(canonicalPath(O.input), stack);
+        double t_scan = nowUs();
+        int threads = compileModules();
+        double t_compile = nowUs();
+        bool entry = linkModules();
+        writeAssembly(O.output, entry);
+        if (O.stats) {
+            size_t bytes = 0, tokens = 0, nodes = 0, symbols = 0, lines = 0, cached = 0;
+            for (const auto& m : P.modules) {
+                bytes += m->file->size;
+                tokens += m->file->tokens.size();
+                nodes += m->nodes;
+                symbols += m->symbols;
+                lines += m->text.size();
+                cached += m->cached;
+            }
+            fprintf(stderr, "kikc: %zu module(s), %zu compiled, %zu cached, %d thread(s)\n", P.modules.size(),
+                    P.modules.size() - cached, cached, threads);
+            fprintf(stderr, "kikc: %zu bytes, %zu tokens, %zu nodes, %zu symbols\n", bytes, tokens, nodes, symbols);
+            fprintf(stderr, "kikc: lex %.2f ms (%.0f MB/s)\n", P.lex_us / 1000, bytes / std::max(P.lex_us, 1.0));
+            fprintf(stderr, "kikc: lex+imports %.2f ms, compile %.2f ms, link+write %.2f ms, %zu lines of code\n",
+                    (t_scan - start) / 1000, (t_compile - t_scan) / 1000, (nowUs() - t_compile) / 1000, lines);
+        }
+    } catch (const CompileError& e) {
+        fprintf(stderr, "%s: error: %s\n", e.where.c_str(), e.message.c_str());
+        return 1;
+    }
+    return 0;
+}
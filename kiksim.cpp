@@ -0,0 +1,1625 @@
+/******************************************************************************
+ * KIKSIM: MIPS32 simulator for programs compiled by kikc.
+ *
+ * Assembles a kikc output file into MIPS32 machine code, laid out like
+ * SPIM and MARS lay it out (text at 0x00400000, data at 0x10010000, heap
+ * at 0x10040000, stack below 0x7ffffffc), and runs it.
+ *
+ * Code runs from a translation cache of basic blocks. The first time
+ * control reaches an address, the block starting there (up to its
+ * branch, jump or system call, and the delay slot) is decoded once into
+ * an array of micro-ops, each holding the address of its handler; the
+ * interpreter jumps from handler to handler (computed goto), so there is
+ * no decode and no central switch on the hot path. A block's exits are
+ * linked to the blocks they lead to the first time they are taken, and
+ * instructions are counted per block, not one by one. The text is
+ * writable: a store into it invalidates the blocks it changes, and if
+ * the running block is one of them it is left right after the store.
+ *
+ * Simulated memory is one 4 GB reservation of host address space in
+ * which only the text, data, heap and stack are accessible, so a load or
+ * store is a single host access; a stray address faults, and the fault
+ * is reported as a bad address.
+ *
+ * System calls use the SPIM/MARS numbering: print_int 1,
+ * print_string 4, read_int 5, read_string 8, sbrk 9, exit 10,
+ * print_char 11, read_char 12, open 13, read 14, write 15, close 16 and
+ * exit2 17. File descriptors 0-2 are the simulator's own stdin, stdout
+ * and stderr.
+ *
+ * By default branches take effect immediately, as in SPIM and MARS. With
+ * --delay-slots the instruction after each branch or jump runs before
+ * the branch is taken, as on real MIPS hardware (for kikc --delay-slots
+ * output). Cycles are counted as one per instruction plus one for every
+ * taken branch or jump without delay slots, where the instruction
+ * fetched after it is thrown away.
+ *
+ * With --profile the simulator reports where the cycles went, by
+ * function, by KIK source line and by loop, with the loads, stores and
+ * branch mispredicts of each. The predictor model is a 2-bit counter per
+ * conditional branch, a return stack for `jr $ra` and the last target
+ * for other indirect jumps. Functions and lines come from the line table
+ * kikc writes as comments (`# function name in file`, `# line n`); in
+ * assembly without one, each label starts a function. --folded writes
+ * the cycles of each call path in the folded-stack format that flame
+ * graph tools read.
+ *
+ * Compilation:
+ * g++ -std=c++11 -O2 -o kiksim kiksim.cpp
+ *
+ * Usage:
+ * ./kiksim [--delay-slots] [--stats] [--profile] [--folded stacks.txt] program.s
+ * ./kikc -o prog.s prog.kik && ./kiksim prog.s < input.txt
+ * ./kiksim --profile --folded prog.folded prog.s && flamegraph.pl prog.folded > prog.svg
+ *
+ * The exit status is the program's (exit2), or 1 if the simulator
+ * stops it with an error.
+ *
+ ******************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+// POSIX API headers
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+// --- Data Structures ---
+
+// Memory layout, as in SPIM and MARS
+static const uint32_t TEXT_BASE = 0x00400000;
+static const uint32_t DATA_BASE = 0x10010000;
+static const uint32_t HEAP_BASE = 0x10040000;
+static const uint32_t DATA_LIMIT = 0x30000000;  // Data and heap must stay below
+static const uint32_t STACK_TOP = 0x7ffffffc;
+static const uint32_t STACK_SIZE = 64 << 20;
+static const uint32_t INITIAL_SP = 0x7fffeffc;
+static const uint32_t INITIAL_GP = 0x10008000;
+
+// Register numbers the simulator itself uses
+enum Register {
+    R_ZERO = 0, R_AT = 1, R_V0 = 2, R_A0 = 4, R_A1 = 5, R_A2 = 6, R_GP = 28, R_SP = 29, R_RA = 31,
+    R_SINK = 32  // Writes to $zero go here, so handlers need not check
+};
+
+static const char* const REG_NAMES[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+// Decoded operations, one interpreter handler each
+enum Op {
+    OP_BAD, OP_END,
+    OP_SLL, OP_SRL, OP_SRA, OP_SLLV, OP_SRLV, OP_SRAV, OP_JR, OP_JALR, OP_SYSCALL, OP_BREAK,
+    OP_MFHI, OP_MFLO, OP_MULT, OP_MULTU, OP_DIV, OP_DIVU, OP_ADD, OP_ADDU, OP_SUB, OP_SUBU,
+    OP_AND, OP_OR, OP_XOR, OP_NOR, OP_SLT, OP_SLTU, OP_TEQ, OP_TNE, OP_MUL,
+    OP_BLTZ, OP_BGEZ, OP_J, OP_JAL, OP_BEQ, OP_BNE, OP_BLEZ, OP_BGTZ,
+    OP_ADDI, OP_ADDIU, OP_SLTI, OP_SLTIU, OP_ANDI, OP_ORI, OP_XORI, OP_LUI,
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU, OP_SB, OP_SH, OP_SW,
+    OP_NOP, OP_EXIT, OP_COUNT
+};
+
+// Longest block, in instructions; longer straight-line code is split
+static const uint32_t BLOCK_LIMIT = 64;
+
+// One decoded instruction, a micro-op of a block. Branch and jump targets
+// are text indexes (word offsets from TEXT_BASE); immediates are already
+// sign- or zero-extended.
+struct Decoded {
+    const void* handler;  // Interpreter label
+    uint8_t op;
+    uint8_t d, s, t;      // Destination and source registers
+    int32_t imm;
+};
+
+// A translated basic block: the instructions from `start` up to the
+// first branch, jump or system call (with its delay slot), then OP_EXIT
+struct Block {
+    uint32_t start;                    // Text index of the first instruction
+    uint32_t length;                   // Instructions, not counting OP_EXIT
+    bool valid;                        // Cleared when a store changes its code
+    uint32_t exit[2];                  // Text index of the taken and fall-through successors
+    Block* next[2];                    // Those successors, once linked
+    int32_t branch;                    // Position in ops of the branch ending it, or -1
+    uint64_t runs, taken, mispredicts; // Entries, taken exits and mispredicts (profiling only)
+    std::vector<Decoded> ops;
+};
+
+// An assembler statement, kept between the two passes
+struct Statement {
+    int line;
+    std::string op;
+    std::vector<std::string> args;
+    uint32_t address;
+    uint32_t function;  // Line table entry: function and KIK source line (0 if none)
+    uint32_t source;
+};
+
+// Simulator settings from the command line
+struct Options {
+    std::string input;
+    bool delay_slots;
+    bool stats;
+    bool profile;
+    std::string folded;  // Folded-stack output file, if any
+};
+
+// The simulated machine
+struct Machine {
+    uint32_t regs[33];                 // $0-$31 and the sink for writes to $zero
+    uint32_t hi, lo;
+    uint8_t* mem;                      // Host address of simulated address 0
+    std::vector<uint32_t> text;        // Machine code as assembled; memory holds the live copy
+    uint32_t entry;                    // Text index of the first instruction
+    std::vector<Block*> block_at;      // Valid block starting at each text index, or null
+    std::vector<Block*> live;          // All valid blocks
+    std::vector<std::unique_ptr<Block>> blocks; // Every block translated, kept until exit
+    uint64_t linked;                   // Block exits linked to their successor
+    uint64_t invalidated;              // Blocks dropped after stores into their code
+    uint32_t data_end;                 // End of the static data
+    uint32_t brk;                      // Current end of the heap
+    uint64_t instructions;
+    uint64_t cycles;
+    std::vector<FILE*> files;          // Open files by descriptor; null when closed
+    int exit_code;
+};
+
+// A function of the line table
+struct Function {
+    std::string name;
+    std::string file;  // Empty for runtime helpers and plain assembly
+};
+
+// A node of the profiled call tree: one call path from the entry point
+struct CallNode {
+    uint32_t parent;   // NO_NODE for the root
+    uint32_t function;
+    uint64_t cycles;   // Spent in this path's own code
+};
+
+static const uint32_t NO_NODE = UINT32_MAX;
+
+// A call on the profiler's shadow stack
+struct Frame {
+    uint32_t node;          // The caller's call path
+    uint32_t return_index;  // Text index the call returns to
+};
+
+// The line table, and the profiler's state while the program runs
+struct Profile {
+    std::vector<Function> functions;
+    std::vector<uint32_t> function_of;  // Function of each text word
+    std::vector<uint32_t> line_of;      // KIK source line of each text word, or 0
+    std::vector<uint8_t> counter;       // 2-bit predictor state of each branch
+    std::vector<uint32_t> last_target;  // Last target of each indirect jump
+    std::vector<CallNode> nodes;
+    std::unordered_map<uint64_t, uint32_t> children; // (node, function) to the node it calls
+    std::vector<Frame> stack;
+    uint32_t node;                      // The running call path
+    std::vector<std::pair<const Block*, uint32_t>> cut; // Blocks left early, and how much of each ran
+};
+
+Options O;
+Machine M;
+Profile P;
+
+// --- Helpers ---
+
+/**
+ * @brief Prints an error message and exits the program.
+ * @param s The error message to display.
+ */
+[[noreturn]] void die(const std::string& s) {
+    fflush(stdout);
+    fprintf(stderr, "kiksim: %s\n", s.c_str());
+    exit(1);
+}
+
+/**
+ * @brief Returns a monotonic timestamp in microseconds.
+ */
+double nowUs() {
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Formats a simulated address for messages.
+ */
+std::string hex32(uint32_t v) {
+    char buf[16];
+    snprintf(buf, sizeof buf, "0x%08x", v);
+    return buf;
+}
+
+/**
+ * @brief Reports a fault inside simulated memory as a bad address.
+ */
+void onFault(int sig, siginfo_t* info, void*) {
+    uintptr_t at = (uintptr_t)info->si_addr - (uintptr_t)M.mem;
+    if ((uintptr_t)info->si_addr < (uintptr_t)M.mem || at >= (1ull << 32)) {
+        // Not simulated memory: crash as usual
+        signal(sig, SIG_DFL);
+        return;
+    }
+    fflush(stdout);
+    char msg[64];
+    int len = snprintf(msg, sizeof msg, "kiksim: bad address 0x%08x\n", (unsigned)at);
+    if (write(2, msg, len) < 0) _exit(1);
+    _exit(1);
+}
+
+/**
+ * @brief Reserves the simulated address space and opens up the stack
+ * and the data segment up to the heap base.
+ */
+void mapMemory() {
+    void* base = mmap(nullptr, 1ull << 32, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) die("cannot reserve simulated memory");
+    M.mem = (uint8_t*)base;
+    uint32_t stack_low = STACK_TOP + 4 - STACK_SIZE;
+    if (mprotect(M.mem + stack_low, STACK_SIZE, PROT_READ | PROT_WRITE) == -1) die("cannot map the stack");
+    if (mprotect(M.mem + DATA_BASE, HEAP_BASE - DATA_BASE, PROT_READ | PROT_WRITE) == -1) die("cannot map data");
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = onFault;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, nullptr);
+    sigaction(SIGBUS, &sa, nullptr);
+}
+
+/**
+ * @brief Makes simulated memory [from, to) readable and writable.
+ * @return False if it cannot be mapped.
+ */
+bool growMemory(uint32_t from, uint32_t to) {
+    uint32_t page = 4096;
+    from &= ~(page - 1);
+    to = (to + page - 1) & ~(page - 1);
+    return from >= to || mprotect(M.mem + from, to - from, PROT_READ | PROT_WRITE) == 0;
+}
+
+// --- Assembler ---
+
+/**
+ * @brief Parses a register name ($t0, $31).
+ * @return The register number, or -1.
+ */
+int parseRegister(const std::string& s) {
+    if (s.size() < 2 || s[0] != '$') return -1;
+    std::string name = s.substr(1);
+    if (isdigit((unsigned char)name[0])) {
+        int n = atoi(name.c_str());
+        return n >= 0 && n < 32 ? n : -1;
+    }
+    if (name == "s8") return 30;
+    for (int i = 0; i < 32; i++) {
+        if (name == REG_NAMES[i]) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Parses an integer literal: decimal, hex or a character.
+ * @return False if the text is not a number.
+ */
+bool parseNumber(const std::string& s, int64_t& value) {
+    if (s.size() == 3 && s[0] == '\'' && s[2] == '\'') {
+        value = (unsigned char)s[1];
+        return true;
+    }
+    if (s.empty()) return false;
+    char* end;
+    errno = 0;
+    value = strtoll(s.c_str(), &end, 0);
+    return *end == 0 && errno == 0;
+}
+
+/**
+ * @brief Decodes the escapes in the body of a string directive.
+ */
+std::string unescape(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '\\' || i + 1 == s.size()) {
+            out += s[i];
+            continue;
+        }
+        switch (s[++i]) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case '0': out += '\0'; break;
+            default: out += s[i]; break;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Splits an assembly line into its label definitions, operation
+ * and operands. Comments are dropped; quoted strings stay whole.
+ */
+void splitLine(const std::string& line, std::vector<std::string>& labels, std::string& op,
+               std::vector<std::string>& args) {
+    std::string s;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted && c == '\\' && i + 1 < line.size()) {
+            s += c;
+            s += line[++i];
+            continue;
+        }
+        if (c == '"') quoted = !quoted;
+        if (c == '#' && !quoted) break;
+        s += c;
+    }
+    size_t i = 0;
+    for (;;) {
+        while (i < s.size() && isspace((unsigned char)s[i])) i++;
+        size_t start = i;
+        while (i < s.size() && (isalnum((unsigned char)s[i]) || s[i] == '_' || s[i] == '.' || s[i] == '$')) i++;
+        if (i < s.size() && s[i] == ':' && i > start) {
+            labels.push_back(s.substr(start, i - start));
+            i++;
+            continue;
+        }
+        op = s.substr(start, i - start);
+        break;
+    }
+    std::string arg;
+    quoted = false;
+    for (; i < s.size(); i++) {
+        char c = s[i];
+        if (quoted && c == '\\' && i + 1 < s.size()) {
+            arg += c;
+            arg += s[++i];
+            continue;
+        }
+        if (c == '"') quoted = !quoted;
+        if (c == ',' && !quoted) {
+            args.push_back(arg);
+            arg.clear();
+        } else if (quoted || !isspace((unsigned char)c)) {
+            arg += c;
+        }
+    }
+    if (!arg.empty()) args.push_back(arg);
+}
+
+/**
+ * @brief Returns how many machine words an instruction statement takes.
+ */
+uint32_t instructionWords(const Statement& st) {
+    if (st.op == "la") return 2;
+    if (st.op == "li") {
+        int64_t v;
+        if (st.args.size() == 2 && parseNumber(st.args[1], v)) {
+            if (v >= -32768 && v <= 65535) return 1;
+        }
+        return 2;
+    }
+    return 1;
+}
+
+// Encoding tables: R-type function codes and I/J-type opcodes by mnemonic
+static const std::unordered_map<std::string, int> R_FUNCT = {
+    {"sll", 0}, {"srl", 2}, {"sra", 3}, {"sllv", 4}, {"srlv", 6}, {"srav", 7}, {"jr", 8}, {"jalr", 9},
+    {"syscall", 12}, {"break", 13}, {"mfhi", 16}, {"mflo", 18}, {"mult", 24}, {"multu", 25},
+    {"div", 26}, {"divu", 27}, {"add", 32}, {"addu", 33}, {"sub", 34}, {"subu", 35}, {"and", 36},
+    {"or", 37}, {"xor", 38}, {"nor", 39}, {"slt", 42}, {"sltu", 43}, {"teq", 52}, {"tne", 54}
+};
+static const std::unordered_map<std::string, int> I_OPCODE = {
+    {"j", 2}, {"jal", 3}, {"beq", 4}, {"bne", 5}, {"blez", 6}, {"bgtz", 7}, {"addi", 8}, {"addiu", 9},
+    {"slti", 10}, {"sltiu", 11}, {"andi", 12}, {"ori", 13}, {"xori", 14}, {"lui", 15},
+    {"lb", 32}, {"lh", 33}, {"lw", 35}, {"lbu", 36}, {"lhu", 37}, {"sb", 40}, {"sh", 41}, {"sw", 43}
+};
+
+// The program being assembled
+struct Assembly {
+    std::string path;
+    std::vector<Statement> text;
+    std::vector<uint8_t> data;
+    std::vector<std::pair<uint32_t, Statement>> data_words; // .word operands that name labels
+    std::unordered_map<std::string, uint32_t> labels;
+    uint32_t function;  // Current line table entry
+    uint32_t source;
+    bool marked;        // The file has `# function` comments
+};
+
+/**
+ * @brief Reports an assembly error at a statement's line.
+ */
+[[noreturn]] void asmError(const Assembly& a, const Statement& st, const std::string& message) {
+    die(a.path + ":" + std::to_string(st.line) + ": " + message);
+}
+
+/**
+ * @brief Resolves an operand that is a number or a label.
+ */
+int64_t operandValue(const Assembly& a, const Statement& st, const std::string& s) {
+    int64_t v;
+    if (parseNumber(s, v)) return v;
+    auto it = a.labels.find(s);
+    if (it == a.labels.end()) asmError(a, st, "undefined label '" + s + "'");
+    return it->second;
+}
+
+/**
+ * @brief Parses a register operand.
+ */
+int registerOperand(const Assembly& a, const Statement& st, size_t i) {
+    if (i >= st.args.size()) asmError(a, st, "missing operand for " + st.op);
+    int r = parseRegister(st.args[i]);
+    if (r < 0) asmError(a, st, "bad register '" + st.args[i] + "'");
+    return r;
+}
+
+/**
+ * @brief Parses a memory operand "offset(base)".
+ */
+void memoryOperand(const Assembly& a, const Statement& st, size_t i, int& base, int32_t& offset) {
+    if (i >= st.args.size()) asmError(a, st, "missing operand for " + st.op);
+    const std::string& s = st.args[i];
+    size_t open = s.find('(');
+    if (open == std::string::npos || s.back() != ')') asmError(a, st, "bad memory operand '" + s + "'");
+    offset = open ? (int32_t)operandValue(a, st, s.substr(0, open)) : 0;
+    base = parseRegister(s.substr(open + 1, s.size() - open - 2));
+    if (base < 0 || offset < -32768 || offset > 32767) asmError(a, st, "bad memory operand '" + s + "'");
+}
+
+/**
+ * @brief Reads a line table comment, `# function name in file` or
+ * `# line n`, into the current entry.
+ * @return True if the line is one.
+ */
+bool lineTableEntry(Assembly& a, const std::string& text) {
+    size_t i = text.find_first_not_of(" \t");
+    if (i == std::string::npos || text.compare(i, 2, "# ") != 0) return false;
+    std::string entry = text.substr(i + 2);
+    int64_t n;
+    if (entry.compare(0, 9, "function ") == 0) {
+        Function f = {entry.substr(9), ""};
+        size_t in = f.name.find(" in ");
+        if (in != std::string::npos) {
+            f.file = f.name.substr(in + 4);
+            f.name.resize(in);
+        }
+        P.functions.push_back(f);
+        a.function = (uint32_t)P.functions.size() - 1;
+        a.source = 0;
+        a.marked = true;
+        return true;
+    }
+    if (entry.compare(0, 5, "line ") == 0 && parseNumber(entry.substr(5), n) && n > 0) {
+        a.source = (uint32_t)n;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Reads the source: lays out the data segment, gives every label
+ * its address and reads the line table (first pass).
+ */
+void readAssembly(Assembly& a) {
+    FILE* in = fopen(a.path.c_str(), "r");
+    if (!in) die("cannot read " + a.path);
+    bool in_data = false;
+    uint32_t text_at = TEXT_BASE;
+    P.functions.assign(1, Function{"(unknown)", ""});
+    a.function = a.source = 0;
+    a.marked = false;
+    char buf[65536];
+    for (int line = 1; fgets(buf, sizeof buf, in); line++) {
+        std::vector<std::string> labels, args;
+        std::string op;
+        std::string text = buf;
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) text.pop_back();
+        if (lineTableEntry(a, text)) continue;
+        splitLine(text, labels, op, args);
+        Statement st = {line, op, args, 0, 0, 0};
+        if (op == ".data") in_data = true;
+        if (op == ".text") in_data = false;
+        // Words and halfwords are aligned before their labels are placed
+        std::vector<uint8_t>& d = a.data;
+        if (in_data && (op == ".word" || op == ".half")) {
+            while (d.size() % (op == ".word" ? 4 : 2)) d.push_back(0);
+        }
+        for (const auto& label : labels) {
+            if (a.labels.count(label)) asmError(a, st, "label '" + label + "' defined twice");
+            a.labels[label] = in_data ? DATA_BASE + (uint32_t)d.size() : text_at;
+            if (!in_data && !a.marked) {
+                // No line table: each label starts a function
+                P.functions.push_back(Function{label, ""});
+                a.function = (uint32_t)P.functions.size() - 1;
+            }
+        }
+        if (op.empty() || op == ".data" || op == ".text" || op == ".globl") continue;
+        if (op[0] == '.' && !in_data) asmError(a, st, op + " outside .data");
+        if (op == ".align") {
+            int64_t n = 0;
+            if (args.size() != 1 || !parseNumber(args[0], n) || n < 0 || n > 12) asmError(a, st, "bad .align");
+            while (d.size() % (1u << n)) d.push_back(0);
+        } else if (op == ".asciiz" || op == ".ascii") {
+            if (args.size() != 1 || args[0].size() < 2 || args[0][0] != '"' || args[0].back() != '"') {
+                asmError(a, st, "bad string");
+            }
+            std::string s = unescape(args[0].substr(1, args[0].size() - 2));
+            d.insert(d.end(), s.begin(), s.end());
+            if (op == ".asciiz") d.push_back(0);
+        } else if (op == ".space") {
+            int64_t n = 0;
+            if (args.size() != 1 || !parseNumber(args[0], n) || n < 0) asmError(a, st, "bad .space");
+            d.resize(d.size() + n, 0);
+        } else if (op == ".word" || op == ".half" || op == ".byte") {
+            size_t size = op == ".word" ? 4 : op == ".half" ? 2 : 1;
+            for (const auto& arg : args) {
+                int64_t v = 0;
+                if (!parseNumber(arg, v)) {
+                    if (size != 4) asmError(a, st, "a label needs .word");
+                    Statement ref = st;
+                    ref.args = {arg};
+                    a.data_words.push_back(std::make_pair((uint32_t)d.size(), ref));
+                }
+                for (size_t k = 0; k < size; k++) d.push_back((uint8_t)(v >> (8 * k)));
+            }
+        } else if (op[0] == '.') {
+            asmError(a, st, "unknown directive " + op);
+        } else {
+            if (in_data) asmError(a, st, "instruction in .data");
+            st.address = text_at;
+            st.function = a.function;
+            st.source = a.source;
+            text_at += 4 * instructionWords(st);
+            a.text.push_back(st);
+        }
+    }
+    fclose(in);
+    if (DATA_BASE + a.data.size() > HEAP_BASE) die(a.path + ": data segment too large");
+}
+
+/**
+ * @brief Encodes one statement into machine words (second pass).
+ * Pseudo-instructions expand as SPIM expands them.
+ */
+void encodeStatement(const Assembly& a, const Statement& st, std::vector<uint32_t>& out) {
+    const std::string& op = st.op;
+    auto rtype = [&](int rs, int rt, int rd, int shamt, int funct) {
+        out.push_back((uint32_t)rs << 21 | (uint32_t)rt << 16 | (uint32_t)rd << 11 | (uint32_t)shamt << 6 | funct);
+    };
+    auto itype = [&](int opcode, int rs, int rt, int32_t imm) {
+        out.push_back((uint32_t)opcode << 26 | (uint32_t)rs << 21 | (uint32_t)rt << 16 | (uint16_t)imm);
+    };
+    auto branchOffset = [&](size_t i) {
+        if (i >= st.args.size()) asmError(a, st, "missing branch target");
+        int64_t target = operandValue(a, st, st.args[i]);
+        int64_t offset = (target - (int64_t)(st.address + 4)) / 4;
+        if (offset < -32768 || offset > 32767) asmError(a, st, "branch out of range");
+        return (int32_t)offset;
+    };
+    auto immediate = [&](size_t i, int64_t low, int64_t high) {
+        if (i >= st.args.size()) asmError(a, st, "missing operand for " + op);
+        int64_t v = operandValue(a, st, st.args[i]);
+        if (v < low || v > high) asmError(a, st, "immediate out of range");
+        return (int32_t)v;
+    };
+    if (op == "nop") {
+        out.push_back(0);
+    } else if (op == "move") {
+        rtype(registerOperand(a, st, 1), R_ZERO, registerOperand(a, st, 0), 0, 33);
+    } else if (op == "li" || op == "la") {
+        int rd = registerOperand(a, st, 0);
+        uint32_t v = (uint32_t)immediate(1, INT32_MIN, UINT32_MAX);
+        if (instructionWords(st) == 1) {
+            if ((int32_t)v >= -32768 && (int32_t)v <= 32767) itype(9, R_ZERO, rd, (int32_t)v);
+            else itype(13, R_ZERO, rd, (int32_t)v);
+        } else {
+            itype(15, R_ZERO, rd, (int32_t)(v >> 16));
+            itype(13, rd, rd, (int32_t)(v & 0xffff));
+        }
+    } else if (op == "b") {
+        itype(4, R_ZERO, R_ZERO, branchOffset(0));
+    } else if (op == "beqz" || op == "bnez") {
+        itype(op == "beqz" ? 4 : 5, registerOperand(a, st, 0), R_ZERO, branchOffset(1));
+    } else if (op == "bltz" || op == "bgez") {
+        itype(1, registerOperand(a, st, 0), op == "bgez", branchOffset(1));
+    } else if (op == "mul") {
+        out.push_back(28u << 26 | (uint32_t)registerOperand(a, st, 1) << 21 | (uint32_t)registerOperand(a, st, 2) << 16 |
+                      (uint32_t)registerOperand(a, st, 0) << 11 | 2);
+    } else if (R_FUNCT.count(op)) {
+        int funct = R_FUNCT.at(op);
+        if (op == "sll" || op == "srl" || op == "sra") {
+            rtype(R_ZERO, registerOperand(a, st, 1), registerOperand(a, st, 0), immediate(2, 0, 31), funct);
+        } else if (op == "sllv" || op == "srlv" || op == "srav") {
+            rtype(registerOperand(a, st, 2), registerOperand(a, st, 1), registerOperand(a, st, 0), 0, funct);
+        } else if (op == "jr") {
+            rtype(registerOperand(a, st, 0), 0, 0, 0, funct);
+        } else if (op == "jalr") {
+            rtype(registerOperand(a, st, 0), 0, R_RA, 0, funct);
+        } else if (op == "syscall" || op == "break") {
+            rtype(0, 0, 0, 0, funct);
+        } else if (op == "mfhi" || op == "mflo") {
+            rtype(0, 0, registerOperand(a, st, 0), 0, funct);
+        } else if (funct >= 24 && funct <= 27) {
+            if (st.args.size() != 2) asmError(a, st, op + " takes two registers");
+            rtype(registerOperand(a, st, 0), registerOperand(a, st, 1), 0, 0, funct);
+        } else if (op == "teq" || op == "tne") {
+            rtype(registerOperand(a, st, 0), registerOperand(a, st, 1), 0, 0, funct);
+        } else {
+            rtype(registerOperand(a, st, 1), registerOperand(a, st, 2), registerOperand(a, st, 0), 0, funct);
+        }
+    } else if (I_OPCODE.count(op)) {
+        int opcode = I_OPCODE.at(op);
+        if (op == "j" || op == "jal") {
+            if (st.args.size() != 1) asmError(a, st, "missing jump target");
+            uint32_t target = (uint32_t)operandValue(a, st, st.args[0]);
+            out.push_back((uint32_t)opcode << 26 | ((target >> 2) & 0x3ffffff));
+        } else if (op == "beq" || op == "bne") {
+            itype(opcode, registerOperand(a, st, 0), registerOperand(a, st, 1), branchOffset(2));
+        } else if (op == "blez" || op == "bgtz") {
+            itype(opcode, registerOperand(a, st, 0), 0, branchOffset(1));
+        } else if (op == "lui") {
+            itype(opcode, 0, registerOperand(a, st, 0), immediate(1, 0, 65535));
+        } else if (opcode >= 32) {
+            int base;
+            int32_t offset;
+            memoryOperand(a, st, 1, base, offset);
+            itype(opcode, base, registerOperand(a, st, 0), offset);
+        } else if (op == "andi" || op == "ori" || op == "xori") {
+            itype(opcode, registerOperand(a, st, 1), registerOperand(a, st, 0), immediate(2, 0, 65535));
+        } else {
+            itype(opcode, registerOperand(a, st, 1), registerOperand(a, st, 0), immediate(2, -32768, 32767));
+        }
+    } else {
+        asmError(a, st, "unknown instruction '" + op + "'");
+    }
+}
+
+/**
+ * @brief Assembles a file and loads it into the machine.
+ */
+void loadProgram(const std::string& path) {
+    Assembly a;
+    a.path = path;
+    readAssembly(a);
+    for (const auto& st : a.text) {
+        size_t before = M.text.size();
+        encodeStatement(a, st, M.text);
+        if (M.text.size() - before != instructionWords(st)) asmError(a, st, "internal error: size changed");
+        P.function_of.resize(M.text.size(), st.function);
+        P.line_of.resize(M.text.size(), st.source);
+    }
+    for (const auto& ref : a.data_words) {
+        uint32_t v = (uint32_t)operandValue(a, ref.second, ref.second.args[0]);
+        memcpy(&a.data[ref.first], &v, 4);
+    }
+    memcpy(M.mem + DATA_BASE, a.data.data(), a.data.size());
+    M.data_end = DATA_BASE + (uint32_t)a.data.size();
+    M.brk = HEAP_BASE;
+    size_t text_bytes = std::max<size_t>(M.text.size() * 4, 4);
+    if (!growMemory(TEXT_BASE, TEXT_BASE + text_bytes)) die("cannot map the text");
+    memcpy(M.mem + TEXT_BASE, M.text.data(), M.text.size() * 4);
+    M.block_at.assign(M.text.size() + 1, nullptr);
+    auto main_label = a.labels.find("main");
+    M.entry = main_label != a.labels.end() ? (main_label->second - TEXT_BASE) / 4 : 0;
+    if (main_label != a.labels.end() && (main_label->second < TEXT_BASE || M.entry >= M.text.size())) {
+        die(path + ": main is not in .text");
+    }
+}
+
+// --- Decoder ---
+
+/**
+ * @brief Returns the text index of a code address, or the index just
+ * past the text if the address is outside it.
+ */
+inline uint32_t codeIndex(uint32_t address) {
+    uint32_t i = (address - TEXT_BASE) >> 2;
+    return (address & 3) || i >= M.text.size() ? (uint32_t)M.text.size() : i;
+}
+
+/**
+ * @brief Decodes one machine word.
+ * @param index Its position in the text, for branch targets.
+ */
+Decoded decode(uint32_t word, uint32_t index) {
+    Decoded d = {nullptr, OP_BAD, R_SINK, 0, 0, 0};
+    int opcode = word >> 26, rs = (word >> 21) & 31, rt = (word >> 16) & 31, rd = (word >> 11) & 31;
+    int shamt = (word >> 6) & 31, funct = word & 63;
+    int32_t simm = (int16_t)(word & 0xffff);
+    uint32_t branch = codeIndex(TEXT_BASE + 4 * (index + 1) + simm * 4);
+    d.s = rs;
+    d.t = rt;
+    switch (opcode) {
+        case 0: {
+            static const uint8_t SPECIAL[64] = {
+                OP_SLL, OP_BAD, OP_SRL, OP_SRA, OP_SLLV, OP_BAD, OP_SRLV, OP_SRAV,
+                OP_JR, OP_JALR, OP_BAD, OP_BAD, OP_SYSCALL, OP_BREAK, OP_BAD, OP_BAD,
+                OP_MFHI, OP_BAD, OP_MFLO, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_MULT, OP_MULTU, OP_DIV, OP_DIVU, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_ADD, OP_ADDU, OP_SUB, OP_SUBU, OP_AND, OP_OR, OP_XOR, OP_NOR,
+                OP_BAD, OP_BAD, OP_SLT, OP_SLTU, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_TEQ, OP_BAD, OP_TNE, OP_BAD,
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD
+            };
+            d.op = SPECIAL[funct];
+            d.d = rd ? rd : R_SINK;
+            d.imm = shamt;
+            if (word == 0) d.op = OP_NOP;
+            break;
+        }
+        case 1:
+            d.op = rt == 0 ? OP_BLTZ : rt == 1 ? OP_BGEZ : OP_BAD;
+            d.imm = branch;
+            break;
+        case 2: case 3:
+            d.op = opcode == 2 ? OP_J : OP_JAL;
+            d.imm = codeIndex(((TEXT_BASE + 4 * index) & 0xf0000000) | (word & 0x3ffffff) << 2);
+            break;
+        case 4: case 5: case 6: case 7:
+            d.op = opcode == 4 ? OP_BEQ : opcode == 5 ? OP_BNE : opcode == 6 ? OP_BLEZ : OP_BGTZ;
+            d.imm = branch;
+            break;
+        case 28:
+            d.op = funct == 2 ? OP_MUL : OP_BAD;
+            d.d = rd ? rd : R_SINK;
+            break;
+        default: {
+            static const uint8_t IMMEDIATE[64] = {
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_ADDI, OP_ADDIU, OP_SLTI, OP_SLTIU, OP_ANDI, OP_ORI, OP_XORI, OP_LUI,
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_LB, OP_LH, OP_BAD, OP_LW, OP_LBU, OP_LHU, OP_BAD, OP_BAD,
+                OP_SB, OP_SH, OP_BAD, OP_SW, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+                OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD
+            };
+            d.op = IMMEDIATE[opcode];
+            d.d = rt ? rt : R_SINK;
+            bool zero_extend = opcode >= 12 && opcode <= 14;
+            d.imm = zero_extend ? (int32_t)(word & 0xffff) : opcode == 15 ? (int32_t)(word << 16) : simm;
+            break;
+        }
+    }
+    return d;
+}
+
+/**
+ * @brief Returns the machine word at a text index, as memory holds it now.
+ */
+inline uint32_t textWord(uint32_t index) {
+    uint32_t word;
+    memcpy(&word, M.mem + TEXT_BASE + 4 * index, 4);
+    return word;
+}
+
+/**
+ * @brief Returns whether a decoded instruction transfers control, so
+ * its block ends after it (and its delay slot).
+ */
+bool isBranch(const Decoded& d) {
+    switch (d.op) {
+        case OP_JR: case OP_JALR: case OP_J: case OP_JAL: case OP_BLTZ: case OP_BGEZ: case OP_BEQ:
+        case OP_BNE: case OP_BLEZ: case OP_BGTZ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Translates the block starting at a text index. An index past
+ * the text gives a block that stops the run.
+ * @param handlers Interpreter label of each operation.
+ */
+Block* translate(uint32_t index, const void* const* handlers) {
+    std::unique_ptr<Block> b(new Block());
+    uint32_t words = (uint32_t)M.text.size();
+    b->start = index;
+    b->valid = true;
+    b->next[0] = b->next[1] = nullptr;
+    b->branch = -1;
+    b->runs = b->taken = b->mispredicts = 0;
+    b->exit[0] = words;
+    for (uint32_t i = index;; i++) {
+        Decoded d = i < words ? decode(textWord(i), i) : Decoded{nullptr, OP_END, R_SINK, 0, 0, 0};
+        d.handler = handlers[d.op];
+        b->ops.push_back(d);
+        if (isBranch(d)) {
+            b->branch = (int32_t)b->ops.size() - 1;
+            b->exit[0] = (uint32_t)d.imm;
+            if (O.delay_slots) {
+                // A branch in the last word has its slot past the text
+                Decoded slot = i + 1 < words ? decode(textWord(i + 1), i + 1) : Decoded{nullptr, OP_END, R_SINK, 0, 0, 0};
+                slot.handler = handlers[slot.op];
+                b->ops.push_back(slot);
+            }
+            break;
+        }
+        bool stops = d.op == OP_SYSCALL || d.op == OP_BREAK || d.op == OP_BAD || d.op == OP_END;
+        if (stops || b->ops.size() >= BLOCK_LIMIT) break;
+    }
+    b->length = (uint32_t)b->ops.size();
+    b->exit[1] = std::min(index + b->length, words);
+    b->ops.push_back(Decoded{handlers[OP_EXIT], OP_EXIT, R_SINK, 0, 0, 0});
+    Block* block = b.get();
+    M.block_at[index] = block;
+    M.live.push_back(block);
+    M.blocks.push_back(std::move(b));
+    return block;
+}
+
+/**
+ * @brief Returns the valid block starting at a text index, translating
+ * it if needed.
+ */
+inline Block* blockAt(uint32_t index, const void* const* handlers) {
+    index = std::min(index, (uint32_t)M.text.size());
+    Block* b = M.block_at[index];
+    return b ? b : translate(index, handlers);
+}
+
+/**
+ * @brief Invalidates the blocks whose code a store into the text changed.
+ * @param address First byte stored.
+ * @param size Bytes stored.
+ * @param running The block doing the store.
+ * @param position Index of the store within it.
+ * @return True if the store changed an instruction of the running block
+ * that has not run yet, so the block must be left.
+ */
+bool invalidateCode(uint32_t address, uint32_t size, const Block* running, uint32_t position) {
+    uint32_t first = (address - TEXT_BASE) / 4, last = (address + size - 1 - TEXT_BASE) / 4;
+    bool leave = false;
+    for (size_t i = 0; i < M.live.size();) {
+        Block* b = M.live[i];
+        if (b->start > last || b->start + b->length <= first) {
+            i++;
+            continue;
+        }
+        if (b == running && last > b->start + position) leave = true;
+        b->valid = false;
+        if (M.block_at[b->start] == b) M.block_at[b->start] = nullptr;
+        M.live[i] = M.live.back();
+        M.live.pop_back();
+        M.invalidated++;
+    }
+    return leave;
+}
+
+// --- System Calls ---
+
+/**
+ * @brief Returns the open file for a descriptor, or null.
+ */
+FILE* fileFor(uint32_t fd) {
+    return fd < M.files.size() ? M.files[fd] : nullptr;
+}
+
+/**
+ * @brief Reads one line from stdin, without its newline.
+ * @return False at end of input.
+ */
+bool readLine(std::string& line) {
+    fflush(stdout);
+    line.clear();
+    int c;
+    while ((c = getchar()) != EOF && c != '\n') line += (char)c;
+    return c != EOF || !line.empty();
+}
+
+/**
+ * @brief Runs the system call selected by $v0.
+ * @param at Address of the syscall instruction, for messages.
+ * @return False if the program exits.
+ */
+bool systemCall(uint32_t at) {
+    uint32_t* R = M.regs;
+    uint32_t a0 = R[R_A0], a1 = R[R_A1], a2 = R[R_A2];
+    switch (R[R_V0]) {
+        case 1:
+            printf("%d", (int32_t)a0);
+            break;
+        case 4:
+            fputs((const char*)M.mem + a0, stdout);
+            break;
+        case 5: {
+            std::string line;
+            readLine(line);
+            R[R_V0] = (uint32_t)strtol(line.c_str(), nullptr, 10);
+            break;
+        }
+        case 8: {
+            // Up to a1 - 1 characters, newline included, then a terminator
+            if ((int32_t)a1 < 1) break;
+            fflush(stdout);
+            uint32_t n = 0;
+            int c = 0;
+            while (n + 1 < a1 && c != '\n' && (c = getchar()) != EOF) M.mem[a0 + n++] = (uint8_t)c;
+            M.mem[a0 + n] = 0;
+            break;
+        }
+        case 9: {
+            uint32_t size = (a0 + 3) & ~3u;
+            if ((int32_t)a0 < 0 || M.brk + size > DATA_LIMIT || !growMemory(M.brk, M.brk + size)) {
+                die("sbrk of " + std::to_string((int32_t)a0) + " bytes failed at " + hex32(at));
+            }
+            R[R_V0] = M.brk;
+            M.brk += size;
+            break;
+        }
+        case 10:
+            M.exit_code = 0;
+            return false;
+        case 11:
+            putchar((int)(a0 & 255));
+            break;
+        case 12: {
+            fflush(stdout);
+            int c = getchar();
+            R[R_V0] = c == EOF ? 0 : (uint32_t)c;
+            break;
+        }
+        case 13: {
+            // Flags: 0 read, 1 write, 9 append
+            const char* mode = a1 == 0 ? "rb" : a1 == 1 ? "wb" : a1 == 9 ? "ab" : nullptr;
+            FILE* f = mode ? fopen((const char*)M.mem + a0, mode) : nullptr;
+            if (!f) {
+                R[R_V0] = (uint32_t)-1;
+                break;
+            }
+            size_t fd = 3;
+            while (fd < M.files.size() && M.files[fd]) fd++;
+            if (fd == M.files.size()) M.files.push_back(nullptr);
+            M.files[fd] = f;
+            R[R_V0] = (uint32_t)fd;
+            break;
+        }
+        case 14: {
+            FILE* f = fileFor(a0);
+            if (!f || (int32_t)a2 < 0) {
+                R[R_V0] = (uint32_t)-1;
+                break;
+            }
+            if (f == stdin) fflush(stdout);
+            size_t n = fread(M.mem + a1, 1, a2, f);
+            R[R_V0] = n == 0 && ferror(f) ? (uint32_t)-1 : (uint32_t)n;
+            break;
+        }
+        case 15: {
+            FILE* f = fileFor(a0);
+            R[R_V0] = !f || (int32_t)a2 < 0 ? (uint32_t)-1 : (uint32_t)fwrite(M.mem + a1, 1, a2, f);
+            break;
+        }
+        case 16: {
+            FILE* f = fileFor(a0);
+            if (f && a0 > 2) {
+                fclose(f);
+                M.files[a0] = nullptr;
+            }
+            break;
+        }
+        case 17:
+            M.exit_code = (int32_t)a0;
+            return false;
+        default:
+            die("unknown system call " + std::to_string((int32_t)R[R_V0]) + " at " + hex32(at));
+    }
+    return true;
+}
+
+// --- Profiler ---
+
+// How many hot lines and loops the profile lists
+static const size_t PROFILE_LINES = 20;
+static const size_t PROFILE_LOOPS = 10;
+
+// What the profile counts for an instruction, a line, a loop or a function
+struct Tally {
+    uint64_t cycles, instructions, loads, stores, branches, mispredicts;
+};
+
+/**
+ * @brief Returns whether an operation is a conditional branch.
+ */
+bool isConditional(uint8_t op) {
+    switch (op) {
+        case OP_BLTZ: case OP_BGEZ: case OP_BEQ: case OP_BNE: case OP_BLEZ: case OP_BGTZ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Prepares the profiler: predictors start weakly not taken and
+ * the call tree at the entry point's function.
+ */
+void startProfile() {
+    P.counter.assign(M.text.size(), 1);
+    P.last_target.assign(M.text.size(), UINT32_MAX);
+    P.nodes.assign(1, CallNode{NO_NODE, M.entry < M.text.size() ? P.function_of[M.entry] : 0, 0});
+    P.node = 0;
+}
+
+/**
+ * @brief Enters the call path to a function from the running one.
+ * @param to Text index of the function.
+ * @param return_index Text index the call returns to.
+ */
+void profileCall(uint32_t to, uint32_t return_index) {
+    uint32_t function = to < M.text.size() ? P.function_of[to] : 0;
+    uint64_t key = (uint64_t)P.node << 32 | function;
+    auto it = P.children.find(key);
+    uint32_t child;
+    if (it != P.children.end()) {
+        child = it->second;
+    } else {
+        child = (uint32_t)P.nodes.size();
+        P.nodes.push_back(CallNode{P.node, function, 0});
+        P.children[key] = child;
+    }
+    P.stack.push_back(Frame{P.node, return_index});
+    P.node = child;
+}
+
+/**
+ * @brief Profiles a block's exit: the cycle lost to a taken branch, the
+ * branch predictor and the shadow call stack.
+ * @param way The exit: 0 taken, 1 fall-through, 2 jump register.
+ * @param to Text index control goes to.
+ */
+template <bool Delayed>
+void profileExit(Block* b, int way, uint32_t to) {
+    if (way != 1) {
+        b->taken++;
+        if (!Delayed) P.nodes[P.node].cycles++;
+    }
+    if (b->branch < 0) return;
+    const Decoded& d = b->ops[b->branch];
+    uint32_t at = b->start + b->branch;
+    if (isConditional(d.op)) {
+        uint8_t& state = P.counter[at];
+        bool taken = way == 0;
+        if ((state >= 2) != taken) b->mispredicts++;
+        if (taken && state < 3) state++;
+        if (!taken && state > 0) state--;
+    } else if (d.op == OP_JR && d.s == R_RA) {
+        // A return: predicted by the return stack; unwinds to the frame
+        // it returns to, if there is one
+        if (P.stack.empty() || P.stack.back().return_index != to) b->mispredicts++;
+        size_t i = P.stack.size();
+        while (i > 0 && P.stack[i - 1].return_index != to) i--;
+        if (i > 0) {
+            P.node = P.stack[i - 1].node;
+            P.stack.resize(i - 1);
+        }
+    } else if (d.op == OP_JR || d.op == OP_JALR) {
+        if (P.last_target[at] != to) b->mispredicts++;
+        P.last_target[at] = to;
+    }
+    if (d.op == OP_JAL || d.op == OP_JALR) profileCall(to, at + (Delayed ? 2 : 1));
+}
+
+/**
+ * @brief Takes back the instructions a block did not run, because a
+ * store into its code left it early.
+ * @param ran How many of its instructions ran.
+ */
+void profileCut(const Block* b, uint32_t ran) {
+    P.cut.push_back(std::make_pair(b, ran));
+    P.nodes[P.node].cycles -= b->length - ran;
+}
+
+/**
+ * @brief Adds a number of runs of part of a block to the instructions'
+ * tallies (a negative number takes them back).
+ * @param from First position in the block counted.
+ */
+void tallyRuns(std::vector<Tally>& t, const Block& b, uint32_t from, int64_t runs) {
+    for (uint32_t j = from; j < b.length; j++) {
+        uint32_t i = b.start + j;
+        if (i >= t.size()) break;
+        uint8_t op = b.ops[j].op;
+        t[i].instructions += runs;
+        t[i].cycles += runs;
+        if (op >= OP_LB && op <= OP_LHU) t[i].loads += runs;
+        if (op >= OP_SB && op <= OP_SW) t[i].stores += runs;
+        if (isConditional(op)) t[i].branches += runs;
+    }
+}
+
+/**
+ * @brief Returns the profile of each text word, from the counters of
+ * every block translated.
+ */
+std::vector<Tally> instructionTallies() {
+    std::vector<Tally> t(M.text.size(), Tally());
+    for (const auto& b : M.blocks) {
+        tallyRuns(t, *b, 0, (int64_t)b->runs);
+        uint32_t at = b->start + b->branch;
+        if (b->branch >= 0 && at < t.size()) {
+            t[at].mispredicts += b->mispredicts;
+            if (!O.delay_slots) t[at].cycles += b->taken;
+        }
+    }
+    for (const auto& cut : P.cut) tallyRuns(t, *cut.first, cut.second, -1);
+    return t;
+}
+
+/**
+ * @brief Adds one tally to another.
+ */
+void addTally(Tally& sum, const Tally& t) {
+    sum.cycles += t.cycles;
+    sum.instructions += t.instructions;
+    sum.loads += t.loads;
+    sum.stores += t.stores;
+    sum.branches += t.branches;
+    sum.mispredicts += t.mispredicts;
+}
+
+/**
+ * @brief Names a function, with its file if it has one.
+ */
+std::string functionName(uint32_t function) {
+    const Function& f = P.functions[function];
+    return f.file.empty() ? f.name : f.name + " (" + f.file + ")";
+}
+
+/**
+ * @brief Names a range of source lines of a function: "file:first-last
+ * (function)", or just the function when it has no lines.
+ */
+std::string linesName(uint32_t function, uint32_t first, uint32_t last) {
+    const Function& f = P.functions[function];
+    if (!first) return f.name;
+    std::string lines = std::to_string(first) + (last != first ? "-" + std::to_string(last) : "");
+    return (f.file.empty() ? f.name : f.file) + ":" + lines + " (" + f.name + ")";
+}
+
+/**
+ * @brief Prints one table of the profile, hottest first.
+ * @param title Heading of the table.
+ * @param column Heading of the name column.
+ * @param rows The rows; at most `limit` of them are printed.
+ * @param total Cycles of the whole run, for the percentages.
+ * @param extra An extra column of numbers, one per row, headed `extra_name`.
+ */
+void printTable(const char* title, const char* column, const std::vector<std::pair<Tally, std::string>>& rows,
+                size_t limit, uint64_t total, const std::vector<uint64_t>* extra = nullptr,
+                const char* extra_name = "") {
+    std::vector<size_t> order(rows.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return rows[x].first.cycles > rows[y].first.cycles;
+    });
+    fprintf(stderr, "\n%s:\n%12s %7s %12s %10s %10s %10s %9s", title, "cycles", "%", "instrs", "loads",
+            "stores", "branches", "mispred");
+    if (extra) fprintf(stderr, " %10s", extra_name);
+    fprintf(stderr, "  %s\n", column);
+    for (size_t n = 0; n < order.size() && n < limit; n++) {
+        const Tally& t = rows[order[n]].first;
+        if (!t.cycles) break;
+        fprintf(stderr, "%12llu %6.2f%% %12llu %10llu %10llu %10llu %9llu", (unsigned long long)t.cycles,
+                total ? 100.0 * t.cycles / total : 0.0, (unsigned long long)t.instructions,
+                (unsigned long long)t.loads, (unsigned long long)t.stores, (unsigned long long)t.branches,
+                (unsigned long long)t.mispredicts);
+        if (extra) fprintf(stderr, " %10llu", (unsigned long long)(*extra)[order[n]]);
+        fprintf(stderr, "  %s\n", rows[order[n]].second.c_str());
+    }
+}
+
+/**
+ * @brief Prints the flat profile: the totals, then the functions, the
+ * hottest source lines and the hottest loops. A loop is the code from a
+ * backward branch's target to the branch, counting its own instructions
+ * (and inner loops) but not the functions it calls.
+ */
+void printProfile() {
+    std::vector<Tally> t = instructionTallies();
+    Tally total = Tally();
+    std::vector<std::pair<Tally, std::string>> functions(P.functions.size());
+    std::unordered_map<uint64_t, size_t> line_row;
+    std::vector<std::pair<Tally, std::string>> lines;
+    for (uint32_t i = 0; i < t.size(); i++) {
+        uint32_t f = P.function_of[i], line = P.line_of[i];
+        addTally(total, t[i]);
+        addTally(functions[f].first, t[i]);
+        uint64_t key = (uint64_t)f << 32 | line;
+        auto it = line_row.find(key);
+        if (it == line_row.end()) {
+            it = line_row.insert(std::make_pair(key, lines.size())).first;
+            lines.push_back(std::make_pair(Tally(), linesName(f, line, line)));
+        }
+        addTally(lines[it->second].first, t[i]);
+    }
+    for (uint32_t f = 0; f < functions.size(); f++) functions[f].second = functionName(f);
+
+    // Loops, by header: the back edges to it, the end of the furthest one
+    // (with its delay slot) and how often they were taken
+    std::unordered_map<uint32_t, std::pair<uint32_t, uint64_t>> loops;
+    for (const auto& b : M.blocks) {
+        uint32_t at = b->start + b->branch;
+        if (b->branch < 0 || at >= t.size() || !b->taken) continue;
+        uint8_t op = b->ops[b->branch].op;
+        if (op == OP_JAL || op == OP_JR || op == OP_JALR || b->exit[0] > at) continue;
+        auto& loop = loops[b->exit[0]];
+        loop.first = std::max(loop.first, std::min(at + (O.delay_slots ? 1 : 0), (uint32_t)t.size() - 1));
+        loop.second += b->taken;
+    }
+    std::vector<std::pair<Tally, std::string>> loop_rows;
+    std::vector<uint64_t> iterations;
+    for (const auto& loop : loops) {
+        Tally sum = Tally();
+        uint32_t first = 0, last = 0;
+        for (uint32_t i = loop.first; i <= loop.second.first; i++) {
+            addTally(sum, t[i]);
+            uint32_t line = P.line_of[i];
+            if (line && (!first || line < first)) first = line;
+            last = std::max(last, line);
+        }
+        loop_rows.push_back(std::make_pair(sum, linesName(P.function_of[loop.first], first, last)));
+        iterations.push_back(loop.second.second);
+    }
+
+    fprintf(stderr, "kiksim profile: %llu cycles, %llu instructions, %llu loads, %llu stores, "
+            "%llu branches, %llu mispredicts\n", (unsigned long long)total.cycles,
+            (unsigned long long)total.instructions, (unsigned long long)total.loads,
+            (unsigned long long)total.stores, (unsigned long long)total.branches,
+            (unsigned long long)total.mispredicts);
+    printTable("Functions", "function", functions, functions.size(), total.cycles);
+    printTable("Hot lines", "line", lines, PROFILE_LINES, total.cycles);
+    printTable("Hot loops", "lines", loop_rows, PROFILE_LOOPS, total.cycles, &iterations, "iterations");
+}
+
+/**
+ * @brief Writes the cycles of each call path in folded-stack format:
+ * one line per path, "kik;sort;swap 1234".
+ */
+void writeFolded(const std::string& path) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) die("cannot create " + path);
+    for (uint32_t n = 0; n < P.nodes.size(); n++) {
+        if (!P.nodes[n].cycles) continue;
+        std::string stack;
+        for (uint32_t k = n; k != NO_NODE; k = P.nodes[k].parent) {
+            const std::string& name = P.functions[P.nodes[k].function].name;
+            stack = stack.empty() ? name : name + ";" + stack;
+        }
+        fprintf(out, "%s %llu\n", stack.c_str(), (unsigned long long)P.nodes[n].cycles);
+    }
+    fclose(out);
+}
+
+// --- Interpreter ---
+
+/**
+ * @brief Runs the program from its entry point until it exits.
+ *
+ * Each handler ends by jumping straight to the next micro-op's handler.
+ * A branch picks the block exit to take; without delay slots it leaves
+ * at once, with them it runs the slot first. Leaving a block follows
+ * the exit's link, and links it the first time. Blocks count their
+ * instructions when they are entered. When profiling, blocks also count
+ * their runs and exits, and the exits drive the profiler's models.
+ */
+template <bool Delayed, bool Profiled>
+void run() {
+    static const void* const HANDLERS[OP_COUNT] = {
+        &&op_bad, &&op_end,
+        &&op_sll, &&op_srl, &&op_sra, &&op_sllv, &&op_srlv, &&op_srav, &&op_jr, &&op_jalr, &&op_syscall, &&op_break,
+        &&op_mfhi, &&op_mflo, &&op_mult, &&op_multu, &&op_div, &&op_divu, &&op_add, &&op_addu, &&op_sub, &&op_subu,
+        &&op_and, &&op_or, &&op_xor, &&op_nor, &&op_slt, &&op_sltu, &&op_teq, &&op_tne, &&op_mul,
+        &&op_bltz, &&op_bgez, &&op_j, &&op_jal, &&op_beq, &&op_bne, &&op_blez, &&op_bgtz,
+        &&op_addi, &&op_addiu, &&op_slti, &&op_sltiu, &&op_andi, &&op_ori, &&op_xori, &&op_lui,
+        &&op_lb, &&op_lh, &&op_lw, &&op_lbu, &&op_lhu, &&op_sb, &&op_sh, &&op_sw,
+        &&op_nop, &&op_exit
+    };
+
+    uint32_t* const R = M.regs;
+    uint8_t* const mem = M.mem;
+    const uint32_t text_bytes = 4 * (uint32_t)M.text.size();
+    uint64_t count = 0, taken = 0;
+    Block* cur;                // The running block
+    const Decoded* ip;         // Next micro-op to run
+    const Decoded* d;          // The running micro-op
+    int way = 1;               // Exit the block leaves by: 0 taken, 1 fall-through, 2 `target`
+    uint32_t target = 0;       // Text index for way 2 (jr, jalr)
+    uint32_t a;
+
+// Runs the micro-op at ip
+#define DISPATCH()                          \
+    do {                                    \
+        d = ip++;                           \
+        goto *d->handler;                   \
+    } while (0)
+// Starts running a block
+#define ENTER(block)                        \
+    do {                                    \
+        cur = (block);                      \
+        ip = cur->ops.data();               \
+        count += cur->length;               \
+        way = 1;                            \
+        if (Profiled) {                     \
+            cur->runs++;                    \
+            P.nodes[P.node].cycles += cur->length; \
+        }                                   \
+        DISPATCH();                         \
+    } while (0)
+// Goes on to the block an exit leads to, linking the exit to it
+#define FOLLOW(w)                                                   \
+    do {                                                            \
+        Block* next = cur->next[w];                                 \
+        if (__builtin_expect(!next || !next->valid, 0)) {           \
+            next = cur->next[w] = blockAt(cur->exit[w], HANDLERS);  \
+            M.linked++;                                             \
+        }                                                           \
+        if ((w) != 1) taken++;                                      \
+        if (Profiled) profileExit<Delayed>(cur, w, cur->exit[w]);   \
+        ENTER(next);                                                \
+    } while (0)
+// Leaves the block by an exit, after the delay slot if there is one
+#define EXIT(w)                             \
+    do {                                    \
+        if (Delayed) {                      \
+            way = (w);                      \
+            DISPATCH();                     \
+        }                                   \
+        if ((w) == 0) FOLLOW(0);            \
+        FOLLOW(1);                          \
+    } while (0)
+#define POSITION() ((uint32_t)(d - cur->ops.data()))
+// Address of the running instruction and of the one after its delay slot
+#define PC() (TEXT_BASE + 4 * (cur->start + POSITION()))
+#define RETURN_ADDRESS() (PC() + (Delayed ? 8 : 4))
+#define ALIGNED(address, size) \
+    if ((address) & ((size) - 1)) die("unaligned address " + hex32(address) + " at " + hex32(PC()))
+// Stores into the text invalidate the code they change
+#define STORED(address, size)                                                              \
+    if ((address) - TEXT_BASE < text_bytes && invalidateCode(address, size, cur, POSITION())) \
+        goto resume
+
+    ENTER(blockAt(M.entry, HANDLERS));
+
+op_sll: R[d->d] = R[d->t] << d->imm; DISPATCH();
+op_srl: R[d->d] = R[d->t] >> d->imm; DISPATCH();
+op_sra: R[d->d] = (uint32_t)((int32_t)R[d->t] >> d->imm); DISPATCH();
+op_sllv: R[d->d] = R[d->t] << (R[d->s] & 31); DISPATCH();
+op_srlv: R[d->d] = R[d->t] >> (R[d->s] & 31); DISPATCH();
+op_srav: R[d->d] = (uint32_t)((int32_t)R[d->t] >> (R[d->s] & 31)); DISPATCH();
+op_jr:
+    target = codeIndex(R[d->s]);
+    way = 2;
+    if (Delayed) DISPATCH();
+    goto leave;
+op_jalr:
+    target = codeIndex(R[d->s]);
+    R[d->d] = RETURN_ADDRESS();
+    way = 2;
+    if (Delayed) DISPATCH();
+    goto leave;
+op_syscall:
+    if (!systemCall(PC())) goto done;
+    DISPATCH();
+op_break: die("break at " + hex32(PC()));
+op_mfhi: R[d->d] = M.hi; DISPATCH();
+op_mflo: R[d->d] = M.lo; DISPATCH();
+op_mult: {
+    int64_t p = (int64_t)(int32_t)R[d->s] * (int32_t)R[d->t];
+    M.lo = (uint32_t)p, M.hi = (uint32_t)(p >> 32);
+    DISPATCH();
+}
+op_multu: {
+    uint64_t p = (uint64_t)R[d->s] * R[d->t];
+    M.lo = (uint32_t)p, M.hi = (uint32_t)(p >> 32);
+    DISPATCH();
+}
+op_div: {
+    // Division by zero leaves HI and LO unpredictable; kikc traps before it
+    int32_t x = (int32_t)R[d->s], y = (int32_t)R[d->t];
+    if (y != 0 && !(x == INT32_MIN && y == -1)) M.lo = (uint32_t)(x / y), M.hi = (uint32_t)(x % y);
+    else if (y == -1) M.lo = (uint32_t)x, M.hi = 0;
+    DISPATCH();
+}
+op_divu:
+    if (R[d->t]) M.lo = R[d->s] / R[d->t], M.hi = R[d->s] % R[d->t];
+    DISPATCH();
+op_add: {
+    int32_t sum;
+    if (__builtin_add_overflow((int32_t)R[d->s], (int32_t)R[d->t], &sum)) die("overflow at " + hex32(PC()));
+    R[d->d] = (uint32_t)sum;
+    DISPATCH();
+}
+op_addu: R[d->d] = R[d->s] + R[d->t]; DISPATCH();
+op_sub: {
+    int32_t difference;
+    if (__builtin_sub_overflow((int32_t)R[d->s], (int32_t)R[d->t], &difference)) die("overflow at " + hex32(PC()));
+    R[d->d] = (uint32_t)difference;
+    DISPATCH();
+}
+op_subu: R[d->d] = R[d->s] - R[d->t]; DISPATCH();
+op_and: R[d->d] = R[d->s] & R[d->t]; DISPATCH();
+op_or: R[d->d] = R[d->s] | R[d->t]; DISPATCH();
+op_xor: R[d->d] = R[d->s] ^ R[d->t]; DISPATCH();
+op_nor: R[d->d] = ~(R[d->s] | R[d->t]); DISPATCH();
+op_slt: R[d->d] = (int32_t)R[d->s] < (int32_t)R[d->t]; DISPATCH();
+op_sltu: R[d->d] = R[d->s] < R[d->t]; DISPATCH();
+op_teq: if (R[d->s] == R[d->t]) die("trap at " + hex32(PC())); DISPATCH();
+op_tne: if (R[d->s] != R[d->t]) die("trap at " + hex32(PC())); DISPATCH();
+op_mul: R[d->d] = (uint32_t)((int32_t)R[d->s] * (int64_t)(int32_t)R[d->t]); DISPATCH();
+op_bltz: if ((int32_t)R[d->s] < 0) EXIT(0); EXIT(1);
+op_bgez: if ((int32_t)R[d->s] >= 0) EXIT(0); EXIT(1);
+op_j: EXIT(0);
+op_jal:
+    R[R_RA] = RETURN_ADDRESS();
+    EXIT(0);
+op_beq: if (R[d->s] == R[d->t]) EXIT(0); EXIT(1);
+op_bne: if (R[d->s] != R[d->t]) EXIT(0); EXIT(1);
+op_blez: if ((int32_t)R[d->s] <= 0) EXIT(0); EXIT(1);
+op_bgtz: if ((int32_t)R[d->s] > 0) EXIT(0); EXIT(1);
+op_addi: {
+    int32_t sum;
+    if (__builtin_add_overflow((int32_t)R[d->s], d->imm, &sum)) die("overflow at " + hex32(PC()));
+    R[d->d] = (uint32_t)sum;
+    DISPATCH();
+}
+op_addiu: R[d->d] = R[d->s] + d->imm; DISPATCH();
+op_slti: R[d->d] = (int32_t)R[d->s] < d->imm; DISPATCH();
+op_sltiu: R[d->d] = R[d->s] < (uint32_t)d->imm; DISPATCH();
+op_andi: R[d->d] = R[d->s] & d->imm; DISPATCH();
+op_ori: R[d->d] = R[d->s] | d->imm; DISPATCH();
+op_xori: R[d->d] = R[d->s] ^ d->imm; DISPATCH();
+op_lui: R[d->d] = d->imm; DISPATCH();
+op_lb: R[d->d] = (uint32_t)(int8_t)mem[R[d->s] + d->imm]; DISPATCH();
+op_lh: {
+    a = R[d->s] + d->imm;
+    ALIGNED(a, 2);
+    int16_t v;
+    memcpy(&v, mem + a, 2);
+    R[d->d] = (uint32_t)v;
+    DISPATCH();
+}
+op_lw:
+    a = R[d->s] + d->imm;
+    ALIGNED(a, 4);
+    memcpy(&R[d->d], mem + a, 4);
+    DISPATCH();
+op_lbu: R[d->d] = mem[(uint32_t)(R[d->s] + d->imm)]; DISPATCH();
+op_lhu: {
+    a = R[d->s] + d->imm;
+    ALIGNED(a, 2);
+    uint16_t v;
+    memcpy(&v, mem + a, 2);
+    R[d->d] = v;
+    DISPATCH();
+}
+op_sb:
+    a = R[d->s] + d->imm;
+    mem[a] = (uint8_t)R[d->t];
+    STORED(a, 1);
+    DISPATCH();
+op_sh:
+    a = R[d->s] + d->imm;
+    ALIGNED(a, 2);
+    memcpy(mem + a, &R[d->t], 2);
+    STORED(a, 2);
+    DISPATCH();
+op_sw:
+    a = R[d->s] + d->imm;
+    ALIGNED(a, 4);
+    memcpy(mem + a, &R[d->t], 4);
+    STORED(a, 4);
+    DISPATCH();
+op_nop: DISPATCH();
+op_exit: goto leave;
+op_bad: die("reserved instruction " + hex32(textWord(cur->start + POSITION())) + " at " + hex32(PC()));
+op_end: die("jumped outside the text");
+
+leave:
+    // The end of a block whose exit was chosen earlier: by a jump
+    // register, or by a branch before its delay slot
+    if (way == 2) {
+        taken++;
+        if (Profiled) profileExit<Delayed>(cur, 2, target);
+        ENTER(blockAt(target, HANDLERS));
+    }
+    if (way == 0) FOLLOW(0);
+    FOLLOW(1);
+
+resume:
+    // The store changed code later in this block: go on from the next
+    // instruction, in a fresh translation
+    count -= cur->length - POSITION() - 1;
+    if (Profiled) profileCut(cur, POSITION() + 1);
+    ENTER(blockAt(cur->start + POSITION() + 1, HANDLERS));
+
+#undef DISPATCH
+#undef ENTER
+#undef FOLLOW
+#undef EXIT
+#undef POSITION
+#undef PC
+#undef RETURN_ADDRESS
+#undef ALIGNED
+#undef STORED
+
+done:
+    M.instructions = count;
+    M.cycles = count + (Delayed ? 0 : taken);
+}
+
+// --- Main ---
+
+int main(int argc, char* argv[]) {
+    O.delay_slots = false;
+    O.stats = false;
+    O.profile = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--delay-slots") {
+            O.delay_slots = true;
+        } else if (arg == "--stats") {
+            O.stats = true;
+        } else if (arg == "--profile") {
+            O.profile = true;
+        } else if (arg == "--folded" && i + 1 < argc) {
+            O.folded = argv[++i];
+        } else if (arg[0] == '-' || !O.input.empty()) {
+            O.input.clear();
+            break;
+        } else {
+            O.input = arg;
+        }
+    }
+    if (O.input.empty()) {
+        fprintf(stderr, "Usage: %s [--delay-slots] [--stats] [--profile] [--folded stacks.txt] program.s\n",
+                argv[0]);
+        return 2;
+    }
+
+    mapMemory();
+    loadProgram(O.input);
+    memset(M.regs, 0, sizeof M.regs);
+    M.regs[R_SP] = INITIAL_SP;
+    M.regs[R_GP] = INITIAL_GP;
+    M.files = {stdin, stdout, stderr};
+    static char out_buffer[1 << 16];
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof out_buffer);
+
+    bool profiled = O.profile || !O.folded.empty();
+    if (profiled) startProfile();
+    double start = nowUs();
+    if (O.delay_slots) {
+        if (profiled) run<true, true>();
+        else run<true, false>();
+    } else {
+        if (profiled) run<false, true>();
+        else run<false, false>();
+    }
+    double elapsed = nowUs() - start;
+    fflush(stdout);
+
+    if (O.stats) {
+        fprintf(stderr, "kiksim: %llu instructions, %llu cycles, %.2f ms (%.0f M instructions/s)\n",
+                (unsigned long long)M.instructions, (unsigned long long)M.cycles, elapsed / 1000,
+                elapsed > 0 ? M.instructions / elapsed : 0.0);
+        fprintf(stderr, "kiksim: %zu blocks translated, %llu exits linked, %llu blocks invalidated\n",
+                M.blocks.size(), (unsigned long long)M.linked, (unsigned long long)M.invalidated);
+    }
+    if (O.profile) printProfile();
+    if (!O.folded.empty()) writeFolded(O.folded);
+    return M.exit_code & 255;
+}
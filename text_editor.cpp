@@ -9,15 +9,62 @@
  * - Normal Mode (for navigation and commands)
  * - Insert Mode (for text entry)
  * - File I/O (opening, saving)
- * - Basic navigation (h, j, k, l)
+ * - Basic navigation (h, j, k, l, G)
  * - Basic editing (x for delete, o for new line)
+ * - Count prefixes for motions and edits (e.g. 5000j, 300x, 40G)
  * - Command mode (':') for saving (:w) and quitting (:q, :wq)
+ * - Headless script mode (-s) for batch edits and benchmarking
+ * - Per-stage frame latency statistics (:stats)
+ * - Chrome trace export of editor sessions (KIK_TRACE=/path.json)
+ * - Multiple buffers (:e file, :bn, :bp, :ls) kept in memory
+ * - Split windows (:sp, :vsp; Ctrl-W w to switch, :q to close)
+ * - Server mode (--server) with thin clients (-c) sharing one session
+ * - Session snapshots (:mksession, and on exit) for instant reopening
+ * - Background work (saving, analysis) on a work-stealing thread pool
+ * - Syntax highlighting for KIK sources (.kik files)
+ * - Go to definition (gd) across KIK imports, from a background index
+ * - Live KIK syntax errors in the status bar, checked while idle
+ * - Identifier completion (Ctrl-N, Ctrl-P) in insert mode
+ * - Bracket matching (%) and highlighting of the matching bracket
  *
  * Compilation:
- * g++ -std=c++11 -o kik-editor kik-editor.cpp
+ * g++ -std=c++11 -pthread -o kik-editor kik-editor.cpp
  *
  * Usage:
  * ./kik-editor [filename]
+ * ./kik-editor -s script.keys [filename]
+ * ./kik-editor --server [filename] &
+ * ./kik-editor -c [filename]
+ *
+ * In script mode the keys are read from script.keys instead of the
+ * terminal (a newline counts as Enter, ESC is the raw 0x1b byte) and
+ * nothing is drawn. When the script runs out the buffer is saved, or
+ * written to stdout if it has no file name, and the editor exits.
+ *
+ * Set KIK_TRACE=/path/to/trace.json to record keypresses, renders, file
+ * loads and saves; waits for the next key are separate "read" spans.
+ * The trace is written on exit and can be opened in chrome://tracing or
+ * Perfetto.
+ *
+ * Open buffers stay in memory, so switching between them is instant.
+ * When their total size passes KIK_BUFFER_BUDGET_MB (default 512),
+ * hidden buffers without unsaved changes are dropped, least recently
+ * used first, and re-read from disk when visited again.
+ *
+ * A server keeps its buffers loaded between sessions. Clients (-c) only
+ * pass keys and screen output over the Unix socket named by KIK_SOCKET
+ * (default $XDG_RUNTIME_DIR/kik-editor.sock, or a private directory
+ * /tmp/kik-editor-$UID without it). Both ends check that the other runs
+ * as the same user. Opening a file the server already holds is a buffer
+ * switch, not a re-read. Several clients can attach at once and see the
+ * same screen. :q detaches a client when its last window is closed;
+ * :shutdown stops the server.
+ *
+ * On exit and on :mksession each open file gets a snapshot in
+ * $XDG_CACHE_HOME/kik-editor (default ~/.cache/kik-editor): its line
+ * table, cursor and any unsaved lines. Opening the file again maps the
+ * snapshot and reads the file whole instead of splitting it into lines,
+ * as long as the file's size, mtime and sampled hash still match.
  *
  ******************************************************************************/
 #include <cstdio>
@@ -25,20 +72,49 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <iterator>
 #include <stdexcept>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <climits>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 // POSIX API headers
 #include <termios.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 
 // --- Defines ---
 #define KIK_VERSION "1.0"
 #define CTRL_KEY(k) ((k) & 0x1f)
+#define KIK_MAX_COUNT 999999999 // Upper bound for numeric count prefixes
+#define KIK_STATS_WINDOW 1024   // Recent samples kept per frame stage
+#define KIK_TRACE_CHUNK 4096    // Trace events per buffer chunk
+#define KIK_BUFFER_BUDGET_MB 512 // Default memory budget for open buffers
+#define KIK_SNAPSHOT_MAGIC "KIKSNAP1"
+#define KIK_SNAPSHOT_VERSION 1
+#define KIK_PARSE_DELAY_MS 300 // Typing pause before a KIK buffer is re-checked
+#define KIK_COMPLETION_ITEMS 10 // Candidates shown in the Ctrl-N popup
+#define KIK_BRACKET_BLOCK 256   // Lines per block of the bracket index
+#define KIK_LINE_CHUNK 512      // Lines per chunk of a buffer's line table, up to twice this
 
 // --- Data Structures ---
 
@@ -49,35 +125,763 @@ enum EditorMode {
     COMMAND
 };
 
+// Stages of one pass through the main loop, timed separately
+enum FrameStage {
+    STAGE_READ_KEY,
+    STAGE_PROCESS_KEY,
+    STAGE_SCROLL,
+    STAGE_DRAW_ROWS,
+    STAGE_DRAW_STATUS,
+    STAGE_WRITE,
+    STAGE_COUNT
+};
+
+// Rolling latency samples for one frame stage
+struct StageStats {
+    uint64_t samples[KIK_STATS_WINDOW]; // Ring of recent durations (ns)
+    uint64_t count;                     // Samples recorded so far
+    uint64_t max_ns;                    // Slowest sample ever seen
+};
+
+// Latency statistics for the main loop
+struct FrameStats {
+    StageStats stages[STAGE_COUNT];
+    uint64_t nested_ns;     // Time spent in reads/redraws inside a keypress
+    bool overlay;           // True while :stats is shown
+};
+
+// One begin/end event of the session trace
+struct TraceEvent {
+    const char* name;       // Static string, never freed
+    const char* cat;
+    char phase;             // 'B' or 'E', as in the Chrome trace format
+    uint64_t ts_ns;
+};
+
+// Fixed-size block of a thread's trace events. Only the owning thread
+// writes; `used` publishes finished events to the exit-time reader.
+struct TraceChunk {
+    TraceEvent events[KIK_TRACE_CHUNK];
+    std::atomic<size_t> used;
+    std::atomic<TraceChunk*> next;
+};
+
+// Append-only trace buffer owned by one thread
+struct TraceBuffer {
+    int tid;
+    const char* thread_name;
+    TraceChunk* head;
+    TraceChunk* tail;                       // Touched by the owner only
+    std::atomic<TraceBuffer*> next_buffer;  // Link in the registry
+};
+
+// Process-wide trace recorder, shared by all threads
+struct TraceState {
+    bool enabled;
+    std::string path;
+    uint64_t start_ns;
+    std::atomic<TraceBuffer*> buffers;      // Lock-free registry of buffers
+    std::atomic<int> next_tid;
+};
+
+// Highlight classes of KIK source text
+enum Highlight {
+    HL_NORMAL,
+    HL_COMMENT,
+    HL_KEYWORD,
+    HL_TYPE,
+    HL_STRING,
+    HL_NUMBER,
+    HL_COLON,               // The ':' that ends a condition or label
+    HL_COUNT
+};
+
+// Lexer state carried from the end of one line to the next
+enum LexState {
+    LEX_CODE,
+    LEX_BLOCK_COMMENT
+};
+
+// A top-level KIK declaration found by the symbol indexer
+struct Symbol {
+    std::string name;
+    std::string path;       // Canonical path of the declaring file
+    int line, col;
+    const char* kind;       // "function", "class", "struct", "enum" or "constant"
+    bool has_body;          // False for prototypes like `void output(str s);`
+};
+
+// What the indexer found in one file
+struct FileSymbols {
+    int64_t mtime_ns;       // Of the file when parsed
+    off_t size;
+    std::vector<Symbol> symbols;
+    std::vector<std::string> imports; // As written in `import "...";`
+};
+
+// Names visible from one file: its own declarations, then those of
+// the files it imports, directly or not
+typedef std::unordered_map<std::string, Symbol> SymbolTable;
+
+// How a file an index read looked: the open buffer it came from, or the
+// file on disk. An index is rebuilt only when one of these changes.
+struct IndexInput {
+    bool in_buffer;
+    uint64_t version;       // Of the buffer, if in_buffer
+    int64_t mtime_ns;       // Of the file otherwise; -1 if it could not be read
+    bool operator==(const IndexInput& o) const {
+        return in_buffer == o.in_buffer && version == o.version && mtime_ns == o.mtime_ns;
+    }
+};
+typedef std::unordered_map<std::string, IndexInput> IndexInputs; // By canonical path
+
+// Parsed files, shared by indexing tasks and kept for the whole session,
+// so a re-index only parses the files that changed
+struct SymbolIndex {
+    std::mutex lock;
+    std::unordered_map<std::string, FileSymbols> files; // By canonical path
+};
+
+// One token of KIK source, for the parser
+struct ParseToken {
+    char type;              // 'i' word, 'n' number, 's' string, 'c' char, 'p' punctuation,
+                            // 'x' malformed literal, 'e' end of input
+    std::string text;
+    int line, col;          // Within the chunk being parsed
+};
+
+// Thrown by the parser at the first syntax error
+struct ParseFailure {
+    int line, col;
+    std::string message;
+};
+
+// Outcome of parsing one top-level chunk
+struct ChunkResult {
+    bool ok;
+    int line, col;          // Of the error, within the chunk
+    std::string message;
+    bool is_import;         // For the imports-first check across chunks
+    bool is_empty;          // Only comments or a stray ';'
+};
+
+// A parsed chunk, with its text to tell hash collisions apart
+struct CachedChunk {
+    std::string text;
+    ChunkResult result;
+};
+
+// Chunk results by hash of the chunk's text. Shared by parse tasks, so
+// only top-level declarations whose text changed are parsed again.
+struct ParseCache {
+    std::mutex lock;
+    std::unordered_map<uint64_t, CachedChunk> results;
+};
+
+// One node of a completion trie. Children form a sibling list sorted
+// by character, so walking a subtree yields its words in order.
+struct TrieNode {
+    char c;
+    int32_t parent, child, sibling; // Indices into WordTrie::nodes; -1 for none
+    uint32_t count;         // References to the word ending at this node
+    uint32_t below;         // References to all words in the subtree
+};
+
+// Reference-counted identifiers of one buffer and the libraries it
+// imports. Lines add and drop their references as they change, so the
+// trie never has to be rebuilt by a full scan.
+struct WordTrie {
+    std::vector<TrieNode> nodes; // nodes[0] is the root
+    std::vector<int32_t> unused; // Pruned nodes, reused before growing `nodes`
+};
+
+// Ctrl-N completion in progress
+struct CompletionState {
+    bool active;
+    std::vector<std::string> candidates;
+    int selected;
+    int cy, start;          // Line and column where the completed word begins
+};
+
+// Bracket balance of a run of text, per kind: (), [] and {}
+struct BracketSpan {
+    int32_t delta[3];       // Opening minus closing brackets
+    int32_t min_prefix[3];  // Lowest running balance from the start, at most 0
+    int32_t max_suffix[3];  // Highest balance of any tail, at least 0
+};
+
+// Consecutive lines of a buffer with their combined balance
+struct BracketBlock {
+    std::vector<BracketSpan> lines;
+    BracketSpan total;
+    bool stale;             // Lines changed since `total` was computed
+};
+
+// Per-line bracket balances of a buffer, grouped in blocks so a search
+// skips the lines between two brackets a block at a time
+struct BracketIndex {
+    std::vector<BracketBlock> blocks; // Never empty
+};
+
+// Priority of a background task; higher levels run first
+enum TaskPriority {
+    TASK_LOW,
+    TASK_NORMAL,
+    TASK_HIGH,
+    TASK_PRIORITIES
+};
+
+// Set to true to keep a task from starting and to drop its result.
+// Long-running work may also poll it and return early.
+typedef std::shared_ptr<std::atomic<bool>> CancelToken;
+
+// A unit of background work and what to do with its result
+struct Task {
+    std::function<void()> work;  // Runs on a worker; must not touch editor state
+    std::function<void()> done;  // Runs on the main thread after `work`
+    TaskPriority priority;
+    CancelToken cancel;
+};
+
+// A worker's queued tasks, one deque per priority. The owner takes the
+// newest task from the back; idle workers steal the oldest from the front.
+struct Worker {
+    std::mutex lock;
+    std::deque<Task> queues[TASK_PRIORITIES];
+};
+
+// Background thread pool. Finished tasks are handed to the main loop
+// through `completed`, and a byte on `notify_pipe` wakes it up.
+struct TaskPool {
+    bool started;
+    std::vector<Worker*> workers;   // Never freed: workers run until exit
+    std::mutex idle_lock;
+    std::condition_variable work_ready; // Signalled when a task is queued
+    std::condition_variable all_done;   // Signalled when a task finishes
+    int queued;                     // Tasks waiting in any deque; under idle_lock
+    int outstanding;                // Tasks submitted but not finished; under idle_lock
+    unsigned next_worker;           // Round-robin target for main-thread submissions
+    std::mutex done_lock;
+    std::vector<Task> completed;    // Finished, waiting for their done callback
+    int notify_pipe[2];
+};
+
+// Fixed-size start of a session snapshot file. The file is laid out
+// for mmap: this header, `line_count` SnapshotLine entries, then the
+// text of lines that were not saved to the source file.
+struct SnapshotHeader {
+    char magic[8];          // KIK_SNAPSHOT_MAGIC
+    uint32_t version;
+    uint32_t dirty;         // Nonzero if some lines live in the snapshot
+    uint64_t file_size;     // Source file, as it was when snapshotted
+    int64_t file_mtime_ns;
+    uint64_t file_hash;     // See snapshotFileHash
+    uint64_t line_count;
+    int32_t cx, cy, row_offset, col_offset;
+};
+
+// Where one line's text is: in the source file or in the snapshot
+struct SnapshotLine {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t in_snapshot;
+};
+
+// A restored snapshot, kept while lines are still read from it. The
+// snapshot file is only ever replaced by a rename, so it stays mapped;
+// the source file can be changed by other programs, so it is copied.
+struct Snapshot {
+    const char* map;        // The snapshot file
+    size_t map_size;
+    std::string file;       // The source file, as it was when restored
+    const SnapshotHeader* header;
+    const SnapshotLine* lines;
+    ~Snapshot() {
+        if (map) munmap((void*)map, map_size);
+    }
+};
+
+// A run of consecutive lines of a buffer: `count` unedited lines of the
+// snapshot it was restored from, starting at the snapshot's line
+// `first`, or the lines held in `text`. Background tasks work on copies
+// of a buffer's table that share its chunks (see lineShare), so a shared
+// chunk is copied before it is changed.
+struct LineChunk {
+    std::shared_ptr<Snapshot> snapshot; // Null for lines held in `text`
+    uint32_t first, count;
+    std::shared_ptr<std::vector<std::string>> text;
+    bool shared;            // `text` may be read by a task; main thread only
+};
+
+// The lines of a buffer, in chunks. Copying a table copies the chunk
+// list only, never the text.
+struct LineTable {
+    std::vector<LineChunk> chunks;
+    std::vector<size_t> starts; // Number of the first line of each chunk
+    size_t count = 0;           // Lines in all chunks
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+// An open file: its text and metadata
+struct Buffer {
+    LineTable lines;        // File content; see bufferText and bufferLine
+    std::string filename;   // Name as given by the user
+    std::string path;       // Canonical path, used to find open buffers
+    bool dirty;             // True if there are unsaved changes
+    bool loaded;            // False after eviction; re-read on next visit
+    size_t mem_bytes;       // Approximate memory held by `lines`
+    uint64_t last_used;     // Tick of the last switch to this buffer
+    int saved_cx, saved_cy; // Cursor and scroll when last shown
+    int saved_row_offset, saved_col_offset;
+    bool opened;            // True once read from disk; re-reads keep the cursor
+    uint64_t version;       // Bumped on every edit; background results compare it
+    CancelToken save_token; // The save in progress, if any
+    std::vector<uint8_t> hl_state;     // LexState at the end of each line, for a prefix of the lines
+    std::shared_ptr<const SymbolTable> symbols; // For .kik buffers, once indexed
+    uint64_t symbols_version;          // Buffer version the index was built from
+    IndexInputs symbols_inputs;        // The other files the index was built from
+    CancelToken index_token;           // The indexing task in progress, if any
+    uint64_t parse_version;            // Buffer version last sent to the parser
+    CancelToken parse_token;           // The parse in progress, if any
+    std::string diagnostic;            // First syntax error, shown in the status bar
+    std::unique_ptr<WordTrie> words;   // Completion trie, built on the first Ctrl-N
+    std::vector<std::vector<int32_t>> line_words; // Per line: trie nodes of its identifiers
+    std::shared_ptr<const SymbolTable> word_symbols; // Library names counted in `words`
+    std::unique_ptr<BracketIndex> brackets; // Built on the first bracket lookup
+    std::shared_ptr<Snapshot> snapshot; // Mapped snapshot the buffer was restored from
+};
+
+// A cursor and scroll position over one buffer, shown in one window
+struct View {
+    Buffer* buf;
+    int cx, cy;             // Cursor position within the file buffer
+    int row_offset;         // Vertical scroll position
+    int col_offset;         // Horizontal scroll position
+    int top, left;          // Screen position of the window (0-based)
+    int rows, cols;         // Text area size, without the window's status line
+    std::vector<std::string> rendered; // Drawn text rows, reused while valid
+    std::vector<bool> row_valid;       // False for rows that must be redrawn
+    const Buffer* drawn_buf;           // What `rendered` was drawn from
+    int drawn_row_offset, drawn_col_offset;
+};
+
+// A node of the window layout: a window (leaf) or a split in two
+struct Layout {
+    View* view;             // Set for leaves only
+    bool vertical;          // For splits: true if the halves are side by side
+    std::unique_ptr<Layout> first, second;
+    Layout* parent;
+};
+
+// Message types of the client/server protocol. Each message is the type
+// byte, a 4-byte payload length in host order, then the payload.
+enum MessageType {
+    MSG_HELLO = 'H',        // Client -> server: "rows cols\npath"
+    MSG_RESIZE = 'R',       // Client -> server: "rows cols"
+    MSG_KEYS = 'K',         // Client -> server: raw key bytes
+    MSG_OUTPUT = 'O',       // Server -> client: bytes for the terminal
+    MSG_DETACH = 'D'        // Server -> client: the session ended for it
+};
+
+// A terminal attached to the server
+struct Client {
+    int fd;
+    std::string inbox;      // Received bytes not yet parsed into messages
+    int rows, cols;         // Size of the client's terminal
+};
+
+// State of server mode (--server)
+struct ServerState {
+    bool enabled;
+    int listen_fd;
+    std::string socket_path;
+    std::vector<Client> clients;
+    std::deque<std::pair<int, char>> keys; // Pending keys and the client they came from
+    int active_fd;          // Client whose keys are being processed
+};
+
 // Global struct to hold the editor's state
 struct EditorState {
-    int cx, cy;             // Cursor position within the file buffer
-    int screen_rows;
+    std::vector<std::unique_ptr<Buffer>> buffers; // Open buffers, in :ls order
+    std::vector<std::unique_ptr<View>> views;     // One per window
+    View* view;             // The window being edited
+    std::unique_ptr<Layout> layout; // How the windows share the screen
+    std::vector<std::string> frame; // Screen rows as last written
+    int screen_rows;        // Terminal size
     int screen_cols;
-    int row_offset;
-    int col_offset;    // Vertical scroll position
-    std::vector<std::string> lines; // File content, one string per line
     EditorMode mode;
     std::string status_msg;
-    std::string filename;
-    bool dirty;             // True if there are unsaved changes
+    uint64_t tick;          // Counts buffer switches, for LRU eviction
+    size_t buffer_budget;   // Bytes of buffer text kept before evicting
     struct termios orig_termios;
+    bool headless;          // True when keys come from a script (-s)
+    std::string script;     // Key stream for headless mode
+    size_t script_pos;      // Next key to feed from the script
+    FrameStats stats;       // Per-stage latency histograms
+    uint64_t last_key_ns;   // When the last key was read, for idle work
+    CompletionState completion; // Open Ctrl-N popup, if any
+    const View* match_view; // Window whose cursor bracket is matched
+    const Buffer* match_buf; // Buffer of the highlighted bracket; only compared
+    int match_line, match_col; // The highlighted bracket; -1 if none
 };
 
 EditorState E;
+TraceState Trace;
+ServerState Server;
+TaskPool& Pool = *new TaskPool(); // Never destroyed: idle workers wait on it until exit
+SymbolIndex& Index = *new SymbolIndex(); // Never destroyed: tasks may use it until exit
+ParseCache& Parses = *new ParseCache();  // Never destroyed: tasks may use it until exit
+thread_local int worker_index = -1; // Index into Pool.workers; -1 off the pool
+thread_local TraceBuffer* trace_buffer = nullptr;
 
 // --- Function Prototypes ---
 void enableRawMode();
 void disableRawMode();
 void die(const std::string& s);
 char editorReadKey();
-void editorProcessKeypress();
+void editorProcessKeypress(char c);
 void editorRefreshScreen();
-void editorDrawRows(std::string& buffer);
-void editorDrawStatusBar(std::string& buffer);
-void editorOpen(const char* filename);
+void editorDrawRows();
+void editorDrawStatusBar(std::vector<std::string>& status);
+void editorOpen(Buffer* B);
 void editorSave();
+void editorQuit(int code);
+void editorFinishScript();
 std::string editorPrompt(const std::string& prompt);
+bool sessionRestore(Buffer* B);
+void syntaxRelex(Buffer* B, int from);
+bool bufferIsKik(const Buffer* B);
+int64_t statMtimeNs(const struct stat& st);
+uint64_t fnv1a(uint64_t h, const char* data, size_t len);
+int editorIdleTimeout();
+void editorOnIdle();
+void completionScanLine(Buffer* B, int at);
+void completionReset(Buffer* B);
+void bracketUpdateLine(Buffer* B, int at);
+void bracketInsertLine(Buffer* B, int at);
+void bracketReset(Buffer* B);
+void indexBuffer(Buffer* B);
+void sessionSaveAll(bool include_dirty);
+char serverReadKey();
+void serverBroadcast(char type, const std::string& payload);
+void serverDetach(int fd);
+void serverShutdown();
+
+// --- Frame Statistics ---
+
+static const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "editorReadKey", "editorProcessKeypress", "editorScroll",
+    "editorDrawRows", "editorDrawStatusBar", "write"
+};
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t statsNow() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Adds one duration sample to a stage's rolling window.
+ * @param stage The stage that was timed.
+ * @param ns How long it took.
+ */
+void statsRecord(FrameStage stage, uint64_t ns) {
+    StageStats& st = E.stats.stages[stage];
+    st.samples[st.count % KIK_STATS_WINDOW] = ns;
+    st.count++;
+    if (ns > st.max_ns) st.max_ns = ns;
+}
+
+/**
+ * @brief Returns a percentile over a stage's recent samples.
+ * @param stage The stage to query.
+ * @param pct The percentile, 0-100.
+ * @return The duration in nanoseconds, or 0 without samples.
+ */
+uint64_t statsPercentile(FrameStage stage, int pct) {
+    const StageStats& st = E.stats.stages[stage];
+    size_t n = st.count < KIK_STATS_WINDOW ? st.count : KIK_STATS_WINDOW;
+    if (n == 0) return 0;
+    std::vector<uint64_t> window(st.samples, st.samples + n);
+    size_t k = (n - 1) * pct / 100;
+    std::nth_element(window.begin(), window.begin() + k, window.end());
+    return window[k];
+}
+
+/**
+ * @brief Builds the lines of the :stats overlay.
+ * @return One string per overlay row, not yet clipped to the screen.
+ */
+std::vector<std::string> statsOverlayLines() {
+    std::vector<std::string> out;
+    char line[128];
+    snprintf(line, sizeof(line), " %-22s %10s %10s %10s %8s", "stage (us)", "p50", "p99", "max", "samples");
+    out.push_back(line);
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        FrameStage stage = (FrameStage)i;
+        snprintf(line, sizeof(line), " %-22s %10.1f %10.1f %10.1f %8llu", STAGE_NAMES[i],
+                 statsPercentile(stage, 50) / 1000.0, statsPercentile(stage, 99) / 1000.0,
+                 E.stats.stages[i].max_ns / 1000.0, (unsigned long long)E.stats.stages[i].count);
+        out.push_back(line);
+    }
+    out.push_back(" (last " + std::to_string(KIK_STATS_WINDOW) + " samples; any key closes)");
+    return out;
+}
+
+// --- Tracing ---
+
+/**
+ * @brief Returns the calling thread's trace buffer, creating it on first use.
+ * New buffers are pushed onto the registry with a CAS loop, so recording
+ * never takes a lock.
+ */
+TraceBuffer* traceThreadBuffer() {
+    if (trace_buffer) return trace_buffer;
+    TraceBuffer* buf = new TraceBuffer();
+    buf->tid = ++Trace.next_tid;
+    buf->thread_name = buf->tid == 1 ? "main" : "worker";
+    buf->head = buf->tail = new TraceChunk();
+    buf->head->used.store(0);
+    buf->head->next.store(nullptr);
+    TraceBuffer* old = Trace.buffers.load();
+    do {
+        buf->next_buffer.store(old);
+    } while (!Trace.buffers.compare_exchange_weak(old, buf));
+    trace_buffer = buf;
+    return buf;
+}
+
+/**
+ * @brief Appends one event to the calling thread's trace buffer.
+ * @param name Event name; must be a string literal.
+ * @param cat Event category; must be a string literal.
+ * @param phase 'B' for begin, 'E' for end.
+ */
+void traceEvent(const char* name, const char* cat, char phase) {
+    if (!Trace.enabled) return;
+    TraceBuffer* buf = traceThreadBuffer();
+    TraceChunk* chunk = buf->tail;
+    size_t used = chunk->used.load(std::memory_order_relaxed);
+    if (used == KIK_TRACE_CHUNK) {
+        TraceChunk* fresh = new TraceChunk();
+        fresh->used.store(0);
+        fresh->next.store(nullptr);
+        chunk->next.store(fresh, std::memory_order_release);
+        buf->tail = chunk = fresh;
+        used = 0;
+    }
+    TraceEvent& ev = chunk->events[used];
+    ev.name = name;
+    ev.cat = cat;
+    ev.phase = phase;
+    ev.ts_ns = statsNow();
+    chunk->used.store(used + 1, std::memory_order_release);
+}
+
+// Shorthands for the begin/end halves of a traced span
+void traceBegin(const char* name, const char* cat) { traceEvent(name, cat, 'B'); }
+void traceEnd(const char* name, const char* cat) { traceEvent(name, cat, 'E'); }
+
+/**
+ * @brief Writes all recorded events as Chrome trace JSON.
+ * Registered with atexit, so it runs on every normal exit path.
+ */
+void traceFlush() {
+    FILE* f = fopen(Trace.path.c_str(), "w");
+    if (!f) return;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int pid = getpid();
+    bool first = true;
+    for (TraceBuffer* buf = Trace.buffers.load(); buf; buf = buf->next_buffer.load()) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", pid, buf->tid, buf->thread_name);
+        first = false;
+        for (TraceChunk* chunk = buf->head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            size_t used = chunk->used.load(std::memory_order_acquire);
+            for (size_t i = 0; i < used; i++) {
+                const TraceEvent& ev = chunk->events[i];
+                uint64_t rel = ev.ts_ns > Trace.start_ns ? ev.ts_ns - Trace.start_ns : 0;
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d}",
+                        ev.name, ev.cat, ev.phase, (unsigned long long)(rel / 1000),
+                        (unsigned long long)(rel % 1000), pid, buf->tid);
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
+
+/**
+ * @brief Turns on tracing if KIK_TRACE names an output file.
+ */
+void traceInit() {
+    const char* path = getenv("KIK_TRACE");
+    if (!path || !*path) return;
+    Trace.path = path;
+    Trace.start_ns = statsNow();
+    Trace.enabled = true;
+    traceThreadBuffer(); // The main thread gets tid 1
+    atexit(traceFlush);
+}
+
+// --- Background Tasks ---
+
+/**
+ * @brief Takes the next task for a worker.
+ * Higher priorities come first. Within a priority the worker's own newest
+ * task is preferred, then the oldest task of another worker.
+ * @param index The worker looking for work.
+ * @param task Receives the task.
+ * @return False if every deque is empty.
+ */
+bool taskFind(int index, Task& task) {
+    int n = Pool.workers.size();
+    for (int p = TASK_PRIORITIES - 1; p >= 0; p--) {
+        for (int k = 0; k < n; k++) {
+            Worker& W = *Pool.workers[(index + k) % n];
+            std::lock_guard<std::mutex> guard(W.lock);
+            std::deque<Task>& q = W.queues[p];
+            if (q.empty()) continue;
+            if (k == 0) {
+                task = std::move(q.back());
+                q.pop_back();
+            } else {
+                task = std::move(q.front());
+                q.pop_front();
+            }
+            std::lock_guard<std::mutex> idle(Pool.idle_lock);
+            Pool.queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Body of a worker thread: runs tasks, sleeping when there are none.
+ */
+void taskWorkerLoop(int index) {
+    worker_index = index;
+    while (true) {
+        Task task;
+        if (!taskFind(index, task)) {
+            std::unique_lock<std::mutex> idle(Pool.idle_lock);
+            Pool.work_ready.wait(idle, [] { return Pool.queued > 0; });
+            continue;
+        }
+        if (!*task.cancel) {
+            traceBegin("task", "task");
+            task.work();
+            traceEnd("task", "task");
+        }
+        if (!*task.cancel && task.done) {
+            std::lock_guard<std::mutex> guard(Pool.done_lock);
+            Pool.completed.push_back(std::move(task));
+            write(Pool.notify_pipe[1], "t", 1); // A full pipe already wakes the main loop
+        }
+        std::lock_guard<std::mutex> idle(Pool.idle_lock);
+        Pool.outstanding--;
+        Pool.all_done.notify_all();
+    }
+}
+
+/**
+ * @brief Starts the worker threads on first use.
+ */
+void taskStart() {
+    if (Pool.started) return;
+    if (pipe(Pool.notify_pipe) == -1) die("pipe failed");
+    for (int i = 0; i < 2; i++) {
+        fcntl(Pool.notify_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(Pool.notify_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    int n = std::max(1, std::min((int)std::thread::hardware_concurrency() - 1, 8));
+    for (int i = 0; i < n; i++) Pool.workers.push_back(new Worker());
+    for (int i = 0; i < n; i++) std::thread(taskWorkerLoop, i).detach();
+    Pool.started = true;
+}
+
+/**
+ * @brief Queues work for the thread pool.
+ * @param work Runs on a worker thread. It may read only data it was given.
+ * @param done Runs on the main thread when `work` is finished, unless the
+ * task was cancelled; this is where results are applied to the editor.
+ * @param priority Scheduling priority.
+ * @return The token that cancels the task.
+ */
+CancelToken taskSubmit(std::function<void()> work, std::function<void()> done,
+                       TaskPriority priority = TASK_NORMAL) {
+    taskStart();
+    Task task;
+    task.work = std::move(work);
+    task.done = std::move(done);
+    task.priority = priority;
+    task.cancel = std::make_shared<std::atomic<bool>>(false);
+    CancelToken token = task.cancel;
+
+    // Tasks spawned by a worker stay local to it; the main thread spreads its own
+    int target = worker_index >= 0 ? worker_index : Pool.next_worker++ % Pool.workers.size();
+    {
+        std::lock_guard<std::mutex> idle(Pool.idle_lock);
+        Pool.outstanding++;
+    }
+    {
+        Worker& W = *Pool.workers[target];
+        std::lock_guard<std::mutex> guard(W.lock);
+        W.queues[priority].push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> idle(Pool.idle_lock);
+        Pool.queued++;
+    }
+    Pool.work_ready.notify_one();
+    return token;
+}
+
+/**
+ * @brief Returns the descriptor the main loop polls for finished tasks.
+ * @return The pipe, or -1 (ignored by poll) before any task was submitted.
+ */
+int taskNotifyFd() {
+    return Pool.started ? Pool.notify_pipe[0] : -1;
+}
+
+/**
+ * @brief Runs the done callbacks of finished tasks on the main thread.
+ */
+void taskRunCompletions() {
+    if (!Pool.started) return;
+    char drain[64];
+    while (read(Pool.notify_pipe[0], drain, sizeof(drain)) > 0) {}
+    std::vector<Task> finished;
+    {
+        std::lock_guard<std::mutex> guard(Pool.done_lock);
+        finished.swap(Pool.completed);
+    }
+    for (auto& task : finished) {
+        if (!*task.cancel) task.done();
+    }
+}
+
+/**
+ * @brief Waits until all submitted tasks, and any they led to, are done.
+ * Used before exiting so that background saves are not lost.
+ */
+void taskWaitIdle() {
+    if (!Pool.started) return;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> idle(Pool.idle_lock);
+            Pool.all_done.wait(idle, [] { return Pool.outstanding == 0; });
+        }
+        taskRunCompletions();
+        std::lock_guard<std::mutex> idle(Pool.idle_lock);
+        if (Pool.outstanding == 0) return; // Callbacks may have queued more
+    }
+}
 
 // --- Terminal Control ---
 
@@ -86,8 +890,10 @@ std::string editorPrompt(const std::string& prompt);
  * @param s The error message to display.
  */
 void die(const std::string& s) {
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    if (!E.headless && !Server.enabled) {
+        write(STDOUT_FILENO, "\x1b[2J", 4);
+        write(STDOUT_FILENO, "\x1b[H", 3);
+    }
     perror(s.c_str());
     exit(1);
 }
@@ -122,17 +928,64 @@ void enableRawMode() {
 
 /**
  * @brief Reads a single keypress from standard input.
+ * In headless mode the key comes from the loaded script instead, and
+ * in server mode from the attached clients. Finished background tasks
+ * are applied, and the screen redrawn, while waiting.
  * @return The character that was read.
  */
 char editorReadKey() {
-    int nread;
+    uint64_t start = statsNow();
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) die("read failed");
+    if (E.headless) {
+        if (E.script_pos >= E.script.size()) editorFinishScript();
+        c = E.script[E.script_pos++];
+        if (c == '\n') c = '\r';
+    } else {
+        // The wait is its own span, so a trace tells idle time from work
+        traceBegin("read", "input");
+        if (Server.enabled) {
+            c = serverReadKey();
+        } else {
+            while (true) {
+                struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {taskNotifyFd(), POLLIN, 0}};
+                int ready = poll(fds, 2, editorIdleTimeout());
+                if (ready == -1) {
+                    if (errno == EINTR) continue;
+                    die("poll failed");
+                }
+                if (ready == 0) editorOnIdle();
+                if (fds[1].revents & POLLIN) {
+                    taskRunCompletions();
+                    editorRefreshScreen();
+                }
+                if (fds[0].revents & POLLIN) {
+                    int nread = read(STDIN_FILENO, &c, 1);
+                    if (nread == 1) break;
+                    if (nread == -1 && errno != EAGAIN) die("read failed");
+                }
+            }
+        }
+        traceEnd("read", "input");
     }
+    E.last_key_ns = statsNow();
+    uint64_t elapsed = E.last_key_ns - start;
+    statsRecord(STAGE_READ_KEY, elapsed);
+    E.stats.nested_ns += elapsed;
     return c;
 }
 
+/**
+ * @brief Sends output to the terminal, or to every client in server mode.
+ * @param data The bytes to write.
+ */
+void editorWrite(const std::string& data) {
+    if (Server.enabled) {
+        serverBroadcast(MSG_OUTPUT, data);
+    } else {
+        write(STDOUT_FILENO, data.data(), data.size());
+    }
+}
+
 /**
  * @brief Gets the terminal window size.
  * @param rows Pointer to store the number of rows.
@@ -149,103 +1002,2509 @@ int getWindowSize(int& rows, int& cols) {
     return 0;
 }
 
-// --- Editor Operations ---
+// --- Line Tables ---
 
 /**
- * @brief Initializes the editor state.
+ * @brief Recomputes the first line number of each chunk, from chunk
+ * `from` on, and the line count.
  */
-void initEditor() {
-    E.cx = 0;
-    E.cy = 0;
-    E.row_offset = 0;
-    E.col_offset=0;
-    E.mode = NORMAL;
-    E.status_msg = "HELP: :q = quit | :w = save | :wq = save & quit";
-    E.filename = "[No Name]";
-    E.dirty = false;
+void lineRenumber(LineTable& T, size_t from) {
+    T.starts.resize(T.chunks.size());
+    size_t line = from ? T.starts[from - 1] + T.chunks[from - 1].count : 0;
+    for (size_t c = from; c < T.chunks.size(); c++) {
+        T.starts[c] = line;
+        line += T.chunks[c].count;
+    }
+    T.count = line;
+}
 
-    if (getWindowSize(E.screen_rows, E.screen_cols) == -1) die("getWindowSize failed");
-    E.screen_rows -= 1; // For the status bar
+/**
+ * @brief Finds the chunk holding a line.
+ * @param at The line index; must be in range.
+ */
+size_t lineChunkOf(const LineTable& T, size_t at) {
+    return std::upper_bound(T.starts.begin(), T.starts.end(), at) - T.starts.begin() - 1;
 }
 
 /**
- * @brief Moves the cursor based on keyboard input.
- * @param key The key pressed ('h', 'j', 'k', 'l').
+ * @brief Returns the text of a chunk held in memory for changing it,
+ * copying it first if it was handed to a background task.
  */
-void editorMoveCursor(char key) {
-    switch (key) {
-        case 'h': if (E.cx > 0) E.cx--; break;
-        case 'l': if (E.cy < E.lines.size() && E.cx < E.lines[E.cy].length()) E.cx++; break;
-        case 'k': if (E.cy > 0) E.cy--; break;
-        case 'j': if (E.cy < E.lines.size() - 1) E.cy++; break;
+std::vector<std::string>& lineOwn(LineTable& T, size_t c) {
+    LineChunk& C = T.chunks[c];
+    if (C.shared) {
+        C.text = std::make_shared<std::vector<std::string>>(*C.text);
+        C.shared = false;
     }
-    // Snap cursor to end of line if needed
-    if (E.cy < E.lines.size() && E.cx > E.lines[E.cy].length()) {
-        E.cx = E.lines[E.cy].length();
+    return *C.text;
+}
+
+/**
+ * @brief Copies a table for a background task. The copy shares the
+ * chunks; they are marked so the next change to each copies it first.
+ */
+LineTable lineShare(LineTable& T) {
+    for (auto& C : T.chunks) C.shared = true;
+    return T;
+}
+
+/**
+ * @brief Returns a line for reading, without copying it out of a
+ * snapshot for good.
+ * @param T The table.
+ * @param at The line index; must be in range.
+ * @param scratch Holds the text if it is still in the snapshot.
+ * @return The line, which may be `scratch`.
+ */
+const std::string& lineText(const LineTable& T, size_t at, std::string& scratch) {
+    size_t c = lineChunkOf(T, at);
+    const LineChunk& C = T.chunks[c];
+    if (!C.snapshot) return (*C.text)[at - T.starts[c]];
+    const Snapshot& S = *C.snapshot;
+    const SnapshotLine& L = S.lines[C.first + at - T.starts[c]];
+    scratch.assign((L.in_snapshot ? S.map : S.file.data()) + L.offset, L.length);
+    return scratch;
+}
+
+/**
+ * @brief Makes a chunk start at a line, splitting the chunk holding it.
+ * @param at The line index, or the line count for the end.
+ * @return The index of the chunk that starts at `at`.
+ */
+size_t lineSplit(LineTable& T, size_t at) {
+    if (at == T.count) return T.chunks.size();
+    size_t c = lineChunkOf(T, at);
+    size_t k = at - T.starts[c];
+    if (k == 0) return c;
+    LineChunk tail = T.chunks[c];
+    tail.count -= k;
+    tail.text.reset();
+    if (tail.snapshot) {
+        tail.first += k;
+    } else {
+        std::vector<std::string>& text = lineOwn(T, c);
+        tail.text = std::make_shared<std::vector<std::string>>(std::make_move_iterator(text.begin() + k),
+                                                               std::make_move_iterator(text.end()));
+        tail.shared = false;
+        text.resize(k);
     }
+    T.chunks[c].count = k;
+    T.chunks.insert(T.chunks.begin() + c + 1, tail);
+    lineRenumber(T, c + 1);
+    return c + 1;
 }
 
 /**
- * @brief Inserts a character at the cursor's position.
- * @param c The character to insert.
+ * @brief Returns a line for changing it. A line still in a snapshot is
+ * copied out first, into a neighbouring chunk where there is room.
+ * @param at The line index; must be in range.
  */
-void editorInsertChar(char c) {
-    if (E.cy == E.lines.size()) {
-        E.lines.push_back("");
+std::string& lineEdit(LineTable& T, size_t at) {
+    size_t c = lineChunkOf(T, at);
+    if (T.chunks[c].snapshot) {
+        std::string scratch;
+        std::string text = lineText(T, at, scratch);
+        c = lineSplit(T, at);
+        lineSplit(T, at + 1);
+        if (c > 0 && !T.chunks[c - 1].snapshot && T.chunks[c - 1].count < KIK_LINE_CHUNK) {
+            lineOwn(T, --c).push_back(text);
+            T.chunks[c].count++;
+            T.chunks.erase(T.chunks.begin() + c + 1);
+        } else if (c + 1 < T.chunks.size() && !T.chunks[c + 1].snapshot && T.chunks[c + 1].count < KIK_LINE_CHUNK) {
+            std::vector<std::string>& next = lineOwn(T, c + 1);
+            next.insert(next.begin(), text);
+            T.chunks[c + 1].count++;
+            T.chunks.erase(T.chunks.begin() + c);
+        } else {
+            LineChunk& C = T.chunks[c];
+            C.snapshot.reset();
+            C.first = 0;
+            C.text = std::make_shared<std::vector<std::string>>(1, text);
+            C.shared = false;
+        }
+        lineRenumber(T, c);
     }
-    E.lines[E.cy].insert(E.cx, 1, c);
-    E.cx++;
-    E.dirty = true;
+    return lineOwn(T, c)[at - T.starts[c]];
 }
 
 /**
- * @brief Deletes the character at the cursor's position.
+ * @brief Inserts a line.
+ * @param at Index the new line will have; the line count appends.
  */
-void editorDeleteChar() {
-    if (E.cy >= E.lines.size()) return;
-    if (E.cx > 0) {
-        E.lines[E.cy].erase(E.cx - 1, 1);
-        E.cx--;
-        E.dirty = true;
+void lineInsert(LineTable& T, size_t at, const std::string& text) {
+    size_t c = at < T.count ? lineChunkOf(T, at) : T.chunks.size();
+    if (c < T.chunks.size() && !T.chunks[c].snapshot) {
+        std::vector<std::string>& lines = lineOwn(T, c);
+        lines.insert(lines.begin() + (at - T.starts[c]), text);
+    } else {
+        c = lineSplit(T, at);
+        if (c > 0 && !T.chunks[c - 1].snapshot && T.chunks[c - 1].count < KIK_LINE_CHUNK) {
+            lineOwn(T, --c).push_back(text);
+        } else {
+            LineChunk added = {nullptr, 0, 0, std::make_shared<std::vector<std::string>>(1, text), false};
+            T.chunks.insert(T.chunks.begin() + c, added);
+        }
     }
+    T.chunks[c].count++;
+    lineRenumber(T, c);
+    if (T.chunks[c].count >= 2 * KIK_LINE_CHUNK) lineSplit(T, T.starts[c] + KIK_LINE_CHUNK);
 }
 
 /**
- * @brief Processes keypresses based on the current editor mode.
+ * @brief Removes every line.
  */
-void editorProcessKeypress() {
-    char c = editorReadKey();
+void lineClear(LineTable& T) {
+    std::vector<LineChunk>().swap(T.chunks);
+    std::vector<size_t>().swap(T.starts);
+    T.count = 0;
+}
 
-    if (E.mode == COMMAND) {
-        // Command mode logic is handled within editorPrompt
-        return;
+/**
+ * @brief Copies every line still in a snapshot into memory.
+ */
+void lineMaterialize(LineTable& T) {
+    std::vector<LineChunk> chunks;
+    std::string scratch;
+    for (size_t c = 0; c < T.chunks.size(); c++) {
+        const LineChunk& C = T.chunks[c];
+        if (!C.snapshot) {
+            chunks.push_back(C);
+            continue;
+        }
+        for (uint32_t k = 0; k < C.count; k += KIK_LINE_CHUNK) {
+            LineChunk owned = {nullptr, 0, std::min<uint32_t>(KIK_LINE_CHUNK, C.count - k),
+                               std::make_shared<std::vector<std::string>>(), false};
+            owned.text->reserve(owned.count);
+            for (uint32_t i = 0; i < owned.count; i++) owned.text->push_back(lineText(T, T.starts[c] + k + i, scratch));
+            chunks.push_back(owned);
+        }
     }
+    T.chunks.swap(chunks);
+    lineRenumber(T, 0);
+}
 
-    if (E.mode == INSERT) {
-        switch (c) {
-            case '\x1b': // Escape key
-                E.mode = NORMAL;
-                E.status_msg = "NORMAL MODE";
-                break;
-            case 127: // Backspace
-                editorDeleteChar();
-                break;
-            case '\r': // Enter
-                 if (E.cy == E.lines.size()) {
-                    E.lines.push_back("");
-                } else {
-                    E.lines.insert(E.lines.begin() + E.cy + 1, E.lines[E.cy].substr(E.cx));
-                    E.lines[E.cy] = E.lines[E.cy].substr(0, E.cx);
-                }
-                E.cy++;
-                E.cx = 0;
-                E.dirty = true;
-                break;
+/**
+ * @brief Estimates the memory a table holds; lines still in a snapshot
+ * are counted with the snapshot (see bufferMemory).
+ */
+size_t lineMemory(const LineTable& T) {
+    size_t bytes = T.chunks.capacity() * (sizeof(LineChunk) + sizeof(size_t));
+    for (const auto& C : T.chunks) {
+        if (C.snapshot) continue;
+        bytes += C.text->capacity() * sizeof(std::string);
+        for (const auto& line : *C.text) bytes += line.capacity();
+    }
+    return bytes;
+}
+
+// --- Buffers ---
+
+/**
+ * @brief Resolves a file name to the path used to identify its buffer.
+ * @param filename The name as typed; the file need not exist yet.
+ */
+std::string canonicalPath(const std::string& filename) {
+    char resolved[PATH_MAX];
+    if (realpath(filename.c_str(), resolved)) return resolved;
+    return filename;
+}
+
+/**
+ * @brief Creates an empty, unloaded buffer and adds it to the buffer list.
+ * @param filename The file the buffer belongs to, or "[No Name]".
+ * @return The new buffer, owned by E.buffers.
+ */
+Buffer* editorNewBuffer(const std::string& filename) {
+    Buffer* B = new Buffer();
+    B->filename = filename;
+    B->path = filename == "[No Name]" ? "" : canonicalPath(filename);
+    B->dirty = false;
+    B->loaded = filename == "[No Name]";
+    B->mem_bytes = 0;
+    B->last_used = ++E.tick;
+    B->saved_cx = B->saved_cy = 0;
+    B->saved_row_offset = B->saved_col_offset = 0;
+    B->opened = false;
+    B->version = 0;
+    B->symbols_version = 0;
+    B->parse_version = UINT64_MAX; // Never parsed
+    E.buffers.push_back(std::unique_ptr<Buffer>(B));
+    return B;
+}
+
+/**
+ * @brief Returns a line of a buffer for reading.
+ * Lines of a buffer restored from a snapshot are read from it as they
+ * are asked for, and not kept.
+ * @param B The buffer.
+ * @param at The line index; must be in range.
+ * @param scratch Holds the text of a line still in the snapshot.
+ * @return The line, which may be `scratch`.
+ */
+const std::string& bufferText(const Buffer* B, int at, std::string& scratch) {
+    return lineText(B->lines, at, scratch);
+}
+
+/**
+ * @brief Returns a line of a buffer for editing.
+ * A line still in the buffer's snapshot is copied out first.
+ * @param B The buffer.
+ * @param at The line index; must be in range.
+ */
+std::string& bufferLine(Buffer* B, int at) {
+    return lineEdit(B->lines, at);
+}
+
+/**
+ * @brief Copies every line still in the snapshot and releases it.
+ * Needed once the source file changed, since the snapshot's line table
+ * no longer describes it.
+ */
+void bufferMaterialize(Buffer* B) {
+    if (!B->snapshot) return;
+    lineMaterialize(B->lines);
+    B->snapshot.reset();
+}
+
+/**
+ * @brief Marks the screen rows showing some lines of a buffer for redraw.
+ * Only the affected rows of each window on the buffer are redrawn;
+ * windows on other buffers are left alone.
+ * @param B The buffer that changed.
+ * @param first First changed line.
+ * @param last Last changed line, or INT_MAX when all lines below moved.
+ */
+void bufferInvalidate(const Buffer* B, int first, int last) {
+    for (const auto& v : E.views) {
+        View& V = *v;
+        if (V.buf != B || V.row_valid.empty()) continue;
+        int from = std::max(first, V.row_offset) - V.row_offset;
+        int to = std::min<long long>(last, (long long)V.row_offset + V.rows - 1) - V.row_offset;
+        for (int y = from; y <= to; y++) V.row_valid[y] = false;
+    }
+}
+
+/**
+ * @brief Records an in-place change to one line of a buffer.
+ */
+void bufferRowChanged(Buffer* B, int at) {
+    B->dirty = true;
+    B->version++;
+    bufferInvalidate(B, at, at);
+    syntaxRelex(B, at);
+    bracketUpdateLine(B, at);
+    if (B->words) completionScanLine(B, at);
+}
+
+/**
+ * @brief Inserts a line into a buffer.
+ * @param B The buffer.
+ * @param at Index the new line will have.
+ * @param text Its contents.
+ */
+void bufferInsertRow(Buffer* B, int at, const std::string& text) {
+    lineInsert(B->lines, at, text);
+    B->dirty = true;
+    B->version++;
+    bufferInvalidate(B, at, INT_MAX);
+    if (at < (int)B->hl_state.size()) {
+        // Until re-lexed, the new line passes on the state it started in
+        B->hl_state.insert(B->hl_state.begin() + at, at == 0 ? static_cast<uint8_t>(LEX_CODE) : B->hl_state[at - 1]);
+    }
+    bracketInsertLine(B, at);
+    syntaxRelex(B, at);
+    if (B->words) {
+        B->line_words.insert(B->line_words.begin() + at, std::vector<int32_t>());
+        completionScanLine(B, at);
+    }
+}
+
+/**
+ * @brief Returns true if any window shows the buffer.
+ */
+bool bufferVisible(const Buffer* B) {
+    for (const auto& v : E.views) {
+        if (v->buf == B) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Estimates the memory held by a buffer's text.
+ */
+size_t bufferMemory(const Buffer& B) {
+    return lineMemory(B.lines) + (B.snapshot ? B.snapshot->file.capacity() : 0);
+}
+
+/**
+ * @brief Drops hidden, unmodified buffers while over the memory budget.
+ * The least recently used buffers go first. An evicted buffer stays in
+ * the list and is re-read from its file when it is visited again.
+ * Sizes are measured afresh, since edits change them.
+ */
+void editorEvictBuffers() {
+    size_t total = 0;
+    for (const auto& b : E.buffers) {
+        if (b->loaded) b->mem_bytes = bufferMemory(*b);
+        total += b->mem_bytes;
+    }
+    while (total > E.buffer_budget) {
+        Buffer* victim = nullptr;
+        for (const auto& b : E.buffers) {
+            if (bufferVisible(b.get()) || b->dirty || !b->loaded || b->path.empty()) continue;
+            if (!victim || b->last_used < victim->last_used) victim = b.get();
+        }
+        if (!victim) return;
+        lineClear(victim->lines);
+        std::vector<uint8_t>().swap(victim->hl_state);
+        completionReset(victim);
+        bracketReset(victim);
+        victim->snapshot.reset();
+        victim->loaded = false;
+        total -= victim->mem_bytes;
+        victim->mem_bytes = 0;
+    }
+}
+
+/**
+ * @brief Shows another buffer in the current view.
+ * The cursor of the buffer being left is remembered, and the target's
+ * last cursor is restored. No file is read unless the target was evicted.
+ * @param B The buffer to show.
+ */
+void editorSwitchBuffer(Buffer* B) {
+    View& V = *E.view;
+    Buffer* old = V.buf;
+    if (old == B) return;
+    old->saved_cx = V.cx;
+    old->saved_cy = V.cy;
+    old->saved_row_offset = V.row_offset;
+    old->saved_col_offset = V.col_offset;
+
+    if (!B->loaded) editorOpen(B);
+    V.buf = B;
+    V.row_valid.clear();
+    V.cx = B->saved_cx;
+    V.cy = B->saved_cy;
+    V.row_offset = B->saved_row_offset;
+    V.col_offset = B->saved_col_offset;
+    B->last_used = ++E.tick;
+
+    // The empty buffer the editor starts with is replaced, as in vi
+    if (old->filename == "[No Name]" && !old->dirty && old->lines.empty() && !bufferVisible(old)) {
+        for (size_t i = 0; i < E.buffers.size(); i++) {
+            if (E.buffers[i].get() == old) {
+                E.buffers.erase(E.buffers.begin() + i);
+                break;
+            }
+        }
+    }
+    editorEvictBuffers();
+    if (bufferIsKik(B)) indexBuffer(B); // Skipped unless it or an import changed
+}
+
+/**
+ * @brief Edits a file (:e), reusing its buffer if it is already open.
+ * @param filename The file to edit.
+ */
+void editorEdit(const std::string& filename) {
+    std::string path = canonicalPath(filename);
+    for (const auto& b : E.buffers) {
+        if (b->path == path) {
+            editorSwitchBuffer(b.get());
+            return;
+        }
+    }
+    editorSwitchBuffer(editorNewBuffer(filename));
+}
+
+/**
+ * @brief Switches to the next or previous buffer in the list (:bn, :bp).
+ * @param step 1 for the next buffer, -1 for the previous one.
+ */
+void editorCycleBuffer(int step) {
+    int n = E.buffers.size();
+    for (int i = 0; i < n; i++) {
+        if (E.buffers[i].get() == E.view->buf) {
+            editorSwitchBuffer(E.buffers[((i + step) % n + n) % n].get());
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Lists the open buffers (:ls) in the status message.
+ * `%` marks the current buffer, `+` unsaved changes and `-` an evicted one.
+ */
+void editorListBuffers() {
+    std::string list;
+    for (size_t i = 0; i < E.buffers.size(); i++) {
+        const Buffer& B = *E.buffers[i];
+        list += std::to_string(i + 1);
+        if (&B == E.view->buf) list += "%";
+        if (B.dirty) list += "+";
+        if (!B.loaded) list += "-";
+        list += " \"" + B.filename + "\"  ";
+    }
+    E.status_msg = list;
+}
+
+/**
+ * @brief Returns the first buffer with unsaved changes, if any.
+ */
+Buffer* editorFirstDirtyBuffer() {
+    for (const auto& b : E.buffers) {
+        if (b->dirty) return b.get();
+    }
+    return nullptr;
+}
+
+// --- Syntax Highlighting ---
+
+static const char* const KIK_KEYWORDS[] = {
+    "kik", "import", "constant", "if", "else", "switch", "case", "default",
+    "while", "do", "for", "break", "continue", "return", "class", "struct",
+    "enum", "public", "private", "protected", "virtual", "override", "new",
+    "delete", "try", "catch", "throw", "this", "true", "false", "cout", "cin",
+    "endl", nullptr
+};
+static const char* const KIK_TYPES[] = {
+    "int", "float", "double", "char", "bool", "str", "void", nullptr
+};
+// Lines starting with one of these end in a label colon
+static const char* const KIK_LABELS[] = {
+    "case", "default", "public", "private", "protected", nullptr
+};
+// SGR foreground color per Highlight
+static const char* const HL_COLORS[HL_COUNT] = {
+    "39", "36", "33", "32", "35", "31", "34"
+};
+
+/**
+ * @brief Returns true if the buffer holds KIK source.
+ */
+bool bufferIsKik(const Buffer* B) {
+    const std::string& name = B->filename;
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".kik") == 0;
+}
+
+/**
+ * @brief Returns true if `text[from, from+len)` is one of the words.
+ */
+bool syntaxIsWord(const char* const* words, const std::string& text, size_t from, size_t len) {
+    for (; *words; words++) {
+        if (strlen(*words) == len && text.compare(from, len, *words) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Lexes one line of KIK source.
+ * Handles the token grammar of README.md: keywords and types, numbers,
+ * string and char literals, `//` and `##` line comments, block comments,
+ * and the colon that ends a condition (`if x > 0: {`) or a
+ * label (`case 1:`). Only block comments span lines.
+ * @param line The line's text.
+ * @param state The LexState at the end of the previous line.
+ * @param hl If not null, receives one Highlight per character.
+ * @return The LexState at the end of this line.
+ */
+uint8_t kikLexLine(const std::string& line, uint8_t state, std::vector<uint8_t>* hl) {
+    size_t n = line.size(), i = 0;
+    if (hl) hl->assign(n, HL_NORMAL);
+    auto mark = [&](size_t from, size_t to, uint8_t cls) {
+        if (hl) std::fill(hl->begin() + from, hl->begin() + to, cls);
+    };
+    auto ident = [&](size_t at) { return at < n && (isalnum((unsigned char)line[at]) || line[at] == '_'); };
+
+    size_t first = line.find_first_not_of(" \t");
+    size_t first_end = first;
+    while (ident(first_end)) first_end++;
+    bool label = first != std::string::npos && syntaxIsWord(KIK_LABELS, line, first, first_end - first);
+
+    while (i < n) {
+        if (state == LEX_BLOCK_COMMENT) {
+            size_t end = line.find("*/", i);
+            size_t stop = end == std::string::npos ? n : end + 2;
+            mark(i, stop, HL_COMMENT);
+            if (end != std::string::npos) state = LEX_CODE;
+            i = stop;
+            continue;
+        }
+        char c = line[i];
+        char next = i + 1 < n ? line[i + 1] : '\0';
+        if (c == '/' && next == '*') {
+            state = LEX_BLOCK_COMMENT;
+            mark(i, i + 2, HL_COMMENT);
+            i += 2;
+        } else if ((c == '/' && next == '/') || (c == '#' && next == '#')) {
+            mark(i, n, HL_COMMENT);
+            break;
+        } else if (c == '"' || c == '\'') {
+            size_t j = i + 1;
+            while (j < n && line[j] != c) j += line[j] == '\\' ? 2 : 1;
+            size_t stop = std::min(j + 1, n);
+            mark(i, stop, HL_STRING);
+            i = stop;
+        } else if (isdigit((unsigned char)c) && !(i > 0 && ident(i - 1))) {
+            size_t j = i;
+            while (j < n && (isdigit((unsigned char)line[j]) || line[j] == '.')) j++;
+            mark(i, j, HL_NUMBER);
+            i = j;
+        } else if (ident(i)) {
+            size_t j = i;
+            while (ident(j)) j++;
+            if (syntaxIsWord(KIK_KEYWORDS, line, i, j - i)) mark(i, j, HL_KEYWORD);
+            else if (syntaxIsWord(KIK_TYPES, line, i, j - i)) mark(i, j, HL_TYPE);
+            i = j;
+        } else {
+            if (c == ':') {
+                size_t k = line.find_first_not_of(" \t", i + 1);
+                if (label || k == std::string::npos || line[k] == '{') mark(i, i + 1, HL_COLON);
+            }
+            i++;
+        }
+    }
+    return state;
+}
+
+/**
+ * @brief Returns the lexer state a line starts in.
+ * End states are cached per line; missing ones are computed from the
+ * last cached line onwards, so each line is lexed once until edited.
+ */
+uint8_t syntaxStateBefore(Buffer* B, int at) {
+    std::string scratch;
+    while ((int)B->hl_state.size() < at) {
+        int line = B->hl_state.size();
+        uint8_t prev = line == 0 ? static_cast<uint8_t>(LEX_CODE) : B->hl_state[line - 1];
+        B->hl_state.push_back(kikLexLine(bufferText(B, line, scratch), prev, nullptr));
+    }
+    return at == 0 ? static_cast<uint8_t>(LEX_CODE) : B->hl_state[at - 1];
+}
+
+/**
+ * @brief Updates cached lexer states after a line was edited or inserted.
+ * Lines are re-lexed from the changed one until a line ends in the same
+ * state as before; the lines below it lex exactly as they did. Rows whose
+ * starting state changed are marked for redraw.
+ * @param B The buffer.
+ * @param from The changed line.
+ */
+void syntaxRelex(Buffer* B, int from) {
+    int cached = B->hl_state.size();
+    if (!bufferIsKik(B) || from >= cached) return;
+    uint8_t state = from == 0 ? static_cast<uint8_t>(LEX_CODE) : B->hl_state[from - 1];
+    int line = from;
+    std::string scratch;
+    for (; line < cached; line++) {
+        uint8_t end = kikLexLine(bufferText(B, line, scratch), state, nullptr);
+        bool converged = end == B->hl_state[line];
+        B->hl_state[line] = end;
+        // Later lines start in a new state, so their brackets may now be code
+        if (line > from) bracketUpdateLine(B, line);
+        state = end;
+        if (converged) break;
+    }
+    if (line > from) bufferInvalidate(B, from + 1, line < cached ? line : INT_MAX);
+}
+
+/**
+ * @brief Draws part of a KIK line with colors.
+ * @param B The buffer.
+ * @param at The line.
+ * @param from First column shown.
+ * @param width Columns to fill; the result is padded with spaces.
+ * @param mark Column to show inverted (a matched bracket), or -1.
+ */
+std::string syntaxRenderLine(Buffer* B, int at, size_t from, size_t width, int mark) {
+    std::vector<uint8_t> hl;
+    std::string scratch;
+    const std::string& text = bufferText(B, at, scratch);
+    kikLexLine(text, syntaxStateBefore(B, at), &hl);
+    std::string out;
+    uint8_t current = HL_NORMAL;
+    size_t end = std::min(text.size(), from + width);
+    for (size_t i = from; i < end; i++) {
+        if (hl[i] != current) {
+            current = hl[i];
+            out.append("\x1b[").append(HL_COLORS[current]).append("m");
+        }
+        if ((int)i == mark) out.append("\x1b[7m").append(1, text[i]).append("\x1b[27m");
+        else out += text[i];
+    }
+    if (current != HL_NORMAL) out.append("\x1b[39m");
+    out.append(width - (end > from ? end - from : 0), ' ');
+    return out;
+}
+
+// --- Bracket Matching ---
+
+static const char BRACKET_OPEN[] = "([{";
+static const char BRACKET_CLOSE[] = ")]}";
+
+/**
+ * @brief Returns the kind of a bracket (index into BRACKET_OPEN), or -1.
+ * @param c The character.
+ * @param open Set to true for an opening bracket.
+ */
+int bracketKind(char c, bool& open) {
+    for (int k = 0; k < 3; k++) {
+        if (c == BRACKET_OPEN[k] || c == BRACKET_CLOSE[k]) {
+            open = c == BRACKET_OPEN[k];
+            return k;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the balance of two runs of text, one after the other.
+ */
+BracketSpan bracketJoin(const BracketSpan& a, const BracketSpan& b) {
+    BracketSpan out;
+    for (int k = 0; k < 3; k++) {
+        out.delta[k] = a.delta[k] + b.delta[k];
+        out.min_prefix[k] = std::min(a.min_prefix[k], a.delta[k] + b.min_prefix[k]);
+        out.max_suffix[k] = std::max(b.max_suffix[k], b.delta[k] + a.max_suffix[k]);
+    }
+    return out;
+}
+
+/**
+ * @brief Classifies the characters of a line for bracket matching.
+ * In KIK buffers brackets inside comments and literals do not count.
+ * @param hl Receives the line's highlight classes; left empty when
+ * every character counts.
+ */
+void bracketMask(Buffer* B, int at, std::vector<uint8_t>& hl) {
+    hl.clear();
+    std::string scratch;
+    if (bufferIsKik(B)) kikLexLine(bufferText(B, at, scratch), syntaxStateBefore(B, at), &hl);
+}
+
+/**
+ * @brief Walks a line and tracks how many brackets of one kind are
+ * still unmatched.
+ * @param text The line.
+ * @param hl Its mask from bracketMask.
+ * @param from First column visited.
+ * @param forward Direction; forwards an opening bracket adds one,
+ * backwards a closing one does.
+ * @param kind The bracket kind.
+ * @param need Unmatched brackets; updated as the line is walked.
+ * @return The column where `need` drops to zero, or -1.
+ */
+int bracketScan(const std::string& text, const std::vector<uint8_t>& hl, int from, bool forward, int kind, int& need) {
+    for (int i = from; i >= 0 && i < (int)text.size(); i += forward ? 1 : -1) {
+        if (!hl.empty() && hl[i] != HL_NORMAL) continue;
+        if (text[i] == BRACKET_OPEN[kind]) need += forward ? 1 : -1;
+        else if (text[i] == BRACKET_CLOSE[kind]) need += forward ? -1 : 1;
+        else continue;
+        if (need == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Computes the bracket balance of one line.
+ */
+BracketSpan bracketSummary(Buffer* B, int at) {
+    std::vector<uint8_t> hl;
+    bracketMask(B, at, hl);
+    std::string scratch;
+    const std::string& text = bufferText(B, at, scratch);
+    BracketSpan span = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    for (size_t i = 0; i < text.size(); i++) {
+        bool open;
+        int k = bracketKind(text[i], open);
+        if (k < 0 || (!hl.empty() && hl[i] != HL_NORMAL)) continue;
+        span.delta[k] += open ? 1 : -1;
+        span.min_prefix[k] = std::min(span.min_prefix[k], span.delta[k]);
+    }
+    // The highest tail balance is the total minus the lowest prefix
+    for (int k = 0; k < 3; k++) span.max_suffix[k] = span.delta[k] - span.min_prefix[k];
+    return span;
+}
+
+/**
+ * @brief Recomputes a block's total from its lines.
+ */
+void bracketRecount(BracketBlock& block) {
+    BracketSpan total = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    for (const auto& line : block.lines) total = bracketJoin(total, line);
+    block.total = total;
+    block.stale = false;
+}
+
+/**
+ * @brief Finds the block holding a line.
+ * @param at The line; may be one past the last line.
+ * @param offset Receives the line's index within the block.
+ * @return The block index.
+ */
+size_t bracketLocate(const BracketIndex& X, int at, size_t& offset) {
+    size_t b = 0;
+    for (; b + 1 < X.blocks.size() && at >= (int)X.blocks[b].lines.size(); b++) {
+        at -= X.blocks[b].lines.size();
+    }
+    offset = at;
+    return b;
+}
+
+/**
+ * @brief Summarizes every line of a buffer. Done once, on the first
+ * bracket lookup; edits then update single lines.
+ */
+void bracketBuild(Buffer* B) {
+    traceBegin("bracketBuild", "brackets");
+    B->brackets.reset(new BracketIndex());
+    BracketIndex& X = *B->brackets;
+    X.blocks.push_back(BracketBlock());
+    for (size_t i = 0; i < B->lines.size(); i++) {
+        if (X.blocks.back().lines.size() == KIK_BRACKET_BLOCK) X.blocks.push_back(BracketBlock());
+        X.blocks.back().lines.push_back(bracketSummary(B, i));
+    }
+    for (auto& block : X.blocks) bracketRecount(block);
+    traceEnd("bracketBuild", "brackets");
+}
+
+/**
+ * @brief Updates the summary of a line that changed or was re-lexed.
+ * The block total is recomputed by the next search that needs it, so
+ * re-lexing many lines (an opened block comment) stays linear.
+ */
+void bracketUpdateLine(Buffer* B, int at) {
+    if (!B->brackets) return;
+    size_t offset;
+    BracketBlock& block = B->brackets->blocks[bracketLocate(*B->brackets, at, offset)];
+    block.lines[offset] = bracketSummary(B, at);
+    block.stale = true;
+}
+
+/**
+ * @brief Adds the summary of an inserted line. Blocks that grow past
+ * twice their size are split, so updates stay cheap.
+ */
+void bracketInsertLine(Buffer* B, int at) {
+    if (!B->brackets) return;
+    BracketIndex& X = *B->brackets;
+    size_t offset;
+    size_t b = bracketLocate(X, at, offset);
+    BracketBlock& block = X.blocks[b];
+    block.lines.insert(block.lines.begin() + offset, bracketSummary(B, at));
+    if (block.lines.size() >= 2 * KIK_BRACKET_BLOCK) {
+        BracketBlock tail;
+        tail.lines.assign(block.lines.begin() + KIK_BRACKET_BLOCK, block.lines.end());
+        block.lines.resize(KIK_BRACKET_BLOCK);
+        tail.stale = true;
+        X.blocks.insert(X.blocks.begin() + b + 1, tail);
+    }
+    X.blocks[b].stale = true;
+}
+
+/**
+ * @brief Drops a buffer's bracket index, e.g. when its text is re-read.
+ */
+void bracketReset(Buffer* B) {
+    B->brackets.reset();
+}
+
+/**
+ * @brief Finds the bracket matching the one at a position.
+ * Only the two lines holding the brackets are scanned; the lines in
+ * between are skipped by their summaries, whole blocks at a time.
+ * @param B The buffer.
+ * @param line, col The bracket.
+ * @param match_line, match_col Receive the match.
+ * @return false if there is no bracket there, or it is unmatched.
+ */
+bool bracketMatch(Buffer* B, int line, int col, int& match_line, int& match_col) {
+    if (line >= (int)B->lines.size()) return false;
+    std::string scratch, other_scratch;
+    const std::string& text = bufferText(B, line, scratch);
+    bool open;
+    int kind = col < (int)text.size() ? bracketKind(text[col], open) : -1;
+    if (kind < 0) return false;
+    std::vector<uint8_t> hl;
+    bracketMask(B, line, hl);
+    if (!hl.empty() && hl[col] != HL_NORMAL) return false;
+
+    int need = 0;
+    int found = bracketScan(text, hl, col, open, kind, need);
+    int y = line;
+    if (found < 0) {
+        if (!B->brackets) bracketBuild(B);
+        BracketIndex& X = *B->brackets;
+        size_t offset;
+        size_t b = bracketLocate(X, line, offset);
+        // Does the rest of the search end within this run of text?
+        auto ends_in = [&](const BracketSpan& s) {
+            return open ? need + s.min_prefix[kind] <= 0 : need - s.max_suffix[kind] <= 0;
+        };
+        auto skip = [&](const BracketSpan& s) { need += open ? s.delta[kind] : -s.delta[kind]; };
+        bool hit = false;
+        int step = open ? 1 : -1;
+        // Finish the block holding the line, then skip whole blocks, then
+        // walk the lines of the block that holds the match
+        for (int i = (int)offset + step; !hit && i >= 0 && i < (int)X.blocks[b].lines.size(); i += step) {
+            y += step;
+            if (ends_in(X.blocks[b].lines[i])) hit = true;
+            else skip(X.blocks[b].lines[i]);
+        }
+        for (int j = (int)b + step; !hit && j >= 0 && j < (int)X.blocks.size(); j += step) {
+            BracketBlock& block = X.blocks[j];
+            if (block.stale) bracketRecount(block);
+            if (!ends_in(block.total)) {
+                skip(block.total);
+                y += step * (int)block.lines.size();
+                continue;
+            }
+            int n = block.lines.size();
+            for (int i = open ? 0 : n - 1; !hit; i += step) {
+                y += step;
+                if (ends_in(block.lines[i])) hit = true;
+                else skip(block.lines[i]);
+            }
+        }
+        if (!hit) return false;
+        const std::string& other = bufferText(B, y, other_scratch);
+        bracketMask(B, y, hl);
+        found = bracketScan(other, hl, open ? 0 : (int)other.size() - 1, open, kind, need);
+        if (found < 0) return false;
+    }
+    match_line = y;
+    match_col = found;
+    return true;
+}
+
+/**
+ * @brief Jumps to the bracket matching the one under the cursor (%).
+ * If the cursor is not on a bracket, the first one after it on the
+ * line is used, as in vi.
+ */
+void editorJumpToMatch() {
+    View& V = *E.view;
+    Buffer* B = V.buf;
+    if (V.cy >= (int)B->lines.size()) return;
+    std::string scratch;
+    const std::string& text = bufferText(B, V.cy, scratch);
+    std::vector<uint8_t> hl;
+    bracketMask(B, V.cy, hl);
+    int col = V.cx;
+    bool open;
+    while (col < (int)text.size() && (bracketKind(text[col], open) < 0 || (!hl.empty() && hl[col] != HL_NORMAL))) col++;
+    int line, match;
+    if (bracketMatch(B, V.cy, col, line, match)) {
+        V.cy = line;
+        V.cx = match;
+    } else {
+        E.status_msg = col < (int)text.size() ? "Unmatched bracket" : "No bracket on this line";
+    }
+}
+
+/**
+ * @brief Finds the bracket to highlight for the cursor of the current
+ * window and marks the rows that gain or lose the highlight for redraw.
+ */
+void editorUpdateMatch() {
+    View& V = *E.view;
+    int line = -1, col = -1;
+    if (E.mode != COMMAND && !bracketMatch(V.buf, V.cy, V.cx, line, col)) line = col = -1;
+    if (E.match_view == &V && E.match_buf == V.buf && E.match_line == line && E.match_col == col) return;
+    if (E.match_buf && E.match_line >= 0) bufferInvalidate(E.match_buf, E.match_line, E.match_line);
+    if (line >= 0) bufferInvalidate(V.buf, line, line);
+    E.match_view = &V;
+    E.match_buf = V.buf;
+    E.match_line = line;
+    E.match_col = col;
+}
+
+// --- Symbol Index ---
+
+/**
+ * @brief Records a declaration unless a better one of the name is known.
+ * Definitions replace prototypes of the same file, so a function with a
+ * forward declaration resolves to its body.
+ */
+void indexAdd(FileSymbols& out, const std::string& name, const std::string& path,
+              int line, int col, const char* kind, bool has_body) {
+    for (auto& sym : out.symbols) {
+        if (sym.name != name) continue;
+        if (!sym.has_body && has_body) {
+            sym.line = line;
+            sym.col = col;
+            sym.kind = kind;
+            sym.has_body = true;
+        }
+        return;
+    }
+    Symbol sym = {name, path, line, col, kind, has_body};
+    out.symbols.push_back(sym);
+}
+
+// One token of a top-level declaration
+struct IndexToken {
+    std::string text;
+    int line, col;
+    char type;              // 'i' identifier, 'n' number, 's' string, 'p' punctuation
+};
+
+/**
+ * @brief Classifies the tokens of one top-level declaration.
+ * @param stmt Tokens up to the `;` or `{` that ended it.
+ * @param has_body True if a `{` followed, i.e. a definition.
+ */
+void indexDeclaration(const std::vector<IndexToken>& stmt, const std::string& path,
+                      bool has_body, FileSymbols& out) {
+    if (stmt.empty()) return;
+    const std::string& first = stmt[0].text;
+    if (first == "import") {
+        if (stmt.size() >= 2 && stmt[1].type == 's') out.imports.push_back(stmt[1].text);
+        return;
+    }
+    if (first == "class" || first == "struct" || first == "enum") {
+        if (stmt.size() >= 2 && stmt[1].type == 'i') {
+            indexAdd(out, stmt[1].text, path, stmt[1].line, stmt[1].col,
+                     first == "class" ? "class" : first == "struct" ? "struct" : "enum", has_body);
+        }
+        return;
+    }
+    if (first == "constant") {
+        // constant [type] NAME = value
+        for (size_t k = 1; k < stmt.size(); k++) {
+            if (stmt[k].text == "=" && stmt[k - 1].type == 'i') {
+                indexAdd(out, stmt[k - 1].text, path, stmt[k - 1].line, stmt[k - 1].col, "constant", true);
+                break;
+            }
+        }
+        return;
+    }
+    // type NAME ( ... ) -- the return type may be a class name
+    for (size_t k = 2; k < stmt.size(); k++) {
+        if (stmt[k].text != "(") continue;
+        if (stmt[k - 1].type == 'i' && stmt[k - 2].type == 'i') {
+            indexAdd(out, stmt[k - 1].text, path, stmt[k - 1].line, stmt[k - 1].col, "function", has_body);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Finds the imports and top-level declarations of a KIK file.
+ * Only brace depth 0 is looked at; comments and literals are skipped.
+ * @param lines The file's text.
+ * @param path Its canonical path, recorded in each symbol.
+ * @param out Receives the declarations and imports.
+ */
+void indexParse(const LineTable& lines, const std::string& path, FileSymbols& out) {
+    std::vector<IndexToken> stmt;
+    int depth = 0;
+    bool in_comment = false;
+    std::string scratch;
+    for (int y = 0; y < (int)lines.size(); y++) {
+        const std::string& s = lineText(lines, y, scratch);
+        size_t n = s.size(), i = 0;
+        while (i < n) {
+            if (in_comment) {
+                size_t end = s.find("*/", i);
+                if (end == std::string::npos) break;
+                in_comment = false;
+                i = end + 2;
+                continue;
+            }
+            char c = s[i];
+            char next = i + 1 < n ? s[i + 1] : '\0';
+            if (c == '/' && next == '*') {
+                in_comment = true;
+                i += 2;
+            } else if ((c == '/' && next == '/') || (c == '#' && next == '#')) {
+                break;
+            } else if (c == '"' || c == '\'') {
+                size_t j = i + 1;
+                while (j < n && s[j] != c) j += s[j] == '\\' ? 2 : 1;
+                if (depth == 0) {
+                    IndexToken tok = {s.substr(i + 1, std::min(j, n) - i - 1), y, (int)i, 's'};
+                    stmt.push_back(tok);
+                }
+                i = j + 1;
+            } else if (isalnum((unsigned char)c) || c == '_') {
+                size_t j = i;
+                while (j < n && (isalnum((unsigned char)s[j]) || s[j] == '_')) j++;
+                if (depth == 0) {
+                    IndexToken tok = {s.substr(i, j - i), y, (int)i, isdigit((unsigned char)c) ? 'n' : 'i'};
+                    stmt.push_back(tok);
+                }
+                i = j;
+            } else {
+                if (c == '{') {
+                    if (depth == 0) indexDeclaration(stmt, path, true, out);
+                    depth++;
+                } else if (c == '}') {
+                    depth = std::max(depth - 1, 0);
+                } else if (c == ';' && depth == 0) {
+                    indexDeclaration(stmt, path, false, out);
+                } else if (depth == 0 && !isspace((unsigned char)c)) {
+                    IndexToken tok = {std::string(1, c), y, (int)i, 'p'};
+                    stmt.push_back(tok);
+                }
+                if (depth == 0 && (c == '{' || c == '}' || c == ';')) stmt.clear();
+                i++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Finds the file an import names.
+ * Looks next to the importing file, then in a KIK-Library directory
+ * beside it or beside any of its parent directories, then in the
+ * colon-separated directories of KIK_PATH.
+ * @param name The imported name, e.g. "io.kik".
+ * @param dir Directory of the importing file.
+ * @return The canonical path, or "" if the import cannot be found.
+ */
+std::string indexResolveImport(const std::string& name, const std::string& dir) {
+    std::vector<std::string> candidates;
+    candidates.push_back(dir + "/" + name);
+    for (std::string d = dir; !d.empty();) {
+        candidates.push_back(d + "/KIK-Library/" + name);
+        size_t slash = d.rfind('/');
+        d = slash == std::string::npos || slash == 0 ? "" : d.substr(0, slash);
+    }
+    if (const char* env = getenv("KIK_PATH")) {
+        std::string paths = env;
+        for (size_t start = 0; start <= paths.size();) {
+            size_t end = paths.find(':', start);
+            if (end == std::string::npos) end = paths.size();
+            if (end > start) candidates.push_back(paths.substr(start, end - start) + "/" + name);
+            start = end + 1;
+        }
+    }
+    for (const auto& c : candidates) {
+        if (access(c.c_str(), R_OK) == 0) return canonicalPath(c);
+    }
+    return "";
+}
+
+/**
+ * @brief Returns the parsed declarations of a file on disk.
+ * Runs on a worker. Files are only re-parsed when their size or mtime
+ * changed since the last time.
+ * @return False if the file cannot be read.
+ */
+bool indexFile(const std::string& path, FileSymbols& out) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) return false;
+    {
+        std::lock_guard<std::mutex> guard(Index.lock);
+        auto it = Index.files.find(path);
+        if (it != Index.files.end() && it->second.mtime_ns == statMtimeNs(st) && it->second.size == st.st_size) {
+            out = it->second;
+            return true;
+        }
+    }
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    LineTable lines;
+    std::string line;
+    while (getline(file, line)) {
+        // Strip trailing carriage returns, as editorOpen does
+        while (!line.empty() && line.back() == '\r') line.pop_back();
+        lineInsert(lines, lines.size(), line);
+    }
+    out = FileSymbols();
+    out.mtime_ns = statMtimeNs(st);
+    out.size = st.st_size;
+    indexParse(lines, path, out);
+    std::lock_guard<std::mutex> guard(Index.lock);
+    Index.files[path] = out;
+    return true;
+}
+
+/**
+ * @brief Returns how a file read by an index looks now: the modified
+ * .kik buffer holding it, else the file on disk.
+ * @param path Its canonical path.
+ */
+IndexInput indexInputOf(const std::string& path) {
+    for (const auto& b : E.buffers) {
+        if (b->path != path || !b->dirty || !b->loaded || !bufferIsKik(b.get())) continue;
+        IndexInput input = {true, b->version, 0};
+        return input;
+    }
+    struct stat st;
+    IndexInput input = {false, 0, stat(path.c_str(), &st) == -1 ? -1 : statMtimeNs(st)};
+    return input;
+}
+
+/**
+ * @brief Rebuilds a .kik buffer's symbol table in the background.
+ * The buffer's own text is parsed as it is in memory, along with any
+ * other modified .kik buffers; imported files that are not open with
+ * changes come from disk through the shared file cache. The import
+ * graph is walked breadth first, so nearer declarations win. Nothing is
+ * done if neither the buffer nor any file the last index read changed.
+ */
+void indexBuffer(Buffer* B) {
+    if (B->path.empty() || !B->loaded) return;
+    if (B->symbols && B->symbols_version == B->version) {
+        bool changed = false;
+        for (const auto& input : B->symbols_inputs) {
+            if (!(indexInputOf(input.first) == input.second)) {
+                changed = true;
+                break;
+            }
+        }
+        if (!changed) return;
+    }
+    typedef std::unordered_map<std::string, LineTable> TextMap;
+    std::shared_ptr<TextMap> texts = std::make_shared<TextMap>();
+    IndexInputs buffered;
+    for (const auto& b : E.buffers) {
+        if (b.get() != B && (!b->dirty || !b->loaded || !bufferIsKik(b.get()))) continue;
+        (*texts)[b->path] = lineShare(b->lines);
+        IndexInput input = {true, b->version, 0};
+        buffered[b->path] = input;
+    }
+    std::shared_ptr<SymbolTable> table = std::make_shared<SymbolTable>();
+    std::shared_ptr<IndexInputs> inputs = std::make_shared<IndexInputs>();
+    std::string root = B->path;
+    uint64_t version = B->version;
+    if (B->index_token) *B->index_token = true;
+    B->index_token = taskSubmit([=]() {
+        std::deque<std::string> queue(1, root);
+        std::unordered_set<std::string> seen(queue.begin(), queue.end());
+        while (!queue.empty()) {
+            std::string path = queue.front();
+            queue.pop_front();
+            FileSymbols fs;
+            auto text = texts->find(path);
+            if (text != texts->end()) {
+                indexParse(text->second, path, fs);
+                if (path != root) (*inputs)[path] = buffered.at(path);
+            } else {
+                bool found = indexFile(path, fs);
+                IndexInput input = {false, 0, found ? fs.mtime_ns : -1};
+                (*inputs)[path] = input;
+                if (!found) continue;
+            }
+            for (const auto& sym : fs.symbols) {
+                auto it = table->find(sym.name);
+                if (it == table->end()) (*table)[sym.name] = sym;
+                else if (!it->second.has_body && sym.has_body) it->second = sym; // Prefer the body over a prototype
+            }
+            std::string dir = path.substr(0, path.rfind('/'));
+            for (const auto& name : fs.imports) {
+                std::string dep = indexResolveImport(name, dir);
+                if (!dep.empty() && seen.insert(dep).second) queue.push_back(dep);
+            }
+        }
+    }, [=]() {
+        B->symbols = table;
+        B->symbols_version = version;
+        B->symbols_inputs = *inputs;
+    }, TASK_LOW);
+}
+
+// --- KIK Parser ---
+
+// Reserved words that cannot start an expression
+static const char* const KIK_STATEMENT_WORDS[] = {
+    "import", "constant", "if", "else", "switch", "case", "default", "while",
+    "do", "for", "break", "continue", "return", "class", "struct", "enum",
+    "public", "private", "protected", "virtual", "override", "try", "catch",
+    "throw", "cout", "cin", nullptr
+};
+
+// Parser position within one chunk's tokens
+struct KikParser {
+    std::vector<ParseToken> toks;
+    size_t pos;
+};
+
+/**
+ * @brief Splits one chunk of KIK source into tokens.
+ * Comments are dropped. Unterminated literals become 'x' tokens so the
+ * parser can report them where they start.
+ */
+void parseTokenize(const std::string& text, std::vector<ParseToken>& out) {
+    static const char* const TWO_CHAR_OPS[] = {
+        "==", "!=", "<=", ">=", "&&", "||", "<<", ">>", "+=", "-=", "*=", "/=",
+        "%=", "++", "--", "->", nullptr
+    };
+    int line = 0;
+    size_t line_start = 0, i = 0, n = text.size();
+    while (i < n) {
+        char c = text[i];
+        char next = i + 1 < n ? text[i + 1] : '\0';
+        int col = i - line_start;
+        if (c == '\n') {
+            line++;
+            line_start = ++i;
+        } else if (isspace((unsigned char)c)) {
+            i++;
+        } else if ((c == '/' && next == '/') || (c == '#' && next == '#')) {
+            while (i < n && text[i] != '\n') i++;
+        } else if (c == '/' && next == '*') {
+            size_t end = text.find("*/", i + 2);
+            end = end == std::string::npos ? n : end + 2;
+            for (; i < end; i++) {
+                if (text[i] == '\n') {
+                    line++;
+                    line_start = i + 1;
+                }
+            }
+        } else if (isalpha((unsigned char)c) || c == '_') {
+            size_t j = i;
+            while (j < n && (isalnum((unsigned char)text[j]) || text[j] == '_')) j++;
+            ParseToken tok = {'i', text.substr(i, j - i), line, col};
+            out.push_back(tok);
+            i = j;
+        } else if (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)next))) {
+            size_t j = i;
+            while (j < n && (isdigit((unsigned char)text[j]) || text[j] == '.')) j++;
+            ParseToken tok = {'n', text.substr(i, j - i), line, col};
+            out.push_back(tok);
+            i = j;
+        } else if (c == '"' || c == '\'') {
+            size_t j = i + 1;
+            while (j < n && text[j] != c && text[j] != '\n') j += text[j] == '\\' ? 2 : 1;
+            bool closed = j < n && text[j] == c;
+            ParseToken tok = {closed ? (c == '"' ? 's' : 'c') : 'x', text.substr(i, std::min(j + 1, n) - i), line, col};
+            out.push_back(tok);
+            i = closed ? j + 1 : j;
+        } else {
+            ParseToken tok = {'p', std::string(1, c), line, col};
+            for (const char* const* op = TWO_CHAR_OPS; *op; op++) {
+                if ((*op)[0] == c && (*op)[1] == next) tok.text = *op;
+            }
+            out.push_back(tok);
+            i += tok.text.size();
+        }
+    }
+    ParseToken end = {'e', "end of input", line, (int)(i - line_start)};
+    out.push_back(end);
+}
+
+// Small helpers over the token stream
+const ParseToken& parsePeek(KikParser& P, size_t ahead = 0) {
+    return P.toks[std::min(P.pos + ahead, P.toks.size() - 1)];
+}
+bool parseIs(KikParser& P, const char* text, size_t ahead = 0) {
+    const ParseToken& t = parsePeek(P, ahead);
+    return t.type != 's' && t.type != 'c' && t.text == text;
+}
+void parseFail(KikParser& P, const std::string& message) {
+    const ParseToken& t = parsePeek(P);
+    std::string found = t.type == 'e' ? t.text : "'" + t.text + "'";
+    if (t.type == 'x') throw ParseFailure{t.line, t.col, "unterminated literal"};
+    throw ParseFailure{t.line, t.col, message + ", found " + found};
+}
+bool parseAccept(KikParser& P, const char* text) {
+    if (!parseIs(P, text)) return false;
+    P.pos++;
+    return true;
+}
+void parseExpect(KikParser& P, const char* text, const char* context = nullptr) {
+    if (parseAccept(P, text)) return;
+    parseFail(P, std::string("expected '") + text + "'" + (context ? context : ""));
+}
+std::string parseExpectIdent(KikParser& P, const char* what) {
+    const ParseToken& t = parsePeek(P);
+    if (t.type != 'i' || syntaxIsWord(KIK_STATEMENT_WORDS, t.text, 0, t.text.size())) {
+        parseFail(P, std::string("expected ") + what);
+    }
+    P.pos++;
+    return t.text;
+}
+bool parseIsBuiltinType(KikParser& P, size_t ahead = 0) {
+    const ParseToken& t = parsePeek(P, ahead);
+    return t.type == 'i' && syntaxIsWord(KIK_TYPES, t.text, 0, t.text.size());
+}
+
+/**
+ * @brief Returns true if a declaration starts here: a built-in type, or
+ * a user type followed by a name (`Point p;`, `EditorState* s;`).
+ */
+bool parseIsDeclaration(KikParser& P) {
+    if (parseIsBuiltinType(P)) return true;
+    const ParseToken& t = parsePeek(P);
+    if (t.type != 'i' || syntaxIsWord(KIK_STATEMENT_WORDS, t.text, 0, t.text.size())) return false;
+    size_t k = 1;
+    while (parseIs(P, "*", k)) k++;
+    if (parseIs(P, "[", k)) {
+        // `str[1000] lines;` -- a sized array type rather than indexing
+        return parsePeek(P, k + 1).type == 'n' && parseIs(P, "]", k + 2) && parsePeek(P, k + 3).type == 'i';
+    }
+    return parsePeek(P, k).type == 'i' && !syntaxIsWord(KIK_STATEMENT_WORDS, parsePeek(P, k).text, 0, parsePeek(P, k).text.size());
+}
+
+void parseExpression(KikParser& P);
+void parseStatement(KikParser& P);
+
+/**
+ * @brief type ::= ( built-in | identifier ) { "*" } { "[" size "]" }
+ */
+void parseType(KikParser& P) {
+    if (!parseIsBuiltinType(P)) parseExpectIdent(P, "a type");
+    else P.pos++;
+    while (parseAccept(P, "*")) {}
+    while (parseIs(P, "[") && parsePeek(P, 1).type == 'n') {
+        P.pos += 2;
+        parseExpect(P, "]");
+    }
+}
+
+/**
+ * @brief Parses a primary expression with its postfix operators.
+ */
+void parsePostfix(KikParser& P) {
+    const ParseToken& t = parsePeek(P);
+    if (t.type == 'n' || t.type == 's' || t.type == 'c') {
+        P.pos++;
+    } else if (parseIs(P, "(")) {
+        P.pos++;
+        if (parseIsBuiltinType(P) && parseIs(P, ")", 1)) {
+            // Explicit cast: (int) value
+            P.pos += 2;
+            parsePostfix(P);
+            return;
+        }
+        parseExpression(P);
+        parseExpect(P, ")");
+    } else if (parseIs(P, "{")) {
+        // Initializer list: {1, 2, 3}
+        P.pos++;
+        if (!parseIs(P, "}")) {
+            do {
+                parseExpression(P);
+            } while (parseAccept(P, ",") && !parseIs(P, "}"));
+        }
+        parseExpect(P, "}", " to close the initializer list");
+    } else if (parseAccept(P, "new")) {
+        parseType(P);
+    } else if (t.type == 'i' && !syntaxIsWord(KIK_STATEMENT_WORDS, t.text, 0, t.text.size())) {
+        P.pos++;
+    } else {
+        parseFail(P, "expected an expression");
+    }
+    while (true) {
+        if (parseAccept(P, "(")) {
+            if (!parseIs(P, ")")) {
+                do {
+                    parseExpression(P);
+                } while (parseAccept(P, ","));
+            }
+            parseExpect(P, ")", " after the arguments");
+        } else if (parseAccept(P, "[")) {
+            parseExpression(P);
+            parseExpect(P, "]");
+        } else if (parseAccept(P, ".") || parseAccept(P, "->")) {
+            parseExpectIdent(P, "a member name");
+        } else if (!parseAccept(P, "++") && !parseAccept(P, "--")) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Parses prefix operators and the operand they apply to.
+ */
+void parseUnary(KikParser& P) {
+    static const char* const PREFIX[] = {"!", "-", "+", "&", "*", "++", "--", "~", nullptr};
+    for (const char* const* op = PREFIX; *op; op++) {
+        if (parseAccept(P, *op)) {
+            parseUnary(P);
+            return;
+        }
+    }
+    parsePostfix(P);
+}
+
+/**
+ * @brief Returns the precedence of a binary operator, or 0 if it is none.
+ */
+int parseBinaryPrecedence(const ParseToken& t) {
+    if (t.type != 'p') return 0;
+    const std::string& op = t.text;
+    if (op == "||") return 1;
+    if (op == "&&") return 2;
+    if (op == "==" || op == "!=") return 3;
+    if (op == "<" || op == ">" || op == "<=" || op == ">=") return 4;
+    if (op == "+" || op == "-") return 5;
+    if (op == "*" || op == "/" || op == "%") return 6;
+    return 0;
+}
+
+/**
+ * @brief Parses binary operators of at least the given precedence.
+ */
+void parseBinary(KikParser& P, int min_prec) {
+    parseUnary(P);
+    int prec;
+    while ((prec = parseBinaryPrecedence(parsePeek(P))) >= min_prec && prec > 0) {
+        P.pos++;
+        parseBinary(P, prec + 1);
+    }
+}
+
+/**
+ * @brief expression ::= binary [ assign-op expression ]
+ */
+void parseExpression(KikParser& P) {
+    static const char* const ASSIGN[] = {"=", "+=", "-=", "*=", "/=", "%=", nullptr};
+    parseBinary(P, 1);
+    for (const char* const* op = ASSIGN; *op; op++) {
+        if (parseAccept(P, *op)) {
+            parseExpression(P);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief block ::= "{" { statement } "}"
+ */
+void parseBlock(KikParser& P) {
+    parseExpect(P, "{", " to open a block");
+    while (!parseIs(P, "}") && parsePeek(P).type != 'e') parseStatement(P);
+    parseExpect(P, "}", " to close the block");
+}
+
+/**
+ * @brief Parses `condition: { ... }`, the shape of every KIK control block.
+ */
+void parseConditionBlock(KikParser& P) {
+    parseExpression(P);
+    parseExpect(P, ":", " after the condition");
+    parseBlock(P);
+}
+
+/**
+ * @brief Parses the rest of a variable declaration after the type:
+ * name { "[" size "]" } [ "=" expression ] { "," ... } ";"
+ */
+void parseVariables(KikParser& P) {
+    do {
+        parseExpectIdent(P, "a variable name");
+        while (parseAccept(P, "[")) {
+            if (!parseIs(P, "]")) parseExpression(P);
+            parseExpect(P, "]");
+        }
+        if (parseAccept(P, "=")) parseExpression(P);
+    } while (parseAccept(P, ","));
+    parseExpect(P, ";", " after the declaration");
+}
+
+/**
+ * @brief parameters ::= "(" [ type [ "&" ] name { "," ... } ] ")"
+ */
+void parseParameters(KikParser& P) {
+    parseExpect(P, "(");
+    if (parseIs(P, "void") && parseIs(P, ")", 1)) P.pos++;
+    if (!parseIs(P, ")")) {
+        do {
+            parseType(P);
+            parseAccept(P, "&");
+            parseExpectIdent(P, "a parameter name");
+            if (parseAccept(P, "[")) parseExpect(P, "]");
+        } while (parseAccept(P, ","));
+    }
+    parseExpect(P, ")", " after the parameters");
+}
+
+/**
+ * @brief Parses statements until a ':' that closes a try or catch body.
+ */
+void parseColonBody(KikParser& P) {
+    parseExpect(P, ":");
+    while (!parseIs(P, ":") && parsePeek(P).type != 'e') parseStatement(P);
+    parseExpect(P, ":", " to close the block");
+}
+
+/**
+ * @brief Parses one statement inside a function body.
+ */
+void parseStatement(KikParser& P) {
+    if (parseIs(P, "{")) {
+        parseBlock(P);
+    } else if (parseAccept(P, ";")) {
+    } else if (parseAccept(P, "if")) {
+        parseConditionBlock(P);
+        while (parseAccept(P, "else")) {
+            if (!parseAccept(P, "if")) {
+                parseExpect(P, ":", " after 'else'");
+                parseBlock(P);
+                break;
+            }
+            parseConditionBlock(P);
+        }
+    } else if (parseAccept(P, "while")) {
+        parseConditionBlock(P);
+    } else if (parseAccept(P, "do")) {
+        parseBlock(P);
+        parseExpect(P, "while", " after the do block");
+        parseExpression(P);
+        if (!parseAccept(P, ";")) {
+            parseExpect(P, ":", " after the condition");
+            parseBlock(P);
+        }
+    } else if (parseAccept(P, "for")) {
+        // for [type] init; condition; [:] increment: { ... }
+        if (parseIsDeclaration(P)) parseType(P);
+        parseExpression(P);
+        parseExpect(P, ";", " after the loop initialization");
+        parseExpression(P);
+        parseExpect(P, ";", " after the loop condition");
+        parseAccept(P, ":");
+        parseExpression(P);
+        parseExpect(P, ":", " after the loop increment");
+        parseBlock(P);
+    } else if (parseAccept(P, "switch")) {
+        parseExpression(P);
+        parseExpect(P, ":", " after the switch value");
+        parseExpect(P, "{");
+        while (!parseIs(P, "}") && parsePeek(P).type != 'e') {
+            if (parseAccept(P, "case")) {
+                parseExpression(P);
+            } else if (!parseAccept(P, "default")) {
+                parseFail(P, "expected 'case' or 'default'");
+            }
+            parseExpect(P, ":", " after the case label");
+            while (!parseIs(P, "case") && !parseIs(P, "default") && !parseIs(P, "}") && parsePeek(P).type != 'e') {
+                parseStatement(P);
+            }
+        }
+        parseExpect(P, "}", " to close the switch");
+    } else if (parseAccept(P, "return") || parseAccept(P, "throw")) {
+        if (!parseIs(P, ";")) parseExpression(P);
+        parseExpect(P, ";", " after the expression");
+    } else if (parseAccept(P, "break") || parseAccept(P, "continue")) {
+        parseExpect(P, ";");
+    } else if (parseAccept(P, "try")) {
+        parseColonBody(P);
+        if (!parseIs(P, "catch")) parseFail(P, "expected 'catch' after the try block");
+        while (parseAccept(P, "catch")) {
+            parseExpect(P, "(");
+            parseType(P);
+            parseExpectIdent(P, "a name for the exception");
+            parseExpect(P, ")");
+            parseColonBody(P);
+        }
+    } else if (parseAccept(P, "cout") || parseAccept(P, "cin")) {
+        const char* op = parseIs(P, ">>") ? ">>" : "<<";
+        do {
+            parseExpect(P, op);
+            parseBinary(P, 1);
+        } while (parseIs(P, op));
+        parseExpect(P, ";", " after the I/O statement");
+    } else if (parseAccept(P, "constant")) {
+        if (parseIsDeclaration(P)) parseType(P);
+        parseVariables(P);
+    } else if (parseIsDeclaration(P)) {
+        parseType(P);
+        parseVariables(P);
+    } else {
+        parseExpression(P);
+        parseExpect(P, ";", " after the statement");
+    }
+}
+
+/**
+ * @brief Parses a class or struct definition.
+ * class Name [ ":" access Base ] [ ":" ] "{" { member } "}" [ ";" ]
+ */
+void parseClass(KikParser& P) {
+    P.pos++;
+    std::string name = parseExpectIdent(P, "a class name");
+    if (parseIs(P, ":") && (parseIs(P, "public", 1) || parseIs(P, "private", 1))) {
+        P.pos += 2;
+        parseExpectIdent(P, "a base class name");
+    }
+    parseAccept(P, ":");
+    parseExpect(P, "{", " to open the class body");
+    while (!parseIs(P, "}") && parsePeek(P).type != 'e') {
+        if ((parseIs(P, "public") || parseIs(P, "private") || parseIs(P, "protected")) && parseIs(P, ":", 1)) {
+            P.pos += 2;
+        } else if (parseAccept(P, "~")) {
+            // Destructor
+            parseExpectIdent(P, "the class name");
+            parseParameters(P);
+            parseAccept(P, ":");
+            parseBlock(P);
+        } else if (parseIs(P, name.c_str()) && parseIs(P, "(", 1)) {
+            // Constructor
+            P.pos++;
+            parseParameters(P);
+            parseAccept(P, ":");
+            parseBlock(P);
+        } else {
+            parseAccept(P, "virtual");
+            parseType(P);
+            if (parseIs(P, "(", 1)) {
+                parseExpectIdent(P, "a method name");
+                parseParameters(P);
+                parseAccept(P, "override");
+                if (!parseAccept(P, ";")) {
+                    parseAccept(P, ":");
+                    parseBlock(P);
+                }
+            } else {
+                parseVariables(P);
+            }
+        }
+    }
+    parseExpect(P, "}", " to close the class body");
+    parseAccept(P, ";");
+}
+
+/**
+ * @brief Parses one top-level chunk: an import, a constant, a class,
+ * struct or enum, a global variable, or a function.
+ * @param P The parser, positioned at the chunk's first token.
+ * @param result Receives whether the chunk was an import or empty.
+ */
+void parseTopLevel(KikParser& P, ChunkResult& result) {
+    result.is_import = parseIs(P, "import");
+    result.is_empty = parsePeek(P).type == 'e' || parseIs(P, ";");
+    if (parseAccept(P, ";")) {
+    } else if (parseAccept(P, "import")) {
+        if (parsePeek(P).type != 's') parseFail(P, "expected a file name string");
+        P.pos++;
+        parseExpect(P, ";", " after the import");
+    } else if (parseAccept(P, "constant")) {
+        if (parseIsDeclaration(P)) parseType(P);
+        parseVariables(P);
+    } else if (parseIs(P, "class") || parseIs(P, "struct")) {
+        parseClass(P);
+    } else if (parseAccept(P, "enum")) {
+        parseExpectIdent(P, "an enum name");
+        parseAccept(P, ":");
+        parseExpect(P, "{", " to open the enum body");
+        do {
+            if (parseIs(P, "}")) break;
+            parseExpectIdent(P, "an enum constant");
+            if (parseAccept(P, "=")) parseExpression(P);
+        } while (parseAccept(P, ","));
+        parseExpect(P, "}", " to close the enum body");
+        parseAccept(P, ";");
+    } else if (parseIs(P, "type") && parsePeek(P, 1).type == 'i' && parseIs(P, ";", 2)) {
+        P.pos += 3; // Opaque type from the runtime, e.g. `type filePointer;`
+    } else if (parsePeek(P).type != 'e') {
+        parseType(P);
+        if (parseIs(P, "(", 1)) {
+            parseExpectIdent(P, "a function name");
+            parseParameters(P);
+            if (!parseAccept(P, ";")) {
+                parseAccept(P, ":");
+                parseBlock(P);
+            }
+        } else {
+            parseVariables(P);
+        }
+    }
+    if (parsePeek(P).type != 'e') parseFail(P, "expected the end of the declaration");
+}
+
+/**
+ * @brief Parses one chunk of source text.
+ */
+ChunkResult parseChunk(const std::string& text) {
+    KikParser P;
+    P.pos = 0;
+    parseTokenize(text, P.toks);
+    ChunkResult result = {true, 0, 0, "", false, false};
+    try {
+        parseTopLevel(P, result);
+    } catch (const ParseFailure& failure) {
+        result.ok = false;
+        result.line = failure.line;
+        result.col = failure.col;
+        result.message = failure.message;
+    }
+    return result;
+}
+
+// A top-level declaration's text and where it starts in the buffer
+struct ParseSource {
+    int line, col;
+    std::string text;
+};
+
+/**
+ * @brief Splits a file into top-level chunks.
+ * A chunk ends at a `;` or `}` at brace depth 0, outside comments and
+ * literals, so each function, class or declaration is one chunk.
+ */
+void parseSplitChunks(const LineTable& lines, std::vector<ParseSource>& out) {
+    int depth = 0, start_line = 0, start_col = 0;
+    bool in_comment = false;
+    std::string scratch, emit_scratch;
+    auto emit = [&](int end_line, int end_col) {
+        ParseSource chunk = {start_line, start_col, ""};
+        for (int y = start_line; y <= end_line && y < (int)lines.size(); y++) {
+            const std::string& line = lineText(lines, y, emit_scratch);
+            int from = y == start_line ? start_col : 0;
+            int to = y == end_line ? end_col : (int)line.size();
+            if (to > from) chunk.text.append(line, from, to - from);
+            if (y != end_line) chunk.text += '\n';
+        }
+        out.push_back(chunk);
+        start_line = end_line;
+        start_col = end_col;
+    };
+    for (int y = 0; y < (int)lines.size(); y++) {
+        const std::string& s = lineText(lines, y, scratch);
+        size_t n = s.size(), i = 0;
+        while (i < n) {
+            if (in_comment) {
+                size_t end = s.find("*/", i);
+                if (end == std::string::npos) break;
+                in_comment = false;
+                i = end + 2;
+                continue;
+            }
+            char c = s[i];
+            char next = i + 1 < n ? s[i + 1] : '\0';
+            if (c == '/' && next == '*') {
+                in_comment = true;
+                i += 2;
+            } else if ((c == '/' && next == '/') || (c == '#' && next == '#')) {
+                break;
+            } else if (c == '"' || c == '\'') {
+                size_t j = i + 1;
+                while (j < n && s[j] != c) j += s[j] == '\\' ? 2 : 1;
+                i = j + 1;
+            } else {
+                if (c == '{') depth++;
+                if (c == '}') depth = std::max(depth - 1, 0);
+                i++;
+                if (depth == 0 && (c == '}' || c == ';')) emit(y, i);
+            }
+        }
+    }
+    int last = lines.empty() ? 0 : (int)lines.size() - 1;
+    emit(last, lines.empty() ? 0 : (int)lineText(lines, last, scratch).size());
+}
+
+/**
+ * @brief Checks a .kik buffer for syntax errors in the background.
+ * The text is split into top-level chunks and only chunks whose text
+ * was not seen before are parsed; the others come from the shared
+ * cache. The first error is shown in the buffer's status line.
+ * Nothing is done if the text was parsed already. The task gets the
+ * buffer's lines by sharing their chunks, so only the chunks edited
+ * while it runs are ever copied (see lineOwn).
+ */
+void parseBuffer(Buffer* B) {
+    if (B->parse_version == B->version) return;
+    std::shared_ptr<LineTable> lines = std::make_shared<LineTable>(lineShare(B->lines));
+    std::shared_ptr<std::string> diagnostic = std::make_shared<std::string>();
+    B->parse_version = B->version;
+    if (B->parse_token) *B->parse_token = true;
+    B->parse_token = taskSubmit([=]() {
+        std::vector<ParseSource> chunks;
+        parseSplitChunks(*lines, chunks);
+        bool seen_declaration = false;
+        for (const auto& chunk : chunks) {
+            uint64_t key = fnv1a(14695981039346656037ULL, chunk.text.data(), chunk.text.size());
+            ChunkResult result;
+            bool cached;
+            {
+                std::lock_guard<std::mutex> guard(Parses.lock);
+                auto it = Parses.results.find(key);
+                cached = it != Parses.results.end() && it->second.text == chunk.text;
+                if (cached) result = it->second.result;
+            }
+            if (!cached) {
+                result = parseChunk(chunk.text);
+                std::lock_guard<std::mutex> guard(Parses.lock);
+                if (Parses.results.size() > 100000) Parses.results.clear(); // Bound memory
+                Parses.results[key] = CachedChunk{chunk.text, result};
+            }
+            if (result.ok && result.is_import && seen_declaration) {
+                result = ChunkResult{false, 0, 0, "imports must come before declarations", true, false};
+            }
+            if (!result.ok) {
+                *diagnostic = "line " + std::to_string(chunk.line + result.line + 1) + ": " + result.message;
+                break;
+            }
+            if (!result.is_import && !result.is_empty) seen_declaration = true;
+        }
+    }, [=]() {
+        B->diagnostic = *diagnostic;
+    }, TASK_NORMAL);
+}
+
+/**
+ * @brief Returns how long the main loop may wait for a key before idle
+ * work is due: a .kik buffer on screen whose text changed since it was
+ * last parsed, once typing has paused for KIK_PARSE_DELAY_MS.
+ * @return Milliseconds, or -1 if nothing is waiting.
+ */
+int editorIdleTimeout() {
+    for (const auto& v : E.views) {
+        const Buffer* B = v->buf;
+        if (!bufferIsKik(B) || !B->loaded || B->parse_version == B->version) continue;
+        int64_t wait_ns = (int64_t)(E.last_key_ns + KIK_PARSE_DELAY_MS * 1000000ULL) - (int64_t)statsNow();
+        return wait_ns > 0 ? (int)(wait_ns / 1000000) + 1 : 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Starts the idle work described at editorIdleTimeout.
+ */
+void editorOnIdle() {
+    for (const auto& v : E.views) {
+        Buffer* B = v->buf;
+        if (bufferIsKik(B) && B->loaded) parseBuffer(B);
+    }
+}
+
+// --- Completion ---
+
+/**
+ * @brief Returns the trie node for a word, creating the path if needed.
+ * @param T The trie.
+ * @param word The word.
+ * @param create If false, returns -1 when the word has no node.
+ */
+int32_t trieNode(WordTrie& T, const char* word, size_t len, bool create) {
+    int32_t node = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = word[i];
+        int32_t prev = -1, child = T.nodes[node].child;
+        while (child != -1 && T.nodes[child].c < c) {
+            prev = child;
+            child = T.nodes[child].sibling;
+        }
+        if (child == -1 || T.nodes[child].c != c) {
+            if (!create) return -1;
+            TrieNode added = {c, node, -1, child, 0, 0};
+            int32_t at;
+            if (!T.unused.empty()) {
+                at = T.unused.back();
+                T.unused.pop_back();
+                T.nodes[at] = added;
+            } else {
+                at = T.nodes.size();
+                T.nodes.push_back(added);
+            }
+            if (prev == -1) T.nodes[node].child = at;
+            else T.nodes[prev].sibling = at;
+            child = at;
+        }
+        node = child;
+    }
+    return node;
+}
+
+/**
+ * @brief Unlinks a subtree from its parent and keeps its nodes for reuse.
+ * @param node The subtree's root; not the trie's root.
+ */
+void triePrune(WordTrie& T, int32_t node) {
+    int32_t* link = &T.nodes[T.nodes[node].parent].child;
+    while (*link != node) link = &T.nodes[*link].sibling;
+    *link = T.nodes[node].sibling;
+    std::vector<int32_t> stack(1, node);
+    while (!stack.empty()) {
+        int32_t n = stack.back();
+        stack.pop_back();
+        for (int32_t c = T.nodes[n].child; c != -1; c = T.nodes[c].sibling) stack.push_back(c);
+        T.unused.push_back(n);
+    }
+}
+
+/**
+ * @brief Adds or drops references to the word ending at a node.
+ * A subtree left without references is pruned, so words that are gone
+ * from the buffer do not keep their nodes.
+ */
+void trieCount(WordTrie& T, int32_t node, int delta) {
+    T.nodes[node].count += delta;
+    int32_t empty = -1; // Highest node whose subtree lost its last reference
+    for (int32_t n = node; n != -1; n = T.nodes[n].parent) {
+        T.nodes[n].below += delta;
+        if (T.nodes[n].below == 0 && n != 0) empty = n;
+    }
+    if (empty != -1) triePrune(T, empty);
+}
+
+/**
+ * @brief Collects words that start with a prefix, in sorted order.
+ * Subtrees whose words are all unreferenced are skipped, so the cost
+ * depends on the number of results, not the size of the trie.
+ * @param T The trie.
+ * @param prefix The typed prefix; not itself a result.
+ * @param limit Maximum number of results.
+ * @param out Receives the words.
+ */
+void trieComplete(WordTrie& T, const std::string& prefix, size_t limit, std::vector<std::string>& out) {
+    int32_t root = trieNode(T, prefix.data(), prefix.size(), false);
+    if (root == -1 || T.nodes[root].below == 0) return;
+    std::string word = prefix;
+    std::vector<int32_t> stack(1, T.nodes[root].child);
+    while (!stack.empty() && out.size() < limit) {
+        int32_t n = stack.back();
+        if (n == -1) {
+            // Finished a sibling list: back up to the parent's next sibling
+            stack.pop_back();
+            if (stack.empty()) break;
+            word.pop_back();
+            stack.back() = T.nodes[stack.back()].sibling;
+            continue;
+        }
+        if (T.nodes[n].below == 0) {
+            stack.back() = T.nodes[n].sibling;
+            continue;
+        }
+        word += T.nodes[n].c;
+        if (T.nodes[n].count > 0) out.push_back(word);
+        stack.push_back(T.nodes[n].child);
+    }
+}
+
+/**
+ * @brief Recounts the identifiers of one line after it changed.
+ * The line's old references are dropped by node, so the old text is
+ * not needed.
+ */
+void completionScanLine(Buffer* B, int at) {
+    WordTrie& T = *B->words;
+    std::vector<int32_t>& ids = B->line_words[at];
+    for (int32_t id : ids) trieCount(T, id, -1);
+    ids.clear();
+    std::string scratch;
+    const std::string& line = bufferText(B, at, scratch);
+    size_t n = line.size(), i = 0;
+    while (i < n) {
+        if (!isalpha((unsigned char)line[i]) && line[i] != '_') {
+            // Skip numbers whole, so the `e10` in `1e10` is no identifier
+            while (i < n && (isalnum((unsigned char)line[i]) || line[i] == '_')) i++;
+            if (i < n && !isalpha((unsigned char)line[i]) && line[i] != '_') i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < n && (isalnum((unsigned char)line[j]) || line[j] == '_')) j++;
+        if (j - i > 1) {
+            int32_t id = trieNode(T, line.data() + i, j - i, true);
+            trieCount(T, id, 1);
+            ids.push_back(id);
+        }
+        i = j;
+    }
+}
+
+/**
+ * @brief Drops a buffer's completion trie, e.g. when its text is re-read.
+ */
+void completionReset(Buffer* B) {
+    B->words.reset();
+    std::vector<std::vector<int32_t>>().swap(B->line_words);
+    B->word_symbols.reset();
+}
+
+/**
+ * @brief Builds a buffer's completion trie if needed and brings its
+ * library names up to date with the symbol index.
+ * The full scan happens once per buffer; later edits update the trie
+ * line by line (see bufferRowChanged).
+ */
+void completionPrepare(Buffer* B) {
+    if (!B->words) {
+        traceBegin("completionBuild", "completion");
+        B->words.reset(new WordTrie());
+        TrieNode root = {'\0', -1, -1, -1, 0, 0};
+        B->words->nodes.push_back(root);
+        B->line_words.assign(B->lines.size(), std::vector<int32_t>());
+        for (size_t i = 0; i < B->lines.size(); i++) completionScanLine(B, i);
+        traceEnd("completionBuild", "completion");
+    }
+    if (B->word_symbols != B->symbols) {
+        WordTrie& T = *B->words;
+        if (B->word_symbols) {
+            for (const auto& entry : *B->word_symbols) {
+                trieCount(T, trieNode(T, entry.first.data(), entry.first.size(), false), -1);
+            }
+        }
+        if (B->symbols) {
+            for (const auto& entry : *B->symbols) {
+                trieCount(T, trieNode(T, entry.first.data(), entry.first.size(), true), 1);
+            }
+        }
+        B->word_symbols = B->symbols;
+    }
+}
+
+/**
+ * @brief Replaces the word being completed with the selected candidate.
+ */
+void completionApply() {
+    View& V = *E.view;
+    Buffer& B = *V.buf;
+    CompletionState& C = E.completion;
+    const std::string& word = C.candidates[C.selected];
+    bufferLine(&B, V.cy).replace(C.start, V.cx - C.start, word);
+    V.cx = C.start + word.size();
+    bufferRowChanged(&B, V.cy);
+    E.status_msg = "Completion " + std::to_string(C.selected + 1) + " of " + std::to_string(C.candidates.size());
+}
+
+/**
+ * @brief Handles Ctrl-N and Ctrl-P in insert mode.
+ * The first press completes the identifier before the cursor from the
+ * buffer's words and its imported libraries and opens a popup; further
+ * presses step through the candidates.
+ * @param step 1 for the next candidate, -1 for the previous one.
+ */
+void editorComplete(int step) {
+    View& V = *E.view;
+    Buffer& B = *V.buf;
+    CompletionState& C = E.completion;
+    if (C.active) {
+        int n = C.candidates.size();
+        C.selected = (C.selected + step + n) % n;
+        completionApply();
+        return;
+    }
+    if (V.cy >= (int)B.lines.size()) return;
+    std::string scratch;
+    const std::string& line = bufferText(&B, V.cy, scratch);
+    int start = V.cx;
+    while (start > 0 && (isalnum((unsigned char)line[start - 1]) || line[start - 1] == '_')) start--;
+    if (start == V.cx) {
+        E.status_msg = "Nothing to complete";
+        return;
+    }
+    std::string prefix = line.substr(start, V.cx - start);
+
+    completionPrepare(&B);
+    C.candidates.clear();
+    trieComplete(*B.words, prefix, KIK_COMPLETION_ITEMS, C.candidates);
+    if (C.candidates.empty()) {
+        E.status_msg = "No completions for " + prefix;
+        return;
+    }
+    C.active = true;
+    C.selected = step > 0 ? 0 : C.candidates.size() - 1;
+    C.cy = V.cy;
+    C.start = start;
+    completionApply();
+}
+
+/**
+ * @brief Draws the completion popup below (or above) the cursor.
+ * The popup is drawn over the finished frame; the screen lines it
+ * covers are marked stale so the next frame repaints them.
+ * @param out Terminal output being assembled.
+ */
+void completionDrawPopup(std::string& out) {
+    const CompletionState& C = E.completion;
+    const View& V = *E.view;
+    size_t width = 0;
+    for (const auto& word : C.candidates) width = std::max(width, word.size());
+    width = std::min<size_t>(width + 2, E.screen_cols);
+    int x = std::min<int>(V.left + C.start - V.col_offset, E.screen_cols - width);
+    int y = V.top + V.cy - V.row_offset + 1;
+    int rows = C.candidates.size();
+    if (y + rows > (int)E.frame.size() - 1) y = std::max(y - 1 - rows, 0);
+    for (int i = 0; i < rows && y + i < (int)E.frame.size(); i++) {
+        std::string item = " " + C.candidates[i];
+        item.resize(width, ' ');
+        out.append("\x1b[" + std::to_string(y + i + 1) + ";" + std::to_string(std::max(x, 0) + 1) + "H");
+        out.append(i == C.selected ? "\x1b[7m" : "\x1b[44;37m");
+        out.append(item);
+        out.append("\x1b[m");
+        E.frame[y + i].clear();
+    }
+}
+
+// --- Windows ---
+
+/**
+ * @brief Creates a window on a buffer.
+ * @param B The buffer to show.
+ * @return The new view, owned by E.views.
+ */
+View* editorNewView(Buffer* B) {
+    View* V = new View();
+    V->buf = B;
+    V->cx = V->cy = 0;
+    V->row_offset = V->col_offset = 0;
+    V->top = V->left = V->rows = V->cols = 0;
+    V->drawn_buf = nullptr;
+    V->drawn_row_offset = V->drawn_col_offset = 0;
+    E.views.push_back(std::unique_ptr<View>(V));
+    return V;
+}
+
+/**
+ * @brief Creates a leaf node of the window layout.
+ */
+Layout* editorNewLayout(View* V, Layout* parent) {
+    Layout* node = new Layout();
+    node->view = V;
+    node->vertical = false;
+    node->parent = parent;
+    return node;
+}
+
+/**
+ * @brief Finds the layout leaf that holds a view.
+ */
+Layout* layoutFind(Layout* node, const View* V) {
+    if (node->view) return node->view == V ? node : nullptr;
+    Layout* found = layoutFind(node->first.get(), V);
+    return found ? found : layoutFind(node->second.get(), V);
+}
+
+/**
+ * @brief Collects the views of a layout subtree, top-left first.
+ */
+void layoutViews(const Layout* node, std::vector<View*>& out) {
+    if (node->view) {
+        out.push_back(node->view);
+        return;
+    }
+    layoutViews(node->first.get(), out);
+    layoutViews(node->second.get(), out);
+}
+
+/**
+ * @brief Assigns screen rectangles to the windows of a layout subtree.
+ * Each window gets `rows` lines including its own status line. Side by
+ * side windows are separated by a one-column bar.
+ */
+void layoutPlace(Layout* node, int top, int left, int rows, int cols) {
+    if (node->view) {
+        View& V = *node->view;
+        if (V.top != top || V.left != left || V.rows != rows - 1 || V.cols != cols) {
+            V.row_valid.clear(); // Geometry changed: redraw the whole window
+        }
+        V.top = top;
+        V.left = left;
+        V.rows = std::max(rows - 1, 0); // A shrunk terminal can leave no text rows
+        V.cols = cols;
+        return;
+    }
+    if (node->vertical) {
+        int first_cols = (cols - 1) / 2;
+        layoutPlace(node->first.get(), top, left, rows, first_cols);
+        layoutPlace(node->second.get(), top, left + first_cols + 1, rows, cols - first_cols - 1);
+    } else {
+        int first_rows = rows / 2;
+        layoutPlace(node->first.get(), top, left, first_rows, cols);
+        layoutPlace(node->second.get(), top + first_rows, left, rows - first_rows, cols);
+    }
+}
+
+/**
+ * @brief Recomputes every window's position from the layout tree.
+ * The last screen line is kept for the message line.
+ */
+void editorLayoutWindows() {
+    layoutPlace(E.layout.get(), 0, 0, E.screen_rows - 1, E.screen_cols);
+}
+
+/**
+ * @brief Keeps a view's cursor inside its buffer.
+ * Needed when the buffer was edited through another window.
+ */
+void editorClampCursor(View& V) {
+    int last_row = V.buf->lines.empty() ? 0 : (int)V.buf->lines.size() - 1;
+    if (V.cy > last_row) V.cy = last_row;
+    std::string scratch;
+    int line_len = V.cy < (int)V.buf->lines.size() ? (int)bufferText(V.buf, V.cy, scratch).length() : 0;
+    if (V.cx > line_len) V.cx = line_len;
+}
+
+/**
+ * @brief Splits the current window in two (:sp, :vsp).
+ * Both halves show the current buffer with their own cursor and scroll;
+ * the new window takes the top or left half and gets the focus.
+ * @param vertical True for side by side windows (:vsp).
+ * @return False if the window is too small to split.
+ */
+bool editorSplitWindow(bool vertical) {
+    View& cur = *E.view;
+    if ((vertical && cur.cols < 3) || (!vertical && cur.rows + 1 < 4)) {
+        E.status_msg = "Not enough room to split";
+        return false;
+    }
+    View* fresh = editorNewView(cur.buf);
+    fresh->cx = cur.cx;
+    fresh->cy = cur.cy;
+    fresh->row_offset = cur.row_offset;
+    fresh->col_offset = cur.col_offset;
+
+    Layout* leaf = layoutFind(E.layout.get(), &cur);
+    leaf->view = nullptr;
+    leaf->vertical = vertical;
+    leaf->first.reset(editorNewLayout(fresh, leaf));
+    leaf->second.reset(editorNewLayout(&cur, leaf));
+    E.view = fresh;
+    editorLayoutWindows();
+    return true;
+}
+
+/**
+ * @brief Closes the current window; its sibling takes over the space.
+ * The buffer stays open. Does nothing if this is the only window.
+ * @return True if a window was closed.
+ */
+bool editorCloseWindow() {
+    Layout* leaf = layoutFind(E.layout.get(), E.view);
+    Layout* parent = leaf->parent;
+    if (!parent) return false;
+
+    // Move the sibling's contents up into the parent node
+    std::unique_ptr<Layout> sibling(parent->first.get() == leaf ? parent->second.release() : parent->first.release());
+    parent->first.reset();
+    parent->second.reset();
+    parent->view = sibling->view;
+    parent->vertical = sibling->vertical;
+    parent->first = std::move(sibling->first);
+    parent->second = std::move(sibling->second);
+    if (parent->first) parent->first->parent = parent;
+    if (parent->second) parent->second->parent = parent;
+
+    for (size_t i = 0; i < E.views.size(); i++) {
+        if (E.views[i].get() == E.view) {
+            E.views.erase(E.views.begin() + i);
+            break;
+        }
+    }
+    std::vector<View*> remaining;
+    layoutViews(parent, remaining);
+    E.view = remaining.front();
+    editorClampCursor(*E.view);
+    editorLayoutWindows();
+    return true;
+}
+
+/**
+ * @brief Moves the focus to the next or previous window (Ctrl-W w / W).
+ * @param step 1 for the next window, -1 for the previous one.
+ */
+void editorCycleWindow(int step) {
+    std::vector<View*> order;
+    layoutViews(E.layout.get(), order);
+    int n = order.size();
+    for (int i = 0; i < n; i++) {
+        if (order[i] == E.view) {
+            E.view = order[((i + step) % n + n) % n];
+            editorClampCursor(*E.view);
+            return;
+        }
+    }
+}
+
+// --- Editor Operations ---
+
+/**
+ * @brief Initializes the editor state.
+ */
+void initEditor() {
+    E.mode = NORMAL;
+    E.status_msg = "HELP: :q = quit | :w = save | :wq = save & quit";
+    E.tick = 0;
+    E.match_line = E.match_col = -1;
+    const char* budget = getenv("KIK_BUFFER_BUDGET_MB");
+    E.buffer_budget = (size_t)(budget ? atol(budget) : KIK_BUFFER_BUDGET_MB) << 20;
+
+    E.view = editorNewView(editorNewBuffer("[No Name]"));
+    E.layout.reset(editorNewLayout(E.view, nullptr));
+
+    if (E.headless || Server.enabled) {
+        // No terminal to query; keep a conventional size for scrolling
+        E.screen_rows = 24;
+        E.screen_cols = 80;
+    } else if (getWindowSize(E.screen_rows, E.screen_cols) == -1) die("getWindowSize failed");
+    editorLayoutWindows();
+}
+
+/**
+ * @brief Moves the cursor based on keyboard input.
+ * A count is applied as a single jump, not as repeated single steps.
+ * @param key The key pressed ('h', 'j', 'k', 'l').
+ * @param count How many cells or lines to move.
+ */
+void editorMoveCursor(char key, int count = 1) {
+    View& V = *E.view;
+    Buffer& B = *V.buf;
+    int last_row = B.lines.empty() ? 0 : (int)B.lines.size() - 1;
+    std::string scratch;
+    int line_len = V.cy < (int)B.lines.size() ? (int)bufferText(&B, V.cy, scratch).length() : 0;
+    switch (key) {
+        case 'h': V.cx = count < V.cx ? V.cx - count : 0; break;
+        case 'l': V.cx = count < line_len - V.cx ? V.cx + count : line_len; break;
+        case 'k': V.cy = count < V.cy ? V.cy - count : 0; break;
+        case 'j': V.cy = count < last_row - V.cy ? V.cy + count : last_row; break;
+    }
+    // Snap cursor to end of line if needed
+    if (V.cy < (int)B.lines.size() && V.cx > line_len) {
+        V.cx = line_len;
+    }
+}
+
+/**
+ * @brief Jumps to a line, like vi's `G`.
+ * @param count 1-based target line; 0 jumps to the last line.
+ */
+void editorGotoLine(int count) {
+    View& V = *E.view;
+    Buffer& B = *V.buf;
+    int last_row = B.lines.empty() ? 0 : (int)B.lines.size() - 1;
+    V.cy = (count == 0 || count - 1 > last_row) ? last_row : count - 1;
+    V.cx = 0;
+    if (V.cy < (int)B.lines.size()) {
+        // Land on the first non-blank character
+        std::string scratch;
+        size_t first = bufferText(&B, V.cy, scratch).find_first_not_of(" \t");
+        if (first != std::string::npos) V.cx = first;
+    }
+}
+
+/**
+ * @brief Jumps to the declaration of the identifier under the cursor (gd).
+ * The lookup is one hash probe in the buffer's symbol table. A file that
+ * is not shown yet is opened through the buffer list, like :e.
+ */
+void editorGotoDefinition() {
+    View& V = *E.view;
+    Buffer* B = V.buf;
+    if (V.cy >= (int)B->lines.size()) return;
+    std::string scratch;
+    const std::string& line = bufferText(B, V.cy, scratch);
+    auto ident = [&](int at) { return at >= 0 && at < (int)line.size() && (isalnum((unsigned char)line[at]) || line[at] == '_'); };
+    int start = V.cx, end = V.cx;
+    while (ident(start - 1)) start--;
+    while (ident(end)) end++;
+    if (start == end) {
+        E.status_msg = "No identifier under cursor";
+        return;
+    }
+    std::string name = line.substr(start, end - start);
+    if (!B->symbols) {
+        E.status_msg = bufferIsKik(B) ? "Symbol index not ready yet" : "Not a KIK file";
+        return;
+    }
+    auto it = B->symbols->find(name);
+    if (B->symbols_version != B->version) indexBuffer(B); // Refresh for next time
+    if (it == B->symbols->end()) {
+        E.status_msg = "No definition found for " + name;
+        return;
+    }
+    Symbol sym = it->second; // The table may be replaced by editorEdit
+    if (sym.path != B->path) editorEdit(sym.path);
+    E.view->cy = sym.line;
+    E.view->cx = sym.col;
+    editorClampCursor(*E.view);
+    E.status_msg = sym.name + ": " + sym.kind + " at " + E.view->buf->filename + ":" + std::to_string(sym.line + 1);
+}
+
+/**
+ * @brief Reads the rest of a numeric count prefix in NORMAL mode.
+ * All digits are consumed here, so a count and the command it applies
+ * to are handled within one keypress cycle and produce one redraw.
+ * @param c The first digit, already read.
+ * @param count Receives the count, clamped to KIK_MAX_COUNT.
+ * @return The first key after the digits.
+ */
+char editorReadCount(char c, int& count) {
+    count = 0;
+    while (c >= '0' && c <= '9') {
+        int digit = c - '0';
+        count = count > (KIK_MAX_COUNT - digit) / 10 ? KIK_MAX_COUNT : count * 10 + digit;
+        c = editorReadKey();
+    }
+    return c;
+}
+
+/**
+ * @brief Inserts a character at the cursor's position.
+ * @param c The character to insert.
+ */
+void editorInsertChar(char c) {
+    View& V = *E.view;
+    Buffer& B = *V.buf;
+    if (V.cy == (int)B.lines.size()) {
+        bufferInsertRow(&B, V.cy, "");
+    }
+    bufferLine(&B, V.cy).insert(V.cx, 1, c);
+    V.cx++;
+    bufferRowChanged(&B, V.cy);
+}
+
+/**
+ * @brief Deletes the character at the cursor's position.
+ */
+void editorDeleteChar() {
+    View& V = *E.view;
+    Buffer& B = *V.buf;
+    if (V.cy >= (int)B.lines.size()) return;
+    if (V.cx > 0) {
+        bufferLine(&B, V.cy).erase(V.cx - 1, 1);
+        V.cx--;
+        bufferRowChanged(&B, V.cy);
+    }
+}
+
+/**
+ * @brief Processes a keypress based on the current editor mode.
+ * @param c The key, already read with editorReadKey.
+ */
+void editorProcessKeypress(char c) {
+    E.stats.overlay = false; // Any key closes the :stats overlay
+    View& V = *E.view;
+
+    if (E.mode == COMMAND) {
+        // Command mode logic is handled within editorPrompt
+        return;
+    }
+
+    if (E.mode == INSERT) {
+        // Ctrl-N and Ctrl-P step through the popup; any other key accepts it
+        if (c != CTRL_KEY('n') && c != CTRL_KEY('p')) E.completion.active = false;
+        switch (c) {
+            case CTRL_KEY('n'):
+                editorComplete(1);
+                break;
+            case CTRL_KEY('p'):
+                editorComplete(-1);
+                break;
+            case '\x1b': // Escape key
+                E.mode = NORMAL;
+                E.status_msg = "NORMAL MODE";
+                break;
+            case 127: // Backspace
+                editorDeleteChar();
+                break;
+            case '\r': { // Enter
+                Buffer& B = *V.buf;
+                if (V.cy == (int)B.lines.size()) {
+                    bufferInsertRow(&B, V.cy, "");
+                } else {
+                    bufferInsertRow(&B, V.cy + 1, bufferLine(&B, V.cy).substr(V.cx));
+                    bufferLine(&B, V.cy).erase(V.cx);
+                    bufferRowChanged(&B, V.cy);
+                }
+                V.cy++;
+                V.cx = 0;
+                break;
+            }
             default:
                 editorInsertChar(c);
                 break;
         }
     } else if (E.mode == NORMAL) {
+        int count = 0; // 0 means no count was typed
+        if (c >= '1' && c <= '9') {
+            c = editorReadCount(c, count);
+        }
         switch (c) {
             case 'i':
                 E.mode = INSERT;
@@ -255,45 +3514,91 @@ void editorProcessKeypress() {
             case 'j':
             case 'k':
             case 'l':
-                editorMoveCursor(c);
+                editorMoveCursor(c, count ? count : 1);
+                break;
+            case 'G':
+                editorGotoLine(count);
+                break;
+            case '%':
+                editorJumpToMatch();
                 break;
-            case 'x':
-                if (E.cy < E.lines.size() && E.cx < E.lines[E.cy].length()) {
-                    E.lines[E.cy].erase(E.cx, 1);
-                    E.dirty = true;
+            case 'g': {
+                char next = editorReadKey();
+                if (next == 'd') editorGotoDefinition();
+                else if (next == 'g') editorGotoLine(count ? count : 1);
+                break;
+            }
+            case CTRL_KEY('w'): {
+                char next = editorReadKey();
+                if (next == 'w' || next == CTRL_KEY('w')) editorCycleWindow(1);
+                else if (next == 'W') editorCycleWindow(-1);
+                break;
+            }
+            case 'x': {
+                Buffer& B = *V.buf;
+                std::string scratch;
+                if (V.cy < (int)B.lines.size() && V.cx < (int)bufferText(&B, V.cy, scratch).length()) {
+                    // A count erases the whole range in one call
+                    bufferLine(&B, V.cy).erase(V.cx, count ? count : 1);
+                    bufferRowChanged(&B, V.cy);
                 }
                 break;
-            case 'o':
-                E.cy++;
-                E.lines.insert(E.lines.begin() + E.cy, "");
-                E.cx = 0;
-                E.dirty = true;
+            }
+            case 'o': {
+                Buffer& B = *V.buf;
+                if (V.cy < (int)B.lines.size()) V.cy++;
+                bufferInsertRow(&B, V.cy, "");
+                V.cx = 0;
                 E.mode = INSERT;
                 E.status_msg = "INSERT MODE";
                 break;
+            }
             case ':': {
                 std::string cmd = editorPrompt(":");
                 if (!cmd.empty()) {
                     if (cmd == "q") {
-                        if (E.dirty) {
-                            E.status_msg = "Unsaved changes! Use :q! to force quit.";
+                        Buffer* dirty = editorFirstDirtyBuffer();
+                        if (editorCloseWindow()) {
+                            // Other windows remain; the buffer stays open
+                        } else if (dirty && !Server.enabled) {
+                            E.status_msg = "Unsaved changes in " + dirty->filename + "! Use :q! to force quit.";
                         } else {
-                            write(STDOUT_FILENO, "\x1b[2J", 4);
-                            write(STDOUT_FILENO, "\x1b[H", 3);
-                            exit(0);
+                            editorQuit(0);
                         }
                     } else if (cmd == "q!") {
-                        write(STDOUT_FILENO, "\x1b[2J", 4);
-                        write(STDOUT_FILENO, "\x1b[H", 3);
-                        exit(0);
+                        if (!editorCloseWindow()) editorQuit(0);
                     }
                     else if (cmd == "w") {
                         editorSave();
+                    } else if (cmd == "stats") {
+                        E.stats.overlay = true;
+                    } else if (cmd.compare(0, 2, "e ") == 0 && cmd.size() > 2) {
+                        editorEdit(cmd.substr(2));
+                    } else if (cmd == "bn") {
+                        editorCycleBuffer(1);
+                    } else if (cmd == "bp") {
+                        editorCycleBuffer(-1);
+                    } else if (cmd == "ls") {
+                        editorListBuffers();
+                    } else if (cmd == "sp" || cmd == "vsp") {
+                        editorSplitWindow(cmd == "vsp");
+                    } else if (cmd.compare(0, 3, "sp ") == 0 || cmd.compare(0, 4, "vsp ") == 0) {
+                        bool vertical = cmd[0] == 'v';
+                        if (editorSplitWindow(vertical)) editorEdit(cmd.substr(vertical ? 4 : 3));
                     } else if (cmd == "wq") {
                         editorSave();
-                        write(STDOUT_FILENO, "\x1b[2J", 4);
-                        write(STDOUT_FILENO, "\x1b[H", 3);
-                        exit(0);
+                        if (!editorCloseWindow()) editorQuit(0);
+                    } else if (cmd == "mksession") {
+                        sessionSaveAll(true);
+                    } else if (cmd == "shutdown" || cmd == "shutdown!") {
+                        Buffer* dirty = editorFirstDirtyBuffer();
+                        if (!Server.enabled) {
+                            E.status_msg = "Not running as a server";
+                        } else if (dirty && cmd == "shutdown") {
+                            E.status_msg = "Unsaved changes in " + dirty->filename + "! Use :shutdown! to force.";
+                        } else {
+                            serverShutdown();
+                        }
                     } else {
                         E.status_msg = "Unknown command: " + cmd;
                     }
@@ -308,106 +3613,229 @@ void editorProcessKeypress() {
 // --- Screen Output ---
 
 /**
- * @brief Handles scrolling of the viewport.
+ * @brief Handles scrolling of the current window.
  */
-// REPLACE THE OLD editorScroll FUNCTION WITH THIS:
 void editorScroll() {
+    View& V = *E.view;
     // Vertical scrolling
-    if (E.cy < E.row_offset) {
-        E.row_offset = E.cy;
+    if (V.cy < V.row_offset) {
+        V.row_offset = V.cy;
     }
-    if (E.cy >= E.row_offset + E.screen_rows) {
-        E.row_offset = E.cy - E.screen_rows + 1;
+    if (V.cy >= V.row_offset + V.rows) {
+        V.row_offset = V.cy - V.rows + 1;
     }
     // Horizontal scrolling
-    if (E.cx < E.col_offset) {
-        E.col_offset = E.cx;
+    if (V.cx < V.col_offset) {
+        V.col_offset = V.cx;
     }
-    if (E.cx >= E.col_offset + E.screen_cols) {
-        E.col_offset = E.cx - E.screen_cols + 1;
+    if (V.cx >= V.col_offset + V.cols) {
+        V.col_offset = V.cx - V.cols + 1;
     }
 }
 
 /**
- * @brief Draws the text rows to the screen buffer.
- * @param buffer The string buffer to append drawing commands to.
+ * @brief Draws one text row of a window.
+ * @param V The window.
+ * @param y The row within the window's text area.
+ * @return The row, padded with spaces to the window's width.
  */
-// REPLACE THE OLD editorDrawRows FUNCTION WITH THIS:
-void editorDrawRows(std::string& buffer) {
-    for (int y = 0; y < E.screen_rows; y++) {
-        int file_row = y + E.row_offset;
-        if (file_row >= E.lines.size()) {
-            buffer.append("~\r\n");
-        } else {
-            std::string line = E.lines[file_row];
-            if (line.length() > E.col_offset) {
-                line = line.substr(E.col_offset);
-            } else {
-                line = "";
-            }
-            if (line.length() > E.screen_cols) {
-                line = line.substr(0, E.screen_cols);
-            }
-            buffer.append(line);
-            buffer.append("\r\n");
+std::string editorRenderRow(const View& V, int y) {
+    Buffer& B = *V.buf;
+    int file_row = y + V.row_offset;
+    int mark = (&V == E.match_view && file_row == E.match_line) ? E.match_col : -1;
+    std::string line, scratch;
+    if (file_row >= (int)B.lines.size()) {
+        line = "~";
+    } else if (bufferIsKik(&B)) {
+        return syntaxRenderLine(&B, file_row, V.col_offset, V.cols, mark);
+    } else {
+        const std::string& text = bufferText(&B, file_row, scratch);
+        if ((int)text.length() > V.col_offset) line = text.substr(V.col_offset, V.cols);
+    }
+    line.append(V.cols - line.length(), ' ');
+    if (mark >= V.col_offset && mark < V.col_offset + V.cols) {
+        line.replace(mark - V.col_offset, 1, "\x1b[7m" + line.substr(mark - V.col_offset, 1) + "\x1b[27m");
+    }
+    return line;
+}
+
+/**
+ * @brief Brings the drawn text rows of every window up to date.
+ * A row is redrawn only if its line changed (see bufferInvalidate) or
+ * its window switched buffer, moved or scrolled sideways. Vertical
+ * scrolling reuses the rows that stay on screen.
+ */
+void editorDrawRows() {
+    for (const auto& v : E.views) {
+        View& V = *v;
+        int shift = V.row_offset - V.drawn_row_offset;
+        if (V.drawn_buf != V.buf || V.drawn_col_offset != V.col_offset ||
+            (int)V.row_valid.size() != V.rows || std::abs(shift) >= V.rows) {
+            V.row_valid.assign(V.rows, false);
+            V.rendered.assign(V.rows, std::string());
+        } else if (shift > 0) {
+            // Scrolled down: keep the rows still visible, draw the new ones
+            std::rotate(V.rendered.begin(), V.rendered.begin() + shift, V.rendered.end());
+            V.row_valid.erase(V.row_valid.begin(), V.row_valid.begin() + shift);
+            V.row_valid.insert(V.row_valid.end(), shift, false);
+        } else if (shift < 0) {
+            std::rotate(V.rendered.rbegin(), V.rendered.rbegin() - shift, V.rendered.rend());
+            V.row_valid.erase(V.row_valid.end() + shift, V.row_valid.end());
+            V.row_valid.insert(V.row_valid.begin(), -shift, false);
+        }
+        V.drawn_buf = V.buf;
+        V.drawn_row_offset = V.row_offset;
+        V.drawn_col_offset = V.col_offset;
+
+        for (int y = 0; y < V.rows; y++) {
+            if (V.row_valid[y]) continue;
+            V.rendered[y] = editorRenderRow(V, y);
+            V.row_valid[y] = true;
         }
     }
 }
 
 /**
- * @brief Draws the status bar at the bottom of the screen.
- * @param buffer The string buffer to append drawing commands to.
+ * @brief Draws the status bar of one window.
+ * @param V The window.
+ * @return The status line, padded to the window's width.
+ */
+std::string editorStatusLine(const View& V) {
+    const Buffer& B = *V.buf;
+    std::string status = B.filename + (B.dirty ? " [Modified]" : "") + " - " + std::to_string(B.lines.size()) + " lines";
+    if (!B.diagnostic.empty()) status += " - " + B.diagnostic;
+    std::string pos = std::to_string(V.cy + 1) + ":" + std::to_string(V.cx + 1);
+    // Narrow windows cut the file name first, then the position
+    if ((int)pos.length() > V.cols) pos.resize(V.cols);
+    if (status.length() > V.cols - pos.length()) status.resize(V.cols - pos.length());
+    std::string line = "\x1b[7m"; // Invert colors
+    line.append(status);
+    line.append(V.cols - status.length() - pos.length(), ' ');
+    line.append(pos);
+    line.append("\x1b[m"); // Reset colors
+    return line;
+}
+
+/**
+ * @brief Draws the status bars of all windows.
+ * @param status Receives one status line per window, in E.views order.
+ */
+void editorDrawStatusBar(std::vector<std::string>& status) {
+    status.clear();
+    for (const auto& v : E.views) status.push_back(editorStatusLine(*v));
+}
+
+/**
+ * @brief Arranges the drawn windows of a layout subtree into screen lines.
+ * @param node The subtree.
+ * @param status Status lines from editorDrawStatusBar.
+ * @param out Receives the subtree's lines, top to bottom.
  */
-void editorDrawStatusBar(std::string& buffer) {
-    buffer.append("\x1b[7m"); // Invert colors
-    std::string status = E.filename + (E.dirty ? " [Modified]" : "") + " - " + std::to_string(E.lines.size()) + " lines";
-    std::string pos = std::to_string(E.cy + 1) + ":" + std::to_string(E.cx + 1);
-    
-    buffer.append(status);
-    int len = status.length();
-    while (len < E.screen_cols - pos.length()) {
-        buffer.append(" ");
-        len++;
+void layoutCompose(const Layout* node, const std::vector<std::string>& status, std::vector<std::string>& out) {
+    if (node->view) {
+        const View& V = *node->view;
+        out.insert(out.end(), V.rendered.begin(), V.rendered.end());
+        for (size_t i = 0; i < E.views.size(); i++) {
+            if (E.views[i].get() == &V) out.push_back(status[i]);
+        }
+        return;
+    }
+    if (!node->vertical) {
+        layoutCompose(node->first.get(), status, out);
+        layoutCompose(node->second.get(), status, out);
+        return;
+    }
+    std::vector<std::string> left, right;
+    layoutCompose(node->first.get(), status, left);
+    layoutCompose(node->second.get(), status, right);
+    for (size_t i = 0; i < left.size(); i++) {
+        out.push_back(left[i] + "|" + right[i]);
     }
-    buffer.append(pos);
-    buffer.append("\x1b[m"); // Reset colors
-    buffer.append("\r\n");
-    buffer.append(E.status_msg);
 }
 
 /**
- * @brief Refreshes the entire screen with the current editor state.
+ * @brief Refreshes the screen with the current editor state.
+ * The windows are composed into one frame and only the screen lines that
+ * differ from the previous frame are sent to the terminal.
  */
-// REPLACE THE OLD editorRefreshScreen FUNCTION WITH THIS:
 void editorRefreshScreen() {
+    traceBegin("render", "render");
+    uint64_t start = statsNow();
     editorScroll();
+    uint64_t t_scroll = statsNow();
+    editorUpdateMatch();
+    editorDrawRows();
+    uint64_t t_rows = statsNow();
+    std::vector<std::string> status;
+    editorDrawStatusBar(status);
+    uint64_t t_status = statsNow();
 
-    // Force clear the screen and move cursor to top-left
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    std::vector<std::string> screen;
+    layoutCompose(E.layout.get(), status, screen);
+    screen.push_back(E.status_msg.substr(0, E.screen_cols));
+    if (E.stats.overlay) {
+        // The stats overlay covers the top rows of the screen
+        std::vector<std::string> overlay = statsOverlayLines();
+        for (size_t y = 0; y < overlay.size() && y + 1 < screen.size(); y++) {
+            std::string line = overlay[y].substr(0, E.screen_cols);
+            line.append(E.screen_cols - line.length(), ' ');
+            screen[y] = "\x1b[7m" + line + "\x1b[m";
+        }
+    }
 
-    std::string buffer;
-    editorDrawRows(buffer);
-    editorDrawStatusBar(buffer);
+    std::string buffer = "\x1b[?25l"; // Hide the cursor while drawing
+    if (E.frame.size() != screen.size()) {
+        buffer.append("\x1b[2J");
+        E.frame.assign(screen.size(), std::string());
+    }
+    for (size_t y = 0; y < screen.size(); y++) {
+        if (screen[y] == E.frame[y]) continue;
+        buffer.append("\x1b[" + std::to_string(y + 1) + ";1H");
+        buffer.append(screen[y]);
+        buffer.append("\x1b[K");
+    }
+    E.frame.swap(screen);
+    if (E.completion.active) completionDrawPopup(buffer);
 
-    // Position cursor relative to the scroll offset
-    int cursor_y = E.cy - E.row_offset + 1;
-    int cursor_x = E.cx - E.col_offset + 1;
+    // Position cursor relative to the window and its scroll offset
+    const View& V = *E.view;
+    int cursor_y = V.top + V.cy - V.row_offset + 1;
+    int cursor_x = V.left + V.cx - V.col_offset + 1;
     buffer.append("\x1b[" + std::to_string(cursor_y) + ";" + std::to_string(cursor_x) + "H");
+    buffer.append("\x1b[?25h");
 
-    write(STDOUT_FILENO, buffer.c_str(), buffer.length());
+    editorWrite(buffer);
+    uint64_t end = statsNow();
+
+    statsRecord(STAGE_SCROLL, t_scroll - start);
+    statsRecord(STAGE_DRAW_ROWS, t_rows - t_scroll);
+    statsRecord(STAGE_DRAW_STATUS, t_status - t_rows);
+    statsRecord(STAGE_WRITE, end - t_status);
+    E.stats.nested_ns += end - start;
+    traceEnd("render", "render");
 }
 
 
 // --- File I/O ---
 
 /**
- * @brief Reads a file from disk into the editor buffer.
- * @param filename The name of the file to open.
+ * @brief Reads a buffer's file from disk into the buffer.
+ * Only needed the first time a buffer is shown, or after eviction.
+ * A valid session snapshot is used instead of reading the file.
+ * @param B The buffer to fill; its filename names the file.
  */
-void editorOpen(const char* filename) {
-    E.filename = filename;
-    std::ifstream file(filename);
+void editorOpen(Buffer* B) {
+    traceBegin("editorOpen", "io");
+    if (sessionRestore(B)) {
+        B->opened = true;
+        traceEnd("editorOpen", "io");
+        return;
+    }
+    lineClear(B->lines);
+    B->hl_state.clear();
+    completionReset(B);
+    bracketReset(B);
+    std::ifstream file(B->filename);
     if (file.is_open()) {
         std::string line;
         while (getline(file, line)) {
@@ -415,37 +3843,144 @@ void editorOpen(const char* filename) {
             while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
                 line.pop_back();
             }
-            E.lines.push_back(line);
+            lineInsert(B->lines, B->lines.size(), line);
         }
         file.close();
     }
+    B->loaded = true;
+    B->opened = true;
+    B->dirty = false;
+    B->mem_bytes = bufferMemory(*B);
+    traceEnd("editorOpen", "io");
 }
 
+// Outcome of a background save, filled in by the worker
+struct SaveResult {
+    bool ok;
+    size_t bytes;
+    std::string error;
+};
+
 /**
  * @brief Saves the current buffer to disk.
+ * The lines are copied and written by a worker thread, so a large file
+ * does not stall typing. Edits made meanwhile keep the buffer modified.
  */
 void editorSave() {
-    if (E.filename == "[No Name]") {
-        E.filename = editorPrompt("Save as: ");
-        if (E.filename.empty()) {
+    static std::mutex save_lock; // Keeps writes to the same file in order
+    Buffer& B = *E.view->buf;
+    if (B.filename == "[No Name]") {
+        std::string name = editorPrompt("Save as: ");
+        if (name.empty()) {
             E.status_msg = "Save aborted.";
             return;
         }
+        B.filename = name;
+        B.path = canonicalPath(name);
     }
 
-    std::ofstream file(E.filename);
-    if (file.is_open()) {
-        int len = 0;
-        for (const auto& line : E.lines) {
-            file << line << std::endl;
-            len += line.length() + 1;
+    std::shared_ptr<LineTable> text = std::make_shared<LineTable>(lineShare(B.lines));
+    std::shared_ptr<SaveResult> result = std::make_shared<SaveResult>();
+    std::string filename = B.filename;
+    uint64_t version = B.version;
+    Buffer* target = &B;
+    if (B.save_token) *B.save_token = true; // Superseded by this save
+    CancelToken token = std::make_shared<std::atomic<bool>>(false);
+    B.save_token = token;
+
+    taskSubmit([=]() {
+        std::lock_guard<std::mutex> guard(save_lock);
+        if (*token) return;
+        traceBegin("editorSave", "io");
+        std::ofstream file(filename);
+        if (file.is_open()) {
+            size_t len = 0;
+            std::string scratch;
+            for (size_t i = 0; i < text->size(); i++) {
+                const std::string& line = lineText(*text, i, scratch);
+                file << line << '\n';
+                len += line.length() + 1;
+            }
+            file.close();
+            result->ok = !file.fail();
+            result->bytes = len;
+        }
+        if (!result->ok) result->error = strerror(errno);
+        traceEnd("editorSave", "io");
+    }, [=]() {
+        if (*token) return; // A later save owns the status now
+        if (!result->ok) {
+            E.status_msg = "Error writing to file: " + result->error;
+            return;
+        }
+        if (target->version == version) target->dirty = false;
+        target->path = canonicalPath(filename);
+        target->mem_bytes = bufferMemory(*target);
+        E.status_msg = std::to_string(result->bytes) + " bytes written to " + filename;
+    }, TASK_HIGH);
+    E.status_msg = "Writing " + filename + "...";
+}
+
+/**
+ * @brief Clears the screen (when drawing) and exits the editor.
+ * In server mode only the client that typed the command is detached;
+ * the server and its buffers stay up.
+ * @param code The process exit status.
+ */
+void editorQuit(int code) {
+    if (Server.enabled) {
+        serverDetach(Server.active_fd);
+        return;
+    }
+    taskWaitIdle(); // Let background saves finish
+    if (!E.headless) {
+        sessionSaveAll(false);
+        write(STDOUT_FILENO, "\x1b[2J", 4);
+        write(STDOUT_FILENO, "\x1b[H", 3);
+    }
+    exit(code);
+}
+
+/**
+ * @brief Loads the key stream for headless mode.
+ * @param path The script file; its bytes are fed as keypresses.
+ */
+void editorLoadScript(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) die(std::string("cannot open script ") + path);
+    E.script.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    E.script_pos = 0;
+    E.headless = true;
+}
+
+/**
+ * @brief Writes the result of a headless run and exits.
+ * Called once the script is exhausted. Named buffers are saved to their
+ * file; an unnamed buffer is written to stdout so scripts can be used
+ * as filters in pipelines.
+ */
+void editorFinishScript() {
+    Buffer* current = E.view->buf;
+    for (const auto& b : E.buffers) {
+        if (b->filename == "[No Name]" || !b->dirty) continue;
+        E.view->buf = b.get();
+        editorSave();
+        taskWaitIdle();
+        if (b->dirty) {
+            fprintf(stderr, "%s\n", E.status_msg.c_str());
+            exit(1);
         }
-        file.close();
-        E.dirty = false;
-        E.status_msg = std::to_string(len) + " bytes written to " + E.filename;
-    } else {
-        E.status_msg = "Error writing to file: " + std::string(strerror(errno));
     }
+    E.view->buf = current;
+    if (current->filename == "[No Name]") {
+        std::string out, scratch;
+        for (size_t i = 0; i < current->lines.size(); i++) {
+            out.append(bufferText(current, i, scratch));
+            out.append("\n");
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+    }
+    exit(0);
 }
 
 /**
@@ -458,7 +3993,7 @@ std::string editorPrompt(const std::string& prompt) {
     E.mode = COMMAND;
     while (true) {
         E.status_msg = prompt + input;
-        editorRefreshScreen();
+        if (!E.headless) editorRefreshScreen();
         char c = editorReadKey();
         if (c == '\r') {
             E.mode = NORMAL;
@@ -476,18 +4011,810 @@ std::string editorPrompt(const std::string& prompt) {
     }
 }
 
+// --- Session Snapshots ---
+
+/**
+ * @brief Returns the directory for session snapshots, creating it if needed.
+ * @return The directory, or "" if there is no home or cache directory.
+ */
+std::string sessionDir() {
+    std::string dir;
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (cache && *cache) dir = cache;
+    else if (home && *home) dir = std::string(home) + "/.cache";
+    else return "";
+    mkdir(dir.c_str(), 0700);
+    dir += "/kik-editor";
+    mkdir(dir.c_str(), 0700);
+    return dir;
+}
+
+/**
+ * @brief FNV-1a hash, continued from `h`.
+ */
+uint64_t fnv1a(uint64_t h, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Returns the snapshot file for a buffer, named by a hash of its path.
+ */
+std::string sessionPath(const Buffer& B) {
+    std::string dir = sessionDir();
+    if (dir.empty()) return "";
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.snap",
+             (unsigned long long)fnv1a(14695981039346656037ULL, B.path.data(), B.path.size()));
+    return dir + name;
+}
+
+/**
+ * @brief Hashes 16 evenly spaced 4 KB samples of a file, including its
+ * first and last block. Small files are hashed whole. Together with the
+ * size and mtime this catches a changed file without reading all of it.
+ */
+uint64_t snapshotFileHash(const char* data, size_t size) {
+    const size_t SAMPLE = 4096, SAMPLES = 16;
+    uint64_t h = 14695981039346656037ULL;
+    if (size <= SAMPLES * SAMPLE) return fnv1a(h, data, size);
+    for (size_t i = 0; i < SAMPLES; i++) {
+        h = fnv1a(h, data + (size - SAMPLE) / (SAMPLES - 1) * i, SAMPLE);
+    }
+    return h;
+}
+
+/**
+ * @brief Returns a file's modification time in nanoseconds.
+ */
+int64_t statMtimeNs(const struct stat& st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Maps a whole file read-only.
+ * @param path The file.
+ * @param size Receives its size.
+ * @param st_out If not null, receives its stat.
+ * @return The mapping, or nullptr if the file is missing or empty.
+ */
+const char* mapFile(const std::string& path, size_t& size, struct stat* st_out) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return nullptr;
+    size = st.st_size;
+    if (st_out) *st_out = st;
+    return (const char*)map;
+}
+
+/**
+ * @brief Reads a whole file into memory. Used for files other programs
+ * may change, which could not be mapped safely.
+ * @param path The file.
+ * @param out Receives its contents.
+ * @param st_out If not null, receives its stat.
+ * @return False if the file cannot be read.
+ */
+bool readFile(const std::string& path, std::string& out, struct stat* st_out) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok) {
+        out.resize(st.st_size);
+        size_t done = 0;
+        while (ok && done < out.size()) {
+            ssize_t n = read(fd, &out[done], out.size() - done);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) ok = false; // Shrank while being read
+            else done += n;
+        }
+    }
+    close(fd);
+    if (ok && st_out) *st_out = st;
+    return ok;
+}
+
+/**
+ * @brief Builds the line table of a file, splitting it as editorOpen does.
+ */
+void sessionScanLines(const char* data, size_t size, std::vector<SnapshotLine>& table) {
+    size_t start = 0;
+    while (start < size) {
+        const char* nl = (const char*)memchr(data + start, '\n', size - start);
+        size_t end = nl ? nl - data : size;
+        size_t len = end - start;
+        while (len > 0 && data[start + len - 1] == '\r') len--;
+        SnapshotLine L = {start, (uint32_t)len, 0};
+        table.push_back(L);
+        start = end + 1;
+    }
+}
+
+/**
+ * @brief Fills a buffer from its session snapshot, if one is valid.
+ * Nothing is parsed: the snapshot is mapped and the file read whole,
+ * the buffer's line table is one chunk over the snapshot's, and lines
+ * are only copied out when they are edited (see LineChunk). The
+ * snapshot is rejected if the file's size, mtime or sampled hash
+ * changed, or if any line lies outside the data it points into.
+ * @param B The buffer; its path names the file.
+ * @return False if the file has to be read normally.
+ */
+bool sessionRestore(Buffer* B) {
+    if (B->path.empty()) return false;
+    std::shared_ptr<Snapshot> S(new Snapshot());
+    S->map = mapFile(sessionPath(*B), S->map_size, nullptr);
+    if (!S->map) return false;
+    const SnapshotHeader* H = (const SnapshotHeader*)S->map;
+    if (S->map_size < sizeof(*H) || memcmp(H->magic, KIK_SNAPSHOT_MAGIC, 8) != 0 ||
+        H->version != KIK_SNAPSHOT_VERSION || H->line_count > INT_MAX ||
+        H->line_count > (S->map_size - sizeof(*H)) / sizeof(SnapshotLine)) {
+        return false;
+    }
+    struct stat st;
+    if (!readFile(B->path, S->file, &st) || S->file.size() != H->file_size ||
+        statMtimeNs(st) != H->file_mtime_ns || snapshotFileHash(S->file.data(), S->file.size()) != H->file_hash) {
+        return false;
+    }
+    S->header = H;
+    S->lines = (const SnapshotLine*)(S->map + sizeof(*H));
+
+    int n = H->line_count;
+    for (int i = 0; i < n; i++) {
+        const SnapshotLine& L = S->lines[i];
+        size_t size = L.in_snapshot ? S->map_size : S->file.size();
+        if (L.in_snapshot > 1 || L.offset > size || L.length > size - L.offset) return false;
+    }
+    lineClear(B->lines);
+    if (n > 0) {
+        LineChunk all = {S, 0, (uint32_t)n, nullptr, false};
+        B->lines.chunks.push_back(all);
+        lineRenumber(B->lines, 0);
+    }
+    B->hl_state.clear();
+    completionReset(B);
+    bracketReset(B);
+    B->snapshot = S;
+    B->loaded = true;
+    B->dirty = H->dirty != 0;
+    B->mem_bytes = bufferMemory(*B);
+    if (!B->opened) {
+        B->saved_cy = std::min(std::max(H->cy, 0), std::max(n - 1, 0));
+        B->saved_cx = std::max(H->cx, 0); // Clamped by the first cursor motion
+        B->saved_row_offset = std::min(std::max(H->row_offset, 0), B->saved_cy);
+        B->saved_col_offset = std::min(std::max(H->col_offset, 0), B->saved_cx);
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the snapshot of one buffer.
+ * A clean buffer's line table points into its file; lines with unsaved
+ * changes are stored in the snapshot. When the buffer came from a
+ * snapshot and neither it nor the file has changed since, only the
+ * header (the cursor) is rewritten.
+ * @return False if the snapshot could not be written.
+ */
+bool sessionSave(Buffer* B) {
+    std::string snap = sessionPath(*B);
+    struct stat st;
+    if (snap.empty() || stat(B->path.c_str(), &st) == -1) return false;
+    traceBegin("sessionSave", "io");
+
+    SnapshotHeader H;
+    memset(&H, 0, sizeof(H));
+    memcpy(H.magic, KIK_SNAPSHOT_MAGIC, 8);
+    H.version = KIK_SNAPSHOT_VERSION;
+    H.cx = B->saved_cx;
+    H.cy = B->saved_cy;
+    H.row_offset = B->saved_row_offset;
+    H.col_offset = B->saved_col_offset;
+    for (const auto& v : E.views) {
+        if (v->buf != B) continue;
+        // Prefer the window being edited, else the first one on the buffer
+        const View& V = (E.view->buf == B) ? *E.view : *v;
+        H.cx = V.cx;
+        H.cy = V.cy;
+        H.row_offset = V.row_offset;
+        H.col_offset = V.col_offset;
+        break;
+    }
+
+    const SnapshotHeader* old = B->snapshot ? B->snapshot->header : nullptr;
+    bool file_same = old && old->file_size == (uint64_t)st.st_size && old->file_mtime_ns == statMtimeNs(st);
+    if (file_same && !B->dirty && !old->dirty && old->line_count == B->lines.size()) {
+        H.file_size = old->file_size;
+        H.file_mtime_ns = old->file_mtime_ns;
+        H.file_hash = old->file_hash;
+        H.line_count = old->line_count;
+        int fd = open(snap.c_str(), O_WRONLY);
+        bool ok = fd != -1 && pwrite(fd, &H, sizeof(H), 0) == sizeof(H);
+        if (fd != -1) close(fd);
+        traceEnd("sessionSave", "io");
+        return ok;
+    }
+    if (old && !file_same) bufferMaterialize(B); // Its file offsets are stale
+
+    std::string file;
+    if (!readFile(B->path, file, &st)) {
+        traceEnd("sessionSave", "io");
+        return false;
+    }
+    H.file_size = file.size();
+    H.file_mtime_ns = statMtimeNs(st);
+    H.file_hash = snapshotFileHash(file.data(), file.size());
+    std::vector<SnapshotLine> table;
+    std::string text;
+    if (!B->dirty) {
+        sessionScanLines(file.data(), file.size(), table);
+    } else {
+        table.reserve(B->lines.size());
+        uint64_t text_start = sizeof(H) + B->lines.size() * sizeof(SnapshotLine);
+        for (const auto& C : B->lines.chunks) {
+            for (uint32_t k = 0; k < C.count; k++) {
+                const char* data;
+                size_t len;
+                if (C.snapshot) {
+                    const SnapshotLine& src = C.snapshot->lines[C.first + k];
+                    if (!src.in_snapshot) {
+                        table.push_back(src); // Still unchanged in the file
+                        continue;
+                    }
+                    data = C.snapshot->map + src.offset;
+                    len = src.length;
+                } else {
+                    data = (*C.text)[k].data();
+                    len = (*C.text)[k].size();
+                }
+                SnapshotLine L = {text_start + text.size(), (uint32_t)len, 1};
+                table.push_back(L);
+                text.append(data, len);
+            }
+        }
+        H.dirty = 1;
+    }
+    H.line_count = table.size();
+
+    // Write a new file and rename it, so a mapped old snapshot stays intact
+    std::string tmp = snap + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    bool ok = f && fwrite(&H, sizeof(H), 1, f) == 1 &&
+              fwrite(table.data(), sizeof(SnapshotLine), table.size(), f) == table.size() &&
+              fwrite(text.data(), 1, text.size(), f) == text.size();
+    if (f && fclose(f) != 0) ok = false;
+    ok = ok && rename(tmp.c_str(), snap.c_str()) == 0;
+    if (!ok) unlink(tmp.c_str());
+    traceEnd("sessionSave", "io");
+    return ok;
+}
+
+/**
+ * @brief Writes snapshots for all loaded, named buffers.
+ * @param include_dirty False on exit, where unsaved changes that were
+ * thrown away with :q! must not come back; true for :mksession.
+ */
+void sessionSaveAll(bool include_dirty) {
+    int saved = 0, failed = 0;
+    for (const auto& b : E.buffers) {
+        if (!b->loaded || b->path.empty() || (b->dirty && !include_dirty)) continue;
+        if (sessionSave(b.get())) saved++;
+        else failed++;
+    }
+    E.status_msg = "Session saved for " + std::to_string(saved) + " buffer(s)";
+    if (failed) E.status_msg += ", " + std::to_string(failed) + " failed";
+}
+
+// --- Server Mode ---
+
+/**
+ * @brief Makes sure a directory exists and is private to this user:
+ * owned by them, not a symlink, and closed to group and others.
+ * @return False if it cannot be created or belongs to someone else.
+ */
+bool privateDir(const std::string& dir) {
+    mkdir(dir.c_str(), 0700);
+    struct stat st;
+    if (lstat(dir.c_str(), &st) == -1) return false;
+    return S_ISDIR(st.st_mode) && st.st_uid == getuid() && !(st.st_mode & 077);
+}
+
+/**
+ * @brief Returns the path of the server's Unix socket.
+ * KIK_SOCKET overrides the default, kik-editor.sock in $XDG_RUNTIME_DIR,
+ * or in a private /tmp/kik-editor-$UID directory if that is not set.
+ * @return The path, or "" if the default directory is not private.
+ */
+std::string serverSocketPath() {
+    const char* env = getenv("KIK_SOCKET");
+    if (env && *env) return env;
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    std::string dir = runtime && *runtime ? runtime : "/tmp/kik-editor-" + std::to_string(getuid());
+    if (!privateDir(dir)) return "";
+    return dir + "/kik-editor.sock";
+}
+
+/**
+ * @brief Checks that the process at the other end of a Unix socket runs
+ * as this user.
+ */
+bool peerIsSelf(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) return false;
+    return cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) == -1) return false;
+    return uid == getuid();
+#endif
+}
+
+/**
+ * @brief Opens a stream socket connected to the server.
+ * Everything typed goes to the server, so the socket file and the
+ * process listening on it must both belong to this user.
+ * @return The socket; -1 if no server is listening; -2 if the path is
+ * not this user's socket, or another user is listening on it.
+ */
+int serverConnect(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1) return -1;
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid()) return -2;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (!peerIsSelf(fd)) {
+        close(fd);
+        return -2;
+    }
+    return fd;
+}
+
+/**
+ * @brief Explains why there is no usable socket path, for serverStart
+ * and clientMain.
+ * @param path The socket path, or "" if serverSocketPath found none.
+ */
+void socketPathError(const std::string& path) {
+    if (path.empty()) {
+        fprintf(stderr, "kik-editor: no private directory for the server socket; set XDG_RUNTIME_DIR or KIK_SOCKET\n");
+    } else {
+        fprintf(stderr, "kik-editor: refusing %s: it belongs to another user or is not a socket\n", path.c_str());
+    }
+}
+
+/**
+ * @brief Sends one framed message.
+ * @param fd The socket.
+ * @param type A MessageType.
+ * @param payload The message body.
+ * @return False if the peer is gone or not reading.
+ */
+bool sendMessage(int fd, char type, const std::string& payload) {
+    uint32_t len = payload.size();
+    std::string msg(1, type);
+    msg.append((const char*)&len, sizeof(len));
+    msg.append(payload);
+    size_t off = 0;
+    while (off < msg.size()) {
+        ssize_t n = send(fd, msg.data() + off, msg.size() - off, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes one complete message from the front of a receive buffer.
+ * @param inbox Bytes received so far.
+ * @param type Receives the message type.
+ * @param payload Receives the message body.
+ * @return False if no complete message has arrived yet.
+ */
+bool takeMessage(std::string& inbox, char& type, std::string& payload) {
+    uint32_t len;
+    if (inbox.size() < 1 + sizeof(len)) return false;
+    memcpy(&len, inbox.data() + 1, sizeof(len));
+    if (inbox.size() < 1 + sizeof(len) + len) return false;
+    type = inbox[0];
+    payload = inbox.substr(1 + sizeof(len), len);
+    inbox.erase(0, 1 + sizeof(len) + len);
+    return true;
+}
+
+/**
+ * @brief Removes the server's socket file. Registered with atexit.
+ */
+void serverCleanup() {
+    unlink(Server.socket_path.c_str());
+}
+
+/**
+ * @brief Starts listening for clients (--server).
+ * A socket file left behind by a server that died is replaced; if a
+ * server is still answering on it, or the file is someone else's, this
+ * one refuses to start.
+ */
+void serverStart() {
+    Server.socket_path = serverSocketPath();
+    int probe = Server.socket_path.empty() ? -2 : serverConnect(Server.socket_path);
+    if (probe == -2) {
+        socketPathError(Server.socket_path);
+        exit(1);
+    }
+    if (probe != -1) {
+        close(probe);
+        fprintf(stderr, "kik-editor: a server is already running on %s\n", Server.socket_path.c_str());
+        exit(1);
+    }
+    unlink(Server.socket_path.c_str());
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (Server.socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "kik-editor: socket path too long: %s\n", Server.socket_path.c_str());
+        exit(1);
+    }
+    strcpy(addr.sun_path, Server.socket_path.c_str());
+    Server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Server.listen_fd == -1) die("socket failed");
+    mode_t old_mask = umask(077); // Only the owner may attach
+    int bound = bind(Server.listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound == -1) die("bind failed");
+    if (listen(Server.listen_fd, 16) == -1) die("listen failed");
+    atexit(serverCleanup);
+    Server.enabled = true;
+    Server.active_fd = -1;
+}
+
+/**
+ * @brief Finds an attached client by its socket.
+ * @return The client, or nullptr if it has gone.
+ */
+Client* serverFindClient(int fd) {
+    for (auto& C : Server.clients) {
+        if (C.fd == fd) return &C;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Closes a client's connection and forgets its pending keys.
+ */
+void serverDropClient(int fd) {
+    for (size_t i = 0; i < Server.clients.size(); i++) {
+        if (Server.clients[i].fd == fd) {
+            Server.clients.erase(Server.clients.begin() + i);
+            close(fd);
+            break;
+        }
+    }
+    for (size_t i = 0; i < Server.keys.size();) {
+        if (Server.keys[i].first == fd) Server.keys.erase(Server.keys.begin() + i);
+        else i++;
+    }
+    if (Server.active_fd == fd) Server.active_fd = -1;
+}
+
+/**
+ * @brief Tells a client its session is over and disconnects it (:q).
+ */
+void serverDetach(int fd) {
+    if (!serverFindClient(fd)) return;
+    sendMessage(fd, MSG_DETACH, "");
+    serverDropClient(fd);
+}
+
+/**
+ * @brief Detaches every client and stops the server (:shutdown).
+ */
+void serverShutdown() {
+    while (!Server.clients.empty()) serverDetach(Server.clients.front().fd);
+    taskWaitIdle();
+    sessionSaveAll(false);
+    exit(0);
+}
+
+/**
+ * @brief Sends a message to every attached client.
+ * Clients that cannot keep up are disconnected.
+ */
+void serverBroadcast(char type, const std::string& payload) {
+    std::vector<int> failed;
+    for (const auto& C : Server.clients) {
+        if (!sendMessage(C.fd, type, payload)) failed.push_back(C.fd);
+    }
+    for (int fd : failed) serverDropClient(fd);
+}
+
+/**
+ * @brief Draws for a client's terminal size from now on.
+ * The whole screen is repainted, since the other clients' terminals
+ * may have been drawn at a different size.
+ */
+void serverResize(const Client& C) {
+    if (C.rows == E.screen_rows && C.cols == E.screen_cols) return;
+    E.screen_rows = C.rows;
+    E.screen_cols = C.cols;
+    E.frame.clear();
+    editorLayoutWindows();
+}
+
+/**
+ * @brief Acts on one message from a client.
+ * HELLO opens the requested file, which is only a buffer switch if the
+ * server already holds it, and repaints every client's screen.
+ */
+void serverHandleMessage(int fd, char type, const std::string& payload) {
+    Client* C = serverFindClient(fd);
+    if (type == MSG_KEYS) {
+        for (char k : payload) Server.keys.push_back(std::make_pair(fd, k));
+        return;
+    }
+    if (type != MSG_HELLO && type != MSG_RESIZE) return;
+    int rows = 0, cols = 0;
+    if (sscanf(payload.c_str(), "%d %d", &rows, &cols) != 2 || rows < 2 || cols < 1) return;
+    C->rows = rows;
+    C->cols = cols;
+    Server.active_fd = fd;
+    serverResize(*C);
+    size_t newline = payload.find('\n');
+    if (type == MSG_HELLO && newline != std::string::npos && newline + 1 < payload.size()) {
+        editorEdit(payload.substr(newline + 1));
+    }
+    E.frame.clear(); // Repaint, so the new client gets a full screen
+    editorRefreshScreen();
+}
+
+/**
+ * @brief Reads what a client sent and handles the complete messages.
+ */
+void serverReceive(int fd) {
+    if (!serverFindClient(fd)) return; // Dropped while handling another client
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+        serverDropClient(fd);
+        return;
+    }
+    serverFindClient(fd)->inbox.append(buf, n);
+    char type;
+    std::string payload;
+    Client* C;
+    while ((C = serverFindClient(fd)) && takeMessage(C->inbox, type, payload)) {
+        serverHandleMessage(fd, type, payload);
+    }
+}
+
+/**
+ * @brief Waits for the next key from any client.
+ * New connections and other messages are handled while waiting. The
+ * client a key came from becomes the active one, and its terminal size
+ * is used for drawing.
+ * @return The key.
+ */
+char serverReadKey() {
+    while (Server.keys.empty()) {
+        std::vector<struct pollfd> fds(2);
+        fds[0].fd = Server.listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = taskNotifyFd();
+        fds[1].events = POLLIN;
+        for (const auto& C : Server.clients) {
+            struct pollfd p;
+            p.fd = C.fd;
+            p.events = POLLIN;
+            fds.push_back(p);
+        }
+        int ready = poll(fds.data(), fds.size(), editorIdleTimeout());
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            die("poll failed");
+        }
+        if (ready == 0) editorOnIdle();
+        if (fds[1].revents & POLLIN) {
+            taskRunCompletions();
+            editorRefreshScreen();
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(Server.listen_fd, nullptr, nullptr);
+            if (fd != -1 && !peerIsSelf(fd)) {
+                close(fd); // Only the owner may attach
+            } else if (fd != -1) {
+                struct timeval timeout = {2, 0}; // A stalled client must not stall the server
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                Client C;
+                C.fd = fd;
+                C.rows = 24;
+                C.cols = 80;
+                Server.clients.push_back(C);
+            }
+        }
+        for (size_t i = 2; i < fds.size(); i++) {
+            if (fds[i].revents) serverReceive(fds[i].fd);
+        }
+    }
+    std::pair<int, char> key = Server.keys.front();
+    Server.keys.pop_front();
+    if (key.first != Server.active_fd) {
+        Server.active_fd = key.first;
+        serverResize(*serverFindClient(key.first));
+    }
+    return key.second;
+}
+
+// --- Client Mode ---
+
+int client_resize_pipe[2]; // Written by the SIGWINCH handler
+
+/**
+ * @brief SIGWINCH handler: wakes the client loop to report the new size.
+ */
+void clientOnResize(int) {
+    int saved = errno;
+    write(client_resize_pipe[1], "R", 1);
+    errno = saved;
+}
+
+/**
+ * @brief Builds the "rows cols" payload for HELLO and RESIZE.
+ */
+std::string clientSize() {
+    int rows, cols;
+    if (getWindowSize(rows, cols) == -1) die("getWindowSize failed");
+    return std::to_string(rows) + " " + std::to_string(cols);
+}
+
+/**
+ * @brief Runs a thin client (-c) attached to a running server.
+ * Keys go to the server unchanged and its output goes to the terminal
+ * unchanged; all editing happens in the server.
+ * @param filename File to open on attach, or nullptr to resume where
+ * the session was.
+ * @return The process exit status.
+ */
+int clientMain(const char* filename) {
+    std::string path = serverSocketPath();
+    int fd = path.empty() ? -2 : serverConnect(path);
+    if (fd == -2) {
+        socketPathError(path);
+        return 1;
+    }
+    if (fd == -1) {
+        fprintf(stderr, "kik-editor: no server on %s (start one with --server)\n", path.c_str());
+        return 1;
+    }
+    enableRawMode();
+
+    std::string hello = clientSize() + "\n";
+    if (filename) {
+        // The server has its own working directory, so send an absolute path
+        std::string file = canonicalPath(filename);
+        char cwd[PATH_MAX];
+        if (file[0] != '/' && getcwd(cwd, sizeof(cwd))) file = std::string(cwd) + "/" + file;
+        hello += file;
+    }
+    if (pipe(client_resize_pipe) == -1) die("pipe failed");
+    signal(SIGWINCH, clientOnResize);
+    sendMessage(fd, MSG_HELLO, hello);
+
+    std::string inbox;
+    bool attached = true;
+    while (attached) {
+        struct pollfd fds[3] = {
+            {STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}, {client_resize_pipe[0], POLLIN, 0}
+        };
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll failed");
+        }
+        char buf[4096];
+        if (fds[0].revents & POLLIN) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n > 0) sendMessage(fd, MSG_KEYS, std::string(buf, n));
+        }
+        if (fds[2].revents & POLLIN) {
+            read(client_resize_pipe[0], buf, sizeof(buf));
+            sendMessage(fd, MSG_RESIZE, clientSize());
+        }
+        if (fds[1].revents) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break; // Server went away
+            inbox.append(buf, n);
+            char type;
+            std::string payload;
+            while (takeMessage(inbox, type, payload)) {
+                if (type == MSG_OUTPUT) {
+                    for (size_t off = 0; off < payload.size();) {
+                        ssize_t w = write(STDOUT_FILENO, payload.data() + off, payload.size() - off);
+                        if (w == -1 && errno != EINTR) die("write failed");
+                        if (w > 0) off += w;
+                    }
+                } else if (type == MSG_DETACH) {
+                    attached = false;
+                }
+            }
+        }
+    }
+    close(fd);
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+    return 0;
+}
+
 // --- Main ---
 
+/**
+ * @brief Reads a key, then runs editorProcessKeypress on it and records
+ * its own latency. The wait for the key is not part of it; key reads
+ * and redraws nested inside it (count prefixes, prompts) are recorded
+ * under their own stages and left out of this one.
+ */
+void editorProcessKeypressTimed() {
+    char c = editorReadKey();
+    E.stats.nested_ns = 0;
+    uint64_t start = statsNow();
+    traceBegin("keypress", "input");
+    editorProcessKeypress(c);
+    traceEnd("keypress", "input");
+    uint64_t elapsed = statsNow() - start;
+    statsRecord(STAGE_PROCESS_KEY, elapsed > E.stats.nested_ns ? elapsed - E.stats.nested_ns : 0);
+}
+
 int main(int argc, char* argv[]) {
-    enableRawMode();
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        return clientMain(argc >= 3 ? argv[2] : nullptr);
+    }
+    traceInit();
+    int argi = 1;
+    if (argc >= 2 && strcmp(argv[1], "--server") == 0) {
+        serverStart();
+        argi = 2;
+    } else if (argc >= 3 && strcmp(argv[1], "-s") == 0) {
+        editorLoadScript(argv[2]);
+        argi = 3;
+    } else {
+        enableRawMode();
+    }
     initEditor();
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    if (argc > argi) {
+        editorEdit(argv[argi]);
+    }
+
+    if (E.headless) {
+        // Run the script through the normal key handling, without drawing
+        while (true) editorProcessKeypressTimed();
     }
 
    while (true) {
     editorRefreshScreen();
-    editorProcessKeypress();
+    editorProcessKeypressTimed();
     // Add a 16-millisecond delay to yield time to the terminal renderer.
     // This is roughly equivalent to one frame at 60 FPS.
     //  std::this_thread::sleep_for(std::chrono::milliseconds(16)); // <-- ADD THIS LINE